@@ -0,0 +1,162 @@
+// 질의 하나를 처리하는 동안 쓰는 임시 메모리 (bump allocator, 색인기는 토큰 문자열을 담는 데 쓴다.)
+// 할당은 블록 안에서 포인터를 옮기기만 하고, 해제는 arenaReset으로 한꺼번에 한다.
+// arenaReset은 여러 블록을 썼으면 그 크기를 합친 블록 하나로 바꾸므로
+// 비슷한 크기의 질의가 반복되면 더 이상 힙 할당이 일어나지 않는다.
+
+#define ARENA_ALIGN			16
+#define ARENA_BLOCK_SIZE	(1 << 20)
+
+typedef struct arenaBlock {
+	struct arenaBlock	*next;	// 이전에 쓰던 블록
+	size_t				size;	// data의 바이트 수
+	size_t				used;	// 사용한 바이트 수
+	char				*data;
+} tARENABLOCK;
+
+typedef struct {
+	tARENABLOCK	*head;		// 현재 할당 중인 블록
+	size_t		peak;		// 지금까지 가장 많이 쓴 바이트 수 (통계용)
+} tARENA;
+
+////////////////////////////////////////////////////////////////////////////////
+static tARENABLOCK *_arenaNewBlock( size_t size, tARENABLOCK *next) {
+	tARENABLOCK *block = (tARENABLOCK *)malloc(sizeof(tARENABLOCK) + size + ARENA_ALIGN);
+
+	if (block == NULL)
+		return NULL;
+
+	block->next = next;
+	block->size = size;
+	block->used = 0;
+	block->data = (char *)(((size_t)(block + 1) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+
+	return block;
+}
+
+/* initializes arena (first block is allocated on first use)
+*/
+void arenaInit( tARENA *arena) {
+	arena->head = NULL;
+	arena->peak = 0;
+}
+
+// size 바이트 이상이 들어가는 새 블록을 붙인다. (이전 블록의 두 배)
+// 실패시 NULL을 반환
+static tARENABLOCK *_arenaGrow( tARENA *arena, size_t size) {
+	tARENABLOCK *head = arena->head;
+	size_t bsize = (head == NULL) ? ARENA_BLOCK_SIZE : head->size * 2;
+
+	if (bsize < size)
+		bsize = size;
+
+	head = _arenaNewBlock( bsize, head);
+	if (head != NULL)
+		arena->head = head;
+
+	return head;
+}
+
+/* allocates size bytes (aligned to ARENA_ALIGN) from arena
+	return	pointer to the memory (valid until arenaReset)
+			NULL if overflow
+*/
+void *arenaAlloc( tARENA *arena, size_t size) {
+	tARENABLOCK *head = arena->head;
+	size_t used = 0;
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	// arenaStrdup이 맞추지 않고 할당했을 수 있으므로 시작 위치도 맞춘다.
+	if (head != NULL)
+		used = (head->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (head == NULL || used + size > head->size) {
+		head = _arenaGrow( arena, size);
+		if (head == NULL)
+			return NULL;
+		used = 0;
+	}
+
+	p = head->data + used;
+	head->used = used + size;
+
+	return p;
+}
+
+/* copies len bytes of s and terminating '\0' into arena (not aligned, for many short strings)
+	return	copied string (valid until arenaReset)
+			NULL if overflow
+*/
+char *arenaStrdup( tARENA *arena, const char *s, size_t len) {
+	tARENABLOCK *head = arena->head;
+	char *p;
+
+	if (head == NULL || head->used + len + 1 > head->size) {
+		head = _arenaGrow( arena, len + 1);
+		if (head == NULL)
+			return NULL;
+	}
+
+	p = head->data + head->used;
+	memcpy(p, s, len);
+	p[len] = 0;
+	head->used += len + 1;
+
+	return p;
+}
+
+/* returns number of bytes allocated since last reset
+*/
+size_t arenaUsed( tARENA *arena) {
+	size_t used = 0;
+
+	for (tARENABLOCK *b = arena->head; b != NULL; b = b->next)
+		used += b->used;
+
+	return used;
+}
+
+/* releases all allocations at once (memory is kept for reuse)
+	if more than one block was used, they are replaced by a single block of the total size
+*/
+void arenaReset( tARENA *arena) {
+	tARENABLOCK *head = arena->head;
+	size_t total = 0;
+	size_t used;
+
+	if (head == NULL)
+		return;
+
+	used = arenaUsed( arena);
+	if (used > arena->peak)
+		arena->peak = used;
+
+	if (head->next != NULL) {
+		while (head != NULL) {
+			tARENABLOCK *next = head->next;
+
+			total += head->size;
+			free(head);
+			head = next;
+		}
+		arena->head = _arenaNewBlock( total, NULL);
+		return;
+	}
+
+	head->used = 0;
+}
+
+/* frees all memory of arena
+*/
+void arenaDestroy( tARENA *arena) {
+	tARENABLOCK *head = arena->head;
+
+	while (head != NULL) {
+		tARENABLOCK *next = head->next;
+
+		free(head);
+		head = next;
+	}
+	arena->head = NULL;
+}
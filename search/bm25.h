@@ -0,0 +1,26 @@
+#include <math.h>
+
+// BM25 순위 함수 (색인기와 검색기가 같은 값을 쓴다.)
+//   score(d, q) = sum over t in q: idf(t) * weight(tf(t, d), |d|)
+//   idf(t)      = log(1 + (N - df + 0.5) / (df + 0.5))
+//   weight      = tf * (K1 + 1) / (tf + K1 * (1 - B + B * |d| / avgdl))
+#define BM25_K1		1.2
+#define BM25_B		0.75
+
+////////////////////////////////////////////////////////////////////////////////
+/* term frequency component of BM25
+	tf		occurrences of the term in the document
+	dl		number of tokens in the document (avgdl if unknown)
+	avgdl	average number of tokens per document
+*/
+double bm25Weight( int tf, double dl, double avgdl) {
+	return tf * (BM25_K1 + 1) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * dl / avgdl));
+}
+
+/* inverse document frequency component of BM25 (always positive)
+	df			number of documents containing the term
+	num_docs	number of documents in the collection
+*/
+double bm25Idf( int df, int num_docs) {
+	return log(1 + (num_docs - df + 0.5) / (df + 0.5));
+}
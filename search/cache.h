@@ -0,0 +1,339 @@
+// 질의 결과 캐시
+// 정규화한 질의(query.h의 queryKey)를 키로 결과를 바이트 배열로 복사해 둔다.
+// 항목들이 차지하는 바이트 수(항목 헤더 + 키 + 값)를 capacity 이내로 유지하며, 넘으면 가장 오래 쓰지 않은 항목(LRU)부터 내보낸다.
+// 새 항목은 TinyLFU로 받아들일지 정한다.
+//   키를 찾을 때마다 count-min sketch에 빈도를 세고, 자리를 내야 하면 내보낼 항목들보다 새 항목의 빈도가 높을 때만 넣는다.
+//   한 번 나오고 마는 질의가 자주 쓰는 결과를 밀어내지 않는다.
+//   빈도를 센 횟수가 sketch 폭의 CACHE_SAMPLE배가 되면 모든 카운터를 절반으로 줄여 오래된 빈도를 잊는다.
+// 색인의 세대(generation)가 바뀌면 모든 항목을 지운다. (cacheValidate)
+// 질의 서버의 작업 스레드들이 함께 쓰므로 mutex로 보호하고, 찾은 값은 부른 쪽의 arena로 복사해 준다.
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define CACHE_SKETCH_DEPTH	4		// count-min sketch의 행 수
+#define CACHE_SKETCH_MAX	15		// sketch 카운터의 최댓값
+#define CACHE_SAMPLE		10		// 카운터를 절반으로 줄이는 주기 (sketch 폭의 배수)
+#define CACHE_ENTRY_BYTES	256		// sketch 폭과 해시 버킷 수를 정할 때 가정하는 항목 하나의 바이트 수
+#define CACHE_MAX_ENTRY		8		// 항목 하나는 capacity의 1/CACHE_MAX_ENTRY까지
+
+// 캐시 항목 (키와 값은 항목 뒤에 이어서 할당)
+typedef struct cacheEntry {
+	struct cacheEntry	*hnext;		// 같은 해시 버킷의 다음 항목
+	struct cacheEntry	*prev;		// LRU 목록 (head가 가장 최근)
+	struct cacheEntry	*next;
+	uint64_t			hash;
+	size_t				bytes;		// 항목이 차지하는 바이트 수
+	size_t				size;		// 값의 바이트 수
+	char				*value;
+	char				key[];
+} tCACHEENTRY;
+
+// 캐시 통계
+typedef struct {
+	long	hits;
+	long	misses;
+	long	admitted;		// 넣은 항목 수
+	long	rejected;		// TinyLFU가 거절했거나 너무 커서 넣지 않은 항목 수
+	long	evicted;		// 자리를 내느라 내보낸 항목 수
+	long	invalidated;	// 색인의 세대가 바뀌어 지운 항목 수
+} tCACHESTATS;
+
+typedef struct {
+	pthread_mutex_t	lock;
+	size_t			capacity;	// 최대 바이트 수
+	size_t			bytes;		// 항목들이 차지하는 바이트 수
+	int				num_entries;
+	tCACHEENTRY		**buckets;
+	int				mask;		// 해시 버킷 수 - 1 (sketch 폭과 같은 2의 거듭제곱)
+	tCACHEENTRY		*head;		// LRU 목록
+	tCACHEENTRY		*tail;
+	unsigned char	*sketch;	// CACHE_SKETCH_DEPTH행 (행마다 mask + 1개 카운터)
+	long			samples;	// 마지막으로 카운터를 줄인 뒤 빈도를 센 횟수
+	unsigned int	generation;	// 항목들을 만든 색인의 세대
+	tCACHESTATS		stats;
+} tCACHE;
+
+////////////////////////////////////////////////////////////////////////////////
+// 키의 64비트 FNV-1a 해시
+static uint64_t _cacheHash( const char *key) {
+	uint64_t h = 14695981039346656037ull;
+
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+// sketch의 row행에서 해시에 해당하는 카운터 (행마다 다른 위치: h1 + row * h2)
+static unsigned char *_cacheCounter( tCACHE *cache, uint64_t hash, int row) {
+	uint32_t h1 = (uint32_t)hash;
+	uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+
+	return &cache->sketch[row * (cache->mask + 1) + ((h1 + row * h2) & cache->mask)];
+}
+
+// 키의 빈도를 하나 늘린다. (카운터가 가장 작은 것들만 늘린다: conservative update)
+static void _cacheRecord( tCACHE *cache, uint64_t hash) {
+	int min = CACHE_SKETCH_MAX;
+
+	for (int r = 0; r < CACHE_SKETCH_DEPTH; r++) {
+		unsigned char *c = _cacheCounter( cache, hash, r);
+
+		if (*c < min)
+			min = *c;
+	}
+
+	if (min < CACHE_SKETCH_MAX) {
+		for (int r = 0; r < CACHE_SKETCH_DEPTH; r++) {
+			unsigned char *c = _cacheCounter( cache, hash, r);
+
+			if (*c == min)
+				(*c)++;
+		}
+	}
+
+	// 오래된 빈도를 잊는다.
+	if (++cache->samples >= (long)CACHE_SAMPLE * (cache->mask + 1)) {
+		for (long i = 0; i < (long)CACHE_SKETCH_DEPTH * (cache->mask + 1); i++)
+			cache->sketch[i] >>= 1;
+		cache->samples /= 2;
+	}
+}
+
+// 키의 빈도 추정값 (행들의 카운터 중 최솟값)
+static int _cacheFrequency( tCACHE *cache, uint64_t hash) {
+	int min = CACHE_SKETCH_MAX;
+
+	for (int r = 0; r < CACHE_SKETCH_DEPTH; r++) {
+		unsigned char *c = _cacheCounter( cache, hash, r);
+
+		if (*c < min)
+			min = *c;
+	}
+	return min;
+}
+
+static tCACHEENTRY *_cacheFind( tCACHE *cache, uint64_t hash, const char *key) {
+	tCACHEENTRY *e = cache->buckets[hash & cache->mask];
+
+	while (e != NULL && (e->hash != hash || strcmp(e->key, key) != 0))
+		e = e->hnext;
+	return e;
+}
+
+// 항목을 LRU 목록에서 뺀다.
+static void _cacheUnlink( tCACHE *cache, tCACHEENTRY *e) {
+	if (e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		cache->head = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		cache->tail = e->prev;
+}
+
+// 항목을 LRU 목록 맨 앞(가장 최근)에 넣는다.
+static void _cachePushFront( tCACHE *cache, tCACHEENTRY *e) {
+	e->prev = NULL;
+	e->next = cache->head;
+	if (cache->head != NULL)
+		cache->head->prev = e;
+	else
+		cache->tail = e;
+	cache->head = e;
+}
+
+// 항목을 캐시에서 지우고 해제한다.
+static void _cacheRemove( tCACHE *cache, tCACHEENTRY *e) {
+	tCACHEENTRY **p = &cache->buckets[e->hash & cache->mask];
+
+	while (*p != e)
+		p = &(*p)->hnext;
+	*p = e->hnext;
+
+	_cacheUnlink( cache, e);
+	cache->bytes -= e->bytes;
+	cache->num_entries--;
+	free(e);
+}
+
+/* initializes cache holding up to capacity bytes (entries, keys and values)
+	return	1 success
+			0 if overflow
+*/
+int cacheInit( tCACHE *cache, size_t capacity) {
+	int width = 1024;
+
+	while ((size_t)width * CACHE_ENTRY_BYTES < capacity)
+		width <<= 1;
+
+	memset(cache, 0, sizeof(tCACHE));
+	cache->capacity = capacity;
+	cache->mask = width - 1;
+	cache->buckets = (tCACHEENTRY **)calloc(width, sizeof(tCACHEENTRY *));
+	cache->sketch = (unsigned char *)calloc((size_t)CACHE_SKETCH_DEPTH * width, 1);
+	if (cache->buckets == NULL || cache->sketch == NULL) {
+		free(cache->buckets);
+		free(cache->sketch);
+		return 0;
+	}
+
+	pthread_mutex_init(&cache->lock, NULL);
+	return 1;
+}
+
+/* drops all entries if they were made from another index generation
+*/
+void cacheValidate( tCACHE *cache, unsigned int generation) {
+	pthread_mutex_lock(&cache->lock);
+	if (cache->generation != generation) {
+		cache->stats.invalidated += cache->num_entries;
+		while (cache->head != NULL)
+			_cacheRemove( cache, cache->head);
+		cache->generation = generation;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* looks up key and counts its frequency
+	the value is copied into arena (data is valid until arenaReset)
+	return	1 found (data and size are set, data may be NULL if size is 0)
+			0 not found or overflow
+*/
+int cacheGet( tCACHE *cache, const char *key, tARENA *arena, void **data, size_t *size) {
+	uint64_t hash = _cacheHash( key);
+	tCACHEENTRY *e;
+	int found = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	_cacheRecord( cache, hash);
+
+	e = _cacheFind( cache, hash, key);
+	if (e != NULL) {
+		*data = NULL;
+		*size = e->size;
+		if (e->size > 0)
+			*data = arenaAlloc(arena, e->size);
+
+		if (e->size == 0 || *data != NULL) {
+			if (e->size > 0)
+				memcpy(*data, e->value, e->size);
+			_cacheUnlink( cache, e);
+			_cachePushFront( cache, e);
+			found = 1;
+		}
+	}
+
+	if (found)
+		cache->stats.hits++;
+	else
+		cache->stats.misses++;
+	pthread_mutex_unlock(&cache->lock);
+
+	return found;
+}
+
+/* stores a copy of value (size bytes) under key
+	when the cache is full, least recently used entries are evicted only if
+	key is looked up more often than all of them (TinyLFU admission)
+	return	1 stored
+			0 rejected (too large, not frequent enough) or overflow
+*/
+int cachePut( tCACHE *cache, const char *key, const void *data, size_t size) {
+	uint64_t hash = _cacheHash( key);
+	size_t keylen = strlen(key);
+	size_t bytes = sizeof(tCACHEENTRY) + keylen + 1 + size;
+	tCACHEENTRY *e;
+	int ret = 0;
+
+	pthread_mutex_lock(&cache->lock);
+
+	// 다른 스레드가 먼저 넣었으면 그대로 둔다.
+	if (_cacheFind( cache, hash, key) != NULL) {
+		pthread_mutex_unlock(&cache->lock);
+		return 1;
+	}
+
+	if (bytes <= cache->capacity / CACHE_MAX_ENTRY) {
+		tCACHEENTRY *victim = cache->tail;
+		size_t freed = 0;
+		int freq = _cacheFrequency( cache, hash);
+		int admit = 1;
+
+		// 자리를 내야 하면 내보낼 항목들이 모두 새 항목보다 덜 쓰였을 때만 넣는다.
+		while (cache->bytes - freed + bytes > cache->capacity && victim != NULL) {
+			if (_cacheFrequency( cache, victim->hash) >= freq) {
+				admit = 0;
+				break;
+			}
+			freed += victim->bytes;
+			victim = victim->prev;
+		}
+
+		e = admit ? (tCACHEENTRY *)malloc(bytes) : NULL;
+		if (e != NULL) {
+			while (cache->bytes + bytes > cache->capacity) {
+				_cacheRemove( cache, cache->tail);
+				cache->stats.evicted++;
+			}
+
+			e->hash = hash;
+			e->bytes = bytes;
+			e->size = size;
+			memcpy(e->key, key, keylen + 1);
+			e->value = e->key + keylen + 1;
+			if (size > 0)
+				memcpy(e->value, data, size);
+
+			e->hnext = cache->buckets[hash & cache->mask];
+			cache->buckets[hash & cache->mask] = e;
+			_cachePushFront( cache, e);
+			cache->bytes += bytes;
+			cache->num_entries++;
+			ret = 1;
+		}
+	}
+
+	if (ret)
+		cache->stats.admitted++;
+	else
+		cache->stats.rejected++;
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+/* prints hit ratio, size and admission counts of cache (stderr)
+*/
+void cacheReport( tCACHE *cache, char *label) {
+	tCACHESTATS s;
+	size_t bytes;
+	int num_entries;
+	long lookups;
+
+	pthread_mutex_lock(&cache->lock);
+	s = cache->stats;
+	bytes = cache->bytes;
+	num_entries = cache->num_entries;
+	pthread_mutex_unlock(&cache->lock);
+
+	lookups = s.hits + s.misses;
+	fprintf( stderr, "[%s] %ld lookups: %ld hits (%.1f%%), %ld misses; %d entries, %.1f / %.1f MB; "
+			"%ld admitted, %ld rejected, %ld evicted, %ld invalidated\n",
+			label, lookups, s.hits, (lookups > 0) ? 100.0 * s.hits / lookups : 0, s.misses,
+			num_entries, bytes / 1048576.0, cache->capacity / 1048576.0,
+			s.admitted, s.rejected, s.evicted, s.invalidated);
+}
+
+/* frees all entries of cache
+*/
+void cacheDestroy( tCACHE *cache) {
+	while (cache->head != NULL)
+		_cacheRemove( cache, cache->head);
+	free(cache->buckets);
+	free(cache->sketch);
+	pthread_mutex_destroy(&cache->lock);
+}
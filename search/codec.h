@@ -0,0 +1,439 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CODEC_X86	1
+#else
+#define CODEC_X86	0
+#endif
+
+// posting.idx 포스팅 리스트 압축 방식
+#define CODEC_RAW		0	// 4바이트 int 그대로, 문서번호 뒤에 tf (tHEADER.index는 int 단위 위치)
+#define CODEC_VBYTE		1	// d-gap + variable-byte (tHEADER.index는 바이트 단위 위치)
+#define CODEC_SVB		2	// d-gap + StreamVByte (tHEADER.index는 바이트 단위 위치)
+
+#define CODEC_PADDING	16	// SIMD 복호화가 리스트 끝을 넘어 읽을 수 있도록 파일 끝에 붙이는 바이트 수
+
+// 압축된 포스팅 리스트는 SKIP_BLOCK개씩 블록으로 나누어 부호화한다.
+// 블록이 둘 이상이면 리스트 앞에 스킵 테이블(블록별 tSKIP)을 둔다.
+//   [tSKIP x 블록 수][블록 0][블록 1]...
+// 각 블록의 d-gap은 이전 블록의 마지막 문서번호를 기준으로 한다.
+// 블록은 문서번호 뒤에 같은 수의 tf(문서 안 출현 횟수)를 variable-byte로 담는다.
+//   [문서번호][tf]
+#define SKIP_BLOCK		128
+
+typedef struct {
+	int		last;	// 블록의 마지막 문서번호
+	int		offset;	// 블록 데이터의 시작 위치 (리스트 시작으로부터 바이트 단위)
+} tSKIP;
+
+////////////////////////////////////////////////////////////////////////////////
+/* returns codec id for given name ("raw", "vbyte", "svb")
+	return	codec id
+			-1 unknown name
+*/
+int codecByName( char *name) {
+	if (strcmp(name, "raw") == 0)
+		return CODEC_RAW;
+	if (strcmp(name, "vbyte") == 0)
+		return CODEC_VBYTE;
+	if (strcmp(name, "svb") == 0)
+		return CODEC_SVB;
+	return -1;
+}
+
+/* returns maximum number of bytes needed to encode n doc ids and term frequencies (including skip table)
+*/
+int codecMaxBytes( int n) {
+	return n * 10 + (n + 3) / 4 + sizeof(tSKIP) * ((n + SKIP_BLOCK - 1) / SKIP_BLOCK) + 4;
+}
+
+/* encodes sorted doc ids as d-gaps (from base) with variable-byte code
+	(7 bits per byte, high bit set when more bytes follow)
+	return	number of bytes written to out
+*/
+int vbyteEncode( const int *docs, int n, int base, unsigned char *out) {
+	unsigned char *p = out;
+	int prev = base;
+
+	for (int i = 0; i < n; i++) {
+		unsigned int gap = docs[i] - prev;
+
+		while (gap >= 128) {
+			*p++ = (gap & 127) | 128;
+			gap >>= 7;
+		}
+		*p++ = gap;
+		prev = docs[i];
+	}
+	return p - out;
+}
+
+/* decodes n doc ids encoded by vbyteEncode
+	return	number of bytes read from in
+*/
+int vbyteDecode( const unsigned char *in, int n, int base, int *docs) {
+	const unsigned char *p = in;
+	int prev = base;
+
+	for (int i = 0; i < n; i++) {
+		unsigned int gap = 0;
+		int shift = 0;
+
+		while (*p & 128) {
+			gap |= (unsigned int)(*p++ & 127) << shift;
+			shift += 7;
+		}
+		gap |= (unsigned int)*p++ << shift;
+
+		prev += gap;
+		docs[i] = prev;
+	}
+	return p - in;
+}
+
+/* encodes sorted doc ids as d-gaps (from base) with StreamVByte code
+	layout: control bytes (2 bits per value, ceil(n/4) bytes) followed by data bytes
+	return	number of bytes written to out
+*/
+int svbEncode( const int *docs, int n, int base, unsigned char *out) {
+	unsigned char *ctrl = out;
+	unsigned char *data = out + (n + 3) / 4;
+	int prev = base;
+
+	memset(ctrl, 0, (n + 3) / 4);
+
+	for (int i = 0; i < n; i++) {
+		unsigned int gap = docs[i] - prev;
+		int code = (gap < (1u << 8)) ? 0 : (gap < (1u << 16)) ? 1 : (gap < (1u << 24)) ? 2 : 3;
+
+		ctrl[i >> 2] |= code << ((i & 3) * 2);
+		for (int k = 0; k <= code; k++) {
+			*data++ = gap & 255;
+			gap >>= 8;
+		}
+		prev = docs[i];
+	}
+	return data - out;
+}
+
+static int _svbDecodeScalar( const unsigned char *ctrl, const unsigned char *data,
+							int from, int n, int prev, int *docs) {
+	const unsigned char *p = data;
+
+	for (int i = from; i < n; i++) {
+		int code = (ctrl[i >> 2] >> ((i & 3) * 2)) & 3;
+		unsigned int gap = 0;
+
+		for (int k = 0; k <= code; k++)
+			gap |= (unsigned int)*p++ << (8 * k);
+
+		prev += gap;
+		docs[i] = prev;
+	}
+	return p - data;
+}
+
+#if CODEC_X86
+static unsigned char svbShuffle[256][16];	// 제어 바이트별 pshufb 마스크
+static unsigned char svbLength[256];		// 제어 바이트별 데이터 바이트 수
+static int svbSimd = -1;					// -1: 미확인, 0: 사용 불가, 1: SSSE3 사용
+
+/* builds decoding tables and detects SIMD support
+	called automatically on first decode; call once before starting threads
+*/
+void codecInit( void) {
+	for (int c = 0; c < 256; c++) {
+		int offset = 0;
+
+		for (int j = 0; j < 4; j++) {
+			int len = ((c >> (2 * j)) & 3) + 1;
+
+			for (int k = 0; k < 4; k++)
+				svbShuffle[c][4 * j + k] = (k < len) ? offset + k : 0x80;
+			offset += len;
+		}
+		svbLength[c] = offset;
+	}
+	__builtin_cpu_init();
+	svbSimd = __builtin_cpu_supports("ssse3") ? 1 : 0;
+}
+
+// 4개씩 pshufb로 풀고 SSE2 누적합으로 d-gap을 문서번호로 복원한다.
+__attribute__((target("ssse3")))
+static int _svbDecodeSimd( const unsigned char *ctrl, const unsigned char *data, int n, int base, int *docs) {
+	const unsigned char *p = data;
+	__m128i prev = _mm_set1_epi32(base);
+	int quads = n / 4;
+	int last = base;
+
+	for (int q = 0; q < quads; q++) {
+		__m128i mask = _mm_loadu_si128((const __m128i *)svbShuffle[ctrl[q]]);
+		__m128i vals = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), mask);
+
+		p += svbLength[ctrl[q]];
+
+		vals = _mm_add_epi32(vals, _mm_slli_si128(vals, 4));
+		vals = _mm_add_epi32(vals, _mm_slli_si128(vals, 8));
+		vals = _mm_add_epi32(vals, prev);
+		_mm_storeu_si128((__m128i *)(docs + 4 * q), vals);
+		prev = _mm_shuffle_epi32(vals, 0xFF);
+	}
+
+	if (quads > 0)
+		last = docs[4 * quads - 1];
+
+	return (p - data) + _svbDecodeScalar( ctrl, p, 4 * quads, n, last, docs);
+}
+#else
+void codecInit( void) {
+}
+#endif
+
+/* decodes n doc ids encoded by svbEncode
+	uses SSSE3 when the CPU supports it (input must be followed by CODEC_PADDING readable bytes)
+	return	number of bytes read from in
+*/
+int svbDecode( const unsigned char *in, int n, int base, int *docs) {
+	const unsigned char *ctrl = in;
+	const unsigned char *data = in + (n + 3) / 4;
+
+#if CODEC_X86
+	if (svbSimd < 0)
+		codecInit();
+	if (svbSimd)
+		return (n + 3) / 4 + _svbDecodeSimd( ctrl, data, n, base, docs);
+#endif
+	return (n + 3) / 4 + _svbDecodeScalar( ctrl, data, 0, n, base, docs);
+}
+
+/* encodes n term frequencies (>= 1) with variable-byte code
+	return	number of bytes written to out
+*/
+int tfEncode( const int *tfs, int n, unsigned char *out) {
+	unsigned char *p = out;
+
+	for (int i = 0; i < n; i++) {
+		unsigned int tf = tfs[i];
+
+		while (tf >= 128) {
+			*p++ = (tf & 127) | 128;
+			tf >>= 7;
+		}
+		*p++ = tf;
+	}
+	return p - out;
+}
+
+/* decodes n term frequencies encoded by tfEncode (tfs may be NULL to skip them)
+	return	number of bytes read from in
+*/
+int tfDecode( const unsigned char *in, int n, int *tfs) {
+	const unsigned char *p = in;
+
+	for (int i = 0; i < n; i++) {
+		unsigned int tf = 0;
+		int shift = 0;
+
+		while (*p & 128) {
+			tf |= (unsigned int)(*p++ & 127) << shift;
+			shift += 7;
+		}
+		tf |= (unsigned int)*p++ << shift;
+
+		if (tfs != NULL)
+			tfs[i] = tf;
+	}
+	return p - in;
+}
+
+static int _encodeBlock( int codec, const int *docs, int n, int base, unsigned char *out) {
+	if (codec == CODEC_SVB)
+		return svbEncode( docs, n, base, out);
+	return vbyteEncode( docs, n, base, out);
+}
+
+static int _decodeBlock( int codec, const unsigned char *in, int n, int base, int *docs) {
+	if (codec == CODEC_SVB)
+		return svbDecode( in, n, base, docs);
+	return vbyteDecode( in, n, base, docs);
+}
+
+/* returns number of skip blocks in a posting list of n doc ids
+	return	0 if the list has no skip table
+*/
+int postingNumBlocks( int codec, int n) {
+	if (codec == CODEC_RAW || n <= SKIP_BLOCK)
+		return 0;
+	return (n + SKIP_BLOCK - 1) / SKIP_BLOCK;
+}
+
+/* reads b-th skip entry of a posting list
+*/
+tSKIP postingSkip( const unsigned char *in, int b) {
+	tSKIP skip;
+
+	memcpy(&skip, in + sizeof(tSKIP) * b, sizeof(tSKIP));
+	return skip;
+}
+
+/* encodes n sorted doc ids and their term frequencies with given codec (with skip table if needed)
+	return	number of bytes written to out
+*/
+int postingEncode( int codec, const int *docs, const int *tfs, int n, unsigned char *out) {
+	int nb = postingNumBlocks( codec, n);
+	int size;
+
+	if (codec == CODEC_RAW) {
+		memcpy(out, docs, sizeof(int) * n);
+		memcpy(out + sizeof(int) * n, tfs, sizeof(int) * n);
+		return 2 * sizeof(int) * n;
+	}
+	if (nb == 0) {
+		size = _encodeBlock( codec, docs, n, 0, out);
+		return size + tfEncode( tfs, n, out + size);
+	}
+
+	size = sizeof(tSKIP) * nb;
+	for (int b = 0; b < nb; b++) {
+		int from = b * SKIP_BLOCK;
+		int cnt = (n - from < SKIP_BLOCK) ? n - from : SKIP_BLOCK;
+		tSKIP skip;
+
+		skip.last = docs[from + cnt - 1];
+		skip.offset = size;
+		memcpy(out + sizeof(tSKIP) * b, &skip, sizeof(tSKIP));
+
+		size += _encodeBlock( codec, docs + from, cnt, (b == 0) ? 0 : docs[from - 1], out + size);
+		size += tfEncode( tfs + from, cnt, out + size);
+	}
+	return size;
+}
+
+/* decodes b-th block of a posting list of n doc ids into docs
+	term frequencies are decoded into tfs unless it is NULL
+	return	number of doc ids in the block
+*/
+int postingDecodeBlock( int codec, const unsigned char *in, int n, int b, int *docs, int *tfs) {
+	int nb = postingNumBlocks( codec, n);
+	int from = b * SKIP_BLOCK;
+	int cnt = (n - from < SKIP_BLOCK) ? n - from : SKIP_BLOCK;
+	int offset;
+	int size;
+
+	if (codec == CODEC_RAW) {
+		memcpy(docs, in + sizeof(int) * from, sizeof(int) * cnt);
+		if (tfs != NULL)
+			memcpy(tfs, in + sizeof(int) * (n + from), sizeof(int) * cnt);
+		return cnt;
+	}
+	if (nb == 0) {
+		size = _decodeBlock( codec, in, n, 0, docs);
+		if (tfs != NULL)
+			tfDecode( in + size, n, tfs);
+		return n;
+	}
+
+	offset = postingSkip( in, b).offset;
+	size = _decodeBlock( codec, in + offset, cnt, (b == 0) ? 0 : postingSkip( in, b - 1).last, docs);
+	if (tfs != NULL)
+		tfDecode( in + offset + size, cnt, tfs);
+	return cnt;
+}
+
+/* decodes n doc ids encoded with given codec
+	term frequencies are decoded into tfs unless it is NULL
+	return	number of bytes read from in
+*/
+int postingDecode( int codec, const unsigned char *in, int n, int *docs, int *tfs) {
+	int nb = postingNumBlocks( codec, n);
+	int size;
+
+	if (codec == CODEC_RAW) {
+		memcpy(docs, in, sizeof(int) * n);
+		if (tfs != NULL)
+			memcpy(tfs, in + sizeof(int) * n, sizeof(int) * n);
+		return 2 * sizeof(int) * n;
+	}
+	if (nb == 0) {
+		size = _decodeBlock( codec, in, n, 0, docs);
+		return size + tfDecode( in + size, n, tfs);
+	}
+
+	size = sizeof(tSKIP) * nb;
+	for (int b = 0; b < nb; b++) {
+		int from = b * SKIP_BLOCK;
+		int cnt = (n - from < SKIP_BLOCK) ? n - from : SKIP_BLOCK;
+
+		size += _decodeBlock( codec, in + size, cnt, (b == 0) ? 0 : docs[from - 1], docs + from);
+		size += tfDecode( in + size, cnt, (tfs != NULL) ? tfs + from : NULL);
+	}
+	return size;
+}
+
+// position.idx의 텀별 위치 정보
+// 문서마다 그 문서 안의 토큰 위치(1부터)를 d-gap + variable-byte로 포스팅 리스트와 같은 순서로 이어 붙인다.
+// 포스팅이 SKIP_BLOCK개보다 많으면 앞에 블록별 시작 위치(int, 위치 정보 시작으로부터 바이트 단위)를 두어
+// 필요한 블록의 위치 정보만 읽을 수 있게 한다.
+//   [블록 시작 위치 x 블록 수][문서 0의 위치들][문서 1의 위치들]...
+
+/* returns maximum number of bytes needed to encode positions of n postings (total positions in all postings)
+*/
+int positionsMaxBytes( int n, int total) {
+	return total * 5 + sizeof(int) * ((n + SKIP_BLOCK - 1) / SKIP_BLOCK);
+}
+
+/* encodes positions of n postings
+	tfs[i]		number of positions of i-th posting
+	positions	positions of all postings in posting order (sorted within each posting)
+	return	number of bytes written to out
+*/
+int positionsEncode( const int *tfs, const int *positions, int n, unsigned char *out) {
+	int nb = postingNumBlocks( CODEC_VBYTE, n);
+	int size = sizeof(int) * nb;
+
+	for (int i = 0; i < n; i++) {
+		if (nb > 0 && i % SKIP_BLOCK == 0) {
+			int offset = size;
+
+			memcpy(out + sizeof(int) * (i / SKIP_BLOCK), &offset, sizeof(int));
+		}
+		size += vbyteEncode( positions, tfs[i], 0, out + size);
+		positions += tfs[i];
+	}
+	return size;
+}
+
+/* decodes positions of all n postings encoded by positionsEncode
+	tfs[i]		number of positions of i-th posting
+	return	number of bytes read from in
+*/
+int positionsDecode( const unsigned char *in, const int *tfs, int n, int *positions) {
+	int size = sizeof(int) * postingNumBlocks( CODEC_VBYTE, n);
+
+	for (int i = 0; i < n; i++) {
+		size += vbyteDecode( in + size, tfs[i], 0, positions);
+		positions += tfs[i];
+	}
+	return size;
+}
+
+/* finds positions of i-th posting among n postings encoded by positionsEncode
+	blocktfs	term frequencies of the skip block containing i-th posting (from the start of the block)
+	return	pointer to the positions (decode with vbyteDecode( p, tf, 0, positions))
+*/
+const unsigned char *positionsSeek( const unsigned char *in, int n, int i, const int *blocktfs) {
+	int nb = postingNumBlocks( CODEC_VBYTE, n);
+	int from = i - i % SKIP_BLOCK;
+	int skip = 0;
+	int offset;
+
+	if (nb == 0)
+		offset = 0;
+	else
+		memcpy(&offset, in + sizeof(int) * (i / SKIP_BLOCK), sizeof(int));
+
+	// 블록 안에서 앞선 포스팅의 위치들을 건너뛴다.
+	for (int j = from; j < i; j++)
+		skip += blocktfs[j - from];
+
+	return in + offset + tfDecode( in + offset, skip, NULL);
+}
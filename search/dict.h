@@ -0,0 +1,459 @@
+// 정적 사전 (dic.idx)
+// 색인기가 사전(dic.txt)과 함께 기록하고, 검색기는 파일을 매핑(mmap)만 하여 텀을 사전 번호(header.idx의 순서)로 찾는다.
+// 텀마다 노드를 할당하는 트라이와 달리 시작할 때 읽거나 할당하는 것이 없다.
+//   정렬된 텀 테이블: 사전 번호 순(= 텀 사전 순)의 문자열 오프셋 배열과 '\0'으로 끝나는 문자열들
+//     같은 접두어로 시작하는 텀들은 연속된 구간이므로 이진 탐색으로 찾는다. (dictPrefix)
+//   최소 완전 해시(minimal perfect hash, CHD 방식): 텀을 0 ~ 텀 수-1의 자리(slot)로 충돌 없이 보낸다.
+//     텀을 버킷으로 나누고, 큰 버킷부터 버킷의 텀들이 모두 빈 자리로 가는 변위 (d0, d1)를 찾아 기록한다.
+//     자리 = (h1 + d0 * h2 + d1) % 텀 수, 자리마다 그 자리로 가는 텀의 사전 번호를 기록한다.
+//   사전에 없는 텀도 어떤 자리로 가므로 찾은 사전 번호의 텀 문자열과 비교하여 확인한다.
+//
+// dic.idx 본문
+//   tDICTHEADER
+//   unsigned int disp[num_buckets]		버킷의 변위 (d0 * 텀 수 + d1)
+//   unsigned int slots[num_terms]		자리 -> 사전 번호
+//   unsigned int offsets[num_terms + 1]	사전 번호 -> 문자열 오프셋
+//   char strings[strings_size]
+
+#include <stdint.h>
+
+#define DICT_LOAD	4		// 버킷 하나의 평균 텀 수
+#define DICT_SEEDS	16		// 변위를 찾지 못하면 해시 씨앗(seed)을 바꾸어 다시 만드는 횟수
+
+typedef struct {
+	unsigned int	num_buckets;
+	unsigned int	seed;
+	unsigned int	strings_size;
+	unsigned int	reserved;
+} tDICTHEADER;
+
+// 매핑된 사전
+typedef struct {
+	tDICTHEADER			*header;	// 매핑한 파일의 본문 (dictUnmap으로 해제)
+	unsigned int		num_terms;
+	const unsigned int	*disp;
+	const unsigned int	*slots;
+	const unsigned int	*offsets;
+	const char			*strings;
+} tDICT;
+
+////////////////////////////////////////////////////////////////////////////////
+// 64비트 해시의 비트를 고르게 섞는다. (MurmurHash3 fmix64)
+static uint64_t _dictMix( uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+// 텀의 해시 (FNV-1a, seed마다 다른 값)
+static uint64_t _dictHash( const char *term, unsigned int seed) {
+	uint64_t h = 14695981039346656037ull ^ _dictMix( seed + 1);
+
+	while (*term) {
+		h ^= (unsigned char)*term++;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+// 해시에서 버킷과 자리를 정하는 두 값(h1, h2)을 구한다.
+static void _dictKeys( uint64_t hash, unsigned int n, unsigned int num_buckets,
+						unsigned int *bucket, unsigned int *h1, unsigned int *h2) {
+	uint64_t g = _dictMix( hash);
+
+	*bucket = (unsigned int)(hash % num_buckets);
+	*h1 = (unsigned int)((g & 0xffffffffu) % n);
+	*h2 = (unsigned int)((g >> 32) % n);
+}
+
+// 변위 disp(d0 * n + d1)로 옮긴 자리
+static inline unsigned int _dictSlot( unsigned int h1, unsigned int h2, unsigned int disp, unsigned int n) {
+	return (unsigned int)((h1 + (uint64_t)(disp / n) * h2 + disp % n) % n);
+}
+
+// seed로 최소 완전 해시를 만든다. (slots[자리] = 사전 번호, disp[버킷] = 변위)
+// 어떤 버킷의 변위를 찾지 못하면 0을 반환
+static int _dictPlace( uint64_t *hashes, unsigned int n, unsigned int num_buckets,
+						unsigned int *disp, unsigned int *slots) {
+	unsigned int *bucket_of = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	unsigned int *h1 = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	unsigned int *h2 = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	unsigned int *start = (unsigned int *)calloc(num_buckets + 1, sizeof(unsigned int));
+	unsigned int *members = (unsigned int *)malloc(sizeof(unsigned int) * n);
+	unsigned int *order = (unsigned int *)malloc(sizeof(unsigned int) * num_buckets);
+	unsigned int *by_size;
+	unsigned char *taken = (unsigned char *)calloc(n, 1);
+	unsigned int max_size = 0;
+	unsigned int next_free = 0;
+	unsigned int max_d0 = (n < UINT32_MAX / n) ? n : UINT32_MAX / n;	// d0 * n + d1이 unsigned int를 넘지 않게
+	unsigned int cand[64];
+	unsigned int base[64];
+	int ok = 1;
+
+	if (bucket_of == NULL || h1 == NULL || h2 == NULL || start == NULL || members == NULL ||
+		order == NULL || taken == NULL)
+		ok = 0;
+
+	// 버킷별로 텀을 모은다. (계수 정렬)
+	for (unsigned int i = 0; ok && i < n; i++) {
+		_dictKeys( hashes[i], n, num_buckets, &bucket_of[i], &h1[i], &h2[i]);
+		start[bucket_of[i] + 1]++;
+	}
+	for (unsigned int b = 0; ok && b < num_buckets; b++) {
+		if (start[b + 1] > max_size)
+			max_size = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	for (unsigned int i = 0; ok && i < n; i++)
+		members[start[bucket_of[i]]++] = i;
+	for (unsigned int b = num_buckets; ok && b > 0; b--)
+		start[b] = start[b - 1];
+	if (ok)
+		start[0] = 0;
+
+	// 버킷 하나의 텀이 너무 많으면 다른 seed로 다시 만든다.
+	if (max_size > sizeof(cand) / sizeof(cand[0]))
+		ok = 0;
+
+	// 큰 버킷부터 (버킷 크기로 계수 정렬)
+	by_size = ok ? (unsigned int *)calloc(max_size + 2, sizeof(unsigned int)) : NULL;
+	if (ok && by_size == NULL)
+		ok = 0;
+	for (unsigned int b = 0; ok && b < num_buckets; b++)
+		by_size[max_size - (start[b + 1] - start[b]) + 1]++;
+	for (unsigned int s = 0; ok && s <= max_size; s++)
+		by_size[s + 1] += by_size[s];
+	for (unsigned int b = 0; ok && b < num_buckets; b++)
+		order[by_size[max_size - (start[b + 1] - start[b])]++] = b;
+
+	for (unsigned int k = 0; ok && k < num_buckets; k++) {
+		unsigned int b = order[k];
+		unsigned int size = start[b + 1] - start[b];
+		unsigned int d0;
+		unsigned int d1;
+		int found;
+
+		disp[b] = 0;
+		if (size == 0)
+			continue;
+
+		// h1, h2가 같은 두 텀은 어떤 변위로도 갈라지지 않는다.
+		for (unsigned int j = 1; j < size && ok; j++)
+			for (unsigned int i = 0; i < j && ok; i++) {
+				unsigned int a = members[start[b] + i];
+				unsigned int c = members[start[b] + j];
+
+				if (h1[a] == h1[c] && h2[a] == h2[c])
+					ok = 0;
+			}
+		if (!ok)
+			break;
+
+		// 텀이 하나뿐인 버킷(가장 나중에 놓인다)은 찾지 않고 다음 빈 자리로 보낸다. (d0 = 0)
+		if (size == 1) {
+			unsigned int t = members[start[b]];
+
+			while (taken[next_free])
+				next_free++;
+			disp[b] = (next_free >= h1[t]) ? next_free - h1[t] : next_free + n - h1[t];
+			taken[next_free] = 1;
+			slots[next_free] = t;
+			continue;
+		}
+
+		// d0마다 자리의 기준(h1 + d0 * h2)을 구해 두고 d1을 하나씩 늘려 가며 찾는다.
+		for (d0 = 0, found = 0; d0 < max_d0 && !found; d0++) {
+			for (unsigned int j = 0; j < size; j++) {
+				unsigned int t = members[start[b] + j];
+
+				base[j] = (unsigned int)((h1[t] + (uint64_t)d0 * h2[t]) % n);
+			}
+
+			for (d1 = 0; d1 < n; d1++) {
+				unsigned int j;
+
+				for (j = 0; j < size; j++) {
+					unsigned int s = base[j] + d1;
+
+					if (s >= n)
+						s -= n;
+					if (taken[s])
+						break;
+					for (unsigned int i = 0; i < j && s != n; i++)
+						if (cand[i] == s)
+							s = n;
+					if (s == n)
+						break;
+					cand[j] = s;
+				}
+				if (j == size) {
+					found = 1;
+					break;
+				}
+			}
+		}
+
+		if (!found) {
+			ok = 0;
+			break;
+		}
+
+		disp[b] = (d0 - 1) * n + d1;
+		for (unsigned int j = 0; j < size; j++) {
+			taken[cand[j]] = 1;
+			slots[cand[j]] = members[start[b] + j];
+		}
+	}
+
+	free(bucket_of);
+	free(h1);
+	free(h2);
+	free(start);
+	free(members);
+	free(order);
+	free(by_size);
+	free(taken);
+
+	return ok;
+}
+
+/* builds static dictionary file (dicfile: one term per line in dictionary order) into dictfile
+	num_docs is recorded in the file header like other index files
+	return	1 success
+			0 failure
+*/
+int dictBuild( char *dicfile, char *dictfile, unsigned int num_docs) {
+	FILE *fp = fopen(dicfile, "rt");
+	tFILEHEADER fh = {0};
+	tDICTHEADER *dh;
+	char *strings = NULL;
+	unsigned int *offsets = NULL;
+	uint64_t *hashes = NULL;
+	unsigned char *body = NULL;
+	size_t strings_size = 0;
+	size_t strings_cap = 0;
+	size_t size;
+	unsigned int n = 0;
+	unsigned int cap = 0;
+	unsigned int num_buckets;
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t len;
+	int ok = 0;
+
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", dicfile);
+		return 0;
+	}
+
+	while ((len = getline(&line, &line_cap, fp)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = 0;
+
+		// 실패해도 이전 배열을 잃지 않도록 임시 포인터로 늘린다.
+		if (n + 1 >= cap) {
+			unsigned int newcap = (cap == 0) ? 1024 : cap * 2;
+			unsigned int *p = (unsigned int *)realloc(offsets, sizeof(unsigned int) * newcap);
+
+			if (p == NULL)
+				break;
+			offsets = p;
+			cap = newcap;
+		}
+		if (strings_size + len + 1 > strings_cap) {
+			size_t newcap = (strings_cap == 0) ? 65536 : strings_cap * 2;
+			char *p;
+
+			if (newcap < strings_size + len + 1)
+				newcap = strings_size + len + 1;
+			if ((p = (char *)realloc(strings, newcap)) == NULL)
+				break;
+			strings = p;
+			strings_cap = newcap;
+		}
+
+		offsets[n++] = strings_size;
+		memcpy(strings + strings_size, line, len + 1);
+		strings_size += len + 1;
+	}
+	free(line);
+
+	// 중간에 멈췄으면 (메모리 부족, 읽기 오류) 잘린 사전을 만들지 않는다.
+	if (len > 0 || ferror(fp)) {
+		if (len > 0)
+			fprintf( stderr, "Out of memory:%s\n", dictfile);
+		else
+			fprintf( stderr, "File read error:%s\n", dicfile);
+		fclose(fp);
+		free(offsets);
+		free(strings);
+		return 0;
+	}
+	fclose(fp);
+
+	if (offsets == NULL && (offsets = (unsigned int *)malloc(sizeof(unsigned int))) == NULL) {
+		fprintf( stderr, "Out of memory:%s\n", dictfile);
+		free(strings);
+		return 0;
+	}
+	offsets[n] = strings_size;
+
+	num_buckets = n / DICT_LOAD + 1;
+	size = sizeof(tDICTHEADER) + sizeof(unsigned int) * (num_buckets + n + n + 1) + strings_size;
+	body = (unsigned char *)calloc(size, 1);
+	hashes = (uint64_t *)malloc(sizeof(uint64_t) * (n + 1));
+
+	if (body != NULL && hashes != NULL) {
+		unsigned int *disp = (unsigned int *)(body + sizeof(tDICTHEADER));
+		unsigned int *slots = disp + num_buckets;
+
+		dh = (tDICTHEADER *)body;
+		dh->num_buckets = num_buckets;
+		dh->strings_size = strings_size;
+
+		// 변위를 찾지 못하면 (드물다) 해시 씨앗을 바꾸어 다시 만든다.
+		for (dh->seed = 0; dh->seed < DICT_SEEDS && !ok; dh->seed++) {
+			for (unsigned int i = 0; i < n; i++)
+				hashes[i] = _dictHash( strings + offsets[i], dh->seed);
+			ok = (n == 0) || _dictPlace( hashes, n, num_buckets, disp, slots);
+		}
+		dh->seed--;
+
+		if (!ok)
+			fprintf( stderr, "Cannot build perfect hash:%s\n", dictfile);
+		else {
+			memcpy(slots + n, offsets, sizeof(unsigned int) * (n + 1));
+			if (strings_size > 0)
+				memcpy(slots + n + n + 1, strings, strings_size);
+		}
+	}
+	else
+		fprintf( stderr, "Out of memory:%s\n", dictfile);
+
+	if (ok) {
+		fh.magic = IDX_MAGIC_DICT;
+		fh.version = IDX_VERSION;
+		fh.count = n;
+		fh.size = size;
+		fh.num_docs = num_docs;
+		fh.checksum = idxChecksum( IDX_CHECKSUM_INIT, body, size);
+
+		// 검색기가 매핑하고 있을 수 있으므로 임시 파일에 쓴 뒤 rename한다.
+		fp = idxCreate( dictfile, "wb");
+		ok = fp != NULL;
+		if (ok)
+			ok = idxCommit( fp, dictfile, fwrite(&fh, sizeof(tFILEHEADER), 1, fp) == 1 && fwrite(body, 1, size, fp) == size);
+	}
+
+	free(body);
+	free(hashes);
+	free(offsets);
+	free(strings);
+
+	return ok;
+}
+
+/* maps static dictionary file (read only)
+	return	1 success
+			0 failure (open error, invalid file)
+*/
+int dictMap( tDICT *dict, char *filename) {
+	tDICTHEADER *dh = (tDICTHEADER *)idxMap( filename, IDX_MAGIC_DICT);
+	tFILEHEADER *fh;
+	unsigned int n;
+
+	memset(dict, 0, sizeof(tDICT));
+	if (dh == NULL)
+		return 0;
+
+	fh = idxFileHeader( dh);
+	n = fh->count;
+	if (fh->size < sizeof(tDICTHEADER) ||
+		fh->size != sizeof(tDICTHEADER) + sizeof(unsigned int) * ((size_t)dh->num_buckets + n + n + 1) + dh->strings_size ||
+		dh->num_buckets == 0) {
+		fprintf( stderr, "Invalid index file:%s\n", filename);
+		idxUnmap( dh);
+		return 0;
+	}
+
+	dict->header = dh;
+	dict->num_terms = n;
+	dict->disp = (const unsigned int *)(dh + 1);
+	dict->slots = dict->disp + dh->num_buckets;
+	dict->offsets = dict->slots + n;
+	dict->strings = (const char *)(dict->offsets + n + 1);
+
+	return 1;
+}
+
+/* returns term of dictionary index idx (0 ~ num_terms - 1)
+*/
+const char *dictTerm( tDICT *dict, int idx) {
+	return dict->strings + dict->offsets[idx];
+}
+
+/* finds term in dictionary
+	return	index in dictionary (order of header.idx)
+			-1 not found
+*/
+int dictSearch( tDICT *dict, const char *term) {
+	unsigned int n = dict->num_terms;
+	unsigned int bucket;
+	unsigned int h1;
+	unsigned int h2;
+	unsigned int idx;
+
+	if (n == 0)
+		return -1;
+
+	_dictKeys( _dictHash( term, dict->header->seed), n, dict->header->num_buckets, &bucket, &h1, &h2);
+	idx = dict->slots[_dictSlot( h1, h2, dict->disp[bucket], n)];
+
+	return (strcmp(dictTerm( dict, idx), term) == 0) ? (int)idx : -1;
+}
+
+/* finds terms starting with prefix (terms are sorted, so they are contiguous)
+	ex) "ab" -> "ab", "abandon", "abbey", ...
+	return	number of terms (dictionary indices first ~ first + return - 1)
+*/
+int dictPrefix( tDICT *dict, const char *prefix, int *first) {
+	size_t len = strlen(prefix);
+	unsigned int lo = 0;
+	unsigned int hi = dict->num_terms;
+	unsigned int end;
+
+	// prefix 이상인 첫 텀
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (strcmp(dictTerm( dict, mid), prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+
+	// prefix로 시작하지 않는 첫 텀
+	hi = dict->num_terms;
+	end = lo;
+	while (end < hi) {
+		unsigned int mid = end + (hi - end) / 2;
+
+		if (strncmp(dictTerm( dict, mid), prefix, len) == 0)
+			end = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return end - lo;
+}
+
+/* unmaps dictionary mapped by dictMap
+*/
+void dictUnmap( tDICT *dict) {
+	idxUnmap( dict->header);
+	memset(dict, 0, sizeof(tDICT));
+}
@@ -0,0 +1,1046 @@
+#include <stdint.h>
+
+// 검색 결과 문서 집합 (DocSet)
+// 문서 수와 문서번호 범위(1 ~ maxdocid)에 따라 표현을 바꾼다.
+//   DOCSET_ARRAY	정렬된 문서번호 배열 (포스팅 리스트의 뷰일 수 있으므로 읽기 전용)
+//   DOCSET_BITMAP	문서번호 0 ~ maxdocid 비트맵 (밀집된 집합, 연산은 64비트 word 단위)
+//   DOCSET_ROARING	문서번호 상위 16비트별 컨테이너, 컨테이너마다 배열(하위 16비트) 또는 비트맵
+// 모든 집합과 연산 결과는 질의별 arena(arena.h)에서 할당하며 만든 뒤에는 바꾸지 않는다.
+// (연산 결과가 입력 집합의 메모리를 공유할 수 있다.)
+
+#define DOCSET_ARRAY		0
+#define DOCSET_BITMAP		1
+#define DOCSET_ROARING		2
+
+#define DOCSET_DENSE		32		// 문서 수 * DOCSET_DENSE >= maxdocid 이면 비트맵이 배열보다 작다. (int = 32비트)
+#define DOCSET_CHUNK_BITS	16
+#define DOCSET_CHUNK_WORDS	((1 << DOCSET_CHUNK_BITS) / 64)
+#define DOCSET_CONTAINER_MAX	4096	// 컨테이너 배열의 최대 원소 수 (넘으면 비트맵이 더 작다)
+
+#define DOCSET_AND			0
+#define DOCSET_OR			1
+#define DOCSET_ANDNOT		2
+
+// Roaring 컨테이너
+typedef struct {
+	int			key;		// 문서번호 상위 16비트
+	int			count;		// 문서 수
+	uint16_t	*array;		// count <= DOCSET_CONTAINER_MAX: 하위 16비트 정렬 배열
+	uint64_t	*words;		// 그 외: DOCSET_CHUNK_WORDS개 word 비트맵
+} tCONTAINER;
+
+typedef struct {
+	int			type;			// DOCSET_ARRAY, DOCSET_BITMAP, DOCSET_ROARING
+	int			count;			// 문서 수
+	int			maxdocid;		// 가장 큰 문서번호
+	const int	*docs;			// ARRAY
+	uint64_t	*words;			// BITMAP: 문서번호 d는 words[d >> 6]의 (d & 63)번째 비트
+	tCONTAINER	*containers;	// ROARING: key 순으로 정렬
+	int			num_containers;
+} tDOCSET;
+
+// 문서 집합 순회 상태
+typedef struct {
+	const tDOCSET	*set;
+	int				pos;		// ARRAY: 다음 위치, 컨테이너 배열: 다음 위치
+	int				word;		// 비트맵: 현재 word 번호
+	uint64_t		bits;		// 비트맵: 현재 word에서 남은 비트
+	int				c;			// ROARING: 현재 컨테이너
+} tDOCSETITER;
+
+////////////////////////////////////////////////////////////////////////////////
+/* returns number of words of a bitmap covering doc ids 0 ~ maxdocid
+*/
+static inline int _docsetWords( int maxdocid) {
+	return (maxdocid >> 6) + 1;
+}
+
+static tDOCSET *_docsetNew( tARENA *arena, int type, int maxdocid) {
+	tDOCSET *set = (tDOCSET *)arenaAlloc(arena, sizeof(tDOCSET));
+
+	if (set == NULL)
+		return NULL;
+
+	memset(set, 0, sizeof(tDOCSET));
+	set->type = type;
+	set->maxdocid = maxdocid;
+
+	return set;
+}
+
+static uint64_t *_docsetAllocWords( tARENA *arena, int num_words) {
+	uint64_t *words = (uint64_t *)arenaAlloc(arena, sizeof(uint64_t) * num_words);
+
+	if (words != NULL)
+		memset(words, 0, sizeof(uint64_t) * num_words);
+
+	return words;
+}
+
+static int _popcount( const uint64_t *words, int num_words) {
+	int count = 0;
+
+	for (int i = 0; i < num_words; i++)
+		count += __builtin_popcountll(words[i]);
+
+	return count;
+}
+
+/* wraps sorted doc ids as an array set (no copy)
+	return	set pointer (allocated from arena)
+			NULL if overflow
+*/
+tDOCSET *docsetFromArray( tARENA *arena, const int *docs, int count, int maxdocid) {
+	tDOCSET *set = _docsetNew( arena, DOCSET_ARRAY, maxdocid);
+
+	if (set == NULL)
+		return NULL;
+
+	set->docs = docs;
+	set->count = (docs == NULL) ? 0 : count;
+
+	return set;
+}
+
+/* wraps bitmap words (doc ids 0 ~ maxdocid, count bits set) as a bitmap set (no copy)
+	return	set pointer (allocated from arena)
+			NULL if overflow
+*/
+tDOCSET *docsetFromBitmap( tARENA *arena, uint64_t *words, int count, int maxdocid) {
+	tDOCSET *set = _docsetNew( arena, DOCSET_BITMAP, maxdocid);
+
+	if (set == NULL)
+		return NULL;
+
+	set->words = words;
+	set->count = count;
+
+	return set;
+}
+
+/* starts iterating doc ids of set in increasing order
+*/
+void docsetIterInit( tDOCSETITER *it, const tDOCSET *set) {
+	it->set = set;
+	it->pos = 0;
+	it->word = -1;
+	it->bits = 0;
+	it->c = 0;
+}
+
+// 비트맵에서 다음 문서번호를 찾는다. (없으면 -1)
+static inline int _iterWords( tDOCSETITER *it, const uint64_t *words, int num_words) {
+	while (it->bits == 0) {
+		if (++it->word >= num_words)
+			return -1;
+		it->bits = words[it->word];
+	}
+
+	int bit = __builtin_ctzll(it->bits);
+
+	it->bits &= it->bits - 1;
+	return (it->word << 6) + bit;
+}
+
+/* returns next doc id of the iteration
+	return	doc id
+			-1 end of set
+*/
+int docsetIterNext( tDOCSETITER *it) {
+	const tDOCSET *set = it->set;
+
+	switch (set->type) {
+		case DOCSET_ARRAY:
+			return (it->pos < set->count) ? set->docs[it->pos++] : -1;
+
+		case DOCSET_BITMAP:
+			return _iterWords( it, set->words, _docsetWords( set->maxdocid));
+
+		default:
+			while (it->c < set->num_containers) {
+				const tCONTAINER *c = &set->containers[it->c];
+				int low;
+
+				if (c->array != NULL)
+					low = (it->pos < c->count) ? c->array[it->pos++] : -1;
+				else
+					low = _iterWords( it, c->words, DOCSET_CHUNK_WORDS);
+
+				if (low >= 0)
+					return (c->key << DOCSET_CHUNK_BITS) | low;
+
+				// 다음 컨테이너
+				it->c++;
+				it->pos = 0;
+				it->word = -1;
+				it->bits = 0;
+			}
+			return -1;
+	}
+}
+
+static inline int _containerContains( const tCONTAINER *c, int low) {
+	int lo = 0;
+	int hi = c->count;
+
+	if (c->array == NULL)
+		return (c->words[low >> 6] >> (low & 63)) & 1;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (c->array[mid] < low)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < c->count && c->array[lo] == low;
+}
+
+static const tCONTAINER *_findContainer( const tDOCSET *set, int key) {
+	int lo = 0;
+	int hi = set->num_containers;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (set->containers[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < set->num_containers && set->containers[lo].key == key) ? &set->containers[lo] : NULL;
+}
+
+/* tests whether doc is in set
+	return	1 if doc is in set
+			0 otherwise
+*/
+int docsetContains( const tDOCSET *set, int doc) {
+	const tCONTAINER *c;
+
+	if (doc < 0 || doc > set->maxdocid)
+		return 0;
+
+	switch (set->type) {
+		case DOCSET_ARRAY: {
+			int pos = gallopSearch( set->docs, 0, set->count, doc);
+
+			return pos < set->count && set->docs[pos] == doc;
+		}
+		case DOCSET_BITMAP:
+			return (set->words[doc >> 6] >> (doc & 63)) & 1;
+
+		default:
+			c = _findContainer( set, doc >> DOCSET_CHUNK_BITS);
+			return c != NULL && _containerContains( c, doc & ((1 << DOCSET_CHUNK_BITS) - 1));
+	}
+}
+
+/* converts set to an array set
+	return	set pointer (set itself if it is already an array)
+			NULL if overflow
+*/
+tDOCSET *docsetToArray( tARENA *arena, const tDOCSET *set) {
+	tDOCSET *result;
+	tDOCSETITER it;
+	int *docs;
+	int doc;
+	int n = 0;
+
+	if (set->type == DOCSET_ARRAY)
+		return (tDOCSET *)set;
+
+	docs = (int *)arenaAlloc(arena, sizeof(int) * set->count + SETOPS_SLACK * sizeof(int));
+	result = _docsetNew( arena, DOCSET_ARRAY, set->maxdocid);
+	if (docs == NULL || result == NULL)
+		return NULL;
+
+	docsetIterInit( &it, set);
+	while ((doc = docsetIterNext( &it)) >= 0)
+		docs[n++] = doc;
+
+	result->docs = docs;
+	result->count = n;
+
+	return result;
+}
+
+// 집합의 문서번호 비트들을 비트맵 words(num_words개)에 켠다. (words에 이미 켜진 비트는 그대로)
+static void _docsetSetBits( const tDOCSET *set, uint64_t *words, int num_words) {
+	if (set->type == DOCSET_ARRAY) {
+		for (int i = 0; i < set->count; i++)
+			words[set->docs[i] >> 6] |= (uint64_t)1 << (set->docs[i] & 63);
+	}
+	else if (set->type == DOCSET_BITMAP) {
+		for (int w = 0; w < num_words; w++)
+			words[w] |= set->words[w];
+	}
+	else {
+		for (int i = 0; i < set->num_containers; i++) {
+			const tCONTAINER *c = &set->containers[i];
+			int base = c->key << DOCSET_CHUNK_BITS;
+
+			if (c->array != NULL) {
+				for (int j = 0; j < c->count; j++) {
+					int doc = base | c->array[j];
+
+					words[doc >> 6] |= (uint64_t)1 << (doc & 63);
+				}
+			}
+			else {
+				int from = base >> 6;
+				int n = (num_words - from < DOCSET_CHUNK_WORDS) ? num_words - from : DOCSET_CHUNK_WORDS;
+
+				for (int w = 0; w < n; w++)
+					words[from + w] |= c->words[w];
+			}
+		}
+	}
+}
+
+/* converts set to a bitmap set
+	return	set pointer (set itself if it is already a bitmap)
+			NULL if overflow
+*/
+tDOCSET *docsetToBitmap( tARENA *arena, const tDOCSET *set) {
+	int num_words = _docsetWords( set->maxdocid);
+	tDOCSET *result;
+	uint64_t *words;
+
+	if (set->type == DOCSET_BITMAP)
+		return (tDOCSET *)set;
+
+	result = _docsetNew( arena, DOCSET_BITMAP, set->maxdocid);
+	words = _docsetAllocWords( arena, num_words);
+	if (result == NULL || words == NULL)
+		return NULL;
+
+	_docsetSetBits( set, words, num_words);
+
+	result->words = words;
+	result->count = set->count;
+
+	return result;
+}
+
+// 청크 비트맵(DOCSET_CHUNK_WORDS words)으로 컨테이너를 만든다.
+// 문서가 DOCSET_CONTAINER_MAX개 이하이면 배열로 줄인다. words는 그대로 컨테이너에 쓰일 수 있다.
+static int _containerFromWords( tARENA *arena, int key, uint64_t *words, int count, tCONTAINER *out) {
+	out->key = key;
+	out->count = count;
+	out->array = NULL;
+	out->words = words;
+
+	if (count <= DOCSET_CONTAINER_MAX) {
+		int n = 0;
+
+		out->array = (uint16_t *)arenaAlloc(arena, sizeof(uint16_t) * (count + 1));
+		if (out->array == NULL)
+			return -1;
+
+		for (int w = 0; w < DOCSET_CHUNK_WORDS; w++) {
+			uint64_t bits = words[w];
+
+			while (bits) {
+				out->array[n++] = (w << 6) + __builtin_ctzll(bits);
+				bits &= bits - 1;
+			}
+		}
+		out->words = NULL;
+	}
+	return 0;
+}
+
+/* converts set to a Roaring set
+	return	set pointer (set itself if it is already a Roaring set)
+			NULL if overflow
+*/
+tDOCSET *docsetToRoaring( tARENA *arena, const tDOCSET *set) {
+	int num_chunks = (set->maxdocid >> DOCSET_CHUNK_BITS) + 1;
+	tDOCSET *result;
+	int n = 0;
+
+	if (set->type == DOCSET_ROARING)
+		return (tDOCSET *)set;
+
+	result = _docsetNew( arena, DOCSET_ROARING, set->maxdocid);
+	if (result == NULL)
+		return NULL;
+
+	result->containers = (tCONTAINER *)arenaAlloc(arena, sizeof(tCONTAINER) * num_chunks);
+	if (result->containers == NULL)
+		return NULL;
+
+	if (set->type == DOCSET_ARRAY) {
+		int i = 0;
+
+		while (i < set->count) {
+			int key = set->docs[i] >> DOCSET_CHUNK_BITS;
+			int end = i;
+			tCONTAINER *c = &result->containers[n++];
+
+			while (end < set->count && (set->docs[end] >> DOCSET_CHUNK_BITS) == key)
+				end++;
+
+			c->key = key;
+			c->count = end - i;
+			c->array = NULL;
+			c->words = NULL;
+
+			if (c->count <= DOCSET_CONTAINER_MAX) {
+				c->array = (uint16_t *)arenaAlloc(arena, sizeof(uint16_t) * c->count);
+				if (c->array == NULL)
+					return NULL;
+				for (int j = i; j < end; j++)
+					c->array[j - i] = set->docs[j] & ((1 << DOCSET_CHUNK_BITS) - 1);
+			}
+			else {
+				c->words = _docsetAllocWords( arena, DOCSET_CHUNK_WORDS);
+				if (c->words == NULL)
+					return NULL;
+				for (int j = i; j < end; j++) {
+					int low = set->docs[j] & ((1 << DOCSET_CHUNK_BITS) - 1);
+
+					c->words[low >> 6] |= (uint64_t)1 << (low & 63);
+				}
+			}
+			i = end;
+		}
+	}
+	else {
+		int num_words = _docsetWords( set->maxdocid);
+
+		for (int key = 0; key < num_chunks; key++) {
+			int from = key * DOCSET_CHUNK_WORDS;
+			int len = (num_words - from < DOCSET_CHUNK_WORDS) ? num_words - from : DOCSET_CHUNK_WORDS;
+			int count = _popcount( set->words + from, len);
+			uint64_t *words;
+
+			if (count == 0)
+				continue;
+
+			words = _docsetAllocWords( arena, DOCSET_CHUNK_WORDS);
+			if (words == NULL)
+				return NULL;
+			memcpy(words, set->words + from, sizeof(uint64_t) * len);
+
+			if (_containerFromWords( arena, key, words, count, &result->containers[n++]) < 0)
+				return NULL;
+		}
+	}
+
+	result->num_containers = n;
+	result->count = set->count;
+
+	return result;
+}
+
+/* converts set to the smallest representation for its density
+	dense (count * DOCSET_DENSE >= maxdocid)			-> bitmap
+	sparse, but more than one chunk of doc ids and
+	more than DOCSET_CONTAINER_MAX docs					-> Roaring
+	otherwise											-> array
+	return	set pointer (set itself if no conversion is needed)
+			NULL if overflow
+*/
+tDOCSET *docsetOptimize( tARENA *arena, const tDOCSET *set) {
+	if (set->count == 0)
+		return docsetFromArray( arena, NULL, 0, set->maxdocid);
+
+	if ((long)set->count * DOCSET_DENSE >= set->maxdocid)
+		return docsetToBitmap( arena, set);
+
+	if ((set->maxdocid >> DOCSET_CHUNK_BITS) > 0 && set->count > DOCSET_CONTAINER_MAX)
+		return docsetToRoaring( arena, set);
+
+	return docsetToArray( arena, set);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 정렬된 문서번호 배열의 집합 연산 (결과는 arena에서 할당)
+
+/* intersection of sorted doc id arrays (galloping when their sizes differ a lot)
+	return	result array (allocated from arena)
+			NULL if overflow
+*/
+int *intersectDocuments( tARENA *arena, const int *docs, int numdocs, const int *docs2, int numdocs2, int *newnumdocs) {
+	int *result;
+
+	*newnumdocs = 0;
+
+	if ((docs == NULL) || (docs2 == NULL))
+		return NULL;
+
+	// 교집합은 작은 집합보다 클 수 없다.
+	result = (int *)arenaAlloc(arena, sizeof(int) * (((numdocs < numdocs2) ? numdocs : numdocs2) + SETOPS_SLACK));
+	if (result == NULL)
+		return NULL;
+
+	*newnumdocs = intersectAdaptive( docs, numdocs, docs2, numdocs2, result);
+
+	return result;
+}
+
+/* union of sorted doc id arrays
+	return	result array (allocated from arena)
+			NULL if overflow
+*/
+int *unionDocuments( tARENA *arena, const int *docs, int numdocs, const int *docs2, int numdocs2, int *newnumdocs) {
+	int *result;
+
+	if (docs == NULL)
+		numdocs = 0;
+	if (docs2 == NULL)
+		numdocs2 = 0;
+
+	// 합집합은 두 집합의 크기의 합보다 클 수 없다.
+	result = (int *)arenaAlloc(arena, sizeof(int) * (numdocs + numdocs2 + SETOPS_SLACK));
+	if (result == NULL) {
+		*newnumdocs = 0;
+		return NULL;
+	}
+
+	*newnumdocs = setUnion( (docs == NULL) ? result : docs, numdocs,
+						  (docs2 == NULL) ? result : docs2, numdocs2, result);
+
+	return result;
+}
+
+/* union of k sorted doc id arrays in one pass (k-way merge with a min-heap of the arrays' current doc ids)
+	unlike folding unionDocuments pairwise, each doc id is copied once
+	return	result array (allocated from arena)
+			NULL if overflow
+*/
+int *unionDocumentsK( tARENA *arena, const int **lists, const int *counts, int k, int *newnumdocs) {
+	int *result;
+	int *heap;		// 배열 번호, heap[0]의 현재 문서번호가 가장 작다.
+	int *pos;		// 배열마다 현재 위치
+	long total = 0;
+	int size = 0;
+	int n = 0;
+
+	*newnumdocs = 0;
+
+	for (int i = 0; i < k; i++)
+		total += counts[i];
+
+	// 합집합은 크기의 합보다 클 수 없다.
+	result = (int *)arenaAlloc(arena, sizeof(int) * (total + 1));
+	heap = (int *)arenaAlloc(arena, sizeof(int) * (k + 1));
+	pos = (int *)arenaAlloc(arena, sizeof(int) * (k + 1));
+	if (result == NULL || heap == NULL || pos == NULL)
+		return NULL;
+
+	for (int i = 0; i < k; i++) {
+		int c;
+
+		if (lists[i] == NULL || counts[i] == 0)
+			continue;
+
+		// 위로 올린다.
+		pos[i] = 0;
+		for (c = size++; c > 0 && lists[heap[(c - 1) / 2]][0] > lists[i][0]; c = (c - 1) / 2)
+			heap[c] = heap[(c - 1) / 2];
+		heap[c] = i;
+	}
+
+	while (size > 0) {
+		int top = heap[0];
+		int doc = lists[top][pos[top]];
+		int c = 0;
+
+		if (n == 0 || result[n - 1] != doc)
+			result[n++] = doc;
+
+		// 맨 앞 배열을 한 칸 옮기고, 끝났으면 맨 뒤 배열을 대신 놓은 뒤 아래로 내린다.
+		if (++pos[top] == counts[top])
+			top = heap[--size];
+		doc = (size > 0) ? lists[top][pos[top]] : 0;
+
+		while (2 * c + 1 < size) {
+			int child = 2 * c + 1;
+
+			if (child + 1 < size && lists[heap[child + 1]][pos[heap[child + 1]]] < lists[heap[child]][pos[heap[child]]])
+				child++;
+			if (lists[heap[child]][pos[heap[child]]] >= doc)
+				break;
+			heap[c] = heap[child];
+			c = child;
+		}
+		heap[c] = top;
+	}
+
+	*newnumdocs = n;
+
+	return result;
+}
+
+/* difference of sorted doc id arrays (docs - docs2)
+	return	result array (allocated from arena)
+			NULL if overflow
+*/
+int *differenceDocuments( tARENA *arena, const int *docs, int numdocs, const int *docs2, int numdocs2, int *newnumdocs) {
+	int *result;
+	int j = 0;
+	int idx = 0;
+
+	*newnumdocs = 0;
+
+	if (docs == NULL)
+		return NULL;
+
+	// 차집합은 첫 번째 집합보다 클 수 없다.
+	result = (int *)arenaAlloc(arena, sizeof(int) * (numdocs + 1));
+	if (result == NULL)
+		return NULL;
+
+	if (docs2 == NULL)
+		numdocs2 = 0;
+
+	for (int i = 0; i < numdocs; i++) {
+		// 두 번째 집합이 훨씬 크면 지수 탐색, 아니면 선형 병합
+		if ((long)numdocs * GALLOP_RATIO < numdocs2)
+			j = gallopSearch( docs2, j, numdocs2, docs[i]);
+		else
+			while (j < numdocs2 && docs2[j] < docs[i])
+				j++;
+
+		if (j >= numdocs2 || docs2[j] != docs[i])
+			result[idx++] = docs[i];
+	}
+
+	*newnumdocs = idx;
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 컨테이너 연산
+// 입력 컨테이너가 없으면(NULL) 빈 컨테이너로 본다.
+// 결과가 비면 -1이 아닌 0을 반환하고 out->count를 0으로 한다. (-1: overflow)
+
+static void _containerToWords( const tCONTAINER *c, uint64_t *words) {
+	if (c->array == NULL) {
+		memcpy(words, c->words, sizeof(uint64_t) * DOCSET_CHUNK_WORDS);
+		return;
+	}
+
+	memset(words, 0, sizeof(uint64_t) * DOCSET_CHUNK_WORDS);
+	for (int i = 0; i < c->count; i++)
+		words[c->array[i] >> 6] |= (uint64_t)1 << (c->array[i] & 63);
+}
+
+static int _containerOp( tARENA *arena, int op, const tCONTAINER *x, const tCONTAINER *y, tCONTAINER *out) {
+	uint64_t *words;
+
+	out->count = 0;
+
+	if (x == NULL || x->count == 0) {
+		if (op == DOCSET_OR && y != NULL)
+			*out = *y;
+		return 0;
+	}
+	if (y == NULL || y->count == 0) {
+		if (op != DOCSET_AND)
+			*out = *x;
+		return 0;
+	}
+
+	out->key = x->key;
+	out->array = NULL;
+	out->words = NULL;
+
+	// 배열 쪽을 다른 컨테이너에서 찾아 걸러낸다.
+	if ((op == DOCSET_AND && (x->array != NULL || y->array != NULL)) ||
+		(op == DOCSET_ANDNOT && x->array != NULL)) {
+		const tCONTAINER *small = (op == DOCSET_AND && x->array == NULL) ? y : x;
+		const tCONTAINER *other = (small == x) ? y : x;
+		int keep = (op == DOCSET_AND) ? 1 : 0;
+		int n = 0;
+
+		out->array = (uint16_t *)arenaAlloc(arena, sizeof(uint16_t) * (small->count + 1));
+		if (out->array == NULL)
+			return -1;
+
+		for (int i = 0; i < small->count; i++)
+			if (_containerContains( other, small->array[i]) == keep)
+				out->array[n++] = small->array[i];
+
+		out->count = n;
+		return 0;
+	}
+
+	// 두 배열의 합집합이 배열 하나에 들어가면 병합
+	if (op == DOCSET_OR && x->array != NULL && y->array != NULL &&
+		x->count + y->count <= DOCSET_CONTAINER_MAX) {
+		int i = 0, j = 0, n = 0;
+
+		out->array = (uint16_t *)arenaAlloc(arena, sizeof(uint16_t) * (x->count + y->count));
+		if (out->array == NULL)
+			return -1;
+
+		while (i < x->count && j < y->count) {
+			if (x->array[i] < y->array[j])
+				out->array[n++] = x->array[i++];
+			else if (x->array[i] > y->array[j])
+				out->array[n++] = y->array[j++];
+			else {
+				out->array[n++] = x->array[i];
+				i++;	j++;
+			}
+		}
+		while (i < x->count)
+			out->array[n++] = x->array[i++];
+		while (j < y->count)
+			out->array[n++] = y->array[j++];
+
+		out->count = n;
+		return 0;
+	}
+
+	// 나머지는 비트맵으로 펼쳐 word 단위로 연산
+	words = (uint64_t *)arenaAlloc(arena, sizeof(uint64_t) * DOCSET_CHUNK_WORDS);
+	if (words == NULL)
+		return -1;
+
+	_containerToWords( x, words);
+
+	if (y->array != NULL) {
+		for (int i = 0; i < y->count; i++) {
+			uint64_t bit = (uint64_t)1 << (y->array[i] & 63);
+
+			if (op == DOCSET_OR)
+				words[y->array[i] >> 6] |= bit;
+			else
+				words[y->array[i] >> 6] &= ~bit;
+		}
+	}
+	else {
+		for (int w = 0; w < DOCSET_CHUNK_WORDS; w++) {
+			if (op == DOCSET_AND)
+				words[w] &= y->words[w];
+			else if (op == DOCSET_OR)
+				words[w] |= y->words[w];
+			else
+				words[w] &= ~y->words[w];
+		}
+	}
+
+	return _containerFromWords( arena, x->key, words, _popcount( words, DOCSET_CHUNK_WORDS), out);
+}
+
+static tDOCSET *_roaringOp( tARENA *arena, int op, const tDOCSET *a, const tDOCSET *b) {
+	tDOCSET *result = _docsetNew( arena, DOCSET_ROARING, a->maxdocid);
+	int i = 0;
+	int j = 0;
+
+	if (result == NULL)
+		return NULL;
+
+	result->containers = (tCONTAINER *)arenaAlloc(arena, sizeof(tCONTAINER) * (a->num_containers + b->num_containers + 1));
+	if (result->containers == NULL)
+		return NULL;
+
+	while (i < a->num_containers || j < b->num_containers) {
+		const tCONTAINER *x = NULL;
+		const tCONTAINER *y = NULL;
+		tCONTAINER *out = &result->containers[result->num_containers];
+
+		if (j >= b->num_containers || (i < a->num_containers && a->containers[i].key < b->containers[j].key))
+			x = &a->containers[i++];
+		else if (i >= a->num_containers || b->containers[j].key < a->containers[i].key)
+			y = &b->containers[j++];
+		else {
+			x = &a->containers[i++];
+			y = &b->containers[j++];
+		}
+
+		if (_containerOp( arena, op, x, y, out) < 0)
+			return NULL;
+
+		if (out->count > 0) {
+			result->count += out->count;
+			result->num_containers++;
+		}
+	}
+
+	return result;
+}
+
+static tDOCSET *_bitmapOp( tARENA *arena, int op, const tDOCSET *a, const tDOCSET *b) {
+	int num_words = _docsetWords( a->maxdocid);
+	tDOCSET *result = _docsetNew( arena, DOCSET_BITMAP, a->maxdocid);
+
+	if (result == NULL)
+		return NULL;
+
+	result->words = (uint64_t *)arenaAlloc(arena, sizeof(uint64_t) * num_words);
+	if (result->words == NULL)
+		return NULL;
+
+	// 64비트 word 단위 연산 (컴파일러가 벡터화한다)
+	switch (op) {
+		case DOCSET_AND:
+			for (int w = 0; w < num_words; w++)
+				result->words[w] = a->words[w] & b->words[w];
+			break;
+		case DOCSET_OR:
+			for (int w = 0; w < num_words; w++)
+				result->words[w] = a->words[w] | b->words[w];
+			break;
+		default:
+			for (int w = 0; w < num_words; w++)
+				result->words[w] = a->words[w] & ~b->words[w];
+			break;
+	}
+
+	result->count = _popcount( result->words, num_words);
+
+	return result;
+}
+
+// 배열 집합(a)의 문서 중 b에 있는 (keep = 1) 또는 없는 (keep = 0) 문서만 남긴다.
+static tDOCSET *_filterArray( tARENA *arena, const tDOCSET *a, const tDOCSET *b, int keep) {
+	tDOCSET *result = _docsetNew( arena, DOCSET_ARRAY, a->maxdocid);
+	int *docs = (int *)arenaAlloc(arena, sizeof(int) * (a->count + 1));
+	int n = 0;
+
+	if (result == NULL || docs == NULL)
+		return NULL;
+
+	for (int i = 0; i < a->count; i++)
+		if (docsetContains( b, a->docs[i]) == keep)
+			docs[n++] = a->docs[i];
+
+	result->docs = docs;
+	result->count = n;
+
+	return result;
+}
+
+static int _isDense( const tDOCSET *set) {
+	return (long)set->count * DOCSET_DENSE >= set->maxdocid;
+}
+
+static tDOCSET *_docsetOp( tARENA *arena, int op, const tDOCSET *a, const tDOCSET *b) {
+	tDOCSET *result;
+	int *docs;
+	int n;
+
+	// 빈 집합
+	if (a->count == 0 || b->count == 0) {
+		if (op == DOCSET_OR)
+			return (tDOCSET *)((a->count == 0) ? b : a);
+		if (op == DOCSET_ANDNOT && a->count > 0)
+			return (tDOCSET *)a;
+		return docsetFromArray( arena, NULL, 0, a->maxdocid);
+	}
+
+	// 두 배열 중 하나라도 희소하면 정렬 배열 연산 (SIMD 커널, galloping)
+	if (a->type == DOCSET_ARRAY && b->type == DOCSET_ARRAY && (!_isDense( a) || !_isDense( b))) {
+		switch (op) {
+			case DOCSET_AND:
+				docs = intersectDocuments( arena, a->docs, a->count, b->docs, b->count, &n);
+				break;
+			case DOCSET_OR:
+				docs = unionDocuments( arena, a->docs, a->count, b->docs, b->count, &n);
+				break;
+			default:
+				docs = differenceDocuments( arena, a->docs, a->count, b->docs, b->count, &n);
+				break;
+		}
+		if (docs == NULL)
+			return NULL;
+		result = docsetFromArray( arena, docs, n, a->maxdocid);
+	}
+	// 희소한 배열은 다른 집합에서 문서마다 찾아 걸러낸다.
+	else if (op == DOCSET_AND && (a->type == DOCSET_ARRAY || b->type == DOCSET_ARRAY) &&
+			 !_isDense( (a->type == DOCSET_ARRAY) ? a : b)) {
+		result = (a->type == DOCSET_ARRAY) ? _filterArray( arena, a, b, 1) : _filterArray( arena, b, a, 1);
+	}
+	else if (op == DOCSET_ANDNOT && a->type == DOCSET_ARRAY && !_isDense( a)) {
+		result = _filterArray( arena, a, b, 0);
+	}
+	// Roaring이 섞이면 컨테이너별 연산
+	else if (a->type == DOCSET_ROARING || b->type == DOCSET_ROARING) {
+		const tDOCSET *ra = docsetToRoaring( arena, a);
+		const tDOCSET *rb = docsetToRoaring( arena, b);
+
+		if (ra == NULL || rb == NULL)
+			return NULL;
+		result = _roaringOp( arena, op, ra, rb);
+	}
+	// 나머지(밀집된 집합끼리)는 비트맵 word 연산
+	else {
+		const tDOCSET *ba = docsetToBitmap( arena, a);
+		const tDOCSET *bb = docsetToBitmap( arena, b);
+
+		if (ba == NULL || bb == NULL)
+			return NULL;
+		result = _bitmapOp( arena, op, ba, bb);
+	}
+
+	if (result == NULL)
+		return NULL;
+
+	return docsetOptimize( arena, result);
+}
+
+/* intersection of sets (a & b)
+	return	result set (allocated from arena; may share memory with a or b)
+			NULL if overflow
+*/
+tDOCSET *docsetAnd( tARENA *arena, const tDOCSET *a, const tDOCSET *b) {
+	return _docsetOp( arena, DOCSET_AND, a, b);
+}
+
+/* union of sets (a | b)
+	return	result set (allocated from arena; may share memory with a or b)
+			NULL if overflow
+*/
+tDOCSET *docsetOr( tARENA *arena, const tDOCSET *a, const tDOCSET *b) {
+	return _docsetOp( arena, DOCSET_OR, a, b);
+}
+
+/* difference of sets (a & !b)
+	return	result set (allocated from arena; may share memory with a)
+			NULL if overflow
+*/
+tDOCSET *docsetAndNot( tARENA *arena, const tDOCSET *a, const tDOCSET *b) {
+	return _docsetOp( arena, DOCSET_ANDNOT, a, b);
+}
+
+/* union of n sets in one pass (sets[0] | sets[1] | ... | sets[n - 1])
+	sparse arrays are merged with a k-way heap (unionDocumentsK), others are OR'ed into one bitmap,
+	so the result is built once instead of being copied again at every pairwise union
+	return	result set (allocated from arena; may be one of sets)
+			NULL if overflow
+*/
+tDOCSET *docsetOrMany( tARENA *arena, tDOCSET **sets, int n) {
+	int maxdocid = sets[0]->maxdocid;
+	tDOCSET **parts;
+	tDOCSET *result;
+	long total = 0;
+	int all_arrays = 1;
+	int m = 0;
+
+	parts = (tDOCSET **)arenaAlloc(arena, sizeof(tDOCSET *) * n);
+	if (parts == NULL)
+		return NULL;
+
+	// 빈 집합은 뺀다.
+	for (int i = 0; i < n; i++) {
+		if (sets[i]->count == 0)
+			continue;
+		parts[m++] = sets[i];
+		total += sets[i]->count;
+		if (sets[i]->type != DOCSET_ARRAY)
+			all_arrays = 0;
+	}
+
+	if (m == 0)
+		return sets[0];
+	if (m == 1)
+		return parts[0];
+	// 두 집합은 표현별 연산(SIMD 병합 등)으로
+	if (m == 2)
+		return docsetOr( arena, parts[0], parts[1]);
+
+	if (all_arrays && total * DOCSET_DENSE < maxdocid) {
+		const int **lists = (const int **)arenaAlloc(arena, sizeof(int *) * m);
+		int *counts = (int *)arenaAlloc(arena, sizeof(int) * m);
+		int *docs;
+		int count;
+
+		if (lists == NULL || counts == NULL)
+			return NULL;
+		for (int i = 0; i < m; i++) {
+			lists[i] = parts[i]->docs;
+			counts[i] = parts[i]->count;
+		}
+
+		docs = unionDocumentsK( arena, lists, counts, m, &count);
+		if (docs == NULL)
+			return NULL;
+		result = docsetFromArray( arena, docs, count, maxdocid);
+	}
+	else {
+		int num_words = _docsetWords( maxdocid);
+
+		result = _docsetNew( arena, DOCSET_BITMAP, maxdocid);
+		if (result == NULL || (result->words = _docsetAllocWords( arena, num_words)) == NULL)
+			return NULL;
+
+		for (int i = 0; i < m; i++)
+			_docsetSetBits( parts[i], result->words, num_words);
+		result->count = _popcount( result->words, num_words);
+	}
+
+	if (result == NULL)
+		return NULL;
+
+	return docsetOptimize( arena, result);
+}
+
+/* complement of set over doc ids 1 ~ maxdocid
+	return	result set (allocated from arena)
+			NULL if overflow
+*/
+tDOCSET *docsetNot( tARENA *arena, const tDOCSET *set) {
+	int num_words = _docsetWords( set->maxdocid);
+	const tDOCSET *bitmap;
+	tDOCSET *result;
+
+	result = _docsetNew( arena, DOCSET_BITMAP, set->maxdocid);
+	if (result == NULL)
+		return NULL;
+
+	result->words = (uint64_t *)arenaAlloc(arena, sizeof(uint64_t) * num_words);
+	if (result->words == NULL)
+		return NULL;
+
+	if (set->type == DOCSET_ARRAY) {
+		memset(result->words, 0xff, sizeof(uint64_t) * num_words);
+		for (int i = 0; i < set->count; i++)
+			result->words[set->docs[i] >> 6] &= ~((uint64_t)1 << (set->docs[i] & 63));
+	}
+	else {
+		bitmap = docsetToBitmap( arena, set);
+		if (bitmap == NULL)
+			return NULL;
+		for (int w = 0; w < num_words; w++)
+			result->words[w] = ~bitmap->words[w];
+	}
+
+	// 문서번호 0과 maxdocid보다 큰 비트는 지운다.
+	result->words[0] &= ~(uint64_t)1;
+	if (((set->maxdocid + 1) & 63) != 0)
+		result->words[num_words - 1] &= ((uint64_t)1 << ((set->maxdocid + 1) & 63)) - 1;
+
+	result->count = set->maxdocid - set->count;
+
+	return docsetOptimize( arena, result);
+}
+
+/* returns number of bytes used by the representation of set
+	(array sets count their doc ids even when they are views of a posting list)
+*/
+size_t docsetBytes( const tDOCSET *set) {
+	size_t bytes = sizeof(tDOCSET);
+
+	switch (set->type) {
+		case DOCSET_ARRAY:
+			return bytes + sizeof(int) * set->count;
+		case DOCSET_BITMAP:
+			return bytes + sizeof(uint64_t) * _docsetWords( set->maxdocid);
+		default:
+			for (int i = 0; i < set->num_containers; i++) {
+				const tCONTAINER *c = &set->containers[i];
+
+				bytes += sizeof(tCONTAINER) + ((c->array != NULL) ? sizeof(uint16_t) * c->count
+															   : sizeof(uint64_t) * DOCSET_CHUNK_WORDS);
+			}
+			return bytes;
+	}
+}
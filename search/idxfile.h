@@ -0,0 +1,165 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define IDX_MAGIC_HEADER	0x52444849 // "IHDR" header.idx
+#define IDX_MAGIC_POSTING	0x54534f50 // "POST" posting.idx
+#define IDX_MAGIC_DOCLEN	0x4e454c44 // "DLEN" doclen.idx
+#define IDX_MAGIC_POSITION	0x49534f50 // "POSI" position.idx
+#define IDX_MAGIC_DELETED	0x534c4544 // "DELS" del.idx (segment.h)
+#define IDX_MAGIC_DICT		0x54434944 // "DICT" dic.idx (dict.h)
+#define IDX_VERSION			5
+
+// 색인 파일(header.idx, posting.idx, position.idx, doclen.idx, del.idx, dic.idx) 맨 앞에 기록되는 파일 헤더
+typedef struct {
+	unsigned int	magic;		// 파일 종류
+	unsigned int	version;	// 파일 형식 버전
+	unsigned int	count;		// 레코드 수 (header.idx, dic.idx: 텀 수, posting.idx: 문서번호 수, position.idx: 위치 수, doclen.idx: 문서 수, del.idx: 삭제된 문서 수)
+	unsigned int	size;		// 파일 헤더 뒤 본문의 바이트 수
+	unsigned int	num_docs;	// 가장 큰 문서번호
+	unsigned int	checksum;	// 본문의 FNV-1a 체크섬
+	unsigned int	codec;		// 포스팅 리스트 압축 방식 (codec.h의 CODEC_*)
+	unsigned int	reserved;
+} tFILEHEADER;
+
+#define IDX_CHECKSUM_INIT	2166136261u
+
+////////////////////////////////////////////////////////////////////////////////
+/* accumulates FNV-1a checksum of data
+	return	updated checksum (start with IDX_CHECKSUM_INIT)
+*/
+unsigned int idxChecksum( unsigned int sum, const void *data, size_t size) {
+	const unsigned char *p = (const unsigned char *)data;
+
+	for (size_t i = 0; i < size; i++) {
+		sum ^= p[i];
+		sum *= 16777619u;
+	}
+	return sum;
+}
+
+/* maps index file into memory (read only) and checks its file header
+	index files are replaced by rename (idxCreate, idxCommit), so a mapping stays valid while the file is rebuilt
+	return	pointer to the body (right after the file header)
+			NULL failure (open error, wrong magic/version, truncated file)
+*/
+void *idxMap( char *filename, unsigned int magic) {
+	struct stat st;
+	tFILEHEADER *fh;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(tFILEHEADER)) {
+		fprintf( stderr, "Invalid index file:%s\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	fh = (tFILEHEADER *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (fh == MAP_FAILED) {
+		fprintf( stderr, "mmap error:%s\n", filename);
+		return NULL;
+	}
+
+	if (fh->magic != magic || fh->version != IDX_VERSION) {
+		fprintf( stderr, "Invalid index file (magic/version):%s\n", filename);
+		munmap(fh, st.st_size);
+		return NULL;
+	}
+
+	if ((off_t)(sizeof(tFILEHEADER) + fh->size) != st.st_size) {
+		fprintf( stderr, "Truncated index file:%s (%u bytes expected, %ld found)\n",
+				filename, fh->size, (long)(st.st_size - sizeof(tFILEHEADER)));
+		munmap(fh, st.st_size);
+		return NULL;
+	}
+
+	return fh + 1;
+}
+
+/* returns the file header of mapped index file
+*/
+tFILEHEADER *idxFileHeader( void *body) {
+	return (tFILEHEADER *)body - 1;
+}
+
+/* verifies checksum of mapped index file (reads whole file)
+	return	1 valid
+			0 checksum mismatch
+*/
+int idxVerify( void *body) {
+	tFILEHEADER *fh = idxFileHeader( body);
+
+	return idxChecksum( IDX_CHECKSUM_INIT, body, fh->size) == fh->checksum;
+}
+
+// 임시 파일 이름 (filename.tmp, free로 해제)
+static char *_idxTempName( const char *filename) {
+	char *tmp = (char *)malloc(strlen(filename) + 5);
+
+	if (tmp != NULL) {
+		strcpy(tmp, filename);
+		strcat(tmp, ".tmp");
+	}
+	return tmp;
+}
+
+/* opens temporary file (filename.tmp) to write index file filename
+	the file is moved over filename by idxCommit, so readers mapping the old file never see it truncated
+	return	file pointer
+			NULL failure
+*/
+FILE *idxCreate( const char *filename, const char *mode) {
+	char *tmp = _idxTempName( filename);
+	FILE *fp = (tmp != NULL) ? fopen(tmp, mode) : NULL;
+
+	if (fp == NULL)
+		fprintf( stderr, "File open error:%s\n", (tmp != NULL) ? tmp : filename);
+	free(tmp);
+	return fp;
+}
+
+/* closes temporary file opened by idxCreate, flushes it to disk and renames it over filename
+	fails if any earlier write to fp failed (ferror)
+	ok == 0 (error already found by caller) only closes and removes the temporary file
+	return	1 success
+			0 failure (temporary file is removed)
+*/
+int idxCommit( FILE *fp, const char *filename, int ok) {
+	char *tmp = _idxTempName( filename);
+
+	if (ok) {
+		ok = !ferror(fp) && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+		ok = (fclose(fp) == 0) && ok;
+		ok = ok && tmp != NULL && rename(tmp, filename) == 0;
+		if (!ok)
+			fprintf( stderr, "File write error:%s\n", filename);
+	}
+	else
+		fclose(fp);
+
+	if (!ok && tmp != NULL)
+		unlink(tmp);
+	free(tmp);
+	return ok;
+}
+
+/* unmaps index file mapped by idxMap
+*/
+void idxUnmap( void *body) {
+	tFILEHEADER *fh;
+
+	if (body == NULL)
+		return;
+
+	fh = idxFileHeader( body);
+	munmap(fh, sizeof(tFILEHEADER) + fh->size);
+}
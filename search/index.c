@@ -1,233 +1,2652 @@
 #define DEBUG 0
 
+#define MEMORY_BUDGET	64	// 기본 메모리 예산 (MB)
+#define MAX_MERGE		64	// 한 번에 병합하는 최대 런(run) 수
+#define MAX_THREADS		64	// 병렬 색인시 최대 스레드 수
+#define SEGMENT_BUDGET	16	// 세그먼트 색인시 메모리 세그먼트의 기본 크기 (MB, 넘으면 디스크 세그먼트로 기록)
+#define MERGE_FACTOR	4	// 크기 단계가 같은 이웃 세그먼트가 이만큼 모이면 하나로 병합
+#define MAX_GARBAGE		0.3	// 포스팅에 남은 삭제 문서 비율이 이보다 크면 세그먼트를 다시 쓴다.
+#define RADIX_BITS		11	// 토큰 기수 정렬의 자리 하나의 비트 수
+#define RADIX_SIZE		(1 << RADIX_BITS)
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/file.h>
+
+#include "idxfile.h"
+#include "codec.h"
+#include "bm25.h"
+#include "segment.h"
+#include "dict.h"
+#include "arena.h"
+#include "tokenizer.h"
+#include "shard.h"
+#include "trie.h"
+#include "wildcard.h"
 
 // 토큰-문서 구조체
 typedef struct {
-	char	*token;	// 토큰
+	char	*token;	// 토큰 (런 생성기에서는 텀마다 하나뿐인 문자열)
+	int		termid;	// 런 생성기 안의 텀 번호 (runAdd가 처음 본 순서대로 붙인다.)
 	int		docid;	// 문서번호(document ID)
+	int		pos;	// 문서 안에서 토큰의 위치 (1부터)
 } tTokenDoc;
 
 typedef struct {
-	int		index;	// starting position in posting.idx
+	int		index;	// starting position in posting.idx (압축시 바이트 단위)
 	int		df;		// 문서 빈도(document frequency)
+	float	max_weight;	// 포스팅 중 가장 큰 BM25 tf 성분 (bm25Weight, 순위 검색의 점수 상한)
+	int		pos_index;	// starting position in position.idx (바이트 단위)
 } tHEADER;
 
+// 포스팅 리스트 압축 방식 (codec.h의 CODEC_*, -z 옵션으로 선택)
+static int posting_codec = CODEC_RAW;
+
+// 문서별 토큰 수 (doc_lengths[문서번호], 병합 전에 setDocLengths로 정하며 writerInit이 작성기에 복사한다.)
+static int *doc_lengths = NULL;
+static int num_doc_lengths = 0;
+static double avg_doclen = 1;
+
+// 역색인 파일 작성기
+// 정렬된 토큰-문서-위치를 차례로 받아 dic/header/posting/position 파일에 바로 기록한다.
+typedef struct {
+	FILE	*fpD;
+	FILE	*fpH;
+	FILE	*fpP;
+	FILE	*fpPos;
+	char	*token;			// 현재 기록 중인 토큰
+	int		docid;			// 현재 토큰의 마지막 문서번호
+	int		num_postings;	// posting 파일에 기록된 문서번호 수
+	int		posting_pos;	// posting 파일의 현재 위치 (tHEADER.index 단위)
+	unsigned int	posting_bytes;	// posting 파일 본문의 바이트 수
+	int		*docs;			// 현재 토큰의 포스팅 리스트 (압축 전)
+	int		*tfs;			// docs와 같은 위치의 tf (위치 수)
+	int		docs_cap;
+	unsigned char	*enc;	// 압축 버퍼
+	int		enc_cap;
+	int		*positions;		// 현재 토큰의 위치들 (포스팅 순서)
+	int		num_positions;
+	int		positions_cap;
+	unsigned char	*penc;	// 위치 압축 버퍼
+	int		penc_cap;
+	unsigned int	total_positions;	// position 파일에 기록된 위치 수
+	unsigned int	position_bytes;		// position 파일 본문의 바이트 수
+	unsigned int	possum;	// position 파일 본문의 체크섬
+	int		num_terms;		// header 파일에 기록된 텀 수
+	int		max_docid;		// 가장 큰 문서번호
+	int		*doclen;		// 문서별 토큰 수 (max_weight 계산용, writerSetDocLengths)
+	int		num_doclen;
+	double	avgdl;			// 평균 문서 길이
+	unsigned int	hsum;	// header 파일 본문의 체크섬
+	unsigned int	psum;	// posting 파일 본문의 체크섬
+	int		fileheader;		// 파일 헤더(tFILEHEADER)를 기록하는지 여부
+	int		error;			// 입력(런 파일 등)을 읽지 못했는지 (writerClose가 실패를 반환한다.)
+	char	*files[4];		// 파일 이름 (사전, header, posting, position 순서, writerOpen)
+							// 임시 파일(idxCreate)에 쓰고 writerClose에서 rename한다. 사전으로는 정적 사전도 만든다.
+	tHEADER	header;			// 현재 토큰의 헤더 정보
+} tIndexWriter;
+
+// 정렬된 런(run)을 순차적으로 읽기 위한 구조체
+// 런 파일(fp) 또는 메모리의 정렬된 토큰 배열(tokens[pos..end-1])에서 읽는다.
+typedef struct {
+	FILE		*fp;
+	tTokenDoc	*tokens;
+	int			pos;
+	int			end;
+	int			docbase;	// 읽은 문서번호에 더할 값 (병렬 색인시 샤드의 시작 문서번호)
+	tTokenDoc	cur;		// 현재 읽은 토큰-문서 쌍
+	char		*buf;
+	int			bufsize;
+} tRunReader;
+
+// 메모리 예산 안에서 토큰을 모으고, 예산을 넘으면 정렬된 런으로 디스크에 내보낸다.
+typedef struct {
+	tTokenDoc	*tokens;
+	int			num_tokens;
+	int			capacity;
+	size_t		bytes;		// 현재 메모리에 있는 토큰이 사용하는 바이트 수 (추정치)
+	size_t		budget;		// 메모리 예산 (바이트)
+	FILE		**runs;		// 디스크에 기록된 런 파일들
+	int			num_runs;
+	int			*doclen;	// 문서별 토큰 수 (doclen[문서번호], 0번은 쓰지 않음)
+	int			doclen_cap;
+	tARENA		strings;	// 메모리에 있는 텀의 문자열 (런을 내보내면 arenaReset)
+	char		**terms;	// 텀 번호 -> 텀 문자열 (메모리에 있는 토큰의 서로 다른 텀들)
+	unsigned int	*term_hash;	// 텀 번호 -> 해시
+	int			num_terms;
+	int			terms_cap;
+	int			*table;		// 텀 해시 테이블 (열린 주소법, 텀 번호 + 1, 0은 빈 자리)
+	int			table_size;	// 2의 거듭제곱
+	int			error;		// 런을 내보내거나 메모리를 잡지 못했는지 (runAdd, 그 뒤로는 토큰을 모으지 않는다.)
+} tRunBuilder;
+
+// 텀 순위를 매기기 위한 텀 문자열과 텀 번호
+typedef struct {
+	char	*term;
+	int		termid;
+} tTermRef;
+
+// _sortTokens가 쓰는 임시 메모리 (런 생성기의 메모리 예산에 넣는다.)
+#define SORT_TOKEN_BYTES	sizeof(tTokenDoc)						// 토큰마다: 기수 정렬의 보조 배열
+#define SORT_TERM_BYTES		(sizeof(tTermRef) + sizeof(int))		// 텀마다: 텀 순위
+#define SORT_FIXED_BYTES	(sizeof(size_t) * RADIX_SIZE * ((64 + RADIX_BITS - 1) / RADIX_BITS))	// 자리별 도수
+
+// 병렬 색인: 입력 파일의 줄 단위 구간(샤드)을 맡아 토큰화/정렬하는 작업자
+typedef struct {
+	char		*filename;
+	long		start;		// 샤드의 시작 위치 (바이트)
+	long		end;		// 샤드의 끝 위치 (바이트)
+	int			num_docs;	// 샤드에 포함된 문서(줄) 수
+	int			docbase;	// 샤드 앞에 있는 문서 수
+	int			error;
+	tRunBuilder	rb;
+} tShard;
+
+// 병렬 색인: 토큰 범위 하나를 맡아 모든 샤드를 병합하는 작업자
+typedef struct {
+	tShard		*shards;
+	int			num_shards;
+	int			*lo;		// 샤드별 병합 구간 시작 (tokens 배열 인덱스)
+	int			*hi;		// 샤드별 병합 구간 끝
+	FILE		*fpD;
+	FILE		*fpH;
+	FILE		*fpP;
+	FILE		*fpPos;
+	int			num_postings;	// 문서번호 수
+	int			posting_pos;	// posting 데이터 크기 (tHEADER.index 단위)
+	unsigned int	num_positions;	// 위치 수
+	unsigned int	position_bytes;	// position 데이터 크기 (바이트)
+	int			max_docid;
+	int			error;
+} tPartition;
+
+// 세그먼트 색인 작성기 (index -a, -d, -M)
+// 메모리 세그먼트를 디스크 세그먼트로 기록하는 동안 백그라운드 스레드가 이웃한 세그먼트들을 병합한다.
+typedef struct {
+	tMANIFEST		manifest;
+	pthread_mutex_t	lock;		// manifest를 보호 (세그먼트 기록과 병합 스레드가 함께 바꾼다.)
+	pthread_t		tid;		// 병합 스레드
+	int				started;	// 병합 스레드를 만들고 아직 join하지 않았는지
+	int				merging;	// 병합 스레드가 일하고 있는지
+	int				first;		// 병합 중인 세그먼트 (manifest.segs의 first ~ first+count-1)
+	int				count;
+	tSEGINFO		*merge_segs;	// 병합 중인 세그먼트 정보 (병합을 시작할 때의 복사본)
+	int				merge_id;	// 병합 결과 세그먼트 번호
+	int				error;
+	int				lockfd;		// SEG_LOCK 파일 (flock)
+} tSegmentWriter;
+
+// 병합할 세그먼트를 텀 순서대로 읽기 위한 구조체
+typedef struct {
+	FILE			*fpD;
+	tHEADER			*header;
+	int				*posting;
+	unsigned char	*positions;
+	int				*doclen;
+	uint64_t		*deleted;	// 삭제 비트맵 (삭제된 문서가 없으면 빈 비트맵)
+	int				docbase;	// 병합한 세그먼트 안에서 이 세그먼트의 문서번호에 더할 값
+	int				Hidx;		// 현재 텀의 사전 번호
+	int				num_terms;
+	char			*term;		// 현재 텀 (getline 버퍼)
+	size_t			term_cap;
+	int				*docs;		// 복호화 버퍼
+	int				*tfs;
+	int				docs_cap;
+	int				*pos;
+	int				positions_cap;
+} tSegmentReader;
+
+// 샤드 색인 (index -n): 샤드 디렉토리마다 띄운 색인 프로세스의 설정 (shardSpawn의 ctx)
+typedef struct {
+	size_t		budget;		// 샤드 하나의 메모리 예산 (바이트)
+	int			num_threads;
+} tShardJob;
+
 ////////////////////////////////////////////////////////////////////////////////
 // 토큰 구조체로부터 역색인 파일을 생성한다.
-void invertedIndex( tTokenDoc *tokens, int num_tokens, 
-					char *dicfilename, char *headerfilename, char *postingfilename);
+// 실패시 0을 반환
+int invertedIndex( tTokenDoc *tokens, int num_tokens,
+					char *dicfilename, char *headerfilename, char *postingfilename, char *positionfilename);
+
+// 역색인 파일 작성기를 연다.
+// header/posting/position 파일 앞에는 파일 헤더(tFILEHEADER)가 기록된다.
+// 실패시 0을 반환
+int writerOpen( tIndexWriter *writer, char *dicfilename, char *headerfilename, char *postingfilename,
+				char *positionfilename);
+
+// 이미 열린 파일로 역색인 파일 작성기를 초기화한다. (파일 헤더는 기록하지 않음)
+void writerInit( tIndexWriter *writer, FILE *fpD, FILE *fpH, FILE *fpP, FILE *fpPos);
+
+// 헤더 정보 하나를 header 파일에 기록한다.
+void writerPutHeader( tIndexWriter *writer, tHEADER *header);
+
+// 이미 부호화된 포스팅 데이터를 posting 파일에 기록한다. (count는 문서번호 수)
+void writerPutPostings( tIndexWriter *writer, unsigned char *data, int size, int count);
+
+// 정렬 순서대로 토큰-문서-위치를 하나 추가한다. (같은 토큰-문서 쌍의 위치 수가 tf가 된다.)
+void writerAdd( tIndexWriter *writer, char *token, int docid, int pos);
+
+// 작성기가 max_weight 계산에 쓸 문서별 토큰 수를 정한다. (doclen[1..num_docs])
+void writerSetDocLengths( tIndexWriter *writer, int *doclen, int num_docs);
+
+// 마지막 토큰의 헤더를 기록한다. (파일은 닫지 않음)
+void writerFinish( tIndexWriter *writer);
+
+// 마지막 토큰의 헤더와 파일 헤더를 기록하고 파일을 닫는다.
+// 실패시 (쓰기 오류, 입력 오류) 0을 반환 (writerOpen으로 연 파일은 남기지 않는다.)
+int writerClose( tIndexWriter *writer);
+
+// 입력 파일을 읽어 토큰-문서 쌍을 런 생성기에 추가한다.
+// 읽은 문서 수를 num_docs에 저장한다.
+// 추가한 토큰 수를 반환 (실패시 -1)
+int get_tokens(char *filename, tRunBuilder *rb, int *num_docs);
 
-// 입력 파일로부터 토큰-문서 구조체를 생성한다.
-tTokenDoc *get_tokens(char *filename, int *num_tokens);
+// 현재 위치부터 end 위치(-1이면 파일 끝)까지 줄 단위로 읽어 토큰을 런 생성기에 추가한다.
+// 각 줄이 하나의 문서이며, 읽은 문서 수를 num_docs에 저장한다.
+// 문서별 토큰 수는 rb->doclen에 기록한다.
+// 추가한 토큰 수를 반환 (실패시 -1)
+int tokenizeRange( FILE *fp, long end, tRunBuilder *rb, int *num_docs);
 
-// qsort를 위한 비교함수 (첫번째 정렬 기준: 토큰 문자열, 두번째 정렬 기준: 문서 번호)
+// num_threads개의 스레드로 역색인 파일을 생성한다.
+// 결과는 단일 스레드로 생성한 파일과 같다.
+// 실패시 0을 반환
+int parallelIndex( char *filename, size_t budget, int num_threads, char *dicfilename, char *headerfilename,
+					char *postingfilename, char *positionfilename, char *doclenfilename);
+
+// 입력 파일을 현재 디렉토리의 역색인 파일들(dic.txt, header.idx, posting.idx, position.idx, doclen.idx)로 색인한다.
+// num_threads가 1보다 크면 parallelIndex로 색인한다.
+// 실패시 0을 반환
+int buildIndex( char *filename, size_t budget, int num_threads);
+
+// 입력 파일의 문서(줄)들을 num_shards개의 샤드로 나누어 샤드 디렉토리마다 색인하고 샤드 목록을 기록한다. (shard.h)
+// mode는 SHARD_RANGE(문서번호 구간) 또는 SHARD_HASH(문서번호의 나머지)
+// 샤드마다 프로세스를 띄워 동시에 색인하며 메모리 예산(budget, 바이트)은 샤드들이 나누어 쓴다.
+// 실패시 0을 반환
+int shardIndex( char *filename, int num_shards, int mode, size_t budget, int num_threads);
+
+// 병합에 쓸 문서별 토큰 수를 정하고 평균 문서 길이를 계산한다. (doclen[1..num_docs])
+void setDocLengths( int *doclen, int num_docs);
+
+// 문서별 토큰 수를 doclen 파일에 기록한다.
+// 실패시 0을 반환
+int writeDocLengths( char *filename);
+
+// 현재 디렉토리의 세그먼트 색인을 연다. (세그먼트 목록이 없으면 빈 목록)
+// 다른 작성기가 열고 있거나 목록을 읽을 수 없으면 0을 반환
+int segmentOpen( tSegmentWriter *sw);
+
+// 입력 파일의 문서(줄)들을 새 세그먼트로 색인하여 덧붙인다. 문서번호는 기존 문서 다음부터 매긴다.
+// 토큰이 메모리 예산(budget, 바이트)을 넘을 때마다 메모리 세그먼트를 디스크 세그먼트로 기록하고
+// 병합 정책에 맞는 세그먼트들을 백그라운드에서 병합한다. 끝나면 남은 병합을 모두 마친다.
+// 실패시 0을 반환
+int segmentAppend( tSegmentWriter *sw, char *filename, size_t budget);
+
+// 문서들(전체 문서번호)을 삭제 비트맵에 표시한다. 삭제 문서가 많은 세그먼트는 다시 쓴다.
+// 실패시 (없는 문서번호가 있으면 나머지를 지운 뒤) 0을 반환
+int segmentDelete( tSegmentWriter *sw, int *docids, int num_docids);
+
+// 모든 세그먼트를 하나로 병합한다. (삭제된 문서를 포스팅에서 모두 지운다.)
+// 실패시 0을 반환
+int segmentForceMerge( tSegmentWriter *sw);
+
+// 진행 중인 병합을 기다린 뒤 세그먼트 색인을 닫는다.
+void segmentClose( tSegmentWriter *sw);
+
+// 런 생성기를 초기화한다. budget은 바이트 단위
+void runInit( tRunBuilder *rb, size_t budget);
+
+// 토큰-문서-위치를 추가한다. 메모리 예산을 넘으면 정렬된 런을 디스크에 기록한다.
+// 토큰은 (문서번호, 위치) 순으로 추가해야 한다.
+// 런을 기록하지 못하거나 메모리가 모자라면 rb->error를 세운다.
+void runAdd( tRunBuilder *rb, char *token, int docid, int pos);
+
+// 메모리에 있는 토큰을 정렬하여 임시 파일(런)로 기록한다.
+// 실패시 0을 반환
+int runSpill( tRunBuilder *rb);
+
+// 런 파일들을 k-way 병합한다.
+// docbase[i]는 i번째 런의 문서번호에 더할 값 (NULL이면 모두 0)
+// writer가 NULL이 아니면 역색인 파일로 (런을 읽지 못하면 writer->error), NULL이면 새 런 파일로 기록하고 그 파일을 반환
+// 새 런 파일을 기록하지 못하면 NULL을 반환
+FILE *mergeRuns( FILE **runs, int *docbase, int num_runs, tIndexWriter *writer);
+
+// 런들을 k-way 병합하여 writer 또는 out 파일에 기록한다.
+// 런 파일을 읽지 못하면 (잘린 런 포함) 0을 반환
+int mergeReaders( tRunReader *readers, int num_readers, tIndexWriter *writer, FILE *out);
+
+// 런 파일 수가 MAX_MERGE 이하가 될 때까지 여러 단계로 병합한 뒤 역색인 파일을 생성한다.
+// 런 파일은 모두 닫힌다.
+// 실패시 0을 반환
+int mergeAllRuns( FILE **runs, int *docbase, int num_runs,
+					char *dicfilename, char *headerfilename, char *postingfilename, char *positionfilename);
+
+// 런 생성기의 메모리와 런 파일을 정리한다.
+void runDestroy( tRunBuilder *rb);
+
+// qsort를 위한 비교함수 (첫번째 정렬 기준: 토큰 문자열, 두번째 정렬 기준: 문서 번호, 세번째 정렬 기준: 위치)
 static int _compare(const void *n1, const void *n2);
 
-static void print_tokens( tTokenDoc *tokens, int num_tokens);
+// 런 생성기의 토큰을 _compare 순서로 정렬한다. (텀 순위와 문서번호로 기수 정렬)
+static void _sortTokens( tRunBuilder *rb);
 
-void destroy_tokens( tTokenDoc *tokens, int num_tokens);
+// 런 생성기의 토큰과 텀을 비운다.
+static void _clearTokens( tRunBuilder *rb);
 
-char *s_gets(char *st, int n, FILE *fp);
 ////////////////////////////////////////////////////////////////////////////////
 int main( int argc, char **argv)
 {
-	tTokenDoc *tokens;
-	int num_tokens = 0;
+	long budget = -1;
+	int num_threads = 1;
+	int num_shards = 0;
+	int shard_mode = SHARD_RANGE;
+	char *filename = NULL;
+	int append = 0;
+	int force_merge = 0;
+	int *docids = NULL;
+	int num_docids = 0;
+	int usage = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp( argv[i], "-m") == 0 && i + 1 < argc)
+			budget = atol( argv[++i]);
+		else if (strcmp( argv[i], "-j") == 0 && i + 1 < argc)
+			num_threads = atoi( argv[++i]);
+		else if (strcmp( argv[i], "-z") == 0 && i + 1 < argc)
+		{
+			posting_codec = codecByName( argv[++i]);
+			if (posting_codec < 0)
+				usage = 1;
+		}
+		// -n SHARDS: 문서를 샤드들로 나누어 샤드마다 색인
+		else if (strcmp( argv[i], "-n") == 0 && i + 1 < argc)
+		{
+			num_shards = atoi( argv[++i]);
+			if (num_shards < 1 || num_shards > SHARD_MAX)
+				usage = 1;
+		}
+		// -H: 문서번호 구간 대신 문서번호의 나머지로 샤드를 나눈다.
+		else if (strcmp( argv[i], "-H") == 0)
+			shard_mode = SHARD_HASH;
+		// -a: 세그먼트 색인에 문서 추가
+		else if (strcmp( argv[i], "-a") == 0)
+			append = 1;
+		// -M: 모든 세그먼트를 하나로 병합
+		else if (strcmp( argv[i], "-M") == 0)
+			force_merge = 1;
+		// -d DOCID...: 세그먼트 색인에서 문서 삭제 (나머지 인자는 모두 문서번호)
+		else if (strcmp( argv[i], "-d") == 0)
+		{
+			if (i + 1 == argc)
+				usage = 1;
+			docids = (int *)malloc(sizeof(int) * argc);
+			while (++i < argc)
+			{
+				docids[num_docids] = atoi( argv[i]);
+				if (docids[num_docids++] <= 0)
+					usage = 1;
+			}
+		}
+		else if (filename == NULL)
+			filename = argv[i];
+		else
+			usage = 1;
+	}
+
+	if (budget == -1)
+		budget = append ? SEGMENT_BUDGET : MEMORY_BUDGET;
+
+	if (append + force_merge + (num_docids > 0) + (num_shards > 0) > 1 || (filename == NULL) != (force_merge || num_docids > 0))
+		usage = 1;
+	if (shard_mode == SHARD_HASH && num_shards == 0)
+		usage = 1;
 
-	if (argc != 2)
+	if (usage || budget <= 0 || num_threads < 1 || num_threads > MAX_THREADS)
 	{
-		printf( "Usage: %s FILE\n", argv[0]);
+		printf( "Usage: %s [-m MB] [-j THREADS] [-z raw|vbyte|svb] FILE\n", argv[0]);
+		printf( "       %s -n SHARDS [-H] [-m MB] [-j THREADS] [-z raw|vbyte|svb] FILE\t(split documents into shards by doc id range, or by hash with -H)\n", argv[0]);
+		printf( "       %s -a [-m MB] [-z raw|vbyte|svb] FILE\t(add documents as new segments)\n", argv[0]);
+		printf( "       %s -d DOCID...\t(delete documents from segments)\n", argv[0]);
+		printf( "       %s -M [-z raw|vbyte|svb]\t(merge all segments)\n", argv[0]);
+		free(docids);
 		return 2;
 	}
-	
-	tokens = get_tokens( argv[1], &num_tokens);
-	
-	//assert( tokens != NULL && num_tokens > 0);
 
-#if DEBUG	
-	print_tokens( tokens, num_tokens);
-#endif
-	
-	// 정렬 (첫번째 정렬 기준: 토큰 문자열, 두번째 정렬 기준: 문서 번호)
-	qsort( tokens, num_tokens, sizeof( tTokenDoc), _compare);
-	
-	invertedIndex( tokens, num_tokens, "dic.txt", "header.idx", "posting.idx");
-
-#if DEBUG	
-	print_tokens( tokens, num_tokens);
-#endif	
-	
-	destroy_tokens( tokens, num_tokens);
-	
+	if (append || force_merge || num_docids > 0)
+	{
+		tSegmentWriter sw;
+		int ret;
+
+		if (!segmentOpen( &sw))
+		{
+			free(docids);
+			return 1;
+		}
+
+		if (append)
+			ret = segmentAppend( &sw, filename, (size_t)budget * 1024 * 1024);
+		else if (force_merge)
+			ret = segmentForceMerge( &sw);
+		else
+			ret = segmentDelete( &sw, docids, num_docids);
+
+		segmentClose( &sw);
+		free(docids);
+
+		return ret ? 0 : 1;
+	}
+
+	if (num_shards > 0)
+		return shardIndex( filename, num_shards, shard_mode, (size_t)budget * 1024 * 1024, num_threads) ? 0 : 1;
+
+	return buildIndex( filename, (size_t)budget * 1024 * 1024, num_threads) ? 0 : 1;
+}
+
+int buildIndex( char *filename, size_t budget, int num_threads) {
+	tRunBuilder rb;
+	int num_docs;
+
+	if (num_threads > 1)
+		return parallelIndex( filename, budget, num_threads,
+							"dic.txt", "header.idx", "posting.idx", "position.idx", "doclen.idx");
+
+	runInit( &rb, budget);
+
+	if (get_tokens( filename, &rb, &num_docs) < 0) {
+		runDestroy( &rb);
+		return 0;
+	}
+
+	setDocLengths( rb.doclen, num_docs);
+
+	if (rb.num_runs == 0) {
+		// 메모리 예산 안에 모두 들어오는 경우
+		// 정렬 (첫번째 정렬 기준: 토큰 문자열, 두번째 정렬 기준: 문서 번호)
+		_sortTokens( &rb);
+
+		if (!invertedIndex( rb.tokens, rb.num_tokens, "dic.txt", "header.idx", "posting.idx", "position.idx")) {
+			runDestroy( &rb);
+			return 0;
+		}
+	}
+	else {
+		// 남은 토큰도 런으로 내보낸 뒤 병합
+		if (!runSpill( &rb)) {
+			runDestroy( &rb);
+			return 0;
+		}
+
+		int ret = mergeAllRuns( rb.runs, NULL, rb.num_runs, "dic.txt", "header.idx", "posting.idx", "position.idx");
+
+		rb.num_runs = 0; // mergeAllRuns가 런 파일을 닫음
+		if (!ret) {
+			runDestroy( &rb);
+			return 0;
+		}
+	}
+
+	if (!writeDocLengths( "doclen.idx")) {
+		runDestroy( &rb);
+		return 0;
+	}
+
+	runDestroy( &rb);
+
+	return 1;
+}
+
+// 샤드 디렉토리에서 나누어 둔 문서들을 색인한다. (shardSpawn이 띄운 프로세스, 종료 코드를 반환)
+static int _buildShard( void *ctx, int *fds, int num_fds, int shard) {
+	tShardJob *job = (tShardJob *)ctx;
+
+	for (int i = 0; i < num_fds; i++)
+		close(fds[i]);
+	// 예전에 세그먼트 색인으로 쓰던 디렉토리이면 검색기가 새 색인 파일을 읽도록 세그먼트 목록을 지운다.
+	unlink(SEG_MANIFEST);
+
+	if (!buildIndex( "docs.tmp", job->budget, job->num_threads)) {
+		fprintf( stderr, "Shard %d: indexing failed\n", shard);
+		return 1;
+	}
 	return 0;
 }
 
-void invertedIndex( tTokenDoc *tokens, int num_tokens, 
-					char *dicfilename, char *headerfilename, char *postingfilename) {
-	
-	int nt = 1;
-	int idx = -1;
-	int Pidx = -1;
-	int *posting;
-	tHEADER *header;
-	FILE *fpD;
-	FILE *fpH;
-	FILE *fpP;
-	FILE *test;			//test
-
-	fpD = fopen(dicfilename, "wt");
-	fpH = fopen(headerfilename, "wb");
-	fpP = fopen(postingfilename, "wb");
-	test = fopen("test.txt", "wt");			//test
-
-	header = (tHEADER *)malloc(sizeof(tHEADER) * num_tokens);
-	posting = (int *)malloc(sizeof(int) * num_tokens);
-
-	if (fpD == NULL) {
-		fprintf( stderr, "File open error:%s\n", dicfilename);
-		return;
+int shardIndex( char *filename, int num_shards, int mode, size_t budget, int num_threads) {
+	tShardJob job;
+	tSHARDMAP map;
+	FILE **out;
+	FILE *fp;
+	int *fds;
+	pid_t *pids;
+	char path[SHARD_PATH];
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	int num_docs = 0;
+	int ret = 1;
+
+	fp = fopen(filename, "rt");
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return 0;
 	}
-	if (fpH == NULL) {
-		fprintf( stderr, "File open error:%s\n", headerfilename);
-		return;
+
+	// 문서(줄) 수를 세어 샤드마다 맡을 문서를 정한다.
+	while (getline(&line, &cap, fp) > 0)
+		num_docs++;
+	rewind(fp);
+
+	out = (FILE **)calloc(num_shards, sizeof(FILE *));
+	fds = (int *)malloc(sizeof(int) * num_shards);
+	pids = (pid_t *)malloc(sizeof(pid_t) * num_shards);
+	if (out == NULL || fds == NULL || pids == NULL || !shardMapInit( &map, num_shards, mode, num_docs)) {
+		fprintf( stderr, "Out of memory\n");
+		fclose(fp);
+		free(line);
+		free(out);
+		free(fds);
+		free(pids);
+		return 0;
 	}
-	if (fpP == NULL) {
-		fprintf( stderr, "File open error:%s\n", postingfilename);
-		return;
+
+	for (int s = 0; s < num_shards && ret; s++) {
+		snprintf(path, SHARD_PATH, SHARD_DIR, s);
+		if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+			fprintf( stderr, "Directory create error:%s\n", path);
+			ret = 0;
+		}
+		else if ((out[s] = fopen(shardPath( path, s, "docs.tmp"), "wt")) == NULL) {
+			fprintf( stderr, "File open error:%s\n", path);
+			ret = 0;
+		}
 	}
 
-	header[++idx].index = 0;
-	header[idx].df = 1;
-	posting[++Pidx] = tokens[0].docid;
+	// 문서를 맡은 샤드의 입력 파일에 옮겨 쓴다. (샤드 안의 문서번호는 옮겨 쓴 순서)
+	for (int d = 1; ret && (len = getline(&line, &cap, fp)) > 0; d++) {
+		FILE *o = out[shardOf( &map, d)];
+
+		fwrite(line, 1, len, o);
+		if (line[len - 1] != '\n')
+			fputc('\n', o);
+	}
+	fclose(fp);
+	free(line);
 
-	fputs(tokens[idx].token, fpD);
-	fprintf(fpD, "\n");
+	for (int s = 0; s < num_shards; s++) {
+		if (out[s] != NULL) {
+			int error = ferror(out[s]);
 
-	for (int index = 0; index < num_tokens - 1; index++) {
-		if (strcmp(tokens[index].token, tokens[index + 1].token) != 0) {
-			posting[++Pidx] = tokens[index + 1].docid;
-			header[++idx].index = Pidx;
-			header[idx].df = 1;
-			
-			fputs(tokens[index + 1].token, fpD);
-			fprintf(fpD, "\n");
+			if (fclose(out[s]) != 0 || error) {
+				fprintf( stderr, "File write error:%s\n", shardPath( path, s, "docs.tmp"));
+				ret = 0;
+			}
 		}
-		else if (tokens[index].docid != tokens[index + 1].docid) {
-			posting[++Pidx] = tokens[index + 1].docid;
-			header[idx].df++;
+	}
+	free(out);
+
+	// 샤드마다 프로세스를 띄워 동시에 색인한다.
+	job.budget = (budget / num_shards > 1024 * 1024) ? budget / num_shards : 1024 * 1024;
+	job.num_threads = num_threads;
+	if (ret && shardSpawn( &map, 1, _buildShard, &job, fds, pids))
+		ret = shardStop( fds, pids, num_shards, 1);
+	else
+		ret = 0;
+
+	for (int s = 0; s < num_shards; s++)
+		unlink(shardPath( path, s, "docs.tmp"));
+
+	if (ret)
+		ret = shardMapWrite( &map, SHARD_MANIFEST);
+	else
+		fprintf( stderr, "Shard indexing failed\n");
+
+	shardMapFree( &map);
+	free(fds);
+	free(pids);
+
+	return ret;
+}
+
+int invertedIndex( tTokenDoc *tokens, int num_tokens,
+					char *dicfilename, char *headerfilename, char *postingfilename, char *positionfilename) {
+	tIndexWriter writer;
+
+	if (!writerOpen( &writer, dicfilename, headerfilename, postingfilename, positionfilename))
+		return 0;
+
+	for (int index = 0; index < num_tokens; index++)
+		writerAdd( &writer, tokens[index].token, tokens[index].docid, tokens[index].pos);
+
+	return writerClose( &writer);
+}
+
+int writerOpen( tIndexWriter *writer, char *dicfilename, char *headerfilename, char *postingfilename,
+				char *positionfilename) {
+	char *names[4] = { dicfilename, headerfilename, postingfilename, positionfilename };
+	int ok;
+
+	// 검색기가 매핑하고 있을 수 있는 파일을 그 자리에서 덮어쓰지 않도록 임시 파일에 쓴다.
+	writerInit( writer, idxCreate( dicfilename, "wt"), idxCreate( headerfilename, "wb"), idxCreate( postingfilename, "wb"),
+				idxCreate( positionfilename, "wb"));
+	writer->fileheader = 1;
+
+	ok = (writer->fpD != NULL && writer->fpH != NULL && writer->fpP != NULL && writer->fpPos != NULL);
+	for (int i = 0; i < 4; i++) {
+		writer->files[i] = strdup(names[i]);
+		ok = ok && writer->files[i] != NULL;
+	}
+
+	if (ok) {
+		// 파일 헤더 자리를 비워 두고 writerClose에서 채운다.
+		tFILEHEADER fh = {0};
+
+		fwrite( &fh, sizeof(tFILEHEADER), 1, writer->fpH);
+		fwrite( &fh, sizeof(tFILEHEADER), 1, writer->fpP);
+		fwrite( &fh, sizeof(tFILEHEADER), 1, writer->fpPos);
+		return 1;
+	}
+
+	if (writer->fpD) idxCommit( writer->fpD, dicfilename, 0);
+	if (writer->fpH) idxCommit( writer->fpH, headerfilename, 0);
+	if (writer->fpP) idxCommit( writer->fpP, postingfilename, 0);
+	if (writer->fpPos) idxCommit( writer->fpPos, positionfilename, 0);
+	for (int i = 0; i < 4; i++) {
+		free(writer->files[i]);
+		writer->files[i] = NULL;
+	}
+	return 0;
+}
+
+void writerInit( tIndexWriter *writer, FILE *fpD, FILE *fpH, FILE *fpP, FILE *fpPos) {
+	writer->fpD = fpD;
+	writer->fpH = fpH;
+	writer->fpP = fpP;
+	writer->fpPos = fpPos;
+	writer->token = NULL;
+	writer->docid = 0;
+	writer->num_postings = 0;
+	writer->posting_pos = 0;
+	writer->posting_bytes = 0;
+	writer->docs = NULL;
+	writer->tfs = NULL;
+	writer->docs_cap = 0;
+	writer->enc = NULL;
+	writer->enc_cap = 0;
+	writer->positions = NULL;
+	writer->num_positions = 0;
+	writer->positions_cap = 0;
+	writer->penc = NULL;
+	writer->penc_cap = 0;
+	writer->total_positions = 0;
+	writer->position_bytes = 0;
+	writer->possum = IDX_CHECKSUM_INIT;
+	writer->num_terms = 0;
+	writer->max_docid = 0;
+	writer->doclen = doc_lengths;
+	writer->num_doclen = num_doc_lengths;
+	writer->avgdl = avg_doclen;
+	writer->hsum = IDX_CHECKSUM_INIT;
+	writer->psum = IDX_CHECKSUM_INIT;
+	writer->fileheader = 0;
+	writer->error = 0;
+	for (int i = 0; i < 4; i++)
+		writer->files[i] = NULL;
+}
+
+void writerPutHeader( tIndexWriter *writer, tHEADER *header) {
+	fwrite( header, sizeof(tHEADER), 1, writer->fpH);
+	writer->hsum = idxChecksum( writer->hsum, header, sizeof(tHEADER));
+	writer->num_terms++;
+}
+
+void writerPutPostings( tIndexWriter *writer, unsigned char *data, int size, int count) {
+	fwrite( data, 1, size, writer->fpP);
+	writer->psum = idxChecksum( writer->psum, data, size);
+	writer->num_postings += count;
+	writer->posting_bytes += size;
+	writer->posting_pos += (posting_codec == CODEC_RAW) ? (int)(size / sizeof(int)) : size;
+}
+
+// 평균 문서 길이 (doclen[1..num_docs], 검색기의 load_doclen과 같은 방식으로 계산)
+static double _averageLength( int *doclen, int num_docs) {
+	long total = 0;
+
+	for (int i = 1; i <= num_docs; i++)
+		total += doclen[i];
+	return (num_docs > 0 && total > 0) ? (double)total / num_docs : 1;
+}
+
+void writerSetDocLengths( tIndexWriter *writer, int *doclen, int num_docs) {
+	writer->doclen = doclen;
+	writer->num_doclen = num_docs;
+	writer->avgdl = _averageLength( doclen, num_docs);
+}
+
+// 문서의 토큰 수 (모르는 문서는 평균 길이)
+static double _docLength( tIndexWriter *writer, int docid) {
+	if (writer->doclen == NULL || docid > writer->num_doclen)
+		return writer->avgdl;
+	return writer->doclen[docid];
+}
+
+// 포스팅 중 가장 큰 BM25 tf 성분
+// 검색기가 점수 상한으로 쓰므로 float로 줄일 때 올림한다.
+static float _maxWeight( tIndexWriter *writer, int *docs, int *tfs, int df) {
+	double max = 0;
+	float w;
+
+	for (int i = 0; i < df; i++) {
+		double x = bm25Weight( tfs[i], _docLength( writer, docs[i]), writer->avgdl);
+
+		if (x > max)
+			max = x;
+	}
+
+	w = (float)max;
+	if (w < max)
+		w = nextafterf( w, max + 1);
+	return w;
+}
+
+// 현재 토큰의 포스팅 리스트를 압축하여 기록하고 헤더를 기록한다.
+static void _flushTerm( tIndexWriter *writer) {
+	int df = writer->header.df;
+	int size;
+
+	if (codecMaxBytes( df) > writer->enc_cap) {
+		writer->enc_cap = codecMaxBytes( df);
+		writer->enc = (unsigned char *)realloc(writer->enc, writer->enc_cap);
+	}
+
+	writer->header.max_weight = _maxWeight( writer, writer->docs, writer->tfs, df);
+	size = postingEncode( posting_codec, writer->docs, writer->tfs, df, writer->enc);
+	writerPutPostings( writer, writer->enc, size, df);
+
+	if (positionsMaxBytes( df, writer->num_positions) > writer->penc_cap) {
+		writer->penc_cap = positionsMaxBytes( df, writer->num_positions);
+		writer->penc = (unsigned char *)realloc(writer->penc, writer->penc_cap);
+	}
+
+	size = positionsEncode( writer->tfs, writer->positions, df, writer->penc);
+	fwrite( writer->penc, 1, size, writer->fpPos);
+	writer->possum = idxChecksum( writer->possum, writer->penc, size);
+	writer->position_bytes += size;
+	writer->total_positions += writer->num_positions;
+
+	writerPutHeader( writer, &writer->header);
+
+	if (df > 0 && writer->docs[df - 1] > writer->max_docid)
+		writer->max_docid = writer->docs[df - 1];
+}
+
+void writerAdd( tIndexWriter *writer, char *token, int docid, int pos) {
+	if (writer->token == NULL || strcmp(writer->token, token) != 0) {
+		// 새로운 토큰: 이전 토큰의 포스팅 리스트와 헤더를 기록
+		if (writer->token != NULL) {
+			_flushTerm( writer);
+			free(writer->token);
 		}
+		writer->token = strdup(token);
+		writer->header.index = writer->posting_pos;
+		writer->header.pos_index = writer->position_bytes;
+		writer->header.df = 0;
+		writer->num_positions = 0;
+
+		fputs(token, writer->fpD);
+		fprintf(writer->fpD, "\n");
+	}
+
+	if (writer->num_positions == writer->positions_cap) {
+		writer->positions_cap = (writer->positions_cap == 0) ? 1024 : writer->positions_cap * 2;
+		writer->positions = (int *)realloc(writer->positions, sizeof(int) * writer->positions_cap);
 	}
+	writer->positions[writer->num_positions++] = pos;
 
-	for (int i = 0; i <= idx; i++) {
-		fprintf(test, "%d\t%d\n", header[i].index, header[i].df);
+	if (writer->header.df > 0 && writer->docid == docid) {
+		// 같은 문서의 다음 위치
+		writer->tfs[writer->header.df - 1]++;
+		return;
 	}
 
-	fwrite( header, sizeof(tHEADER), idx + 1, fpH);
-	fwrite( posting, sizeof(int), Pidx + 1, fpP);
+	if (writer->header.df == writer->docs_cap) {
+		writer->docs_cap = (writer->docs_cap == 0) ? 1024 : writer->docs_cap * 2;
+		writer->docs = (int *)realloc(writer->docs, sizeof(int) * writer->docs_cap);
+		writer->tfs = (int *)realloc(writer->tfs, sizeof(int) * writer->docs_cap);
+	}
+	writer->tfs[writer->header.df] = 1;
+	writer->docs[writer->header.df++] = docid;
+	writer->docid = docid;
 
-	fclose(test);				//test
-	fclose(fpD);
-	fclose(fpH);
-	fclose(fpP);
-	free(header);
-	free(posting);
+#if DEBUG
+	printf( "%d\t%d\n", writer->header.index, writer->header.df);
+#endif
 }
 
-tTokenDoc *get_tokens(char *filename, int *num_tokens) {
-	FILE *fp;
-	tTokenDoc *Dic;
-	char *str;
-	char *ptr;
-	int docNum = 0;
-	int nt = 1;
+void writerFinish( tIndexWriter *writer) {
+	if (writer->token != NULL) {
+		_flushTerm( writer);
+		free(writer->token);
+		writer->token = NULL;
+	}
+	free(writer->docs);
+	free(writer->tfs);
+	free(writer->enc);
+	free(writer->positions);
+	free(writer->penc);
+	writer->docs = NULL;
+	writer->tfs = NULL;
+	writer->enc = NULL;
+	writer->positions = NULL;
+	writer->penc = NULL;
+	writer->docs_cap = writer->enc_cap = 0;
+	writer->positions_cap = writer->penc_cap = 0;
+}
 
+// 파일 맨 앞으로 돌아가 파일 헤더를 기록한다.
+static void _writeFileHeader( FILE *fp, unsigned int magic, unsigned int count,
+							unsigned int size, unsigned int num_docs, unsigned int checksum) {
+	tFILEHEADER fh = {0};
 
-	Dic = (tTokenDoc *)malloc(sizeof(tTokenDoc) * 1000);
-	str = (char *)malloc(sizeof(char) * 5000);
+	fh.magic = magic;
+	fh.version = IDX_VERSION;
+	fh.count = count;
+	fh.size = size;
+	fh.num_docs = num_docs;
+	fh.checksum = checksum;
+	fh.codec = posting_codec;
 
-	fp = fopen(filename, "rt");
+	fseek(fp, 0, SEEK_SET);
+	fwrite( &fh, sizeof(tFILEHEADER), 1, fp);
+}
 
-	while (s_gets(str, 5000, fp)) {
-		docNum++;
-		ptr = strtok(str, " \n");
+int writerClose( tIndexWriter *writer) {
+	int ok;
+
+	writerFinish( writer);
+
+	// 파일 헤더의 num_docs(검색기의 NOT 연산 범위)는 끝에 있는 빈 문서까지 포함하여 색인한 문서 수로 한다.
+	// (세그먼트나 샤드로 나눈 색인도 문서마다 한 곳에서 NOT 연산 범위에 들어간다.)
+	if (writer->max_docid < writer->num_doclen)
+		writer->max_docid = writer->num_doclen;
+
+	if (writer->fileheader) {
+		// 압축된 포스팅 파일 끝에는 SIMD 복호화를 위한 여유 바이트를 붙인다.
+		if (posting_codec != CODEC_RAW) {
+			unsigned char pad[CODEC_PADDING] = {0};
+
+			fwrite( pad, 1, CODEC_PADDING, writer->fpP);
+			writer->psum = idxChecksum( writer->psum, pad, CODEC_PADDING);
+			writer->posting_bytes += CODEC_PADDING;
+		}
+
+		_writeFileHeader( writer->fpH, IDX_MAGIC_HEADER, writer->num_terms,
+						sizeof(tHEADER) * writer->num_terms, writer->max_docid, writer->hsum);
+		_writeFileHeader( writer->fpP, IDX_MAGIC_POSTING, writer->num_postings,
+						writer->posting_bytes, writer->max_docid, writer->psum);
+		_writeFileHeader( writer->fpPos, IDX_MAGIC_POSITION, writer->total_positions,
+						writer->position_bytes, writer->max_docid, writer->possum);
+	}
+
+	ok = !writer->error;
+	if (writer->error)
+		fprintf( stderr, "Index input read error\n");
+
+	// 임시 파일들을 rename한다. (writerOpen)
+	// 옛 색인 파일과 섞이지 않도록 모든 파일의 쓰기 오류(ferror, fflush)를 먼저 확인하고, 하나라도 실패하면 모두 지운다.
+	if (writer->files[0] != NULL) {
+		FILE *fps[4] = { writer->fpD, writer->fpH, writer->fpP, writer->fpPos };
+
+		for (int i = 0; i < 4 && ok; i++) {
+			if (ferror(fps[i]) || fflush(fps[i]) != 0) {
+				fprintf( stderr, "File write error:%s\n", writer->files[i]);
+				ok = 0;
+			}
+		}
+		for (int i = 0; i < 4; i++)
+			ok = idxCommit( fps[i], writer->files[i], ok);
+	}
+	else {
+		FILE *fps[4] = { writer->fpD, writer->fpH, writer->fpP, writer->fpPos };
+
+		for (int i = 0; i < 4; i++) {
+			int error = ferror(fps[i]);
+
+			ok = (fclose(fps[i]) == 0) && !error && ok;
+		}
+		if (!ok)
+			fprintf( stderr, "File write error\n");
+	}
+
+	// 검색기가 매핑만 하면 되는 정적 사전(dic.txt -> dic.idx)과 permuterm 트라이(dic.pmt)를 만든다.
+	if (ok && writer->files[0] != NULL) {
+		char *dictfile = (char *)malloc(strlen(writer->files[0]) + 5);
+		char *pmtfile = (char *)malloc(strlen(writer->files[0]) + 5);
+		char *ext;
+		tDICT dict;
 
-		do {
-			*num_tokens += 1;
+		if (dictfile != NULL && pmtfile != NULL) {
+			strcpy(dictfile, writer->files[0]);
+			ext = strrchr(dictfile, '.');
+			if (ext == NULL || strchr(ext, '/') != NULL)
+				ext = dictfile + strlen(dictfile);
+			strcpy(ext, ".idx");
 
-			if ((*num_tokens) % 1000 == 0) {
-				nt++;
-				Dic = (tTokenDoc *)realloc(Dic, sizeof(tTokenDoc) * nt * 1000);
+			strcpy(pmtfile, dictfile);
+			strcpy(pmtfile + (ext - dictfile), ".pmt");
+
+			ok = dictBuild( writer->files[0], dictfile, writer->max_docid) && dictMap( &dict, dictfile);
+			if (ok) {
+				ok = wildcardWrite( &dict, pmtfile);
+				dictUnmap( &dict);
 			}
+		}
+		else {
+			fprintf( stderr, "Out of memory\n");
+			ok = 0;
+		}
+		free(dictfile);
+		free(pmtfile);
+	}
+	for (int i = 0; i < 4; i++) {
+		free(writer->files[i]);
+		writer->files[i] = NULL;
+	}
+
+	return ok;
+}
 
-			Dic[*num_tokens - 1].token = strdup(ptr);
-			Dic[*num_tokens - 1].docid = docNum;
+int get_tokens(char *filename, tRunBuilder *rb, int *num_docs) {
+	FILE *fp;
+	int num_tokens;
 
-		} while (ptr = strtok(NULL, " \n"));
-		
-		free(str);
-		str = NULL;
-		str = (char *)malloc(sizeof(char) * 5000);
+	fp = fopen(filename, "rt");
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return -1;
 	}
 
-	free(str);
+	num_tokens = tokenizeRange( fp, -1, rb, num_docs);
+
 	fclose(fp);
 
-	return Dic;
+	return num_tokens;
 }
 
-static int _compare(const void *n1, const void *n2) {
-	const tTokenDoc *ptr1 = (const tTokenDoc *)n1;
-	const tTokenDoc *ptr2 = (const tTokenDoc *)n2;
+// 문서(한 줄) 하나의 토큰을 런 생성기에 추가하고 문서 길이를 rb->doclen[docNum]에 기록한다.
+// 추가한 토큰 수를 반환 (입력이 끝나 문서가 없거나 rb->error이면 -1)
+static int _tokenizeDoc( tRunBuilder *rb, tTOKENIZER *tk, int docNum) {
+	int length = 0;
+	int type;
 
-	if (strcmp(ptr1->token, ptr2->token) < 0)
+	while ((type = tokenizerNext( tk)) == TOKEN_WORD && !rb->error)
+		runAdd( rb, tk->token, docNum, ++length);
+
+	if ((type == TOKEN_EOF && length == 0) || rb->error)
 		return -1;
-	else if (strcmp(ptr1->token ,ptr2->token) == 0) {
-		if (ptr1->docid > ptr2->docid)
-			return 1;
-		else 
+
+	if (docNum >= rb->doclen_cap) {
+		int *doclen = (int *)realloc(rb->doclen, sizeof(int) * rb->doclen_cap * 2);
+
+		if (doclen == NULL) {
+			fprintf( stderr, "Out of memory\n");
+			rb->error = 1;
 			return -1;
+		}
+		rb->doclen = doclen;
+		rb->doclen_cap *= 2;
 	}
-	else
-		return 1;
-	
+	rb->doclen[docNum] = length;
+
+	return length;
 }
 
-static void print_tokens( tTokenDoc *tokens, int num_tokens)
-{
-	int i;
-	
-	for (i = 0; i < num_tokens; i++)
-	{
-		printf( "%s\t%d\n", tokens[i].token, tokens[i].docid);
+int tokenizeRange( FILE *fp, long end, tRunBuilder *rb, int *num_docs) {
+	tTOKENIZER tk;
+	int docNum = 0;
+	int num_tokens = 0;
+	int length;
+
+	*num_docs = 0;
+	if (!tokenizerInit( &tk, fp, end)) {
+		fprintf( stderr, "Out of memory\n");
+		return -1;
 	}
+
+	while ((length = _tokenizeDoc( rb, &tk, docNum + 1)) >= 0) {
+		docNum++;
+		num_tokens += length;
+	}
+
+	tokenizerDestroy( &tk);
+
+	*num_docs = docNum;
+
+	return rb->error ? -1 : num_tokens;
 }
 
-void destroy_tokens( tTokenDoc *tokens, int num_tokens)
-{
-	int i;
-	
-	for (i = 0; i < num_tokens; i++)
-	{
-		free( tokens[i].token);
+static void *_shardWorker( void *arg) {
+	tShard *shard = (tShard *)arg;
+	FILE *fp = fopen(shard->filename, "rt");
+
+	if (fp == NULL) {
+		shard->error = 1;
+		return NULL;
+	}
+
+	fseek(fp, shard->start, SEEK_SET);
+	if (tokenizeRange( fp, shard->end, &shard->rb, &shard->num_docs) < 0)
+		shard->error = 1;
+	fclose(fp);
+
+	// 디스크로 내보낸 런이 있으면 나머지도 런으로, 아니면 메모리에서 정렬만 한다.
+	if (shard->rb.num_runs > 0) {
+		if (!runSpill( &shard->rb))
+			shard->error = 1;
 	}
-	free( tokens);
+	else
+		_sortTokens( &shard->rb);
+
+	return NULL;
 }
 
-char *s_gets(char *st, int n, FILE *fp) {
-	char *ret_val;
-	char *find;
+// 정렬된 tokens[lo..hi-1]에서 token 이상인 첫 토큰의 위치
+static int _lowerBound( tTokenDoc *tokens, int lo, int hi, char *token) {
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
 
-	ret_val = fgets(st, n, fp);
-	if (ret_val) {
-		find = strchr(st, '\n');
-		if (find)
-			*find = '\0';
+		if (strcmp(tokens[mid].token, token) < 0)
+			lo = mid + 1;
 		else
-			while (getchar() != '\n');
+			hi = mid;
+	}
+	return lo;
+}
+
+static int _compareString(const void *n1, const void *n2) {
+	return strcmp(*(char * const *)n1, *(char * const *)n2);
+}
+
+static void *_partitionWorker( void *arg) {
+	tPartition *part = (tPartition *)arg;
+	tRunReader *readers = (tRunReader *)malloc(sizeof(tRunReader) * part->num_shards);
+	tIndexWriter writer;
+
+	part->fpD = tmpfile();
+	part->fpH = tmpfile();
+	part->fpP = tmpfile();
+	part->fpPos = tmpfile();
+	if (readers == NULL || part->fpD == NULL || part->fpH == NULL || part->fpP == NULL || part->fpPos == NULL) {
+		part->error = 1;
+		free(readers);
+		return NULL;
+	}
+
+	for (int i = 0; i < part->num_shards; i++) {
+		readers[i].fp = NULL;
+		readers[i].tokens = part->shards[i].rb.tokens;
+		readers[i].pos = part->lo[i];
+		readers[i].end = part->hi[i];
+		readers[i].docbase = part->shards[i].docbase;
+	}
+
+	writerInit( &writer, part->fpD, part->fpH, part->fpP, part->fpPos);
+	mergeReaders( readers, part->num_shards, &writer, NULL);
+	writerFinish( &writer);
+
+	// rewind는 오류 표시를 지우므로 먼저 확인한다.
+	if (fflush(part->fpD) != 0 || fflush(part->fpH) != 0 || fflush(part->fpP) != 0 || fflush(part->fpPos) != 0 ||
+		ferror(part->fpD) || ferror(part->fpH) || ferror(part->fpP) || ferror(part->fpPos)) {
+		fprintf( stderr, "Temporary file write error\n");
+		part->error = 1;
 	}
-	return ret_val;
-}
\ No newline at end of file
+	part->num_postings = writer.num_postings;
+	part->posting_pos = writer.posting_pos;
+	part->num_positions = writer.total_positions;
+	part->position_bytes = writer.position_bytes;
+	part->max_docid = writer.max_docid;
+
+	rewind(part->fpD);
+	rewind(part->fpH);
+	rewind(part->fpP);
+	rewind(part->fpPos);
+	free(readers);
+
+	return NULL;
+}
+
+static void _copyFile( FILE *src, FILE *dst) {
+	char buf[BUFSIZ];
+	size_t n;
+
+	while ((n = fread( buf, 1, sizeof(buf), src)) > 0)
+		fwrite( buf, 1, n, dst);
+}
+
+// 분할 결과 파일을 읽지 못했으면 작성기에 오류를 남긴다. (writerClose가 실패를 반환)
+static void _checkRead( FILE *src, tIndexWriter *writer) {
+	if (ferror(src))
+		writer->error = 1;
+}
+
+static void _copyPostings( FILE *src, tIndexWriter *writer) {
+	unsigned char buf[BUFSIZ];
+	size_t n;
+
+	// 문서번호 수와 위치는 분할 단위로 따로 더한다.
+	while ((n = fread( buf, 1, sizeof(buf), src)) > 0) {
+		fwrite( buf, 1, n, writer->fpP);
+		writer->psum = idxChecksum( writer->psum, buf, n);
+		writer->posting_bytes += n;
+	}
+}
+
+static void _copyPositions( FILE *src, tIndexWriter *writer) {
+	unsigned char buf[BUFSIZ];
+	size_t n;
+
+	// 위치 수는 분할 단위로 따로 더한다.
+	while ((n = fread( buf, 1, sizeof(buf), src)) > 0) {
+		fwrite( buf, 1, n, writer->fpPos);
+		writer->possum = idxChecksum( writer->possum, buf, n);
+		writer->position_bytes += n;
+	}
+}
+
+// 모든 샤드가 메모리 안에서 정렬된 경우: 토큰 범위로 나누어 병렬로 병합한 뒤 이어 붙인다.
+static int _parallelMerge( tShard *shards, int num_shards, char *dicfilename, char *headerfilename,
+					char *postingfilename, char *positionfilename) {
+	tPartition parts[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	char **samples;
+	char *splitters[MAX_THREADS];
+	int num_samples = 0;
+	int *bounds;
+	int ret = 1;
+	int offset = 0;
+	unsigned int pos_offset = 0;
+	tIndexWriter writer;
+
+	// 각 샤드에서 고르게 토큰을 뽑아 분할 기준(splitter)을 정한다.
+	samples = (char **)malloc(sizeof(char *) * num_shards * num_shards);
+	for (int i = 0; i < num_shards; i++) {
+		for (int k = 1; k <= num_shards; k++) {
+			int n = shards[i].rb.num_tokens;
+
+			if (n > 0)
+				samples[num_samples++] = shards[i].rb.tokens[(long)n * k / (num_shards + 1)].token;
+		}
+	}
+	qsort( samples, num_samples, sizeof(char *), _compareString);
+	for (int p = 1; p < num_shards; p++)
+		splitters[p - 1] = (num_samples > 0) ? samples[num_samples * p / num_shards] : NULL;
+
+	// bounds[p * num_shards + i]: p번째 분할이 i번째 샤드에서 시작하는 위치
+	bounds = (int *)malloc(sizeof(int) * (num_shards + 1) * num_shards);
+	for (int i = 0; i < num_shards; i++) {
+		int n = shards[i].rb.num_tokens;
+
+		bounds[i] = 0;
+		for (int p = 1; p < num_shards; p++)
+			bounds[p * num_shards + i] = (splitters[p - 1] == NULL) ? n :
+				_lowerBound( shards[i].rb.tokens, bounds[(p - 1) * num_shards + i], n, splitters[p - 1]);
+		bounds[num_shards * num_shards + i] = n;
+	}
+
+	for (int p = 0; p < num_shards; p++) {
+		parts[p].shards = shards;
+		parts[p].num_shards = num_shards;
+		parts[p].lo = bounds + p * num_shards;
+		parts[p].hi = bounds + (p + 1) * num_shards;
+		parts[p].error = 0;
+		pthread_create( &tids[p], NULL, _partitionWorker, &parts[p]);
+	}
+	for (int p = 0; p < num_shards; p++)
+		pthread_join( tids[p], NULL);
+
+	// 분할 결과를 이어 붙이면서 헤더의 포스팅/위치 시작 위치를 보정한다.
+	if (writerOpen( &writer, dicfilename, headerfilename, postingfilename, positionfilename)) {
+		for (int p = 0; p < num_shards; p++) {
+			tHEADER header;
+
+			if (parts[p].error) {
+				writer.error = 1;
+				ret = 0;
+				continue;
+			}
+
+			_copyFile( parts[p].fpD, writer.fpD);
+			_copyPostings( parts[p].fpP, &writer);
+			_copyPositions( parts[p].fpPos, &writer);
+			while (fread( &header, sizeof(tHEADER), 1, parts[p].fpH) == 1) {
+				header.index += offset;
+				header.pos_index += pos_offset;
+				writerPutHeader( &writer, &header);
+			}
+			_checkRead( parts[p].fpD, &writer);
+			_checkRead( parts[p].fpH, &writer);
+			_checkRead( parts[p].fpP, &writer);
+			_checkRead( parts[p].fpPos, &writer);
+			offset += parts[p].posting_pos;
+			pos_offset += parts[p].position_bytes;
+			writer.posting_pos += parts[p].posting_pos;
+			writer.num_postings += parts[p].num_postings;
+			writer.total_positions += parts[p].num_positions;
+			if (parts[p].max_docid > writer.max_docid)
+				writer.max_docid = parts[p].max_docid;
+		}
+		if (!writerClose( &writer))
+			ret = 0;
+	}
+	else
+		ret = 0;
+
+	for (int p = 0; p < num_shards; p++) {
+		if (parts[p].fpD) fclose(parts[p].fpD);
+		if (parts[p].fpH) fclose(parts[p].fpH);
+		if (parts[p].fpP) fclose(parts[p].fpP);
+		if (parts[p].fpPos) fclose(parts[p].fpPos);
+	}
+	free(samples);
+	free(bounds);
+
+	return ret;
+}
+
+int parallelIndex( char *filename, size_t budget, int num_threads, char *dicfilename, char *headerfilename,
+					char *postingfilename, char *positionfilename, char *doclenfilename) {
+	tShard shards[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	FILE *fp;
+	long size;
+	int *doclen;
+	int num_docs;
+	int spilled = 0;
+	int ret = 1;
+
+	fp = fopen(filename, "rt");
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return 0;
+	}
+
+	// 파일을 바이트 크기로 균등하게 나누되, 경계는 줄의 시작 위치로 맞춘다.
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+
+	for (int i = 0; i < num_threads; i++) {
+		long pos = size * i / num_threads;
+
+		if (i > 0 && pos < shards[i - 1].start)
+			pos = shards[i - 1].start;
+		if (pos > 0) {
+			int ch;
+
+			fseek(fp, pos - 1, SEEK_SET);
+			while ((ch = fgetc(fp)) != EOF && ch != '\n')
+				;
+			pos = ftell(fp);
+		}
+		shards[i].start = pos;
+		if (i > 0)
+			shards[i - 1].end = pos;
+	}
+	shards[num_threads - 1].end = size;
+	fclose(fp);
+
+	for (int i = 0; i < num_threads; i++) {
+		shards[i].filename = filename;
+		shards[i].num_docs = 0;
+		shards[i].error = 0;
+		runInit( &shards[i].rb, budget / num_threads);
+		pthread_create( &tids[i], NULL, _shardWorker, &shards[i]);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join( tids[i], NULL);
+
+		if (shards[i].error)
+			ret = 0;
+		if (shards[i].rb.num_runs > 0)
+			spilled = 1;
+		shards[i].docbase = (i == 0) ? 0 : shards[i - 1].docbase + shards[i - 1].num_docs;
+	}
+
+	// 샤드별 문서 길이를 전체 문서번호로 이어 붙인다.
+	num_docs = shards[num_threads - 1].docbase + shards[num_threads - 1].num_docs;
+	doclen = (int *)malloc(sizeof(int) * (num_docs + 1));
+	doclen[0] = 0;
+	for (int i = 0; i < num_threads; i++)
+		memcpy(doclen + shards[i].docbase + 1, shards[i].rb.doclen + 1, sizeof(int) * shards[i].num_docs);
+	setDocLengths( doclen, num_docs);
+
+	if (ret && !spilled)
+		ret = _parallelMerge( shards, num_threads, dicfilename, headerfilename, postingfilename, positionfilename);
+	else if (ret) {
+		// 메모리 예산을 넘은 샤드가 있으면 모든 런을 모아 한 번에 병합한다.
+		FILE **runs = NULL;
+		int *docbase = NULL;
+		int num_runs = 0;
+
+		// 예산 안에 들어온 샤드는 이때 런으로 내보낸다.
+		for (int i = 0; i < num_threads; i++)
+			if (shards[i].rb.num_runs == 0 && !runSpill( &shards[i].rb))
+				ret = 0;
+
+		for (int i = 0; ret && i < num_threads; i++) {
+			runs = (FILE **)realloc(runs, sizeof(FILE *) * (num_runs + shards[i].rb.num_runs + 1));
+			docbase = (int *)realloc(docbase, sizeof(int) * (num_runs + shards[i].rb.num_runs + 1));
+
+			for (int k = 0; k < shards[i].rb.num_runs; k++) {
+				runs[num_runs] = shards[i].rb.runs[k];
+				docbase[num_runs++] = shards[i].docbase;
+			}
+			shards[i].rb.num_runs = 0;
+		}
+
+		if (ret)
+			ret = mergeAllRuns( runs, docbase, num_runs, dicfilename, headerfilename, postingfilename, positionfilename);
+		free(runs);
+		free(docbase);
+	}
+
+	for (int i = 0; i < num_threads; i++)
+		runDestroy( &shards[i].rb);
+
+	if (ret)
+		ret = writeDocLengths( doclenfilename);
+	setDocLengths( NULL, 0);
+	free(doclen);
+
+	return ret;
+}
+
+void setDocLengths( int *doclen, int num_docs) {
+	doc_lengths = doclen;
+	num_doc_lengths = num_docs;
+	avg_doclen = _averageLength( doclen, num_docs);
+}
+
+// 문서별 토큰 수(doclen[1..num_docs])를 doclen 파일에 기록한다.
+// 임시 파일에 쓴 뒤 rename한다. (idxCreate)
+static int _writeDocLengths( char *filename, int *doclen, int num_docs) {
+	FILE *fp = idxCreate( filename, "wb");
+	unsigned int size = sizeof(int) * (num_docs + 1);
+	int zero = 0;
+
+	if (fp == NULL)
+		return 0;
+
+	// 본문: 문서번호로 바로 찾을 수 있도록 0번 자리를 비워 둔 int 배열
+	_writeFileHeader( fp, IDX_MAGIC_DOCLEN, num_docs, size, num_docs,
+					idxChecksum( idxChecksum( IDX_CHECKSUM_INIT, &zero, sizeof(int)),
+								doclen + 1, sizeof(int) * num_docs));
+	fwrite( &zero, sizeof(int), 1, fp);
+	fwrite( doclen + 1, sizeof(int), num_docs, fp);
+
+	return idxCommit( fp, filename, 1);
+}
+
+int writeDocLengths( char *filename) {
+	return _writeDocLengths( filename, doc_lengths, num_doc_lengths);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 세그먼트 색인 (segment.h)
+
+int segmentOpen( tSegmentWriter *sw) {
+	sw->lockfd = open(SEG_LOCK, O_RDWR | O_CREAT, 0644);
+	if (sw->lockfd < 0) {
+		fprintf( stderr, "File open error:%s\n", SEG_LOCK);
+		return 0;
+	}
+	if (flock(sw->lockfd, LOCK_EX | LOCK_NB) < 0) {
+		fprintf( stderr, "Segment index is locked by another writer:%s\n", SEG_LOCK);
+		close(sw->lockfd);
+		return 0;
+	}
+
+	if (access(SEG_MANIFEST, F_OK) == 0) {
+		if (!manifestRead( &sw->manifest, SEG_MANIFEST)) {
+			close(sw->lockfd);
+			return 0;
+		}
+	}
+	else
+		manifestInit( &sw->manifest);
+
+	pthread_mutex_init(&sw->lock, NULL);
+	sw->started = 0;
+	sw->merging = 0;
+	sw->first = 0;
+	sw->count = 0;
+	sw->merge_segs = NULL;
+	sw->merge_id = 0;
+	sw->error = 0;
+
+	codecInit();
+
+	return 1;
+}
+
+// 세그먼트 디렉토리를 지운다. (검색기가 매핑하고 있는 파일도 지울 수 있다.)
+// 쓰다가 남은 임시 파일(idxCreate)도 지운다.
+static void _removeSegment( int id) {
+	static char *files[] = { "dic.txt", "dic.idx", WILDCARD_FILE, "header.idx", "posting.idx", "position.idx", "doclen.idx",
+							SEG_DELETED };
+	char path[SEG_PATH];
+
+	for (int i = 0; i < (int)(sizeof(files) / sizeof(files[0])); i++) {
+		unlink(segmentPath( path, id, files[i]));
+		strcat(path, ".tmp");
+		unlink(path);
+	}
+
+	snprintf(path, SEG_PATH, SEG_DIR, id);
+	rmdir(path);
+}
+
+// 삭제 비트맵을 del.idx 파일에 기록한다. (임시 파일에 쓴 뒤 rename)
+// 실패시 0을 반환
+static int _writeDeleted( char *filename, uint64_t *words, int num_docs, int num_deleted) {
+	unsigned int size = sizeof(uint64_t) * segmentDeletedWords( num_docs);
+	FILE *fp = idxCreate( filename, "wb");
+
+	if (fp == NULL)
+		return 0;
+
+	_writeFileHeader( fp, IDX_MAGIC_DELETED, num_deleted, size, num_docs, idxChecksum( IDX_CHECKSUM_INIT, words, size));
+	fwrite( words, 1, size, fp);
+
+	return idxCommit( fp, filename, 1);
+}
+
+// 세그먼트의 삭제 비트맵을 읽는다. (삭제된 문서가 없으면 빈 비트맵)
+// 비트맵의 주소를 반환 (free로 해제)
+// 실패시 NULL을 반환
+static uint64_t *_loadDeleted( tSEGINFO *seg) {
+	int num_words = segmentDeletedWords( seg->num_docs);
+	uint64_t *words = (uint64_t *)calloc(num_words, sizeof(uint64_t));
+	uint64_t *mapped;
+	char path[SEG_PATH];
+
+	if (words == NULL || seg->num_deleted == 0)
+		return words;
+
+	mapped = (uint64_t *)idxMap( segmentPath( path, seg->id, SEG_DELETED), IDX_MAGIC_DELETED);
+	if (mapped == NULL || idxFileHeader( mapped)->size != sizeof(uint64_t) * num_words) {
+		if (mapped != NULL)
+			fprintf( stderr, "Invalid index file:%s\n", path);
+		idxUnmap( mapped);
+		free(words);
+		return NULL;
+	}
+
+	memcpy(words, mapped, sizeof(uint64_t) * num_words);
+	idxUnmap( mapped);
+
+	return words;
+}
+
+static int _isDeleted( uint64_t *words, int doc) {
+	return (words[doc >> 6] >> (doc & 63)) & 1;
+}
+
+// 새 세그먼트 디렉토리를 만들고 그 안의 색인 파일로 작성기를 연다.
+// doclen[1..num_docs]: 세그먼트 안의 문서번호별 토큰 수
+// 실패시 0을 반환
+static int _openSegment( tIndexWriter *writer, int id, int *doclen, int num_docs) {
+	char dir[SEG_PATH];
+	char dic[SEG_PATH];
+	char header[SEG_PATH];
+	char posting[SEG_PATH];
+	char position[SEG_PATH];
+
+	snprintf(dir, SEG_PATH, SEG_DIR, id);
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		fprintf( stderr, "Directory create error:%s\n", dir);
+		return 0;
+	}
+
+	if (!writerOpen( writer, segmentPath( dic, id, "dic.txt"), segmentPath( header, id, "header.idx"),
+					segmentPath( posting, id, "posting.idx"), segmentPath( position, id, "position.idx")))
+		return 0;
+
+	writerSetDocLengths( writer, doclen, num_docs);
+	return 1;
+}
+
+// 세그먼트의 색인 파일을 닫고 문서 길이와 삭제 비트맵(deleted, 삭제된 문서가 없으면 기록하지 않음)을 기록한다.
+// 실패시 0을 반환
+static int _closeSegment( tIndexWriter *writer, int id, uint64_t *deleted, int num_deleted) {
+	char path[SEG_PATH];
+
+	if (!writerClose( writer))
+		return 0;
+
+	if (!_writeDocLengths( segmentPath( path, id, "doclen.idx"), writer->doclen, writer->num_doclen))
+		return 0;
+
+	if (num_deleted > 0 && !_writeDeleted( segmentPath( path, id, SEG_DELETED), deleted, writer->num_doclen, num_deleted))
+		return 0;
+
+	return 1;
+}
+
+// 메모리 세그먼트의 토큰이 쓰는 바이트 수 (추정치, 토큰 배열의 빈 자리는 빼고 센다.)
+static size_t _segmentBytes( tRunBuilder *rb) {
+	return rb->bytes - sizeof(tTokenDoc) * (rb->capacity - rb->num_tokens);
+}
+
+// 메모리 세그먼트(rb의 토큰, 문서번호 1 ~ num_docs)를 정렬하여 디스크 세그먼트로 기록하고 세그먼트 목록에 덧붙인다.
+// 런 생성기는 비운다.
+// 실패시 0을 반환
+static int _flushSegment( tSegmentWriter *sw, tRunBuilder *rb, int num_docs) {
+	tIndexWriter writer;
+	tSEGINFO *seg;
+	int id;
+	int ret;
+
+	pthread_mutex_lock(&sw->lock);
+	id = sw->manifest.next_id++;
+	pthread_mutex_unlock(&sw->lock);
+
+	_sortTokens( rb);
+
+	ret = _openSegment( &writer, id, rb->doclen, num_docs);
+	if (ret) {
+		for (int i = 0; i < rb->num_tokens; i++)
+			writerAdd( &writer, rb->tokens[i].token, rb->tokens[i].docid, rb->tokens[i].pos);
+		ret = _closeSegment( &writer, id, NULL, 0);
+	}
+
+	_clearTokens( rb);
+
+	if (!ret) {
+		_removeSegment( id);
+		return 0;
+	}
+
+	pthread_mutex_lock(&sw->lock);
+	seg = manifestAdd( &sw->manifest);
+	if (seg != NULL) {
+		seg->id = id;
+		seg->docbase = sw->manifest.num_docs;
+		seg->num_docs = num_docs;
+		sw->manifest.num_docs += num_docs;
+		sw->manifest.generation++;
+		ret = manifestWrite( &sw->manifest, SEG_MANIFEST);
+	}
+	else
+		ret = 0;
+	pthread_mutex_unlock(&sw->lock);
+
+	return ret;
+}
+
+// 병합할 세그먼트를 연다. (docbase: 병합한 세그먼트 안에서 이 세그먼트의 문서번호에 더할 값)
+// 실패시 0을 반환
+static int _readerOpen( tSegmentReader *r, tSEGINFO *seg, int docbase) {
+	char path[SEG_PATH];
+
+	memset(r, 0, sizeof(tSegmentReader));
+	r->docbase = docbase;
+	r->Hidx = -1;
+
+	r->header = (tHEADER *)idxMap( segmentPath( path, seg->id, "header.idx"), IDX_MAGIC_HEADER);
+	r->posting = (int *)idxMap( segmentPath( path, seg->id, "posting.idx"), IDX_MAGIC_POSTING);
+	r->positions = (unsigned char *)idxMap( segmentPath( path, seg->id, "position.idx"), IDX_MAGIC_POSITION);
+	r->doclen = (int *)idxMap( segmentPath( path, seg->id, "doclen.idx"), IDX_MAGIC_DOCLEN);
+	r->fpD = fopen(segmentPath( path, seg->id, "dic.txt"), "rt");
+	r->deleted = _loadDeleted( seg);
+
+	if (r->fpD == NULL)
+		fprintf( stderr, "File open error:%s\n", path);
+
+	if (r->header == NULL || r->posting == NULL || r->positions == NULL || r->doclen == NULL ||
+		r->fpD == NULL || r->deleted == NULL)
+		return 0;
+
+	if (idxFileHeader( r->doclen)->count != (unsigned int)seg->num_docs) {
+		fprintf( stderr, "Invalid index file:%s\n", segmentPath( path, seg->id, "doclen.idx"));
+		return 0;
+	}
+
+	r->num_terms = idxFileHeader( r->header)->count;
+	return 1;
+}
+
+// 다음 텀으로 옮긴다. (텀이 더 없으면 Hidx == num_terms)
+// 텀의 길이는 색인기의 토큰 길이를 따르므로 줄 길이에 상한을 두지 않고 읽는다.
+static void _readerNext( tSegmentReader *r) {
+	ssize_t len;
+
+	if (++r->Hidx >= r->num_terms)
+		return;
+	if ((len = getline(&r->term, &r->term_cap, r->fpD)) <= 0) {
+		r->num_terms = r->Hidx;
+		return;
+	}
+	if (r->term[len - 1] == '\n')
+		r->term[len - 1] = 0;
+}
+
+// 현재 텀의 포스팅과 위치를 복호화하여 삭제되지 않은 문서만 작성기에 넣는다.
+static void _readerCopyTerm( tSegmentReader *r, tIndexWriter *writer, char *term) {
+	tHEADER *h = &r->header[r->Hidx];
+	int codec = idxFileHeader( r->posting)->codec;
+	int df = h->df;
+	const int *docs;
+	const int *tfs;
+	int *pos;
+	int total = 0;
+
+	if (df > r->docs_cap) {
+		r->docs_cap = df;
+		r->docs = (int *)realloc(r->docs, sizeof(int) * df);
+		r->tfs = (int *)realloc(r->tfs, sizeof(int) * df);
+	}
+
+	if (codec == CODEC_RAW) {
+		docs = r->posting + h->index;
+		tfs = docs + df;
+	}
+	else {
+		postingDecode( codec, (unsigned char *)r->posting + h->index, df, r->docs, r->tfs);
+		docs = r->docs;
+		tfs = r->tfs;
+	}
+
+	for (int i = 0; i < df; i++)
+		total += tfs[i];
+	if (total > r->positions_cap) {
+		r->positions_cap = total;
+		r->pos = (int *)realloc(r->pos, sizeof(int) * total);
+	}
+	positionsDecode( r->positions + h->pos_index, tfs, df, r->pos);
+
+	pos = r->pos;
+	for (int i = 0; i < df; i++) {
+		if (!_isDeleted( r->deleted, docs[i])) {
+			for (int k = 0; k < tfs[i]; k++)
+				writerAdd( writer, term, docs[i] + r->docbase, pos[k]);
+		}
+		pos += tfs[i];
+	}
+}
+
+static void _readerClose( tSegmentReader *r) {
+	idxUnmap( r->header);
+	idxUnmap( r->posting);
+	idxUnmap( r->positions);
+	idxUnmap( r->doclen);
+	if (r->fpD != NULL)
+		fclose(r->fpD);
+	free(r->deleted);
+	free(r->term);
+	free(r->docs);
+	free(r->tfs);
+	free(r->pos);
+}
+
+// 문서번호 순으로 이웃한 세그먼트들(segs[0..n-1])을 새 세그먼트(id) 하나로 병합한다.
+// 텀 순서대로 각 세그먼트의 포스팅을 문서번호 순으로 이어 붙이면서 삭제된 문서를 뺀다.
+// 삭제 비트맵은 이어받고 삭제된 문서의 길이는 0으로 한다.
+// 병합한 세그먼트 정보를 out에 저장
+// 실패시 0을 반환
+static int _mergeSegments( tSEGINFO *segs, int n, int id, tSEGINFO *out) {
+	tSegmentReader *readers = (tSegmentReader *)calloc(n, sizeof(tSegmentReader));
+	tIndexWriter writer;
+	uint64_t *deleted;
+	int *doclen;
+	char *term = NULL;
+	size_t term_cap = 0;
+	int num_docs = 0;
+	int num_deleted = 0;
+	int opened = 0;
+	int ret = 1;
+
+	for (int i = 0; i < n; i++)
+		num_docs += segs[i].num_docs;
+	doclen = (int *)calloc(num_docs + 1, sizeof(int));
+	deleted = (uint64_t *)calloc(segmentDeletedWords( num_docs), sizeof(uint64_t));
+
+	for (opened = 0; opened < n && ret; opened++) {
+		tSegmentReader *r = &readers[opened];
+
+		ret = _readerOpen( r, &segs[opened], segs[opened].docbase - segs[0].docbase);
+		if (!ret)
+			continue;
+
+		for (int d = 1; d <= segs[opened].num_docs; d++) {
+			int doc = d + r->docbase;
+
+			if (_isDeleted( r->deleted, d)) {
+				deleted[doc >> 6] |= (uint64_t)1 << (doc & 63);
+				num_deleted++;
+			}
+			else
+				doclen[doc] = r->doclen[d];
+		}
+		_readerNext( r);
+	}
+
+	if (ret)
+		ret = _openSegment( &writer, id, doclen, num_docs);
+
+	if (ret) {
+		while (1) {
+			tSegmentReader *min = NULL;
+			size_t len;
+
+			for (int i = 0; i < n; i++) {
+				tSegmentReader *r = &readers[i];
+
+				if (r->Hidx < r->num_terms && (min == NULL || strcmp(r->term, min->term) < 0))
+					min = r;
+			}
+			if (min == NULL)
+				break;
+
+			len = strlen(min->term) + 1;
+			if (len > term_cap) {
+				char *p = (char *)realloc(term, len);
+
+				if (p == NULL) {
+					fprintf( stderr, "Out of memory\n");
+					writer.error = 1;
+					break;
+				}
+				term = p;
+				term_cap = len;
+			}
+			memcpy(term, min->term, len);
+			for (int i = 0; i < n; i++) {
+				tSegmentReader *r = &readers[i];
+
+				if (r->Hidx < r->num_terms && strcmp(r->term, term) == 0) {
+					_readerCopyTerm( r, &writer, term);
+					_readerNext( r);
+				}
+			}
+		}
+		for (int i = 0; i < n; i++)
+			if (ferror(readers[i].fpD))
+				writer.error = 1;
+		ret = _closeSegment( &writer, id, deleted, num_deleted);
+	}
+
+	for (int i = 0; i < opened; i++)
+		_readerClose( &readers[i]);
+	free(readers);
+	free(doclen);
+	free(deleted);
+	free(term);
+
+	out->id = id;
+	out->docbase = segs[0].docbase;
+	out->num_docs = num_docs;
+	out->num_deleted = num_deleted;
+	out->num_purged = num_deleted;
+
+	return ret;
+}
+
+// 세그먼트의 크기 단계 (남은 문서 수가 MERGE_FACTOR의 몇 제곱 이상인지)
+static int _segmentLevel( tSEGINFO *seg) {
+	long live = seg->num_docs - seg->num_deleted;
+	long size = MERGE_FACTOR;
+	int level = 0;
+
+	while (live >= size) {
+		level++;
+		size *= MERGE_FACTOR;
+	}
+	return level;
+}
+
+// 병합 정책 (log-structured merge)
+// 문서번호 범위가 이어지도록 이웃한 세그먼트끼리만 병합한다.
+// 삭제된 문서가 포스팅에 많이 남은 (MAX_GARBAGE) 세그먼트는 혼자 다시 쓰고,
+// 그 밖에는 크기 단계가 같은 이웃 세그먼트 MERGE_FACTOR개를 최근 세그먼트부터 찾아 하나로 병합한다.
+// 병합할 세그먼트 수를 반환하고 첫 세그먼트의 위치를 first에 저장 (병합할 것이 없으면 0)
+static int _findMerge( tMANIFEST *m, int *first) {
+	for (int i = 0; i < m->num_segs; i++) {
+		tSEGINFO *seg = &m->segs[i];
+		int garbage = seg->num_deleted - seg->num_purged;
+
+		if (garbage > 0 && garbage > MAX_GARBAGE * (seg->num_docs - seg->num_purged)) {
+			*first = i;
+			return 1;
+		}
+	}
+
+	for (int i = m->num_segs - MERGE_FACTOR; i >= 0; i--) {
+		int level = _segmentLevel( &m->segs[i]);
+		int k;
+
+		for (k = 1; k < MERGE_FACTOR && _segmentLevel( &m->segs[i + k]) == level; k++)
+			;
+		if (k == MERGE_FACTOR) {
+			*first = i;
+			return MERGE_FACTOR;
+		}
+	}
+
+	return 0;
+}
+
+// 세그먼트 목록의 first ~ first+count-1을 병합할 준비를 한다. (lock을 잡고 부른다.)
+// 실패시 0을 반환
+static int _prepareMerge( tSegmentWriter *sw, int first, int count) {
+	free(sw->merge_segs);
+	sw->merge_segs = (tSEGINFO *)malloc(sizeof(tSEGINFO) * count);
+	if (sw->merge_segs == NULL)
+		return 0;
+	memcpy(sw->merge_segs, &sw->manifest.segs[first], sizeof(tSEGINFO) * count);
+	sw->first = first;
+	sw->count = count;
+	sw->merge_id = sw->manifest.next_id++;
+	sw->merging = 1;
+	return 1;
+}
+
+// 세그먼트 목록에서 병합한 세그먼트들을 병합 결과로 바꾸고 목록 파일을 기록한다. (lock을 잡고 부른다.)
+// 병합하는 동안 새로 기록된 세그먼트는 목록 뒤에 덧붙으므로 병합한 세그먼트의 위치는 그대로다.
+// 실패시 0을 반환
+static int _commitMerge( tSegmentWriter *sw, tSEGINFO *out) {
+	tMANIFEST *m = &sw->manifest;
+	int rest = m->num_segs - sw->first - sw->count;
+
+	m->segs[sw->first] = *out;
+	memmove(&m->segs[sw->first + 1], &m->segs[sw->first + sw->count], sizeof(tSEGINFO) * rest);
+	m->num_segs -= sw->count - 1;
+	m->generation++;
+
+	return manifestWrite( m, SEG_MANIFEST);
+}
+
+// 병합 스레드: _prepareMerge로 고른 세그먼트들을 병합하고 세그먼트 목록을 바꾼 뒤 이전 세그먼트를 지운다.
+static void *_mergeWorker( void *arg) {
+	tSegmentWriter *sw = (tSegmentWriter *)arg;
+	tSEGINFO out;
+	int ret = _mergeSegments( sw->merge_segs, sw->count, sw->merge_id, &out);
+
+	pthread_mutex_lock(&sw->lock);
+	if (ret)
+		ret = _commitMerge( sw, &out);
+	if (!ret)
+		sw->error = 1;
+	sw->merging = 0;
+	pthread_mutex_unlock(&sw->lock);
+
+	if (ret) {
+		for (int i = 0; i < sw->count; i++)
+			_removeSegment( sw->merge_segs[i].id);
+	}
+	else
+		_removeSegment( sw->merge_id);
+
+	return NULL;
+}
+
+// 병합 정책에 맞는 세그먼트가 있으면 병합 스레드를 시작한다.
+// 시작했으면 1을 반환
+static int _startMerge( tSegmentWriter *sw) {
+	int first;
+	int count;
+
+	pthread_mutex_lock(&sw->lock);
+	count = sw->error ? 0 : _findMerge( &sw->manifest, &first);
+	if (count > 0 && !_prepareMerge( sw, first, count)) {
+		fprintf( stderr, "Out of memory\n");
+		sw->error = 1;
+		count = 0;
+	}
+	pthread_mutex_unlock(&sw->lock);
+
+	if (count == 0)
+		return 0;
+
+	// 스레드를 만들지 못하면 이 스레드에서 병합한다.
+	if (pthread_create( &sw->tid, NULL, _mergeWorker, sw) != 0)
+		_mergeWorker( sw);
+	else
+		sw->started = 1;
+	return 1;
+}
+
+// 병합 스레드가 일하고 있지 않으면 (끝난 스레드를 정리하고) 다음 병합을 시작한다.
+static void _maybeMerge( tSegmentWriter *sw) {
+	int merging;
+
+	pthread_mutex_lock(&sw->lock);
+	merging = sw->merging;
+	pthread_mutex_unlock(&sw->lock);
+
+	if (merging)
+		return;
+
+	if (sw->started) {
+		pthread_join( sw->tid, NULL);
+		sw->started = 0;
+	}
+	_startMerge( sw);
+}
+
+// 진행 중인 병합을 기다린 뒤 병합 정책에 맞는 세그먼트가 없어질 때까지 병합한다.
+// 실패시 0을 반환
+static int _finishMerges( tSegmentWriter *sw) {
+	do {
+		if (sw->started) {
+			pthread_join( sw->tid, NULL);
+			sw->started = 0;
+		}
+	} while (_startMerge( sw));
+
+	return !sw->error;
+}
+
+int segmentAppend( tSegmentWriter *sw, char *filename, size_t budget) {
+	tRunBuilder rb;
+	tTOKENIZER tk;
+	FILE *fp;
+	int num_docs = 0;
+	int ret = 1;
+
+	fp = fopen(filename, "rt");
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return 0;
+	}
+
+	// 메모리 세그먼트는 런으로 내보내지 않고 budget을 넘으면 디스크 세그먼트로 기록한다.
+	runInit( &rb, SIZE_MAX);
+	if (!tokenizerInit( &tk, fp, -1)) {
+		fprintf( stderr, "Out of memory\n");
+		ret = 0;
+	}
+
+	while (ret && _tokenizeDoc( &rb, &tk, num_docs + 1) >= 0) {
+		num_docs++;
+
+		if (_segmentBytes( &rb) >= budget) {
+			ret = _flushSegment( sw, &rb, num_docs);
+			num_docs = 0;
+			_maybeMerge( sw);
+		}
+	}
+
+	if (rb.error)
+		ret = 0;
+	if (ret && num_docs > 0)
+		ret = _flushSegment( sw, &rb, num_docs);
+
+	tokenizerDestroy( &tk);
+	fclose(fp);
+	runDestroy( &rb);
+
+	if (!_finishMerges( sw))
+		ret = 0;
+
+	return ret;
+}
+
+int segmentDelete( tSegmentWriter *sw, int *docids, int num_docids) {
+	tMANIFEST *m = &sw->manifest;
+	uint64_t **bitmaps = (uint64_t **)calloc(m->num_segs + 1, sizeof(uint64_t *));
+	int *added = (int *)calloc(m->num_segs + 1, sizeof(int));
+	int changed = 0;
+	int invalid = 0;
+	int ret = 1;
+
+	if (bitmaps == NULL || added == NULL) {
+		fprintf( stderr, "Out of memory\n");
+		free(bitmaps);
+		free(added);
+		return 0;
+	}
+
+	// 없는 문서번호는 알리고 건너뛰되 나머지를 지운 뒤 실패를 반환한다.
+	for (int i = 0; i < num_docids && ret; i++) {
+		int s = manifestFind( m, docids[i]);
+		int doc;
+
+		if (s < 0) {
+			fprintf( stderr, "Invalid document number:%d\n", docids[i]);
+			invalid = 1;
+			continue;
+		}
+
+		if (bitmaps[s] == NULL && (bitmaps[s] = _loadDeleted( &m->segs[s])) == NULL) {
+			ret = 0;
+			break;
+		}
+
+		doc = docids[i] - m->segs[s].docbase;
+		if (!_isDeleted( bitmaps[s], doc)) {
+			bitmaps[s][doc >> 6] |= (uint64_t)1 << (doc & 63);
+			added[s]++;
+		}
+	}
+
+	// 바뀐 삭제 비트맵을 기록한 뒤 세그먼트 목록을 바꾼다.
+	for (int s = 0; s < m->num_segs && ret; s++) {
+		char path[SEG_PATH];
+
+		if (added[s] == 0)
+			continue;
+
+		m->segs[s].num_deleted += added[s];
+		ret = _writeDeleted( segmentPath( path, m->segs[s].id, SEG_DELETED), bitmaps[s],
+							m->segs[s].num_docs, m->segs[s].num_deleted);
+		changed = 1;
+	}
+
+	if (ret && changed) {
+		m->generation++;
+		ret = manifestWrite( m, SEG_MANIFEST);
+	}
+
+	for (int s = 0; s < m->num_segs; s++)
+		free(bitmaps[s]);
+	free(bitmaps);
+	free(added);
+
+	// 삭제된 문서가 많이 남은 세그먼트는 다시 쓴다.
+	if (ret)
+		ret = _finishMerges( sw);
+
+	return ret && !invalid;
+}
+
+int segmentForceMerge( tSegmentWriter *sw) {
+	tMANIFEST *m = &sw->manifest;
+	int purged = 1;
+
+	for (int i = 0; i < m->num_segs; i++)
+		if (m->segs[i].num_deleted != m->segs[i].num_purged)
+			purged = 0;
+
+	if (m->num_segs == 0 || (m->num_segs == 1 && purged))
+		return 1;
+
+	_prepareMerge( sw, 0, m->num_segs);
+	_mergeWorker( sw);
+
+	return !sw->error;
+}
+
+void segmentClose( tSegmentWriter *sw) {
+	if (sw->started)
+		pthread_join( sw->tid, NULL);
+
+	pthread_mutex_destroy(&sw->lock);
+	manifestFree( &sw->manifest);
+	free(sw->merge_segs);
+
+	flock(sw->lockfd, LOCK_UN);
+	close(sw->lockfd);
+}
+
+void runInit( tRunBuilder *rb, size_t budget) {
+	rb->capacity = 1000;
+	rb->tokens = (tTokenDoc *)malloc(sizeof(tTokenDoc) * rb->capacity);
+	rb->num_tokens = 0;
+	rb->bytes = sizeof(tTokenDoc) * rb->capacity + SORT_FIXED_BYTES;
+	rb->budget = budget;
+	rb->runs = NULL;
+	rb->num_runs = 0;
+	rb->doclen_cap = 1024;
+	rb->doclen = (int *)malloc(sizeof(int) * rb->doclen_cap);
+	rb->doclen[0] = 0;
+	arenaInit( &rb->strings);
+	rb->terms = NULL;
+	rb->term_hash = NULL;
+	rb->num_terms = 0;
+	rb->terms_cap = 0;
+	rb->table_size = 1024;
+	rb->table = (int *)calloc(rb->table_size, sizeof(int));
+	rb->error = 0;
+}
+
+// 텀 해시 (FNV-1a)
+static unsigned int _termHash( const char *term, size_t len) {
+	unsigned int h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)term[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// 텀 해시 테이블을 두 배로 늘린다.
+// 실패시 0을 반환
+static int _growTable( tRunBuilder *rb) {
+	int size = rb->table_size * 2;
+	int *table = (int *)calloc(size, sizeof(int));
+
+	if (table == NULL)
+		return 0;
+
+	for (int id = 0; id < rb->num_terms; id++) {
+		unsigned int slot = rb->term_hash[id] & (size - 1);
+
+		while (table[slot] != 0)
+			slot = (slot + 1) & (size - 1);
+		table[slot] = id + 1;
+	}
+
+	free(rb->table);
+	rb->table = table;
+	rb->table_size = size;
+	return 1;
+}
+
+// 토큰의 텀 번호를 반환 (처음 보는 텀이면 문자열을 arena에 복사하고 새 번호를 붙이며 added를 1로 한다.)
+// 실패시 -1을 반환
+static int _internTerm( tRunBuilder *rb, char *token, size_t len, int *added) {
+	unsigned int h = _termHash( token, len);
+	unsigned int slot = h & (rb->table_size - 1);
+	int id;
+
+	*added = 0;
+	for (; rb->table[slot] != 0; slot = (slot + 1) & (rb->table_size - 1)) {
+		id = rb->table[slot] - 1;
+		if (rb->term_hash[id] == h && strcmp(rb->terms[id], token) == 0)
+			return id;
+	}
+
+	if (rb->num_terms == rb->terms_cap) {
+		int cap = (rb->terms_cap == 0) ? 1024 : rb->terms_cap * 2;
+		char **terms = (char **)realloc(rb->terms, sizeof(char *) * cap);
+		unsigned int *hashes;
+
+		if (terms == NULL)
+			return -1;
+		rb->terms = terms;
+		hashes = (unsigned int *)realloc(rb->term_hash, sizeof(unsigned int) * cap);
+		if (hashes == NULL)
+			return -1;
+		rb->term_hash = hashes;
+		rb->terms_cap = cap;
+	}
+
+	id = rb->num_terms;
+	rb->terms[id] = arenaStrdup( &rb->strings, token, len);
+	if (rb->terms[id] == NULL)
+		return -1;
+	rb->term_hash[id] = h;
+	rb->table[slot] = id + 1;
+	rb->num_terms++;
+	*added = 1;
+
+	// 테이블을 반 넘게 채우지 않는다.
+	if (rb->num_terms * 2 > rb->table_size && !_growTable( rb))
+		return -1;
+
+	return id;
+}
+
+void runAdd( tRunBuilder *rb, char *token, int docid, int pos) {
+	// 토큰 하나가 차지하는 메모리: 구조체와 정렬할 때 쓰는 자리 (+ 처음 보는 텀이면 문자열과 텀 배열/해시 테이블, 텀 순위의 자리)
+	size_t len = strlen(token);
+	size_t term_bytes = len + 1 + sizeof(char *) + sizeof(unsigned int) + 2 * sizeof(int) + SORT_TERM_BYTES;
+	size_t need = sizeof(tTokenDoc) + SORT_TOKEN_BYTES + term_bytes;
+	tTokenDoc *t;
+	int added;
+	int id;
+
+	if (rb->error)
+		return;
+
+	assert(rb->num_tokens == 0 || rb->tokens[rb->num_tokens - 1].docid < docid ||
+		(rb->tokens[rb->num_tokens - 1].docid == docid && rb->tokens[rb->num_tokens - 1].pos < pos));
+
+	// 토큰 배열을 늘려야 하면 새 배열 전체를 예산에 넣는다. (realloc 동안에는 옛 배열과 새 배열이 함께 있다.)
+	if (rb->num_tokens == rb->capacity)
+		need += sizeof(tTokenDoc) * rb->capacity * 2;
+
+	if (rb->num_tokens > 0 && rb->bytes + need > rb->budget && !runSpill( rb)) {
+		rb->error = 1;
+		return;
+	}
+
+	if (rb->num_tokens == rb->capacity) {
+		tTokenDoc *tokens = (tTokenDoc *)realloc(rb->tokens, sizeof(tTokenDoc) * rb->capacity * 2);
+
+		if (tokens == NULL) {
+			fprintf( stderr, "Out of memory\n");
+			rb->error = 1;
+			return;
+		}
+		rb->tokens = tokens;
+		rb->bytes += sizeof(tTokenDoc) * rb->capacity;
+		rb->capacity *= 2;
+	}
+
+	id = _internTerm( rb, token, len, &added);
+	if (id < 0) {
+		fprintf( stderr, "Out of memory\n");
+		rb->error = 1;
+		return;
+	}
+	rb->bytes += SORT_TOKEN_BYTES;
+	if (added)
+		rb->bytes += term_bytes;
+
+	t = &rb->tokens[rb->num_tokens++];
+	t->token = rb->terms[id];
+	t->termid = id;
+	t->docid = docid;
+	t->pos = pos;
+}
+
+// 메모리에 있는 토큰과 텀을 비운다. (메모리는 다시 쓴다.)
+static void _clearTokens( tRunBuilder *rb) {
+	arenaReset( &rb->strings);
+	memset(rb->table, 0, sizeof(int) * rb->table_size);
+	rb->num_terms = 0;
+	rb->num_tokens = 0;
+	rb->bytes = sizeof(tTokenDoc) * rb->capacity + SORT_FIXED_BYTES;
+}
+
+// 텀 순위를 매기기 위한 비교함수 (텀 문자열 사전 순)
+static int _compareTermRef( const void *n1, const void *n2) {
+	return strcmp(((const tTermRef *)n1)->term, ((const tTermRef *)n2)->term);
+}
+
+// 런 생성기의 토큰을 (토큰 문자열, 문서번호, 위치) 순으로 정렬한다. (_compare와 같은 순서)
+// 서로 다른 텀만 사전 순으로 한 번 정렬하여 순위를 매기고,
+// 토큰은 (텀 순위, 문서번호)를 묶은 64비트 키로 기수 정렬(LSD)한다.
+// 기수 정렬은 안정 정렬이고 토큰은 (문서번호, 위치) 순으로 추가되므로 같은 키 안에서는 위치 순서가 유지된다.
+static void _sortTokens( tRunBuilder *rb) {
+	int n = rb->num_tokens;
+	tTermRef *order;
+	int *rank;
+	tTokenDoc *tmp;
+	tTokenDoc *src;
+	tTokenDoc *dst;
+	int max_docid = 0;
+	int doc_bits = 0;
+	int key_bits = 0;
+	int passes;
+	size_t (*count)[RADIX_SIZE];
+
+	if (n < 2)
+		return;
+
+	// 텀 순위 (rank[텀 번호])
+	order = (tTermRef *)malloc(sizeof(tTermRef) * rb->num_terms);
+	rank = (int *)malloc(sizeof(int) * rb->num_terms);
+	tmp = (tTokenDoc *)malloc(sizeof(tTokenDoc) * n);
+	if (order == NULL || rank == NULL || tmp == NULL) {
+		free(order);
+		free(rank);
+		free(tmp);
+		qsort( rb->tokens, n, sizeof( tTokenDoc), _compare);
+		return;
+	}
+
+	for (int id = 0; id < rb->num_terms; id++) {
+		order[id].term = rb->terms[id];
+		order[id].termid = id;
+	}
+	qsort( order, rb->num_terms, sizeof(tTermRef), _compareTermRef);
+	for (int r = 0; r < rb->num_terms; r++)
+		rank[order[r].termid] = r;
+	free(order);
+
+	for (int i = 0; i < n; i++)
+		if (rb->tokens[i].docid > max_docid)
+			max_docid = rb->tokens[i].docid;
+	while ((1u << doc_bits) <= (unsigned int)max_docid && doc_bits < 32)
+		doc_bits++;
+	while (key_bits < 32 && (1u << key_bits) < (unsigned int)rb->num_terms)
+		key_bits++;
+	key_bits += doc_bits;
+	passes = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+
+	// 모든 자리의 도수를 한 번에 센다.
+	count = (size_t (*)[RADIX_SIZE])calloc(passes > 0 ? passes : 1, sizeof(*count));
+	if (count == NULL) {
+		free(rank);
+		free(tmp);
+		qsort( rb->tokens, n, sizeof( tTokenDoc), _compare);
+		return;
+	}
+
+#define _TOKEN_KEY(t)	(((uint64_t)rank[(t).termid] << doc_bits) | (unsigned int)(t).docid)
+
+	// 자리마다 src에서 dst로 옮긴다. (보조 배열은 토큰 수만큼이므로 끝나고 src가 보조 배열이면 토큰 배열로 복사)
+	src = rb->tokens;
+	dst = tmp;
+
+	for (int i = 0; i < n; i++) {
+		uint64_t key = _TOKEN_KEY( src[i]);
+
+		for (int p = 0; p < passes; p++)
+			count[p][(key >> (p * RADIX_BITS)) & (RADIX_SIZE - 1)]++;
+	}
+
+	for (int p = 0; p < passes; p++) {
+		size_t sum = 0;
+		tTokenDoc *swap;
+
+		// 모든 토큰의 자리 값이 같으면 이 자리는 건너뛴다.
+		if (count[p][(_TOKEN_KEY( src[0]) >> (p * RADIX_BITS)) & (RADIX_SIZE - 1)] == (size_t)n)
+			continue;
+
+		for (int d = 0; d < RADIX_SIZE; d++) {
+			size_t c = count[p][d];
+
+			count[p][d] = sum;
+			sum += c;
+		}
+
+		for (int i = 0; i < n; i++) {
+			uint64_t key = _TOKEN_KEY( src[i]);
+
+			dst[count[p][(key >> (p * RADIX_BITS)) & (RADIX_SIZE - 1)]++] = src[i];
+		}
+
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+#undef _TOKEN_KEY
+
+	if (src != rb->tokens)
+		memcpy(rb->tokens, src, sizeof(tTokenDoc) * n);
+
+	free(count);
+	free(rank);
+	free(tmp);
+}
+
+// 런 파일 형식: [토큰 길이(int)][토큰 문자열][문서번호(int)][위치(int)] 반복
+static void _writeRecord( FILE *fp, char *token, int docid, int pos) {
+	int len = strlen(token);
+
+	fwrite( &len, sizeof(int), 1, fp);
+	fwrite( token, sizeof(char), len, fp);
+	fwrite( &docid, sizeof(int), 1, fp);
+	fwrite( &pos, sizeof(int), 1, fp);
+}
+
+// 런에서 다음 레코드를 읽는다.
+// 런의 끝이면 0, 읽기 오류나 잘린 레코드이면 -1을 반환
+static int _readRecord( tRunReader *reader) {
+	int len;
+
+	if (reader->fp == NULL) {
+		if (reader->pos >= reader->end)
+			return 0;
+
+		reader->cur.token = reader->tokens[reader->pos].token;
+		reader->cur.docid = reader->tokens[reader->pos].docid + reader->docbase;
+		reader->cur.pos = reader->tokens[reader->pos].pos;
+		reader->pos++;
+
+		return 1;
+	}
+
+	if (fread( &len, sizeof(int), 1, reader->fp) != 1)
+		return ferror(reader->fp) ? -1 : 0;
+
+	if (len < 0)
+		return -1;
+	if (len + 1 > reader->bufsize) {
+		char *buf = (char *)realloc(reader->buf, len + 1);
+
+		if (buf == NULL)
+			return -1;
+		reader->buf = buf;
+		reader->bufsize = len + 1;
+	}
+
+	if (fread( reader->buf, sizeof(char), len, reader->fp) != (size_t)len ||
+		fread( &reader->cur.docid, sizeof(int), 1, reader->fp) != 1 ||
+		fread( &reader->cur.pos, sizeof(int), 1, reader->fp) != 1)
+		return -1;
+
+	reader->buf[len] = '\0';
+	reader->cur.token = reader->buf;
+	reader->cur.docid += reader->docbase;
+
+	return 1;
+}
+
+int runSpill( tRunBuilder *rb) {
+	FILE **runs;
+	FILE *fp;
+
+	if (rb->num_tokens == 0)
+		return 1;
+
+	fp = tmpfile();
+	if (fp == NULL) {
+		fprintf( stderr, "Temporary file open error\n");
+		return 0;
+	}
+
+	_sortTokens( rb);
+
+	for (int i = 0; i < rb->num_tokens; i++)
+		_writeRecord( fp, rb->tokens[i].token, rb->tokens[i].docid, rb->tokens[i].pos);
+
+	// rewind는 오류 표시를 지우므로 먼저 확인한다.
+	if (fflush(fp) != 0 || ferror(fp)) {
+		fprintf( stderr, "Temporary file write error\n");
+		fclose(fp);
+		return 0;
+	}
+
+	runs = (FILE **)realloc(rb->runs, sizeof(FILE *) * (rb->num_runs + 1));
+	if (runs == NULL) {
+		fprintf( stderr, "Out of memory\n");
+		fclose(fp);
+		return 0;
+	}
+
+	_clearTokens( rb);
+	rewind(fp);
+
+	rb->runs = runs;
+	rb->runs[rb->num_runs++] = fp;
+
+	return 1;
+}
+
+// 병합을 위한 최소 힙 (각 런의 현재 레코드를 기준으로 정렬)
+static void _reheapDown( tRunReader **heap, int last, int index) {
+	int child;
+	tRunReader *tmp;
+
+	while ((child = index * 2 + 1) <= last) {
+		if (child < last && _compare( &heap[child + 1]->cur, &heap[child]->cur) < 0)
+			child++;
+
+		if (_compare( &heap[child]->cur, &heap[index]->cur) >= 0)
+			break;
+
+		tmp = heap[index];
+		heap[index] = heap[child];
+		heap[child] = tmp;
+		index = child;
+	}
+}
+
+FILE *mergeRuns( FILE **runs, int *docbase, int num_runs, tIndexWriter *writer) {
+	tRunReader *readers;
+	FILE *out = NULL;
+	int ok = 0;
+
+	if (writer == NULL) {
+		out = tmpfile();
+		if (out == NULL) {
+			fprintf( stderr, "Temporary file open error\n");
+			return NULL;
+		}
+	}
+
+	readers = (tRunReader *)malloc(sizeof(tRunReader) * num_runs);
+	if (readers != NULL) {
+		for (int i = 0; i < num_runs; i++) {
+			readers[i].fp = runs[i];
+			readers[i].docbase = (docbase == NULL) ? 0 : docbase[i];
+		}
+		ok = mergeReaders( readers, num_runs, writer, out);
+	}
+	else
+		fprintf( stderr, "Out of memory\n");
+
+	for (int i = 0; i < num_runs; i++)
+		fclose( runs[i]);
+	free(readers);
+
+	if (!ok) {
+		fprintf( stderr, "Run file read error\n");
+		if (writer != NULL)
+			writer->error = 1;
+	}
+
+	if (out != NULL) {
+		// rewind는 오류 표시를 지우므로 먼저 확인한다.
+		if (ok && (fflush(out) != 0 || ferror(out))) {
+			fprintf( stderr, "Temporary file write error\n");
+			ok = 0;
+		}
+		if (!ok) {
+			fclose(out);
+			return NULL;
+		}
+		rewind(out);
+	}
+
+	return out;
+}
+
+int mergeReaders( tRunReader *readers, int num_readers, tIndexWriter *writer, FILE *out) {
+	tRunReader **heap;
+	int last = -1;
+	int ok = 1;
+	int r;
+
+	heap = (tRunReader **)malloc(sizeof(tRunReader *) * num_readers);
+	if (heap == NULL)
+		return 0;
+
+	for (int i = 0; i < num_readers; i++) {
+		readers[i].buf = NULL;
+		readers[i].bufsize = 0;
+
+		r = _readRecord( &readers[i]);
+		if (r > 0)
+			heap[++last] = &readers[i];
+		else if (r < 0)
+			ok = 0;
+	}
+
+	for (int i = (last - 1) / 2; i >= 0; i--)
+		_reheapDown( heap, last, i);
+
+	while (last >= 0) {
+		tRunReader *top = heap[0];
+
+		if (writer != NULL)
+			writerAdd( writer, top->cur.token, top->cur.docid, top->cur.pos);
+		else
+			_writeRecord( out, top->cur.token, top->cur.docid, top->cur.pos);
+
+		r = _readRecord( top);
+		if (r <= 0) {
+			if (r < 0)
+				ok = 0;
+			heap[0] = heap[last--];
+		}
+
+		_reheapDown( heap, last, 0);
+	}
+
+	for (int i = 0; i < num_readers; i++)
+		free( readers[i].buf);
+	free(heap);
+
+	return ok;
+}
+
+int mergeAllRuns( FILE **runs, int *docbase, int num_runs,
+					char *dicfilename, char *headerfilename, char *postingfilename, char *positionfilename) {
+	tIndexWriter writer;
+
+	while (num_runs > MAX_MERGE) {
+		int n = 0;
+
+		for (int i = 0; i < num_runs; i += MAX_MERGE) {
+			int k = (num_runs - i < MAX_MERGE) ? num_runs - i : MAX_MERGE;
+
+			// 병합된 런의 문서번호는 이미 보정되어 있음
+			runs[n] = mergeRuns( runs + i, (docbase == NULL) ? NULL : docbase + i, k, NULL);
+			if (runs[n] == NULL) {
+				// runs[i..i+k-1]은 mergeRuns가 닫았다.
+				for (int j = i + k; j < num_runs; j++)
+					fclose( runs[j]);
+				for (int j = 0; j < n; j++)
+					fclose( runs[j]);
+				return 0;
+			}
+			n++;
+		}
+		num_runs = n;
+		docbase = NULL;
+	}
+
+	if (!writerOpen( &writer, dicfilename, headerfilename, postingfilename, positionfilename)) {
+		for (int i = 0; i < num_runs; i++)
+			fclose( runs[i]);
+		return 0;
+	}
+
+	mergeRuns( runs, docbase, num_runs, &writer);
+
+	return writerClose( &writer);
+}
+
+void runDestroy( tRunBuilder *rb) {
+	free( rb->tokens);
+	arenaDestroy( &rb->strings);
+	free( rb->terms);
+	free( rb->term_hash);
+	free( rb->table);
+
+	for (int i = 0; i < rb->num_runs; i++)
+		fclose( rb->runs[i]);
+	free( rb->runs);
+	free( rb->doclen);
+}
+
+static int _compare(const void *n1, const void *n2) {
+	const tTokenDoc *ptr1 = (const tTokenDoc *)n1;
+	const tTokenDoc *ptr2 = (const tTokenDoc *)n2;
+	int cmp = strcmp(ptr1->token, ptr2->token);
+
+	if (cmp != 0)
+		return cmp;
+
+	if (ptr1->docid != ptr2->docid)
+		return (ptr1->docid > ptr2->docid) ? 1 : -1;
+
+	if (ptr1->pos > ptr2->pos)
+		return 1;
+	else if (ptr1->pos < ptr2->pos)
+		return -1;
+	else
+		return 0;
+}
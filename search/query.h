@@ -0,0 +1,536 @@
+// 불린 질의 파서
+//   expr    := and ( '|' and )*
+//   and     := not ( ['&'] not )*		(연산자 없이 이어진 텀은 AND)
+//   not     := '!' not | near
+//   near    := primary [ 'NEAR/'k primary ]	(두 피연산자는 텀)
+//   primary := '(' expr ')' | '"' TERM+ '"' | TERM | WILDCARD
+// 우선순위: NEAR > NOT > AND > OR, 같은 연산자가 이어지면 하나의 n-ary 노드로 합친다.
+// 구(phrase) "a b c"는 텀들이 이 순서로 이어서 나오는 문서,
+// a NEAR/k b는 두 텀이 (순서와 관계없이) 위치 차이 k 이내로 나오는 문서를 찾는다.
+// 텀은 색인기(tokenizer.h)와 같이 정규화한다. 구두점 등으로 나뉘는 텀(예) don't)은 나뉜 텀들의 구가 된다.
+// '*'를 포함한 텀(예) ab*, *ab, a*b)은 와일드카드 텀으로, 패턴에 맞는 사전의 텀들 중 하나라도 나오는 문서를 찾는다.
+// (구와 NEAR의 피연산자로는 쓸 수 없다.)
+// 질의 트리는 질의별 arena(arena.h)에 만들어지므로 따로 해제하지 않는다.
+
+#define Q_TERM		0
+#define Q_AND		1
+#define Q_OR		2
+#define Q_NOT		3
+#define Q_PHRASE	4
+#define Q_NEAR		5
+#define Q_WILDCARD	6
+
+#define Q_LPAREN	'('
+#define Q_RPAREN	')'
+#define Q_NOTOP		'!'
+#define Q_ANDOP		'&'
+#define Q_OROP		'|'
+#define Q_QUOTE		'"'
+#define Q_NEAROP	"NEAR/"
+#define Q_STAR		'*'
+
+// 질의 트리 노드
+typedef struct queryNode {
+	int					type;		// Q_TERM, Q_AND, Q_OR, Q_NOT, Q_PHRASE, Q_NEAR, Q_WILDCARD
+	char				*term;		// Q_TERM: 텀 문자열, Q_WILDCARD: 패턴
+	int					Hidx;		// Q_TERM: 사전 번호 (-1: 사전에 없음)
+	int					*terms;		// Q_WILDCARD: 패턴에 맞는 텀들의 사전 번호 (계획 단계에서 채움)
+	int					num_terms;	// Q_WILDCARD: terms의 수 (음수: 펼치지 못함)
+	long				cost;		// 결과 문서 수 추정치 (계획 단계에서 채움)
+	char				*key;		// 정규화한 부분 질의 문자열 (queryKey에서 채움, 결과 캐시의 키)
+	int					slop;		// Q_NEAR: 허용하는 위치 차이
+	struct queryNode	**children;
+	int					num_children;
+	int					cap_children;
+} tQNODE;
+
+// 파서 상태
+typedef struct {
+	char	*p;		// 현재 위치
+	int		error;
+	tARENA	*arena;
+} tQPARSER;
+
+////////////////////////////////////////////////////////////////////////////////
+static tQNODE *_qParseOr( tQPARSER *qp);
+
+/* allocates a query node from arena
+	return	node pointer
+			NULL if overflow
+*/
+tQNODE *queryCreateNode( tARENA *arena, int type) {
+	tQNODE *node = (tQNODE *)arenaAlloc(arena, sizeof(tQNODE));
+
+	if (node == NULL)
+		return NULL;
+
+	node->type = type;
+	node->term = NULL;
+	node->Hidx = -1;
+	node->terms = NULL;
+	node->num_terms = 0;
+	node->cost = 0;
+	node->key = NULL;
+	node->slop = 0;
+	node->children = NULL;
+	node->num_children = 0;
+	node->cap_children = 0;
+
+	return node;
+}
+
+/* appends child to node (same-type AND/OR children are flattened)
+	return	0 success
+			-1 if overflow
+*/
+int queryAddChild( tARENA *arena, tQNODE *node, tQNODE *child) {
+	if (child->type == node->type && (node->type == Q_AND || node->type == Q_OR)) {
+		for (int i = 0; i < child->num_children; i++)
+			if (queryAddChild( arena, node, child->children[i]) < 0)
+				return -1;
+		return 0;
+	}
+
+	if (node->num_children == node->cap_children) {
+		int cap = (node->cap_children == 0) ? 4 : node->cap_children * 2;
+		tQNODE **children = (tQNODE **)arenaAlloc(arena, sizeof(tQNODE *) * cap);
+
+		if (children == NULL)
+			return -1;
+		if (node->num_children > 0)
+			memcpy(children, node->children, sizeof(tQNODE *) * node->num_children);
+		node->children = children;
+		node->cap_children = cap;
+	}
+
+	node->children[node->num_children++] = child;
+	return 0;
+}
+
+static void _qSkipSpace( tQPARSER *qp) {
+	while (*qp->p == ' ' || *qp->p == '\t' || *qp->p == '\n' || *qp->p == '\r')
+		qp->p++;
+}
+
+static int _qIsTermChar( char ch) {
+	return ch != '\0' && ch != ' ' && ch != '\t' && ch != '\n' && ch != '\r' &&
+		ch != Q_LPAREN && ch != Q_RPAREN && ch != Q_NOTOP && ch != Q_ANDOP && ch != Q_OROP && ch != Q_QUOTE;
+}
+
+// 텀 조각 하나(len 바이트, 구분자 없음)를 노드로 만든다. ('*'를 포함하면 와일드카드 텀)
+// 색인기처럼 영문 대문자는 소문자로 바꾸고 TOKEN_MAX 바이트보다 긴 텀은 나머지를 버린다.
+static tQNODE *_qTermNode( tQPARSER *qp, const char *start, int len, int stars) {
+	tQNODE *node = queryCreateNode( qp->arena, (stars > 0) ? Q_WILDCARD : Q_TERM);
+
+	if (stars == 0 && len > TOKEN_MAX)
+		len = TOKEN_MAX;
+	if (node == NULL || (node->term = (char *)arenaAlloc(qp->arena, len + 1)) == NULL) {
+		qp->error = 1;
+		return NULL;
+	}
+	for (int i = 0; i < len; i++)
+		node->term[i] = (start[i] == Q_STAR) ? Q_STAR : (char)_tokenChar( start[i]);
+	node->term[len] = 0;
+
+	return node;
+}
+
+// 현재 위치의 텀 하나를 노드로 만든다.
+// 색인기(tokenizer.h)와 같이 정규화하므로 구분자(_tokenChar가 0인 바이트, '*' 제외)가 있으면 여러 조각으로 나뉜다.
+// 조각이 여럿이면 구(phrase)로 묶고 (예) don't -> "don t"), 와일드카드 조각이 있으면 AND로 묶는다.
+// '*'만으로 된 조각은 모든 텀에 맞으므로 버리고, 조각이 '*'만으로 된 것뿐이면 받지 않는다.
+// 조각이 없으면 (예) "...") 어떤 문서에도 없는 빈 텀
+static tQNODE *_qParseTerm( tQPARSER *qp) {
+	tQNODE *node = NULL;
+	tQNODE *group = NULL;
+	int wildcard = 0;
+	int only_stars = 0;
+	char *end;
+
+	if (!_qIsTermChar( *qp->p)) {
+		qp->error = 1;
+		return NULL;
+	}
+
+	for (end = qp->p; _qIsTermChar( *end); end++)
+		;
+
+	while (qp->p < end) {
+		char *start;
+		tQNODE *piece;
+		int stars = 0;
+
+		if (*qp->p != Q_STAR && _tokenChar( *qp->p) == 0) {
+			qp->p++;
+			continue;
+		}
+
+		for (start = qp->p; qp->p < end && (*qp->p == Q_STAR || _tokenChar( *qp->p) != 0); qp->p++)
+			if (*qp->p == Q_STAR)
+				stars++;
+
+		if (stars == qp->p - start) {
+			only_stars = 1;
+			continue;
+		}
+
+		piece = _qTermNode( qp, start, qp->p - start, stars);
+		if (piece == NULL)
+			return NULL;
+		if (stars > 0)
+			wildcard = 1;
+
+		if (node == NULL)
+			node = piece;
+		else {
+			if (group == NULL) {
+				group = queryCreateNode( qp->arena, Q_PHRASE);
+				if (group == NULL || queryAddChild( qp->arena, group, node) < 0) {
+					qp->error = 1;
+					return NULL;
+				}
+			}
+			if (queryAddChild( qp->arena, group, piece) < 0) {
+				qp->error = 1;
+				return NULL;
+			}
+		}
+	}
+
+	if (group != NULL) {
+		// 와일드카드 텀은 구에 넣을 수 없다.
+		if (wildcard)
+			group->type = Q_AND;
+		return group;
+	}
+	if (node == NULL) {
+		if (only_stars) {
+			qp->error = 1;
+			return NULL;
+		}
+		node = _qTermNode( qp, "", 0, 0);
+	}
+
+	return node;
+}
+
+// 구(phrase): 따옴표 안의 텀들 (텀이 하나면 텀 노드)
+static tQNODE *_qParsePhrase( tQPARSER *qp) {
+	tQNODE *node = queryCreateNode( qp->arena, Q_PHRASE);
+
+	if (node == NULL) {
+		qp->error = 1;
+		return NULL;
+	}
+
+	qp->p++;
+	while (1) {
+		tQNODE *term;
+
+		_qSkipSpace( qp);
+		if (*qp->p == Q_QUOTE)
+			break;
+
+		term = _qParseTerm( qp);
+		if (term == NULL || (term->type != Q_TERM && term->type != Q_PHRASE)) {
+			qp->error = 1;
+			return NULL;
+		}
+
+		// 나뉜 텀(구)은 그 텀들을 이어 넣고, 빈 텀은 (색인기처럼) 건너뛴다.
+		if (term->type == Q_PHRASE) {
+			for (int i = 0; i < term->num_children; i++)
+				if (queryAddChild( qp->arena, node, term->children[i]) < 0) {
+					qp->error = 1;
+					return NULL;
+				}
+		}
+		else if (term->term[0] != 0 && queryAddChild( qp->arena, node, term) < 0) {
+			qp->error = 1;
+			return NULL;
+		}
+	}
+	qp->p++;
+
+	if (node->num_children == 0) {
+		qp->error = 1;
+		return NULL;
+	}
+
+	return (node->num_children == 1) ? node->children[0] : node;
+}
+
+static tQNODE *_qParsePrimary( tQPARSER *qp) {
+	tQNODE *node;
+
+	_qSkipSpace( qp);
+
+	if (*qp->p == Q_LPAREN) {
+		qp->p++;
+		node = _qParseOr( qp);
+		_qSkipSpace( qp);
+
+		if (node == NULL || *qp->p != Q_RPAREN) {
+			qp->error = 1;
+			return NULL;
+		}
+		qp->p++;
+		return node;
+	}
+
+	if (*qp->p == Q_QUOTE)
+		return _qParsePhrase( qp);
+
+	return _qParseTerm( qp);
+}
+
+// 현재 위치가 NEAR/k 연산자이면 그 길이를, 아니면 0을 반환 (k는 slop에 저장)
+// 위치는 0 ~ INT_MAX이므로 INT_MAX보다 큰 k는 INT_MAX로 줄여도 결과가 같다.
+static int _qNearOp( tQPARSER *qp, int *slop) {
+	int len = strlen(Q_NEAROP);
+	char *p = qp->p + len;
+
+	if (strncmp(qp->p, Q_NEAROP, len) != 0 || *p < '0' || *p > '9')
+		return 0;
+
+	*slop = 0;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		int d = *p - '0';
+
+		*slop = (*slop > (INT_MAX - d) / 10) ? INT_MAX : *slop * 10 + d;
+	}
+
+	// NEAR/3abc 처럼 텀 문자가 이어지면 연산자가 아닌 텀
+	if (_qIsTermChar( *p))
+		return 0;
+
+	return p - qp->p;
+}
+
+static tQNODE *_qParseNear( tQPARSER *qp) {
+	tQNODE *node;
+	tQNODE *right;
+	tQNODE *left = _qParsePrimary( qp);
+	int slop;
+	int len;
+
+	if (left == NULL)
+		return NULL;
+
+	_qSkipSpace( qp);
+	len = _qNearOp( qp, &slop);
+	if (len == 0)
+		return left;
+	qp->p += len;
+
+	right = _qParsePrimary( qp);
+	if (right == NULL)
+		return NULL;
+
+	if (left->type != Q_TERM || right->type != Q_TERM) {
+		qp->error = 1;
+		return NULL;
+	}
+
+	node = queryCreateNode( qp->arena, Q_NEAR);
+	if (node == NULL || queryAddChild( qp->arena, node, left) < 0 || queryAddChild( qp->arena, node, right) < 0) {
+		qp->error = 1;
+		return NULL;
+	}
+	node->slop = slop;
+
+	return node;
+}
+
+static tQNODE *_qParseNot( tQPARSER *qp) {
+	tQNODE *node;
+	tQNODE *child;
+
+	_qSkipSpace( qp);
+
+	if (*qp->p != Q_NOTOP)
+		return _qParseNear( qp);
+
+	qp->p++;
+	child = _qParseNot( qp);
+	if (child == NULL)
+		return NULL;
+
+	// 이중 부정은 없앤다.
+	if (child->type == Q_NOT)
+		return child->children[0];
+
+	node = queryCreateNode( qp->arena, Q_NOT);
+	if (node == NULL || queryAddChild( qp->arena, node, child) < 0) {
+		qp->error = 1;
+		return NULL;
+	}
+
+	return node;
+}
+
+static tQNODE *_qParseAnd( tQPARSER *qp) {
+	tQNODE *node;
+	tQNODE *left = _qParseNot( qp);
+
+	if (left == NULL)
+		return NULL;
+
+	node = NULL;
+	while (1) {
+		tQNODE *right;
+
+		_qSkipSpace( qp);
+		if (*qp->p == Q_ANDOP)
+			qp->p++;
+		else if (*qp->p == '\0' || *qp->p == Q_OROP || *qp->p == Q_RPAREN)
+			break;
+		// 그 외에는 연산자 없이 이어진 텀 (AND)
+
+		right = _qParseNot( qp);
+		if (right == NULL)
+			return NULL;
+
+		if (node == NULL) {
+			node = queryCreateNode( qp->arena, Q_AND);
+			if (node == NULL || queryAddChild( qp->arena, node, left) < 0) {
+				qp->error = 1;
+				return NULL;
+			}
+		}
+		if (queryAddChild( qp->arena, node, right) < 0) {
+			qp->error = 1;
+			return NULL;
+		}
+	}
+
+	return node ? node : left;
+}
+
+static tQNODE *_qParseOr( tQPARSER *qp) {
+	tQNODE *node;
+	tQNODE *left = _qParseAnd( qp);
+
+	if (left == NULL)
+		return NULL;
+
+	node = NULL;
+	while (1) {
+		tQNODE *right;
+
+		_qSkipSpace( qp);
+		if (*qp->p != Q_OROP)
+			break;
+		qp->p++;
+
+		right = _qParseAnd( qp);
+		if (right == NULL)
+			return NULL;
+
+		if (node == NULL) {
+			node = queryCreateNode( qp->arena, Q_OR);
+			if (node == NULL || queryAddChild( qp->arena, node, left) < 0) {
+				qp->error = 1;
+				return NULL;
+			}
+		}
+		if (queryAddChild( qp->arena, node, right) < 0) {
+			qp->error = 1;
+			return NULL;
+		}
+	}
+
+	return node ? node : left;
+}
+
+/* parses query string into query tree (nodes are allocated from arena)
+	ex) "a & (b | !c)", "\"a b\" | c NEAR/3 d", "ab* & !*ing"
+	return	root node of query tree
+			NULL syntax error, empty query or overflow
+*/
+tQNODE *queryParse( tARENA *arena, char *query) {
+	tQPARSER qp;
+	tQNODE *root;
+
+	qp.p = query;
+	qp.error = 0;
+	qp.arena = arena;
+
+	root = _qParseOr( &qp);
+	_qSkipSpace( &qp);
+
+	if (root == NULL || qp.error || *qp.p != '\0')
+		return NULL;
+
+	return root;
+}
+
+static int _qCompareKey( const void *n1, const void *n2) {
+	return strcmp(*(char **)n1, *(char **)n2);
+}
+
+/* makes canonical string of query tree and stores it in key of every node
+	children of AND/OR are sorted, so equivalent queries like "b a" and "a & b" have the same key
+	ex) (AND a (OR b c)), (PHRASE a b), (NEAR/3 c d), (NOT a)
+	return	key of node (allocated from arena)
+			NULL if overflow
+*/
+char *queryKey( tARENA *arena, tQNODE *node) {
+	static const char *names[] = { "TERM", "AND", "OR", "NOT", "PHRASE", "NEAR", "WILDCARD" };
+	char **keys;
+	char *p;
+	size_t len;
+
+	if (node->type == Q_TERM || node->type == Q_WILDCARD)
+		return node->key = node->term;
+
+	keys = (char **)arenaAlloc(arena, sizeof(char *) * node->num_children);
+	if (keys == NULL)
+		return NULL;
+
+	// "(" 이름 "/slop" (" " 자식)* ")"
+	len = strlen(names[node->type]) + 16;
+	for (int i = 0; i < node->num_children; i++) {
+		keys[i] = queryKey( arena, node->children[i]);
+		if (keys[i] == NULL)
+			return NULL;
+		len += strlen(keys[i]) + 1;
+	}
+
+	if (node->type == Q_AND || node->type == Q_OR)
+		qsort( keys, node->num_children, sizeof(char *), _qCompareKey);
+
+	node->key = p = (char *)arenaAlloc(arena, len);
+	if (p == NULL)
+		return NULL;
+
+	p += sprintf(p, "(%s", names[node->type]);
+	if (node->type == Q_NEAR)
+		p += sprintf(p, "/%d", node->slop);
+	for (int i = 0; i < node->num_children; i++)
+		p += sprintf(p, " %s", keys[i]);
+	strcpy(p, ")");
+
+	return node->key;
+}
+
+/* prints query tree (for debugging)
+	ex) (AND a (OR b (NOT c))), (NEAR/3 c d)
+*/
+void queryPrint( tQNODE *node) {
+	static const char *names[] = { "TERM", "AND", "OR", "NOT", "PHRASE", "NEAR", "WILDCARD" };
+
+	if (node->type == Q_TERM || node->type == Q_WILDCARD) {
+		printf("%s", node->term);
+		return;
+	}
+
+	printf("(%s", names[node->type]);
+	if (node->type == Q_NEAR)
+		printf("/%d", node->slop);
+	for (int i = 0; i < node->num_children; i++) {
+		printf(" ");
+		queryPrint( node->children[i]);
+	}
+	printf(")");
+}
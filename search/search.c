@@ -1,58 +1,272 @@
 //#define DEBUG 1
-#define AND			'&'
-#define OR			'|'
+#define MAX_QUERY	1000
+
+#define SKIP_RATIO		32	// 텀의 df가 중간 결과보다 이만큼 크면 스킵 테이블로 교집합
+#define CURSOR_END		INT_MAX	// 커서가 포스팅 리스트 끝에 도달했을 때의 문서번호
+#define RANK_SLACK		1e-9	// 점수 상한에 더하는 상대 여유 (부동소수 오차)
+#define CACHE_MB		64		// 검색 결과 캐시의 기본 크기 (MB)
+#define MAX_EXPANSION	1024	// 와일드카드 텀 하나가 펼쳐질 수 있는 텀 수의 기본 상한
+#define MAX_CHANNELS	16		// 샤드 조정기가 동시에 보내는 질의 수의 상한 (작업 프로세스마다의 소켓 수)
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
+#include <time.h>
 
 #include "trie.h"
+#include "idxfile.h"
+#include "segment.h"
+#include "codec.h"
+#include "setops.h"
+#include "arena.h"
+#include "docset.h"
+#include "tokenizer.h"
+#include "query.h"
+#include "bm25.h"
+#include "server.h"
+#include "cache.h"
+#include "dict.h"
+#include "wildcard.h"
+#include "shard.h"
 
 // 역색인 헤더 정보에 대한 구조체
 typedef struct {
-	int		index;	// starting position in posting.idx
+	int		index;	// starting position in posting.idx (압축시 바이트 단위)
 	int		df;		// document frequency
+	float	max_weight;	// 포스팅 중 가장 큰 BM25 tf 성분 (점수 상한)
+	int		pos_index;	// starting position in position.idx (바이트 단위)
 } tHEADER;
 
+// 순위 검색 결과
+typedef struct {
+	int		doc;	// 문서번호
+	double	score;	// BM25 점수
+} tSCORED;
+
+// 점수가 높은 문서 k개를 유지하는 최소 힙 (가장 낮은 순위의 문서가 맨 앞)
+typedef struct {
+	tSCORED	*items;
+	int		num;
+	int		k;
+} tTOPK;
+
+// 텀의 포스팅 리스트를 문서번호 순으로 읽는 커서 (순위 검색, 위치 확인용)
+// 압축된 리스트는 현재 블록만 복호화하고 스킵 테이블로 건너뛴다.
+typedef struct {
+	int					codec;
+	int					df;
+	const unsigned char	*list;	// 압축된 리스트의 시작
+	const int			*docs;	// 현재 블록의 문서번호 (RAW: 리스트 전체)
+	const int			*tfs;	// 현재 블록의 tf
+	int					*block;	// 복호화 버퍼 (SKIP_BLOCK개)
+	int					*tfblock;
+	int					nb;		// 스킵 블록 수 (0이면 블록 하나)
+	int					b;		// 현재 블록 번호
+	int					cnt;	// 현재 블록의 문서 수
+	int					pos;	// 현재 블록 안의 위치
+	int					doc;	// 현재 문서번호 (끝이면 CURSOR_END)
+	double				idf;
+	double				ub;		// 이 텀이 더할 수 있는 점수의 상한 (idf * max_weight)
+} tCURSOR;
+
+// 세그먼트 하나의 색인 (segment.h, 세그먼트 목록이 없는 색인은 세그먼트 하나로 다룬다.)
+typedef struct {
+	int				id;			// 세그먼트 번호 (-1: 현재 디렉토리의 색인 파일)
+	tHEADER			*header;
+	int				*posting;
+	unsigned char	*positions;
+	int				*doclen;	// 순위 검색할 때만 매핑 (그 외에는 NULL)
+	tDICT			dict;		// 정적 사전 (dic.idx)
+	tWILDCARD		wildcard;	// 와일드카드 텀 확장 (permuterm 트라이는 처음 쓸 때 만든다.)
+	tDOCSET			deleted_set;	// 매핑된 삭제 비트맵(del.idx)의 비트맵 집합 뷰
+	tDOCSET			*deleted;	// 삭제된 문서 (없으면 NULL)
+	int				docbase;	// 세그먼트 안의 문서번호에 더하면 전체 문서번호
+	int				max_docid;	// 세그먼트 안의 가장 큰 문서번호
+	double			avgdl;		// 세그먼트의 평균 문서 길이 (색인기가 점수 상한을 계산할 때 쓴 값)
+} tSEGMENT;
+
+// 검색할 색인 (문서번호 순의 세그먼트들)
+typedef struct {
+	tSEGMENT		*segments;
+	int				num_segments;
+	unsigned int	generation;	// 세그먼트 목록의 세대 (세그먼트 목록이 없으면 0)
+	int				max_docid;	// 전체 문서번호 중 가장 큰 값
+	int				num_docs;	// 삭제되지 않은 문서 수 (순위 검색할 때만 계산)
+	long			total_doclen;	// 삭제되지 않은 문서의 토큰 수 합 (순위 검색할 때만 계산)
+	tCACHE			*cache;		// 검색 결과 캐시 (NULL: 쓰지 않음)
+} tINDEX;
+
+// 결과 캐시(cache.h)에 넣는 문서 집합의 머리 (뒤에 문서번호 배열 또는 비트맵)
+typedef struct {
+	int		type;		// DOCSET_ARRAY 또는 DOCSET_BITMAP
+	int		count;
+	int		maxdocid;
+	int		reserved;	// 비트맵을 8바이트 경계에 맞춘다.
+} tCACHEDSET;
+
+// 샤드 조정기 (샤드 목록(shards.txt)이 있을 때, shard.h)
+// 채널마다 모든 작업 프로세스와 연결된 소켓이 하나씩 있고, 질의 서버의 작업 스레드는 쉬는 채널 하나를 빌려 질의를 보낸다.
+typedef struct {
+	tSHARDMAP		map;
+	int				*fds;		// 작업 프로세스와 연결된 소켓 (샤드 s의 채널 c: fds[s * num_channels + c])
+	pid_t			*pids;
+	int				num_channels;
+	int				*idle;		// 쉬는 채널들 (스택)
+	int				num_idle;
+	pthread_mutex_t	lock;		// idle을 보호 (질의를 주고받는 동안에는 잡지 않는다.)
+	pthread_cond_t	ready;		// 쉬는 채널이 생겼다.
+} tCOORD;
+
+// 샤드 작업 프로세스의 설정 (shardSpawn의 ctx)
+typedef struct {
+	int		rank_k;		// 0보다 크면 순위 검색
+	int		cache_mb;	// 작업 프로세스마다의 검색 결과 캐시 크기 (MB)
+} tSHARDOPT;
+
+// 질의 서버의 작업 스레드들이 함께 쓰는 검색 정보 (읽기 전용)
+typedef struct {
+	tINDEX	*index;
+	int		rank_k;		// 0보다 크면 순위 검색
+	tCOORD	*coord;		// NULL이 아니면 색인 대신 샤드 조정기로 질의를 처리
+} tSERVICE;
+
+// 문서 길이의 평균 (load_doclen, load_segments에서 계산)
+static double avg_doclen = 1;
+
+// 와일드카드 텀 하나가 펼쳐질 수 있는 텀 수의 상한 (넘으면 질의를 처리하지 않는다.)
+static int max_expansion = MAX_EXPANSION;
+
 ////////////////////////////////////////////////////////////////////////////////
-// 헤더 정보가 저장된 파일(예) "header.idx")을 읽어 메모리에 저장한다.
-// 헤더 구조체 메모리를 할당하고 그 주소를 반환
-// 실패시 NULL을 반환
+// 헤더 정보가 저장된 파일(예) "header.idx")을 메모리에 매핑(mmap)한다.
+// 매핑된 헤더 구조체 배열의 주소를 반환 (unload_index로 해제)
+// 실패시 NULL을 반환 (파일 헤더가 맞지 않거나 잘린 파일인 경우 포함)
 tHEADER *load_header( char *filename);
 
-// 포스팅 리스트가 저장된 파일(예) "posting.idx")를 읽어 메모리에 저장한다.
-// 포스팅 리스트(int arrary) 메모리를 할당하고 그 주소를 반환
-// 실패시 NULL을 반환
+// 포스팅 리스트가 저장된 파일(예) "posting.idx")를 메모리에 매핑(mmap)한다.
+// 매핑된 포스팅 리스트(int arrary)의 주소를 반환 (unload_index로 해제)
+// 실패시 NULL을 반환 (파일 헤더가 맞지 않거나 잘린 파일인 경우 포함)
 int *load_posting( char *filename);
 
-// 문서 집합을 화면에 출력한다.
-void showDocuments( int *docs, int numdocs);
+// 텀 위치 정보가 저장된 파일(예) "position.idx")을 메모리에 매핑(mmap)한다.
+// 매핑된 위치 정보(바이트 배열)의 주소를 반환 (unload_index로 해제)
+// 실패시 NULL을 반환
+unsigned char *load_positions( char *filename);
 
-// 두 문서 집합의 교집합을 구한다.
-// 교집합을 위한 메모리를 할당하고 그 주소를 반환
+// 문서별 토큰 수가 저장된 파일(예) "doclen.idx")을 메모리에 매핑(mmap)하고 평균 문서 길이를 계산한다.
+// 문서번호로 바로 찾을 수 있는 int 배열의 주소를 반환 (unload_index로 해제)
 // 실패시 NULL을 반환
-// 교집합의 문서 수는 newnumdocs에 저장한다.
-int *intersectDocuments( int *docs, int numdocs, int *docs2, int numdocs2, int *newnumdocs);
+int *load_doclen( char *filename);
+
+// load_header, load_posting, load_positions, load_doclen으로 매핑한 파일을 해제한다.
+void unload_index( void *data);
+
+// 색인을 메모리에 매핑한다.
+// 세그먼트 목록(segments.txt)이 있으면 모든 세그먼트를, 없으면 현재 디렉토리의 색인 파일을 매핑한다.
+// ranked이면 순위 검색을 위해 문서 길이도 매핑하고 삭제되지 않은 문서로 평균 문서 길이와 문서 수를 계산한다.
+// 실패시 0을 반환
+int load_segments( tINDEX *index, int ranked);
+
+// load_segments로 매핑한 색인을 해제한다.
+void unload_segments( tINDEX *index);
+
+// 세그먼트 목록의 세대가 바뀌었으면 (색인기가 세그먼트를 더하거나 지우거나 병합했으면) 색인을 다시 매핑한다.
+// 새 색인을 모두 매핑한 뒤에 바꾸므로 실패하면 이전 색인을 그대로 쓴다.
+// 다시 매핑했으면 1, 아니면 0을 반환
+int reload_segments( tINDEX *index, int ranked);
 
-// 두 문서 집합의 합집합을 구한다.
-// 합집합을 위한 메모리를 할당하고 그 주소를 반환
+// 문서 집합을 fp(화면 또는 서버 응답)에 한 줄로 출력한다.
+void showDocuments( FILE *fp, tDOCSET *docs);
+
+// 문서 집합과 텀(header[Hidx])의 포스팅 리스트의 교집합을 구한다.
+// 포스팅 리스트를 모두 복호화하지 않고 스킵 테이블로 필요한 블록만 복호화한다.
+// 교집합을 위한 메모리를 arena에서 할당하고 그 주소를 반환 (arenaReset까지 유효)
 // 실패시 NULL을 반환
-// 합집합의 문서 수는 newnumdocs에 저장한다.
-int *unionDocuments( int *docs, int numdocs, int *docs2, int numdocs2, int *newnumdocs);
+// 교집합의 문서 수는 newnumdocs에 저장한다.
+int *intersectPosting( tARENA *arena, const int *docs, int numdocs, tHEADER *header, int *posting, int Hidx, int *newnumdocs);
 
 // 단일 텀(single term)을 검색하여 문서를 찾는다.
-// 문서 집합을 위한 메모리를 할당하고 그 주소를 반환
+// 압축하지 않은 색인이면 복사하지 않고 매핑된 posting 배열 안의 포스팅 리스트를 가리키는 배열 집합(뷰)을 반환
+// 압축된 색인이면 arena에 복호화하여 반환 (arenaReset까지 유효)
 // 실패시 NULL을 반환
-// 검색된 문서 수는 newnumdocs에 저장한다.
-int *getDocuments( tHEADER *header, int *posting, TRIE *trie, char *term, int *numdocs);
+tDOCSET *getDocuments( tHEADER *header, int *posting, tDICT *dict, char *term, tARENA *arena);
 
 // 질의(query)를 검색하여 문서를 찾는다.
-// 질의는 단일 텀 또는 하나 이상의 불린 연산자('&' 또는 '|')를 포함한 질의가 될 수 있다.
-// 문서 집합을 위한 메모리를 할당하고 그 주소를 반환
-// 실패시 NULL을 반환
-// 검색된 문서 수는 newnumdocs에 저장한다.
-int *searchDocuments( tHEADER *header, int *posting, TRIE *trie, char *query, int *numdocs);
+// 질의는 단일 텀 또는 불린 연산자('&', '|', '!')와 괄호를 포함한 질의가 될 수 있다.
+// 연산자 우선순위는 '!' > '&' > '|'이며 연산자 없이 이어진 텀은 '&'로 처리한다.
+// 구("a b c")와 근접 연산자(a NEAR/k b)는 위치 정보(positions)로 확인한다.
+// 와일드카드 텀(ab*, *ab, a*b)은 세그먼트마다 패턴에 맞는 텀들(max_expansion개까지)로 펼쳐 포스팅 리스트의 합집합을 구한다.
+// 질의 트리를 만든 뒤 df로 비용을 추정하여 교집합은 드문 텀부터 계산하고
+// 중간 결과가 비면 나머지 연산을 생략한다.
+// 세그먼트마다 질의를 처리하고 삭제된 문서를 뺀 뒤 전체 문서번호로 합친다.
+// 텀의 문서 집합은 포스팅 리스트의 뷰를 쓰고 질의 트리와 중간 결과는 arena에서 할당하므로
+// 질의를 처리한 뒤 arenaReset으로 한꺼번에 해제한다.
+// 결과 캐시가 있으면 정규화한 질의의 결과와 세그먼트별 부분 질의(예) 자주 쓰는 두 텀의 교집합)의 결과를 캐시한다.
+// 결과 문서 집합의 주소를 반환 (arenaReset까지 유효)
+// 실패시 (찾은 문서가 없는 경우 포함) NULL을 반환
+tDOCSET *searchDocuments( tINDEX *index, char *query, tARENA *arena);
+
+// 질의(query)에 맞는 문서를 BM25 점수로 순위를 매겨 상위 k개를 찾는다.
+// 텀들의 OR 질의(예) "a | b | c")는 WAND로 점수 상한이 k번째 점수를 넘지 못하는 문서를 건너뛰고
+// 그 밖의 불린 질의는 searchDocuments와 같은 결과 집합의 문서만 점수를 매긴다.
+// 점수는 NOT 아래에 있지 않은 텀들로 계산한다. (와일드카드 텀은 점수에 더하지 않고 결과 집합만 거른다.)
+// idf와 평균 문서 길이는 모든 세그먼트를 합친 값을 쓰므로 세그먼트가 나뉘어 있어도 점수가 같다.
+// 결과 캐시가 있으면 정규화한 질의와 k로 결과를 캐시한다.
+// 결과 배열의 주소를 반환 (점수 내림차순, 같은 점수는 문서번호 오름차순, arenaReset까지 유효)
+// 실패시 (찾은 문서가 없는 경우 포함) NULL을 반환
+// 찾은 문서 수는 numresults에 저장한다.
+tSCORED *rankDocuments( tINDEX *index, char *query, int k, tARENA *arena, int *numresults);
+
+// rankDocuments와 같지만 idf를 이 색인의 df 대신 dfs(termStats의 텀 순서로 num_dfs개, NULL이면 이 색인의 df)로 계산한다.
+// 샤드의 작업 프로세스가 모든 샤드의 df를 합친 값으로 점수를 매길 때 쓴다.
+tSCORED *rankDocumentsStats( tINDEX *index, char *query, int k, const int *dfs, int num_dfs, tARENA *arena,
+							int *numresults);
+
+// 순위 검색에서 점수를 매길 텀들(NOT 아래에 있지 않은 텀, 사전 순으로 중복 없이)의 df를 모든 세그먼트에서 합해 dfs에 저장한다.
+// 텀 수를 반환 (실패시 -1, dfs는 arena에서 할당)
+int termStats( tINDEX *index, char *query, tARENA *arena, int **dfs);
+
+// 순위 검색 결과를 fp(화면 또는 서버 응답)에 한 줄로 출력한다.
+void showRanked( FILE *fp, tSCORED *results, int numresults);
+
+// 질의 하나를 처리하여 결과를 fp에 한 줄로 출력한다. (rank_k > 0이면 상위 rank_k개 순위 검색)
+void answerQuery( tINDEX *index, int rank_k, char *query, tARENA *arena, FILE *fp);
+
+// 샤드 목록의 샤드마다 작업 프로세스를 num_channels개의 채널로 띄우고 전체 문서 수와 문서 길이의 합을 작업 프로세스들에 알린다.
+// 실패시 0을 반환
+int coordOpen( tCOORD *coord, tSHARDOPT *opt, int num_channels);
+
+// 샤드 작업 프로세스 (shard.h의 tSHARDFN, ctx는 tSHARDOPT)
+// 샤드 디렉토리의 색인을 매핑하고 채널마다 스레드 하나가 조정기가 보낸 요청(불린 검색, df, 순위 검색)을 끝날 때까지 처리한다.
+int shardServe( void *ctx, int *fds, int num_fds, int shard);
+
+// 질의 하나를 모든 샤드에 보내고 결과를 전체 문서번호로 합쳐 fp에 한 줄로 출력한다. (answerQuery와 같은 출력)
+// 순위 검색은 샤드들의 df를 먼저 모아 더한 뒤 모든 샤드가 같은 idf로 점수를 매긴 상위 rank_k개씩을 합친다.
+void coordAnswer( tCOORD *coord, int rank_k, char *query, tARENA *arena, FILE *fp);
+
+// 작업 프로세스들을 끝내고 조정기를 닫는다.
+void coordClose( tCOORD *coord);
+
+// 질의 서버의 질의 처리 함수 (server.h의 tSERVERFN, ctx는 tSERVICE)
+// 작업 스레드들이 동시에 부른다.
+void serveQuery( void *ctx, char *query, tARENA *arena, FILE *out);
+
+// 질의 서버의 통계 출력 함수 (server.h의 tSERVERREPORTFN, ctx는 tSERVICE)
+// 결과 캐시의 적중률을 출력한다.
+void reportService( void *ctx);
+
+// df 차이가 큰 텀 쌍의 교집합 속도를 방식별로 측정하여 출력한다.
+// (선형 병합, 지수 탐색, 스킵 테이블)
+void benchIntersect( tHEADER *header, int *posting);
+
+// 흔한 텀들의 OR 질의로 상위 k개 순위 검색 속도를 측정하여 출력한다.
+// (결과 집합 전체에 점수를 매기는 방식, WAND)
+void benchRank( tHEADER *header, int *posting, int *doclen);
+
+// df가 큰 텀 쌍의 교집합/합집합 속도를 커널(스칼라, SSE, AVX2)별로 측정하여 출력한다.
+// 같은 텀 쌍을 밀도에 맞는 DocSet 표현(비트맵 등)으로 연산한 결과도 함께 출력한다.
+void benchSetops( tHEADER *header, int *posting);
 
 ////////////////////////////////////////////////////////////////////////////////
 static char *rtrim( char *str)
@@ -92,357 +306,2317 @@ static char *trim( char *str)
 ////////////////////////////////////////////////////////////////////////////////
 int main( int argc, char **argv)
 {
-	tHEADER *header;
-	int *posting;
-	TRIE *trie;
-	char query[100];
-	int index;
+	tINDEX index;
+	tARENA arena;
+	tCACHE cache;
+	char query[MAX_QUERY];
+	char *address = NULL;
+	int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int cache_mb = CACHE_MB;
+	int rank_k = 0;
+	int verify = 0;
+	int bench = 0;
+	
+	setopsInit( -1);
 	
-	header = load_header( "header.idx");
-	if (header == NULL) return 1;
+	for (int i = 1; i < argc; i++)
+	{
+		// -s LEVEL: 집합 연산 커널 지정 (0: 스칼라, 1: SSE4.2, 2: AVX2)
+		if (strcmp( argv[i], "-s") == 0 && i + 1 < argc)
+		{
+			setopsInit( atoi( argv[++i]));
+		}
+		// -c: 색인 파일 전체를 읽어 체크섬을 검사한다.
+		else if (strcmp( argv[i], "-c") == 0)
+		{
+			verify = 1;
+		}
+		// -k K: BM25 순위 검색 (상위 K개 문서)
+		else if (strcmp( argv[i], "-k") == 0 && i + 1 < argc)
+		{
+			rank_k = atoi( argv[++i]);
+			if (rank_k <= 0)
+			{
+				fprintf( stderr, "Invalid number of results:%s\n", argv[i]);
+				return 2;
+			}
+		}
+		// -b: 교집합 벤치마크 (첫 세그먼트)
+		else if (strcmp( argv[i], "-b") == 0)
+		{
+			bench = 1;
+		}
+		// -S ADDRESS: 질의 서버 (Unix 도메인 소켓 경로 또는 [HOST:]PORT)
+		else if (strcmp( argv[i], "-S") == 0 && i + 1 < argc)
+		{
+			address = argv[++i];
+		}
+		// -w WORKERS: 질의 서버의 작업 스레드 수 (기본: CPU 수)
+		else if (strcmp( argv[i], "-w") == 0 && i + 1 < argc)
+		{
+			num_workers = atoi( argv[++i]);
+			if (num_workers <= 0)
+			{
+				fprintf( stderr, "Invalid number of workers:%s\n", argv[i]);
+				return 2;
+			}
+		}
+		// -e TERMS: 와일드카드 텀 하나가 펼쳐질 수 있는 텀 수의 상한
+		else if (strcmp( argv[i], "-e") == 0 && i + 1 < argc)
+		{
+			max_expansion = atoi( argv[++i]);
+			if (max_expansion <= 0)
+			{
+				fprintf( stderr, "Invalid number of expansion terms:%s\n", argv[i]);
+				return 2;
+			}
+		}
+		// -C MB: 검색 결과 캐시 크기 (0이면 쓰지 않음)
+		else if (strcmp( argv[i], "-C") == 0 && i + 1 < argc)
+		{
+			cache_mb = atoi( argv[++i]);
+			if (cache_mb < 0)
+			{
+				fprintf( stderr, "Invalid cache size:%s\n", argv[i]);
+				return 2;
+			}
+		}
+	}
 	
-	posting = load_posting( "posting.idx");
-	if (posting == NULL) return 1;
+	// 샤드 색인 (index -n): 샤드마다 작업 프로세스를 띄우고 질의를 모든 샤드에 보내 결과를 합친다.
+	// 결과 캐시는 작업 프로세스마다 -C 크기로 둔다.
+	if (access( SHARD_MANIFEST, F_OK) == 0)
+	{
+		tSHARDOPT opt = { rank_k, cache_mb };
+		tCOORD coord;
+		int ret = 1;
+		
+		if (verify || bench)
+		{
+			fprintf( stderr, "-c and -b are not supported for a sharded index (run them in a shard directory)\n");
+			return 2;
+		}
+		
+		// 질의 서버이면 작업 스레드들이 동시에 질의를 보내도록 채널을 작업 스레드 수만큼 둔다.
+		if (!coordOpen( &coord, &opt, (address == NULL) ? 1 : (num_workers < MAX_CHANNELS) ? num_workers : MAX_CHANNELS)) return 1;
+		
+		if (address != NULL)
+		{
+			tSERVICE service = { NULL, rank_k, &coord };
+			tSERVER server;
+			
+			ret = 0;
+			if (serverOpen( &server, address, num_workers, MAX_QUERY, serveQuery, &service))
+			{
+				server.report = reportService;
+				ret = serverRun( &server);
+				serverClose( &server);
+			}
+		}
+		else
+		{
+			arenaInit( &arena);
+			
+			printf( "\nQuery: ");
+			while (fgets( query, MAX_QUERY, stdin) != NULL)
+			{
+				coordAnswer( &coord, rank_k, query, &arena, stdout);
+				
+				arenaReset( &arena);
+				printf( "\nQuery: ");
+			}
+			
+			arenaDestroy( &arena);
+		}
 		
-	trie = dic2trie( "dic.txt");
+		coordClose( &coord);
+		return ret ? 0 : 1;
+	}
 	
-	printf( "\nQuery: ");
-	while (fgets( query, 100, stdin) != NULL)
+	if (!load_segments( &index, rank_k > 0)) return 1;
+	
+	if (verify)
+	{
+		for (int i = 0; i < index.num_segments; i++)
+		{
+			tSEGMENT *seg = &index.segments[i];
+			
+			if (!idxVerify( seg->header) || !idxVerify( seg->posting) || !idxVerify( seg->positions) ||
+				(seg->doclen != NULL && !idxVerify( seg->doclen)) ||
+				(seg->deleted != NULL && !idxVerify( seg->deleted->words)))
+			{
+				fprintf( stderr, "Index checksum mismatch\n");
+				return 1;
+			}
+		}
+	}
+	
+	if (bench)
 	{
-		int numdocs;
-		int *docs = searchDocuments( header, posting, trie, query, &numdocs);
+		tSEGMENT *seg = &index.segments[0];
+		char path[SEG_PATH];
+		int *doclen;
 		
-		if (docs == NULL) printf( "not found!\n");
-		else 
+		benchIntersect( seg->header, seg->posting);
+		benchSetops( seg->header, seg->posting);
+		doclen = load_doclen( segmentPath( path, seg->id, "doclen.idx"));
+		if (doclen != NULL)
+		{
+			benchRank( seg->header, seg->posting, doclen);
+			unload_index( doclen);
+		}
+		unload_segments( &index);
+		return 0;
+	}
+	
+	if (cache_mb > 0)
+	{
+		if (!cacheInit( &cache, (size_t)cache_mb << 20)) return 1;
+		index.cache = &cache;
+	}
+	
+	// 색인을 한 번 읽어 두고 여러 클라이언트의 질의를 동시에 처리한다.
+	if (address != NULL)
+	{
+		tSERVICE service = { &index, rank_k, NULL };
+		tSERVER server;
+		int ret = 0;
+		
+		if (serverOpen( &server, address, num_workers, MAX_QUERY, serveQuery, &service))
 		{
-			showDocuments( docs, numdocs);
-			free( docs);
+			server.report = reportService;
+			ret = serverRun( &server);
+			serverClose( &server);
 		}
+		unload_segments( &index);
+		if (index.cache != NULL) cacheDestroy( index.cache);
+		return ret ? 0 : 1;
+	}
+	
+	arenaInit( &arena);
+	
+	printf( "\nQuery: ");
+	while (fgets( query, MAX_QUERY, stdin) != NULL)
+	{
+		// 색인기가 세그먼트를 바꿨으면 새 색인으로 검색한다. (캐시는 세대가 바뀌어 비워진다.)
+		reload_segments( &index, rank_k > 0);
+		
+		answerQuery( &index, rank_k, query, &arena, stdout);
+		
+		// 질의에 쓴 메모리를 한꺼번에 해제
+		arenaReset( &arena);
 		printf( "\nQuery: ");
 	}
 	
-	free( header);
-	free( posting);
-	trieDestroy( trie);
+	unload_segments( &index);
+	arenaDestroy( &arena);
+	if (index.cache != NULL)
+	{
+		cacheReport( index.cache, "cache");
+		cacheDestroy( index.cache);
+	}
 	
 	return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// 헤더 정보가 저장된 파일(예) "header.idx")을 읽어 메모리에 저장한다.
-// 헤더 구조체 메모리를 할당하고 그 주소를 반환
-// 실패시 NULL을 반환
+// 헤더 정보가 저장된 파일(예) "header.idx")을 메모리에 매핑(mmap)한다.
+// 매핑된 헤더 구조체 배열의 주소를 반환 (unload_index로 해제)
+// 실패시 NULL을 반환 (파일 헤더가 맞지 않거나 잘린 파일인 경우 포함)
 tHEADER *load_header( char *filename) {
-	FILE *fp;
-	tHEADER *header;
-	int size;
+	tHEADER *header = (tHEADER *)idxMap( filename, IDX_MAGIC_HEADER);
 
-	fp = fopen(filename, "rb");
+	if (header == NULL)
+		return NULL;
 
-	if (fp == NULL) {
-		fprintf( stderr, "File open error:%s\n", filename);
+	if (idxFileHeader( header)->size != sizeof(tHEADER) * idxFileHeader( header)->count) {
+		fprintf( stderr, "Invalid index file:%s\n", filename);
+		idxUnmap( header);
 		return NULL;
 	}
-	
-	fseek(fp, 0, SEEK_END);
-	size = ftell(fp);
-	size = size / sizeof(tHEADER);
-	fseek(fp, 0, SEEK_SET);
-	header = (tHEADER *)malloc(sizeof(tHEADER) * size);
-
-	fread(header, sizeof(tHEADER), size, fp);
-
-	fclose(fp);
 
 	return header;
 }
 
-// 포스팅 리스트가 저장된 파일(예) "posting.idx")를 읽어 메모리에 저장한다.
-// 포스팅 리스트(int arrary) 메모리를 할당하고 그 주소를 반환
-// 실패시 NULL을 반환
+// 포스팅 리스트가 저장된 파일(예) "posting.idx")를 메모리에 매핑(mmap)한다.
+// 매핑된 포스팅 리스트(int arrary)의 주소를 반환 (unload_index로 해제)
+// 압축된 파일(codec != CODEC_RAW)이면 바이트 배열로 다루어야 한다.
+// 실패시 NULL을 반환 (파일 헤더가 맞지 않거나 잘린 파일인 경우 포함)
 int *load_posting( char *filename) {
-	FILE *fp;
-	int *posting;
-	int size;
+	int *posting = (int *)idxMap( filename, IDX_MAGIC_POSTING);
+	tFILEHEADER *fh;
 
-	fp = fopen(filename, "rb");
+	if (posting == NULL)
+		return NULL;
 
-	if (fp == NULL) {
-		fprintf( stderr, "File open error:%s\n", filename);
+	fh = idxFileHeader( posting);
+	if ((fh->codec == CODEC_RAW && fh->size != 2 * sizeof(int) * fh->count) ||
+		fh->codec > CODEC_SVB) {
+		fprintf( stderr, "Invalid index file:%s\n", filename);
+		idxUnmap( posting);
 		return NULL;
 	}
-	fseek(fp, 0, SEEK_END);
-	size = ftell(fp);
-	size = size / sizeof(int);
-	fseek(fp, 0, SEEK_SET);
-	posting = (int *)malloc(sizeof(int) * size);
-	fread(posting, sizeof(int), size, fp);
 
-	fclose(fp);
+	codecInit();
 
 	return posting;
 }
 
-// 문서 집합을 화면에 출력한다.
-void showDocuments( int *docs, int numdocs) {
-	for (int i = 0; i < numdocs; i++) {
-		printf(" %d", docs[i]);
-	}
-	printf("\n");
+// 텀 위치 정보가 저장된 파일(예) "position.idx")을 메모리에 매핑(mmap)한다.
+// 매핑된 위치 정보(바이트 배열)의 주소를 반환 (unload_index로 해제)
+// 실패시 NULL을 반환
+unsigned char *load_positions( char *filename) {
+	return (unsigned char *)idxMap( filename, IDX_MAGIC_POSITION);
+}
+
+// 문서 길이의 평균 (색인기의 평균 문서 길이와 같은 방식)
+static double _averageLength( int *doclen, int num_docs) {
+	long total = 0;
+
+	for (int i = 1; i <= num_docs; i++)
+		total += doclen[i];
+	return (num_docs > 0 && total > 0) ? (double)total / num_docs : 1;
 }
 
-// 두 문서 집합의 교집합을 구한다.
-// 교집합을 위한 메모리를 할당하고 그 주소를 반환
+// 문서별 토큰 수가 저장된 파일(예) "doclen.idx")을 메모리에 매핑(mmap)하고 평균 문서 길이를 계산한다.
+// 문서번호로 바로 찾을 수 있는 int 배열의 주소를 반환 (unload_index로 해제)
 // 실패시 NULL을 반환
-// 교집합의 문서 수는 newnumdocs에 저장한다.
-int *intersectDocuments( int *docs, int numdocs, int *docs2, int numdocs2, int *newnumdocs) {
-	int i = 0;
-	int j = 0;
-	int idx = -1;
-	int nt = 0;
-	int *result;
+int *load_doclen( char *filename) {
+	int *doclen = (int *)idxMap( filename, IDX_MAGIC_DOCLEN);
+	tFILEHEADER *fh;
 
-	if ((docs == NULL) || (docs2 == NULL)) {
-		*newnumdocs = 0;
+	if (doclen == NULL)
+		return NULL;
+
+	fh = idxFileHeader( doclen);
+	if (fh->size != sizeof(int) * (fh->count + 1)) {
+		fprintf( stderr, "Invalid index file:%s\n", filename);
+		idxUnmap( doclen);
 		return NULL;
 	}
 
-	result = (int *)malloc(sizeof(int) * 100);
+	avg_doclen = _averageLength( doclen, fh->count);
 
-	if (result == NULL) {
-		*newnumdocs = 0;
-		return NULL;
+	return doclen;
+}
+
+// load_header, load_posting, load_positions, load_doclen으로 매핑한 파일을 해제한다.
+void unload_index( void *data) {
+	idxUnmap( data);
+}
+
+// 세그먼트(id, 전체 문서번호 docbase+1부터)의 색인 파일을 매핑한다.
+// 삭제된 문서가 있으면(num_deleted > 0) 삭제 비트맵도 매핑한다.
+// 실패시 0을 반환 (매핑한 파일은 _unloadSegment로 해제)
+static int _loadSegment( tSEGMENT *seg, int id, int docbase, int num_deleted, int ranked) {
+	char path[SEG_PATH];
+
+	memset(seg, 0, sizeof(tSEGMENT));
+	wildcardInit( &seg->wildcard, segmentPath( path, id, WILDCARD_FILE));
+	seg->id = id;
+	seg->docbase = docbase;
+	seg->avgdl = 1;
+
+	seg->header = load_header( segmentPath( path, id, "header.idx"));
+	if (seg->header == NULL)
+		return 0;
+
+	seg->posting = load_posting( segmentPath( path, id, "posting.idx"));
+	if (seg->posting == NULL)
+		return 0;
+	seg->max_docid = idxFileHeader( seg->posting)->num_docs;
+
+	seg->positions = load_positions( segmentPath( path, id, "position.idx"));
+	if (seg->positions == NULL)
+		return 0;
+
+	if (ranked) {
+		seg->doclen = load_doclen( segmentPath( path, id, "doclen.idx"));
+		if (seg->doclen == NULL)
+			return 0;
+		seg->avgdl = _averageLength( seg->doclen, idxFileHeader( seg->doclen)->count);
 	}
 
-	while ((i < numdocs) && (j < numdocs2)) {
-		if (docs[i] < docs2[j])
-			i++;
-		else if (docs[i] > docs2[j])
-			j++;
-		else {
-			idx++;
-			if (idx % 100 == 0) {
-				nt++;
-				result = (int *)realloc(result, sizeof(int) * 100 * nt);
-			}
-			if (result == NULL)	{
-				*newnumdocs = 0;
-				return NULL;
+	if (num_deleted > 0) {
+		uint64_t *words = (uint64_t *)idxMap( segmentPath( path, id, SEG_DELETED), IDX_MAGIC_DELETED);
+		tFILEHEADER *fh;
+
+		if (words == NULL)
+			return 0;
+
+		fh = idxFileHeader( words);
+		if (fh->num_docs != (unsigned int)seg->max_docid ||
+			fh->size != sizeof(uint64_t) * segmentDeletedWords( seg->max_docid)) {
+			fprintf( stderr, "Invalid index file:%s\n", path);
+			idxUnmap( words);
+			return 0;
+		}
+
+		seg->deleted_set.type = DOCSET_BITMAP;
+		seg->deleted_set.count = fh->count;
+		seg->deleted_set.maxdocid = seg->max_docid;
+		seg->deleted_set.words = words;
+		seg->deleted = &seg->deleted_set;
+	}
+
+	if (!dictMap( &seg->dict, segmentPath( path, id, "dic.idx")))
+		return 0;
+	if (seg->dict.num_terms != idxFileHeader( seg->header)->count) {
+		fprintf( stderr, "Invalid index file:%s\n", path);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void _unloadSegment( tSEGMENT *seg) {
+	unload_index( seg->header);
+	unload_index( seg->posting);
+	unload_index( seg->positions);
+	unload_index( seg->doclen);
+	if (seg->deleted != NULL)
+		idxUnmap( seg->deleted->words);
+	dictUnmap( &seg->dict);
+	wildcardDestroy( &seg->wildcard);
+}
+
+// 색인을 메모리에 매핑한다.
+// 세그먼트 목록(segments.txt)이 있으면 모든 세그먼트를, 없으면 현재 디렉토리의 색인 파일을 매핑한다.
+// ranked이면 순위 검색을 위해 문서 길이도 매핑하고 삭제되지 않은 문서로 평균 문서 길이와 문서 수를 계산한다.
+// 실패시 0을 반환
+int load_segments( tINDEX *index, int ranked) {
+	tMANIFEST m;
+	long total = 0;
+	int ret = 1;
+
+	manifestInit( &m);
+	if (access(SEG_MANIFEST, F_OK) == 0) {
+		if (!manifestRead( &m, SEG_MANIFEST))
+			return 0;
+		if (m.num_segs == 0) {
+			fprintf( stderr, "Empty segment list:%s\n", SEG_MANIFEST);
+			return 0;
+		}
+	}
+	else {
+		// 세그먼트 목록이 없는 색인 (index FILE)
+		tSEGINFO *seg = manifestAdd( &m);
+
+		if (seg == NULL)
+			return 0;
+		seg->id = -1;
+	}
+
+	index->segments = (tSEGMENT *)calloc(m.num_segs, sizeof(tSEGMENT));
+	index->num_segments = 0;
+	index->generation = m.generation;
+	index->max_docid = 0;
+	index->num_docs = 0;
+	index->total_doclen = 0;
+	index->cache = NULL;
+	if (index->segments == NULL) {
+		manifestFree( &m);
+		return 0;
+	}
+
+	for (int i = 0; i < m.num_segs && ret; i++) {
+		tSEGMENT *seg = &index->segments[index->num_segments++];
+
+		ret = _loadSegment( seg, m.segs[i].id, m.segs[i].docbase, m.segs[i].num_deleted, ranked);
+		if (ret && seg->docbase + seg->max_docid > index->max_docid)
+			index->max_docid = seg->docbase + seg->max_docid;
+	}
+	manifestFree( &m);
+
+	if (!ret) {
+		unload_segments( index);
+		return 0;
+	}
+
+	if (ranked) {
+		// 전체 문서 수와 평균 문서 길이는 삭제되지 않은 문서로 계산한다.
+		for (int i = 0; i < index->num_segments; i++) {
+			tSEGMENT *seg = &index->segments[i];
+			int count = idxFileHeader( seg->doclen)->count;
+
+			for (int d = 1; d <= count; d++) {
+				if (seg->deleted == NULL || !docsetContains( seg->deleted, d)) {
+					total += seg->doclen[d];
+					index->num_docs++;
+				}
 			}
-			result[idx] = docs[i];
-			i++;	j++;
 		}
-		*newnumdocs = idx + 1;
+		index->total_doclen = total;
+		avg_doclen = (index->num_docs > 0 && total > 0) ? (double)total / index->num_docs : 1;
 	}
 
-	return result;
+	return 1;
+}
+
+// load_segments로 매핑한 색인을 해제한다.
+void unload_segments( tINDEX *index) {
+	for (int i = 0; i < index->num_segments; i++)
+		_unloadSegment( &index->segments[i]);
+	free(index->segments);
+	index->segments = NULL;
+	index->num_segments = 0;
+}
+
+// 세그먼트 목록의 세대가 바뀌었으면 (색인기가 세그먼트를 더하거나 지우거나 병합했으면) 색인을 다시 매핑한다.
+// 새 색인을 모두 매핑한 뒤에 바꾸므로 실패하면 이전 색인을 그대로 쓴다.
+// 다시 매핑했으면 1, 아니면 0을 반환
+int reload_segments( tINDEX *index, int ranked) {
+	tMANIFEST m;
+	tINDEX fresh;
+	int changed;
+
+	// 세그먼트 목록이 없는 색인은 바뀌지 않는다.
+	if (index->segments[0].id < 0 || !manifestRead( &m, SEG_MANIFEST))
+		return 0;
+	changed = (m.generation != index->generation);
+	manifestFree( &m);
+
+	if (!changed || !load_segments( &fresh, ranked))
+		return 0;
+
+	fresh.cache = index->cache;
+	unload_segments( index);
+	*index = fresh;
+
+	return 1;
+}
+
+// 문서 집합을 fp(화면 또는 서버 응답)에 한 줄로 출력한다.
+void showDocuments( FILE *fp, tDOCSET *docs) {
+	tDOCSETITER it;
+	int doc;
+
+	docsetIterInit( &it, docs);
+	while ((doc = docsetIterNext( &it)) >= 0) {
+		fprintf(fp, " %d", doc);
+	}
+	fprintf(fp, "\n");
 }
 
-// 두 문서 집합의 합집합을 구한다.
-// 합집합을 위한 메모리를 할당하고 그 주소를 반환
+// 순위 검색 결과를 fp(화면 또는 서버 응답)에 한 줄로 출력한다.
+void showRanked( FILE *fp, tSCORED *results, int numresults) {
+	for (int i = 0; i < numresults; i++) {
+		fprintf(fp, " %d:%.4f", results[i].doc, results[i].score);
+	}
+	fprintf(fp, "\n");
+}
+
+// 질의 하나를 처리하여 결과를 fp에 한 줄로 출력한다. (rank_k > 0이면 상위 rank_k개 순위 검색)
+void answerQuery( tINDEX *index, int rank_k, char *query, tARENA *arena, FILE *fp) {
+	if (rank_k > 0) {
+		int n;
+		tSCORED *results = rankDocuments( index, query, rank_k, arena, &n);
+
+		if (results == NULL)
+			fprintf(fp, "not found!\n");
+		else
+			showRanked( fp, results, n);
+	}
+	else {
+		tDOCSET *docs = searchDocuments( index, query, arena);
+
+		if (docs == NULL)
+			fprintf(fp, "not found!\n");
+		else
+			showDocuments( fp, docs);
+	}
+}
+
+// 질의 서버의 질의 처리 함수 (server.h의 tSERVERFN, ctx는 tSERVICE)
+// 작업 스레드들이 동시에 부른다. (색인은 읽기만 하고 질의별 메모리는 작업 스레드의 arena에서 할당)
+void serveQuery( void *ctx, char *query, tARENA *arena, FILE *out) {
+	tSERVICE *service = (tSERVICE *)ctx;
+
+	if (service->coord != NULL)
+		coordAnswer( service->coord, service->rank_k, query, arena, out);
+	else
+		answerQuery( service->index, service->rank_k, query, arena, out);
+}
+
+// 질의 서버의 통계 출력 함수 (server.h의 tSERVERREPORTFN, ctx는 tSERVICE)
+// 결과 캐시의 적중률을 출력한다.
+void reportService( void *ctx) {
+	tSERVICE *service = (tSERVICE *)ctx;
+
+	if (service->index != NULL && service->index->cache != NULL)
+		cacheReport( service->index->cache, "cache");
+}
+
+// 스킵 테이블에서 b번 블록 다음부터 마지막 문서번호가 target 이상인 첫 블록을 지수 탐색한다.
+// 없으면 nb를 반환
+static int _skipSearch( const unsigned char *list, int b, int nb, int target) {
+	int lo = b;
+	int hi;
+	int step = 1;
+
+	while (lo + step < nb && postingSkip( list, lo + step).last < target) {
+		lo += step;
+		step <<= 1;
+	}
+	hi = (lo + step < nb) ? lo + step : nb;
+	lo++;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (postingSkip( list, mid).last < target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// 문서 집합과 텀(header[Hidx])의 포스팅 리스트의 교집합을 구한다.
+// 포스팅 리스트를 모두 복호화하지 않고 스킵 테이블로 필요한 블록만 복호화한다.
+// 교집합을 위한 메모리를 arena에서 할당하고 그 주소를 반환 (arenaReset까지 유효)
 // 실패시 NULL을 반환
-// 합집합의 문서 수는 newnumdocs에 저장한다.
-int *unionDocuments( int *docs, int numdocs, int *docs2, int numdocs2, int *newnumdocs) {
-	int i = 0;
-	int j = 0;
-	int idx = -1;
-	int nt = 1;
+// 교집합의 문서 수는 newnumdocs에 저장한다.
+int *intersectPosting( tARENA *arena, const int *docs, int numdocs, tHEADER *header, int *posting, int Hidx, int *newnumdocs) {
+	int codec = idxFileHeader( posting)->codec;
+	int df = header[Hidx].df;
+	unsigned char *list;
+	int block[SKIP_BLOCK];
+	int nb;
+	int b = 0;
+	int cur = -1;	// 복호화된 블록 번호
+	int cnt = 0;
+	int pos = 0;
+	int idx = 0;
 	int *result;
 
-	if ((docs == NULL) && (docs2 == NULL)) {
-		*newnumdocs = 0;
-		return NULL;
-	}
+	*newnumdocs = 0;
 
-	result = (int *)malloc(sizeof(int) * 100);
+	if (docs == NULL)
+		return NULL;
 
-	if (result == NULL) {
-		*newnumdocs = 0;
+	result = (int *)arenaAlloc(arena, sizeof(int) * (numdocs + 1));
+	if (result == NULL)
 		return NULL;
+
+	// 압축하지 않은 리스트는 매핑된 배열에서 바로 지수 탐색
+	if (codec == CODEC_RAW) {
+		*newnumdocs = intersectGallop( docs, numdocs, posting + header[Hidx].index, df, result);
+		return result;
 	}
 
-	while ((i < numdocs) && (j < numdocs2)) {
-		idx++;
-		if (idx % 100 == 0) {
-			nt++;
-			result = (int *)realloc(result, sizeof(int) * 100 * nt);
-		}
+	list = (unsigned char *)posting + header[Hidx].index;
+	nb = postingNumBlocks( codec, df);
 
-		if (docs[i] < docs2[j]) {
-			result[idx] = docs[i];
-			i++;
-		}
-		else if (docs[i] > docs2[j]) {
-			result[idx] = docs2[j];
-			j++;
-		}
-		else {
-			result[idx] = docs[i];
-			i++;	j++;
-		}
+	// 스킵 테이블이 없는 짧은 리스트
+	if (nb == 0) {
+		cnt = postingDecodeBlock( codec, list, df, 0, block, NULL);
+		*newnumdocs = intersectGallop( docs, numdocs, block, cnt, result);
+		return result;
 	}
 
-	while (i < numdocs) {
-		idx++;
-		if (idx % 100 == 0) {
-			nt++;
-			result = (int *)realloc(result, sizeof(int) * 100 * nt);
+	for (int i = 0; i < numdocs; i++) {
+		// docs[i]를 포함할 수 있는 블록을 스킵 테이블에서 지수 탐색
+		if (postingSkip( list, b).last < docs[i]) {
+			b = _skipSearch( list, b, nb, docs[i]);
+			if (b == nb)
+				break;
 		}
-		result[idx] = *(docs + i);
-		i++;
-	}
-	while (j < numdocs2) {
-		idx++;
-		if (idx % 100 == 0) {
-			nt++;
-			result = (int *)realloc(result, sizeof(int) * 100 * nt);
+
+		if (b != cur) {
+			cnt = postingDecodeBlock( codec, list, df, b, block, NULL);
+			cur = b;
+			pos = 0;
 		}
-		result[idx] = docs2[j];
-		j++;
+
+		pos = gallopSearch( block, pos, cnt, docs[i]);
+		if (pos < cnt && block[pos] == docs[i])
+			result[idx++] = docs[i];
 	}
 
-	*newnumdocs = idx + 1;
+	*newnumdocs = idx;
 
 	return result;
 }
 
+// 텀(header[Hidx])의 포스팅 리스트를 문서 집합으로 돌려준다.
+// 압축하지 않은 색인이면 매핑된 posting 배열을 그대로 가리키고 (복사하지 않음)
+// 압축된 색인이면 arena에 복호화한다. (실패시 NULL)
+static tDOCSET *_termDocuments( tHEADER *header, int *posting, int Hidx, tARENA *arena) {
+	tFILEHEADER *fh = idxFileHeader( posting);
+	int Pidx = header[Hidx].index;
+	int df = header[Hidx].df;
+	int *docs;
+
+	if (fh->codec == CODEC_RAW)
+		return docsetFromArray( arena, posting + Pidx, df, fh->num_docs);
+
+	docs = (int *)arenaAlloc(arena, sizeof(int) * df);
+	if (docs == NULL)
+		return NULL;
+
+	// 압축된 포스팅 리스트: Pidx는 바이트 단위 위치
+	postingDecode( fh->codec, (unsigned char *)posting + Pidx, df, docs, NULL);
+
+	return docsetFromArray( arena, docs, df, fh->num_docs);
+}
+
 // 단일 텀(single term)을 검색하여 문서를 찾는다.
-// 문서 집합을 위한 메모리를 할당하고 그 주소를 반환
+// 압축하지 않은 색인이면 복사하지 않고 매핑된 posting 배열 안의 포스팅 리스트를 가리키는 배열 집합(뷰)을 반환
+// 압축된 색인이면 arena에 복호화하여 반환 (arenaReset까지 유효)
 // 실패시 NULL을 반환
-// 검색된 문서 수는 newnumdocs에 저장한다.
-int *getDocuments( tHEADER *header, int *posting, TRIE *trie, char *term, int *numdocs) {
-	int Hidx, Pidx;
-	int *docs;
+tDOCSET *getDocuments( tHEADER *header, int *posting, tDICT *dict, char *term, tARENA *arena) {
+	int Hidx;
 	char *clean;
 
 	clean = trim(term);
 
-	Hidx = trieSearch( trie, clean);
-	if (Hidx == -1)	 {
-		*numdocs = 0;
+	Hidx = dictSearch( dict, clean);
+	if (Hidx == -1)
 		return NULL;
-	}
 
-	Pidx = header[Hidx].index;
-	*numdocs = header[Hidx].df;
+	return _termDocuments( header, posting, Hidx, arena);
+}
 
-	docs = (int *)malloc(sizeof(int) * (*numdocs));
-	if (docs == NULL) {
-		*numdocs = 0;
-		return NULL;
-	}
+// 텀(header[Hidx])의 포스팅 리스트 커서를 b번 블록의 처음으로 옮긴다.
+static void _cursorLoad( tCURSOR *c, int b) {
+	c->cnt = postingDecodeBlock( c->codec, c->list, c->df, b, c->block, c->tfblock);
+	c->b = b;
+	c->pos = 0;
+	c->doc = c->docs[0];
+}
 
-	for (int i = 0; i < *numdocs; i++) {
-		docs[i] = posting[Pidx + i];
+// 텀(header[Hidx])의 포스팅 리스트 커서를 첫 문서에 놓는다.
+// 복호화 버퍼는 arena에서 할당한다.
+// 실패시 0을 반환
+static int _cursorInit( tCURSOR *c, tHEADER *header, int *posting, int Hidx, tARENA *arena) {
+	int codec = idxFileHeader( posting)->codec;
+
+	c->codec = codec;
+	c->df = header[Hidx].df;
+	c->idf = 0;
+	c->ub = 0;
+	c->b = 0;
+	c->pos = 0;
+
+	if (codec == CODEC_RAW) {
+		// 압축하지 않은 리스트는 매핑된 배열을 그대로 읽는다. [문서번호 x df][tf x df]
+		c->list = NULL;
+		c->docs = posting + header[Hidx].index;
+		c->tfs = c->docs + c->df;
+		c->nb = 0;
+		c->cnt = c->df;
+		c->doc = (c->df > 0) ? c->docs[0] : CURSOR_END;
+		return 1;
 	}
 
-	return docs;
+	c->list = (unsigned char *)posting + header[Hidx].index;
+	c->nb = postingNumBlocks( codec, c->df);
+	c->block = (int *)arenaAlloc(arena, sizeof(int) * SKIP_BLOCK);
+	c->tfblock = (int *)arenaAlloc(arena, sizeof(int) * SKIP_BLOCK);
+	if (c->block == NULL || c->tfblock == NULL)
+		return 0;
+	c->docs = c->block;
+	c->tfs = c->tfblock;
+
+	_cursorLoad( c, 0);
+	return 1;
 }
 
-// 질의(query)를 검색하여 문서를 찾는다.
-// 질의는 단일 텀 또는 하나 이상의 불린 연산자('&' 또는 '|')를 포함한 질의가 될 수 있다.
-// 문서 집합을 위한 메모리를 할당하고 그 주소를 반환
-// 실패시 NULL을 반환
-// 검색된 문서 수는 newnumdocs에 저장한다.
-int *searchDocuments( tHEADER *header, int *posting, TRIE *trie, char *query, int *numdocs) {
-	char *clean;
-	char *ptr;
-	char *temp;
+// 순위 검색을 위해 커서에 텀의 idf와 점수 상한을 정한다.
+// max_weight는 색인기가 세그먼트의 평균 문서 길이로 계산한 값이므로
+// 검색기의 평균 문서 길이가 더 길면 그 비율(scale)만큼 상한을 늘린다.
+static void _cursorScoring( tCURSOR *c, float max_weight, double idf, double scale) {
+	c->idf = idf;
+	c->ub = idf * max_weight * scale * (1 + RANK_SLACK);
+}
 
-	int front = 0;
-	int rear = -1;
-	int idx = -1;
-	int count = 0;
-	int nt = 1;
-	int *docs;
-	int *boolQ;
-	int *term1, *term2, *term3, *tmp;
-	int numdocs1, numdocs2, newnumdocs;
-	
-	clean = trim(query);
+// 커서를 다음 문서로 옮긴다.
+static void _cursorNext( tCURSOR *c) {
+	if (++c->pos < c->cnt)
+		c->doc = c->docs[c->pos];
+	else if (c->b + 1 < c->nb)
+		_cursorLoad( c, c->b + 1);
+	else
+		c->doc = CURSOR_END;
+}
 
-	if (strchr(clean, AND) || strchr(clean, OR)) {
-		boolQ = (int *)malloc(sizeof(int) * 1000);
+// 커서를 target 이상인 첫 문서로 옮긴다. (스킵 테이블로 필요 없는 블록은 복호화하지 않음)
+static void _cursorSeek( tCURSOR *c, int target) {
+	if (c->doc >= target)
+		return;
 
-		for (int i = 0; i < strlen(clean); i++) {
-			if (clean[i] == AND) {
-				rear++;
-				if ((rear + 1) % 1000 == 0) {
-					nt++;
-					boolQ = (int *)realloc(boolQ, sizeof(int) * 1000 * nt);
-				}
-				boolQ[rear] = 1;
-			}
-			else if (clean[i] == OR) {
-				rear++;
-				if ((rear + 1) % 1000 == 0) {
-					nt++;
-					boolQ = (int *)realloc(boolQ, sizeof(int) * 1000 * nt);
-				}
-				boolQ[rear] = 2;
-			}
+	if (c->docs[c->cnt - 1] < target) {
+		int b = (c->nb > 0) ? _skipSearch( c->list, c->b, c->nb, target) : c->nb;
+
+		if (b >= c->nb) {
+			c->doc = CURSOR_END;
+			return;
 		}
+		_cursorLoad( c, b);
+	}
 
-		ptr = strtok(clean, "&|");
-		temp = strdup(ptr);
-		term1 = getDocuments(header, posting, trie, temp, &numdocs1);
+	c->pos = gallopSearch( c->docs, c->pos, c->cnt, target);
+	c->doc = c->docs[c->pos];
+}
 
-		free(temp);
-		temp = NULL;
+// 커서가 가리키는 문서에 대한 텀의 BM25 점수
+static double _cursorScore( tCURSOR *c, int *doclen) {
+	return c->idf * bm25Weight( c->tfs[c->pos], doclen[c->doc], avg_doclen);
+}
 
-		do {
-			ptr = strtok(NULL, "&|");
-			temp = strdup(ptr);
-			term2 = getDocuments(header, posting, trie, temp, &numdocs2);
+// AND/OR 노드의 자식 정렬 기준: 비용이 작은 것부터, NOT은 맨 뒤로
+static int _compareCost( const void *n1, const void *n2) {
+	const tQNODE *a = *(tQNODE * const *)n1;
+	const tQNODE *b = *(tQNODE * const *)n2;
 
-			free(temp);
-			temp = NULL;
+	if ((a->type == Q_NOT) != (b->type == Q_NOT))
+		return (a->type == Q_NOT) ? 1 : -1;
 
-			switch (boolQ[front]) {
-				case 1:
-					term3 = intersectDocuments(term1, numdocs1, term2, numdocs2, &newnumdocs);
-					break;
-				case 2:
-					term3 = unionDocuments(term1, numdocs1, term2, numdocs2, &newnumdocs);
-					break;
-				default:
-					free(term1);
-					free(term2);
-					free(boolQ);
-					return NULL;
-			}
+	return (a->cost > b->cost) - (a->cost < b->cost);
+}
 
-			if (term1 != NULL) {
-				free(term1);
-				term1 = NULL;
-			}
-			if (term2 != NULL) {
-				free(term2);
-				term2 = NULL;
+// 세그먼트에서 질의 트리의 각 노드에 사전 번호와 결과 문서 수 추정치(cost)를 채우고
+// AND/OR 노드의 자식을 비용 순으로 정렬한다.
+//   TERM: df, NOT: 전체 문서 수 - 자식 비용
+//   AND, PHRASE, NEAR: 가장 작은 (NOT이 아닌) 자식 비용, OR: 자식 비용의 합
+//   WILDCARD: 패턴에 맞는 텀들(arena에 펼친다)의 df의 합
+// PHRASE, NEAR의 자식은 텀의 순서가 의미를 가지므로 정렬하지 않는다.
+static long _planQuery( tQNODE *node, tSEGMENT *seg, tARENA *arena) {
+	tHEADER *header = seg->header;
+	long maxdocid = seg->max_docid;
+	long cost;
+
+	switch (node->type) {
+		case Q_TERM:
+			node->Hidx = dictSearch( &seg->dict, node->term);
+			node->cost = (node->Hidx == -1) ? 0 : header[node->Hidx].df;
+			break;
+
+		case Q_WILDCARD:
+			node->num_terms = wildcardExpand( &seg->wildcard, &seg->dict, node->term, max_expansion, arena, &node->terms);
+			cost = 0;
+			for (int i = 0; i < node->num_terms; i++)
+				cost += header[node->terms[i]].df;
+
+			node->cost = (cost < maxdocid) ? cost : maxdocid;
+			break;
+
+		case Q_NOT:
+			node->cost = maxdocid - _planQuery( node->children[0], seg, arena);
+			break;
+
+		case Q_AND:
+			for (int i = 0; i < node->num_children; i++)
+				_planQuery( node->children[i], seg, arena);
+			qsort( node->children, node->num_children, sizeof(tQNODE *), _compareCost);
+
+			// 모든 자식이 NOT이면 차집합으로 줄여 나가므로 첫 자식의 비용
+			node->cost = node->children[0]->cost;
+			break;
+
+		case Q_OR:
+			cost = 0;
+			for (int i = 0; i < node->num_children; i++)
+				cost += _planQuery( node->children[i], seg, arena);
+			qsort( node->children, node->num_children, sizeof(tQNODE *), _compareCost);
+
+			node->cost = (cost < maxdocid) ? cost : maxdocid;
+			break;
+
+		case Q_PHRASE:
+		case Q_NEAR:
+			node->cost = maxdocid;
+			for (int i = 0; i < node->num_children; i++) {
+				cost = _planQuery( node->children[i], seg, arena);
+				if (cost < node->cost)
+					node->cost = cost;
 			}
+			break;
+	}
 
-			term1 = term3;
-			numdocs1 = newnumdocs;
+	if (node->cost < 0)
+		node->cost = 0;
 
-			front++;
-		} while (front <= rear);
+	return node->cost;
+}
 
-		free(boolQ);
-		boolQ = NULL;
+static tDOCSET *_evalQuery( tQNODE *node, tSEGMENT *seg, tCACHE *cache, tARENA *arena);
 
-		if (term1 == NULL) {
-			return NULL;
-		}
+// 커서가 가리키는 문서 안의 텀 위치들을 out에 복호화한다.
+// base는 position.idx 안의 텀 위치 정보 시작
+// 위치 수(tf)를 반환
+static int _cursorPositions( tCURSOR *c, const unsigned char *base, int *out) {
+	int i = (c->nb > 0) ? c->b * SKIP_BLOCK + c->pos : c->pos;
+	const int *blocktfs = (c->nb > 0) ? c->tfs : c->tfs + (i - i % SKIP_BLOCK);
+	int tf = c->tfs[c->pos];
 
-		docs = term1;
-		*numdocs = newnumdocs;
-	}
-	else {
-		docs = getDocuments(header, posting, trie, clean, numdocs);
+	vbyteDecode( positionsSeek( base, c->df, i, blocktfs), tf, 0, out);
+	return tf;
+}
+
+// 위치 목록들(pos[i], 각 npos[i]개)에서 pos[0]의 어떤 위치 p에 대해 모든 i에서 p + i가 있는지 (구 일치)
+// from은 n개짜리 작업 공간
+static int _phraseMatch( int **pos, int *npos, int n, int *from) {
+	memset(from, 0, sizeof(int) * n);
 
-		if (docs == NULL)	return NULL;
+	for (int j = 0; j < npos[0]; j++) {
+		int i;
+
+		for (i = 1; i < n; i++) {
+			int target = pos[0][j] + i;
+
+			from[i] = gallopSearch( pos[i], from[i], npos[i], target);
+			if (from[i] >= npos[i])
+				return 0;
+			if (pos[i][from[i]] != target)
+				break;
+		}
+		if (i == n)
+			return 1;
 	}
+	return 0;
+}
 
+// 두 위치 목록에서 위치 차이가 slop 이하인 쌍이 있는지 (근접 일치)
+static int _nearMatch( int *a, int na, int *b, int nb, int slop) {
+	int i = 0;
+	int j = 0;
 
-	return docs;
+	while (i < na && j < nb) {
+		if (abs(a[i] - b[j]) <= slop)
+			return 1;
+		if (a[i] < b[j])
+			i++;
+		else
+			j++;
+	}
+	return 0;
+}
+
+// 구(PHRASE) 또는 근접(NEAR) 노드를 평가한다.
+// 자식 텀들의 교집합으로 후보 문서를 구한 뒤 후보 문서의 위치 정보만 복호화하여 확인한다.
+// 결과 문서 집합의 주소를 반환 (arenaReset까지 유효)
+// 실패시 NULL을 반환
+static tDOCSET *_evalPositional( tQNODE *node, tSEGMENT *seg, tARENA *arena) {
+	tHEADER *header = seg->header;
+	int *posting = seg->posting;
+	int maxdocid = seg->max_docid;
+	int n = node->num_children;
+	tQNODE *all;
+	tDOCSET *candidates;
+	tDOCSETITER it;
+	tCURSOR *cursors;
+	int **pos;
+	int *npos;
+	int *cap;
+	int *from;
+	int *result;
+	int count = 0;
+	int doc;
+
+	for (int i = 0; i < n; i++)
+		if (node->children[i]->Hidx == -1)
+			return docsetFromArray( arena, NULL, 0, maxdocid);
+
+	// 후보 문서: 자식 텀들의 AND (드문 텀부터)
+	all = queryCreateNode( arena, Q_AND);
+	if (all == NULL)
+		return NULL;
+	for (int i = 0; i < n; i++)
+		if (queryAddChild( arena, all, node->children[i]) < 0)
+			return NULL;
+	qsort( all->children, all->num_children, sizeof(tQNODE *), _compareCost);
+
+	candidates = _evalQuery( all, seg, NULL, arena);
+	if (candidates == NULL || candidates->count == 0)
+		return candidates;
+
+	cursors = (tCURSOR *)arenaAlloc(arena, sizeof(tCURSOR) * n);
+	pos = (int **)arenaAlloc(arena, sizeof(int *) * n);
+	npos = (int *)arenaAlloc(arena, sizeof(int) * n);
+	cap = (int *)arenaAlloc(arena, sizeof(int) * n);
+	from = (int *)arenaAlloc(arena, sizeof(int) * n);
+	result = (int *)arenaAlloc(arena, sizeof(int) * candidates->count);
+	if (cursors == NULL || pos == NULL || npos == NULL || cap == NULL || from == NULL || result == NULL)
+		return NULL;
+
+	for (int i = 0; i < n; i++) {
+		if (!_cursorInit( &cursors[i], header, posting, node->children[i]->Hidx, arena))
+			return NULL;
+		cap[i] = 0;
+	}
+
+	docsetIterInit( &it, candidates);
+	while ((doc = docsetIterNext( &it)) >= 0) {
+		int match;
+
+		for (int i = 0; i < n; i++) {
+			tCURSOR *c = &cursors[i];
+
+			// 후보 문서는 모든 텀의 포스팅 리스트에 있다.
+			_cursorSeek( c, doc);
+			if (c->tfs[c->pos] > cap[i]) {
+				cap[i] = (c->tfs[c->pos] > 2 * cap[i]) ? c->tfs[c->pos] : 2 * cap[i];
+				pos[i] = (int *)arenaAlloc(arena, sizeof(int) * cap[i]);
+				if (pos[i] == NULL)
+					return NULL;
+			}
+			npos[i] = _cursorPositions( c, seg->positions + header[node->children[i]->Hidx].pos_index, pos[i]);
+		}
+
+		if (node->type == Q_PHRASE)
+			match = _phraseMatch( pos, npos, n, from);
+		else
+			match = _nearMatch( pos[0], npos[0], pos[1], npos[1], node->slop);
+
+		if (match)
+			result[count++] = doc;
+	}
+
+	return docsetFromArray( arena, result, count, maxdocid);
+}
+
+// 와일드카드 노드를 평가한다.
+// 펼친 텀들의 포스팅 리스트를 한 번에 합친다. (docsetOrMany)
+// 결과 문서 집합의 주소를 반환 (arenaReset까지 유효)
+// 실패시 NULL을 반환 (펼친 텀 수가 상한을 넘은 경우 포함)
+static tDOCSET *_evalWildcard( tQNODE *node, tSEGMENT *seg, tARENA *arena) {
+	tDOCSET **parts;
+
+	if (node->num_terms == WILDCARD_TOO_MANY) {
+		fprintf( stderr, "Too many terms for wildcard:%s (max %d)\n", node->term, max_expansion);
+		return NULL;
+	}
+	if (node->num_terms < 0)
+		return NULL;
+
+	if (node->num_terms == 0)
+		return docsetFromArray( arena, NULL, 0, seg->max_docid);
+
+	parts = (tDOCSET **)arenaAlloc(arena, sizeof(tDOCSET *) * node->num_terms);
+	if (parts == NULL)
+		return NULL;
+
+	for (int i = 0; i < node->num_terms; i++) {
+		parts[i] = _termDocuments( seg->header, seg->posting, node->terms[i], arena);
+		if (parts[i] == NULL)
+			return NULL;
+	}
+
+	return docsetOrMany( arena, parts, node->num_terms);
+}
+
+// 계획된 질의 트리의 노드 하나를 평가한다. (자식은 _evalQuery로)
+// 텀은 포스팅 리스트의 뷰를, 중간 결과는 밀도에 맞는 표현(배열, 비트맵, Roaring)으로 arena에 만든다.
+// 결과 문서 집합의 주소를 반환 (arenaReset까지 유효, 결과가 비면 문서 수 0)
+// 실패시 NULL을 반환
+static tDOCSET *_evalNode( tQNODE *node, tSEGMENT *seg, tCACHE *cache, tARENA *arena) {
+	tHEADER *header = seg->header;
+	int *posting = seg->posting;
+	int maxdocid = seg->max_docid;
+	tDOCSET *docs = NULL;
+	tDOCSET *docs2;
+	tDOCSET **parts;
+
+	switch (node->type) {
+		case Q_TERM:
+			if (node->Hidx == -1)
+				return docsetFromArray( arena, NULL, 0, maxdocid);
+			return _termDocuments( header, posting, node->Hidx, arena);
+
+		case Q_NOT:
+			docs2 = _evalQuery( node->children[0], seg, cache, arena);
+			return (docs2 == NULL) ? NULL : docsetNot( arena, docs2);
+
+		case Q_PHRASE:
+		case Q_NEAR:
+			return _evalPositional( node, seg, arena);
+
+		case Q_WILDCARD:
+			return _evalWildcard( node, seg, arena);
+
+		case Q_AND:
+			// 비용이 작은 자식부터 (NOT은 차집합으로 맨 뒤에서)
+			docs = _evalQuery( node->children[0], seg, cache, arena);
+
+			for (int i = 1; i < node->num_children && docs != NULL && docs->count > 0; i++) {
+				tQNODE *child = node->children[i];
+
+				if (child->type == Q_NOT) {
+					docs2 = _evalQuery( child->children[0], seg, cache, arena);
+					docs = (docs2 == NULL) ? NULL : docsetAndNot( arena, docs, docs2);
+				}
+				else if (docs->type == DOCSET_ARRAY && child->type == Q_TERM && child->Hidx != -1 &&
+						(long)docs->count * SKIP_RATIO < header[child->Hidx].df) {
+					// 중간 결과가 훨씬 작으면 포스팅 리스트를 건너뛰며 교집합
+					int n;
+					int *result = intersectPosting( arena, docs->docs, docs->count, header, posting, child->Hidx, &n);
+
+					docs = (result == NULL) ? NULL : docsetFromArray( arena, result, n, maxdocid);
+				}
+				else {
+					docs2 = _evalQuery( child, seg, cache, arena);
+					docs = (docs2 == NULL) ? NULL : docsetAnd( arena, docs, docs2);
+				}
+			}
+			return docs;
+
+		default:
+			// a | b | c ...는 하나의 OR 노드이므로 자식들의 결과를 한 번에 합친다.
+			parts = (tDOCSET **)arenaAlloc(arena, sizeof(tDOCSET *) * node->num_children);
+			if (parts == NULL)
+				return NULL;
+
+			for (int i = 0; i < node->num_children; i++) {
+				parts[i] = _evalQuery( node->children[i], seg, cache, arena);
+				if (parts[i] == NULL)
+					return NULL;
+			}
+			return docsetOrMany( arena, parts, node->num_children);
+	}
+}
+
+// 결과 캐시의 키: 종류와 번호(Q0: 검색 결과, R<k>: 상위 k개 순위 검색 결과, S<세그먼트 번호>: 세그먼트의 부분 질의 결과)
+// 다음에 정규화한 질의 (arena에서 할당, 실패시 NULL)
+static char *_cacheKey( tARENA *arena, char kind, int num, char *key) {
+	size_t len = strlen(key) + 16;
+	char *p = (char *)arenaAlloc(arena, len);
+
+	if (p != NULL)
+		snprintf(p, len, "%c%d %s", kind, num, key);
+	return p;
+}
+
+// 질의 전체의 결과를 찾을 캐시 키를 만든다.
+// 세대가 바뀐 캐시를 비우고, 질의 트리의 노드마다 정규화한 키(queryKey)를 채운다.
+// 질의 전체의 결과는 이 키로 캐시하므로 루트는 세그먼트별로 캐시하지 않는다.
+// 단일 텀의 검색 결과는 포스팅 리스트를 그대로 쓰는 편이 빠르므로 캐시하지 않는다. (NULL을 반환)
+static char *_queryCacheKey( tINDEX *index, tQNODE *root, char kind, int num, tARENA *arena) {
+	char *key;
+
+	cacheValidate( index->cache, index->generation);
+
+	key = queryKey( arena, root);
+	if (key == NULL)
+		return NULL;
+	root->key = NULL;
+
+	if (kind == 'Q' && root->type == Q_TERM)
+		return NULL;
+
+	return _cacheKey( arena, kind, num, key);
+}
+
+// 문서 집합을 결과 캐시에 key로 넣는다.
+// tCACHEDSET 다음에 문서번호 배열 또는 비트맵 중 작은 쪽으로 넣는다. (찾을 때 복사하는 양도 줄어든다.)
+static void _cacheDocuments( tCACHE *cache, char *key, tDOCSET *docs, tARENA *arena) {
+	tCACHEDSET *cs;
+	size_t size;
+
+	docs = ((long)docs->count * DOCSET_DENSE >= docs->maxdocid) ? docsetToBitmap( arena, docs)
+																: docsetToArray( arena, docs);
+	if (docs == NULL)
+		return;
+
+	size = (docs->type == DOCSET_BITMAP) ? sizeof(uint64_t) * _docsetWords( docs->maxdocid)
+										 : sizeof(int) * docs->count;
+	cs = (tCACHEDSET *)arenaAlloc(arena, sizeof(tCACHEDSET) + size);
+	if (cs == NULL)
+		return;
+
+	cs->type = docs->type;
+	cs->count = docs->count;
+	cs->maxdocid = docs->maxdocid;
+	cs->reserved = 0;
+	if (size > 0)
+		memcpy(cs + 1, (docs->type == DOCSET_BITMAP) ? (void *)docs->words : (void *)docs->docs, size);
+
+	cachePut( cache, key, cs, sizeof(tCACHEDSET) + size);
+}
+
+// 결과 캐시에서 key의 문서 집합을 찾는다. (arena로 복사되므로 arenaReset까지 유효)
+// 없으면 NULL을 반환
+static tDOCSET *_cachedDocuments( tCACHE *cache, char *key, tARENA *arena) {
+	tCACHEDSET *cs;
+	size_t size;
+
+	if (!cacheGet( cache, key, arena, (void **)&cs, &size) || size < sizeof(tCACHEDSET))
+		return NULL;
+
+	if (cs->type == DOCSET_BITMAP)
+		return docsetFromBitmap( arena, (uint64_t *)(cs + 1), cs->count, cs->maxdocid);
+	return docsetFromArray( arena, (int *)(cs + 1), cs->count, cs->maxdocid);
+}
+
+// 계획된 질의 트리를 평가한다.
+// 캐시가 있으면 단일 텀(포스팅 리스트의 뷰)과 NOT(여집합)이 아닌 부분 질의의 결과를
+// 세그먼트 번호와 정규화한 부분 질의로 찾아 쓰고, 없으면 평가하여 넣는다. (삭제된 문서를 빼기 전의 결과)
+// 결과 문서 집합의 주소를 반환 (arenaReset까지 유효, 결과가 비면 문서 수 0)
+// 실패시 NULL을 반환
+static tDOCSET *_evalQuery( tQNODE *node, tSEGMENT *seg, tCACHE *cache, tARENA *arena) {
+	char *key = NULL;
+	tDOCSET *docs;
+
+	if (cache != NULL && node->key != NULL && node->type != Q_TERM && node->type != Q_NOT) {
+		key = _cacheKey( arena, 'S', seg->id, node->key);
+		if (key != NULL && (docs = _cachedDocuments( cache, key, arena)) != NULL)
+			return docs;
+	}
+
+	docs = _evalNode( node, seg, cache, arena);
+	if (key != NULL && docs != NULL)
+		_cacheDocuments( cache, key, docs, arena);
+
+	return docs;
+}
+
+// 세그먼트에서 질의 트리를 계획하고 평가한 뒤 삭제된 문서를 뺀다.
+// 결과 문서 집합(세그먼트 안의 문서번호)의 주소를 반환 (실패시 NULL)
+static tDOCSET *_searchSegment( tQNODE *root, tSEGMENT *seg, tCACHE *cache, tARENA *arena) {
+	tDOCSET *docs;
+
+	_planQuery( root, seg, arena);
+
+	docs = _evalQuery( root, seg, cache, arena);
+	if (docs != NULL && docs->count > 0 && seg->deleted != NULL)
+		docs = docsetAndNot( arena, docs, seg->deleted);
+
+	return docs;
+}
+
+// 질의 트리를 세그먼트마다 처리하고 삭제된 문서를 뺀 뒤 전체 문서번호로 합친다.
+// 결과 문서 집합의 주소를 반환 (arenaReset까지 유효, 결과가 비면 문서 수 0)
+// 실패시 NULL을 반환
+static tDOCSET *_searchIndex( tINDEX *index, tQNODE *root, tARENA *arena) {
+	tDOCSET **parts;
+	int *result;
+	long total = 0;
+	int n = 0;
+
+	// 세그먼트가 하나면 세그먼트의 결과를 그대로 돌려준다.
+	if (index->num_segments == 1 && index->segments[0].docbase == 0)
+		return _searchSegment( root, &index->segments[0], index->cache, arena);
+
+	parts = (tDOCSET **)arenaAlloc(arena, sizeof(tDOCSET *) * index->num_segments);
+	if (parts == NULL)
+		return NULL;
+
+	for (int i = 0; i < index->num_segments; i++) {
+		parts[i] = _searchSegment( root, &index->segments[i], index->cache, arena);
+		if (parts[i] == NULL)
+			return NULL;
+		total += parts[i]->count;
+	}
+
+	if (total == 0)
+		return docsetFromArray( arena, NULL, 0, index->max_docid);
+
+	// 세그먼트는 문서번호 순이므로 docbase를 더해 이어 붙이면 정렬된 배열이 된다.
+	result = (int *)arenaAlloc(arena, sizeof(int) * total);
+	if (result == NULL)
+		return NULL;
+
+	for (int i = 0; i < index->num_segments; i++) {
+		tDOCSETITER it;
+		int doc;
+
+		docsetIterInit( &it, parts[i]);
+		while ((doc = docsetIterNext( &it)) >= 0)
+			result[n++] = doc + index->segments[i].docbase;
+	}
+
+	return docsetFromArray( arena, result, n, index->max_docid);
+}
+
+// 질의(query)를 검색하여 문서를 찾는다.
+// 질의는 단일 텀 또는 불린 연산자('&', '|', '!')와 괄호를 포함한 질의가 될 수 있다.
+// 연산자 우선순위는 '!' > '&' > '|'이며 연산자 없이 이어진 텀은 '&'로 처리한다.
+// 구("a b c")와 근접 연산자(a NEAR/k b)는 위치 정보(positions)로 확인한다.
+// 와일드카드 텀(ab*, *ab, a*b)은 세그먼트마다 패턴에 맞는 텀들(max_expansion개까지)로 펼쳐 포스팅 리스트의 합집합을 구한다.
+// 질의 트리를 만든 뒤 df로 비용을 추정하여 교집합은 드문 텀부터 계산하고
+// 중간 결과가 비면 나머지 연산을 생략한다.
+// 세그먼트마다 질의를 처리하고 삭제된 문서를 뺀 뒤 전체 문서번호로 합친다.
+// 텀의 문서 집합은 포스팅 리스트의 뷰를 쓰고 질의 트리와 중간 결과는 arena에서 할당하므로
+// 질의를 처리한 뒤 arenaReset으로 한꺼번에 해제한다.
+// 결과 캐시가 있으면 정규화한 질의의 결과와 세그먼트별 부분 질의(예) 자주 쓰는 두 텀의 교집합)의 결과를 캐시한다.
+// 결과 문서 집합의 주소를 반환 (arenaReset까지 유효)
+// 실패시 (찾은 문서가 없는 경우 포함) NULL을 반환
+tDOCSET *searchDocuments( tINDEX *index, char *query, tARENA *arena) {
+	tQNODE *root;
+	tDOCSET *docs;
+	char *key = NULL;
+
+	root = queryParse( arena, query);
+	if (root == NULL) {
+		if (query[strspn(query, " \t\r\n")] != 0)
+			fprintf( stderr, "Query syntax error\n");
+		return NULL;
+	}
+
+#ifdef DEBUG
+	queryPrint( root);
+	printf("\n");
+#endif
+
+	if (index->cache != NULL) {
+		key = _queryCacheKey( index, root, 'Q', 0, arena);
+		if (key != NULL && (docs = _cachedDocuments( index->cache, key, arena)) != NULL)
+			return (docs->count > 0) ? docs : NULL;
+	}
+
+	docs = _searchIndex( index, root, arena);
+	if (key != NULL && docs != NULL)
+		_cacheDocuments( index->cache, key, docs, arena);
+
+	if (docs == NULL || docs->count == 0)
+		return NULL;
+
+	return docs;
+}
+
+// a가 b보다 순위가 낮은지 (점수가 낮거나, 같은 점수면 문서번호가 큼)
+static int _rankedBelow( tSCORED *a, tSCORED *b) {
+	return a->score < b->score || (a->score == b->score && a->doc > b->doc);
+}
+
+// 순위 정렬을 위한 비교함수 (점수 내림차순, 문서번호 오름차순)
+static int _compareScored( const void *n1, const void *n2) {
+	tSCORED *a = (tSCORED *)n1;
+	tSCORED *b = (tSCORED *)n2;
+
+	return _rankedBelow( a, b) - _rankedBelow( b, a);
+}
+
+// 상위 k개에 들어가기 위해 넘어야 하는 점수 (k개가 차기 전에는 음수)
+static double _topkThreshold( tTOPK *topk) {
+	return (topk->num < topk->k) ? -1 : topk->items[0].score;
+}
+
+// 문서를 상위 k개 후보에 넣는다. (k개가 찼으면 가장 낮은 순위의 문서보다 높을 때만)
+static void _topkPush( tTOPK *topk, int doc, double score) {
+	tSCORED item = { doc, score };
+	tSCORED *heap = topk->items;
+	int i;
+
+	if (topk->num < topk->k) {
+		// 위로 올리기
+		for (i = topk->num++; i > 0 && _rankedBelow( &item, &heap[(i - 1) / 2]); i = (i - 1) / 2)
+			heap[i] = heap[(i - 1) / 2];
+		heap[i] = item;
+		return;
+	}
+
+	if (!_rankedBelow( &heap[0], &item))
+		return;
+
+	// 맨 앞을 바꾸고 아래로 내리기
+	for (i = 0; 2 * i + 1 < topk->num; ) {
+		int child = 2 * i + 1;
+
+		if (child + 1 < topk->num && _rankedBelow( &heap[child + 1], &heap[child]))
+			child++;
+		if (!_rankedBelow( &heap[child], &item))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = item;
+}
+
+// 문서 집합의 모든 문서에 점수를 매겨 상위 k개를 고른다.
+// 점수는 커서 순서(사전 순)로 더하고 문서번호에 docbase를 더하여 넣는다.
+// 점수를 매긴 문서 수를 반환
+static long _rankSet( tDOCSET *docs, tCURSOR *cursors, int n, int *doclen, int docbase, tTOPK *topk) {
+	tDOCSETITER it;
+	long scored = 0;
+	int doc;
+
+	docsetIterInit( &it, docs);
+	while ((doc = docsetIterNext( &it)) >= 0) {
+		double score = 0;
+
+		for (int i = 0; i < n; i++) {
+			_cursorSeek( &cursors[i], doc);
+			if (cursors[i].doc == doc)
+				score += _cursorScore( &cursors[i], doclen);
+		}
+		_topkPush( topk, doc + docbase, score);
+		scored++;
+	}
+	return scored;
+}
+
+// 텀들의 OR 질의를 WAND(Weak AND)로 처리하여 상위 k개를 고른다.
+// 커서를 현재 문서번호 순으로 놓고 점수 상한을 앞에서부터 더해 k번째 점수를 처음 넘는 커서(pivot)를 찾는다.
+// pivot 문서보다 앞의 문서는 상위 k개에 들 수 없으므로 앞의 커서들을 pivot 문서로 건너뛴다.
+// 점수는 커서 순서(사전 순)로 더하므로 _rankSet과 같은 결과를 낸다.
+// 삭제된 문서(deleted, NULL이면 없음)는 점수를 매기지 않고 건너뛰며 문서번호에 docbase를 더하여 넣는다.
+// 점수를 매긴 문서 수를 반환 (실패시 -1)
+static long _rankWand( tCURSOR *cursors, int n, int *doclen, int docbase, tDOCSET *deleted, tTOPK *topk,
+					tARENA *arena) {
+	tCURSOR **order = (tCURSOR **)arenaAlloc(arena, sizeof(tCURSOR *) * n);
+	long scored = 0;
+
+	if (order == NULL)
+		return -1;
+
+	for (int i = 0; i < n; i++)
+		order[i] = &cursors[i];
+
+	while (1) {
+		double threshold = _topkThreshold( topk);
+		double bound = 0;
+		int pivot;
+		int p;
+
+		// 현재 문서번호 순으로 정렬 (한 번에 몇 개만 바뀌므로 삽입 정렬)
+		for (int i = 1; i < n; i++) {
+			tCURSOR *c = order[i];
+			int j;
+
+			for (j = i; j > 0 && order[j - 1]->doc > c->doc; j--)
+				order[j] = order[j - 1];
+			order[j] = c;
+		}
+
+		for (p = 0; p < n && order[p]->doc != CURSOR_END; p++) {
+			bound += order[p]->ub;
+			if (bound > threshold)
+				break;
+		}
+		if (p == n || order[p]->doc == CURSOR_END)
+			break;
+
+		pivot = order[p]->doc;
+
+		if (order[0]->doc == pivot && deleted != NULL && docsetContains( deleted, pivot)) {
+			for (int i = 0; i < n; i++)
+				if (cursors[i].doc == pivot)
+					_cursorNext( &cursors[i]);
+		}
+		else if (order[0]->doc == pivot) {
+			// pivot 문서까지 모든 커서가 모였으면 점수를 매긴다.
+			double score = 0;
+
+			for (int i = 0; i < n; i++) {
+				if (cursors[i].doc == pivot) {
+					score += _cursorScore( &cursors[i], doclen);
+					_cursorNext( &cursors[i]);
+				}
+			}
+			_topkPush( topk, pivot + docbase, score);
+			scored++;
+		}
+		else {
+			for (int i = 0; i < p; i++)
+				_cursorSeek( order[i], pivot);
+		}
+	}
+
+	return scored;
+}
+
+// 질의 트리에서 NOT 아래에 있지 않은 텀을 모은다.
+static void _scoringTerms( tQNODE *node, char **terms, int *n) {
+	if (node->type == Q_NOT)
+		return;
+
+	if (node->type == Q_TERM) {
+		terms[(*n)++] = node->term;
+		return;
+	}
+
+	for (int i = 0; i < node->num_children; i++)
+		_scoringTerms( node->children[i], terms, n);
+}
+
+static int _compareInt( const void *n1, const void *n2) {
+	int a = *(const int *)n1;
+	int b = *(const int *)n2;
+
+	return (a > b) - (a < b);
+}
+
+// 사전 순 정렬을 위한 비교함수
+static int _compareTerm( const void *n1, const void *n2) {
+	return strcmp(*(char * const *)n1, *(char * const *)n2);
+}
+
+// 텀 번호들을 정렬하고 중복을 없앤 뒤 각 텀의 커서를 만든다.
+// 커서 배열의 주소를 반환 (실패시 NULL)
+static tCURSOR *_termCursors( tHEADER *header, int *posting, int *terms, int *n, int num_docs, tARENA *arena) {
+	tCURSOR *cursors;
+	int m = 0;
+
+	qsort( terms, *n, sizeof(int), _compareInt);
+	for (int i = 0; i < *n; i++)
+		if (m == 0 || terms[m - 1] != terms[i])
+			terms[m++] = terms[i];
+	*n = m;
+
+	cursors = (tCURSOR *)arenaAlloc(arena, sizeof(tCURSOR) * (m + 1));
+	if (cursors == NULL)
+		return NULL;
+
+	for (int i = 0; i < m; i++) {
+		if (!_cursorInit( &cursors[i], header, posting, terms[i], arena))
+			return NULL;
+		_cursorScoring( &cursors[i], header[terms[i]].max_weight, bm25Idf( header[terms[i]].df, num_docs), 1);
+	}
+
+	return cursors;
+}
+
+// 상위 k개 후보를 순위 순으로 정렬하여 돌려준다.
+static tSCORED *_topkResults( tTOPK *topk, int *numresults) {
+	*numresults = topk->num;
+	if (topk->num == 0)
+		return NULL;
+
+	qsort( topk->items, topk->num, sizeof(tSCORED), _compareScored);
+	return topk->items;
+}
+
+// 점수를 매길 텀들(NOT 아래에 있지 않은 텀)을 모아 사전 순으로 정렬하고 중복을 없앤다.
+// 텀 수를 반환 (실패시 -1, 텀 배열은 arena에서 할당)
+static int _rankTerms( tQNODE *root, char *query, tARENA *arena, char ***terms) {
+	int n = 0;
+	int m = 0;
+
+	// 텀 수는 질의 길이의 절반을 넘지 않는다.
+	*terms = (char **)arenaAlloc(arena, sizeof(char *) * (strlen(query) / 2 + 1));
+	if (*terms == NULL)
+		return -1;
+
+	_scoringTerms( root, *terms, &n);
+	qsort( *terms, n, sizeof(char *), _compareTerm);
+	for (int i = 0; i < n; i++)
+		if (m == 0 || strcmp((*terms)[m - 1], (*terms)[i]) != 0)
+			(*terms)[m++] = (*terms)[i];
+
+	return m;
+}
+
+// 모든 세그먼트에서 텀의 df를 합한다.
+static int _termDf( tINDEX *index, char *term) {
+	int df = 0;
+
+	for (int i = 0; i < index->num_segments; i++) {
+		tSEGMENT *seg = &index->segments[i];
+		int Hidx = dictSearch( &seg->dict, term);
+
+		if (Hidx != -1)
+			df += seg->header[Hidx].df;
+	}
+	return df;
+}
+
+// 순위 검색에서 점수를 매길 텀들(NOT 아래에 있지 않은 텀, 사전 순으로 중복 없이)의 df를 모든 세그먼트에서 합해 dfs에 저장한다.
+// 샤드 조정기가 샤드들의 df를 더해 전체 색인의 idf를 구할 때 쓴다. (rankDocumentsStats)
+// 텀 수를 반환 (실패시 -1, dfs는 arena에서 할당)
+int termStats( tINDEX *index, char *query, tARENA *arena, int **dfs) {
+	tQNODE *root = queryParse( arena, query);
+	char **terms;
+	int m;
+
+	if (root == NULL || (m = _rankTerms( root, query, arena, &terms)) < 0)
+		return -1;
+
+	*dfs = (int *)arenaAlloc(arena, sizeof(int) * (m + 1));
+	if (*dfs == NULL)
+		return -1;
+
+	for (int t = 0; t < m; t++)
+		(*dfs)[t] = _termDf( index, terms[t]);
+
+	return m;
+}
+
+// 질의(query)에 맞는 문서를 BM25 점수로 순위를 매겨 상위 k개를 찾는다.
+// 텀들의 OR 질의(예) "a | b | c")는 WAND로 점수 상한이 k번째 점수를 넘지 못하는 문서를 건너뛰고
+// 그 밖의 불린 질의는 searchDocuments와 같은 결과 집합의 문서만 점수를 매긴다.
+// 점수는 NOT 아래에 있지 않은 텀들로 계산한다. (와일드카드 텀은 점수에 더하지 않고 결과 집합만 거른다.)
+// idf와 평균 문서 길이는 모든 세그먼트를 합친 값을 쓰므로 세그먼트가 나뉘어 있어도 점수가 같다.
+// 결과 캐시가 있으면 정규화한 질의와 k로 결과를 캐시한다.
+// 결과 배열의 주소를 반환 (점수 내림차순, 같은 점수는 문서번호 오름차순, arenaReset까지 유효)
+// 실패시 (찾은 문서가 없는 경우 포함) NULL을 반환
+// 찾은 문서 수는 numresults에 저장한다.
+tSCORED *rankDocuments( tINDEX *index, char *query, int k, tARENA *arena, int *numresults) {
+	return rankDocumentsStats( index, query, k, NULL, 0, arena, numresults);
+}
+
+// rankDocuments와 같지만 idf를 이 색인의 df 대신 dfs(termStats의 텀 순서로 num_dfs개, NULL이면 이 색인의 df)로 계산한다.
+// 샤드의 작업 프로세스가 모든 샤드의 df를 합친 값으로 점수를 매길 때 쓴다.
+tSCORED *rankDocumentsStats( tINDEX *index, char *query, int k, const int *dfs, int num_dfs, tARENA *arena,
+							int *numresults) {
+	tQNODE *root;
+	tTOPK topk;
+	tSCORED *results;
+	char *key = NULL;
+	char **terms;
+	double *idf;
+	int m;
+	int disjunctive;
+
+	*numresults = 0;
+
+	root = queryParse( arena, query);
+	if (root == NULL) {
+		if (query[strspn(query, " \t\r\n")] != 0)
+			fprintf( stderr, "Query syntax error\n");
+		return NULL;
+	}
+
+	if (index->cache != NULL) {
+		size_t size;
+
+		key = _queryCacheKey( index, root, 'R', k, arena);
+		if (key != NULL && cacheGet( index->cache, key, arena, (void **)&results, &size)) {
+			*numresults = size / sizeof(tSCORED);
+			return (*numresults > 0) ? results : NULL;
+		}
+	}
+
+	// 텀을 사전 순으로 정렬하고 중복을 없앤 뒤 모든 세그먼트의 df를 합쳐 idf를 구한다.
+	m = _rankTerms( root, query, arena, &terms);
+	idf = (double *)arenaAlloc(arena, sizeof(double) * (strlen(query) / 2 + 1));
+	topk.items = (tSCORED *)arenaAlloc(arena, sizeof(tSCORED) * k);
+	topk.num = 0;
+	topk.k = k;
+	if (m < 0 || idf == NULL || topk.items == NULL || (dfs != NULL && num_dfs != m))
+		return NULL;
+
+	for (int t = 0; t < m; t++)
+		idf[t] = bm25Idf( (dfs != NULL) ? dfs[t] : _termDf( index, terms[t]), index->num_docs);
+
+	// 텀 하나 또는 텀들의 OR
+	disjunctive = (root->type == Q_TERM);
+	if (root->type == Q_OR) {
+		disjunctive = 1;
+		for (int i = 0; i < root->num_children; i++)
+			if (root->children[i]->type != Q_TERM)
+				disjunctive = 0;
+	}
+
+	// 상위 k개 후보는 세그먼트들이 함께 쓰므로 뒤의 세그먼트일수록 WAND가 더 많이 건너뛴다.
+	for (int i = 0; i < index->num_segments; i++) {
+		tSEGMENT *seg = &index->segments[i];
+		tCURSOR *cursors = (tCURSOR *)arenaAlloc(arena, sizeof(tCURSOR) * (m + 1));
+		double scale = (avg_doclen > seg->avgdl) ? avg_doclen / seg->avgdl : 1;
+		int nc = 0;
+
+		if (cursors == NULL)
+			return NULL;
+
+		for (int t = 0; t < m; t++) {
+			int Hidx = dictSearch( &seg->dict, terms[t]);
+
+			if (Hidx == -1)
+				continue;
+			if (!_cursorInit( &cursors[nc], seg->header, seg->posting, Hidx, arena))
+				return NULL;
+			_cursorScoring( &cursors[nc++], seg->header[Hidx].max_weight, idf[t], scale);
+		}
+
+		if (disjunctive) {
+			if (_rankWand( cursors, nc, seg->doclen, seg->docbase, seg->deleted, &topk, arena) < 0)
+				return NULL;
+		}
+		else {
+			tDOCSET *docs = _searchSegment( root, seg, index->cache, arena);
+
+			if (docs == NULL)
+				return NULL;
+			_rankSet( docs, cursors, nc, seg->doclen, seg->docbase, &topk);
+		}
+	}
+
+	results = _topkResults( &topk, numresults);
+	if (key != NULL)
+		cachePut( index->cache, key, results, sizeof(tSCORED) * *numresults);
+
+	return results;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 샤드 조정기와 작업 프로세스 (shard.h)
+
+// 조정기의 요청 하나를 처리하여 응답을 보낸다.
+// 응답을 보내지 못하면 (조정기가 끝났으면) 0을 반환
+static int _shardRequest( tINDEX *index, int fd, tSHARDMSG *msg, char *body, tARENA *arena) {
+	switch (msg->type) {
+		case SHARD_SEARCH: {
+			tDOCSET *docs = searchDocuments( index, body, arena);
+
+			if (docs == NULL)
+				return shardSend( fd, SHARD_OK, 0, 0, NULL, 0);
+			docs = docsetToArray( arena, docs);
+			if (docs == NULL)
+				break;
+			return shardSend( fd, SHARD_OK, 0, docs->count, docs->docs, sizeof(int) * docs->count);
+		}
+
+		case SHARD_DF: {
+			int *dfs;
+			int m = termStats( index, body, arena, &dfs);
+
+			if (m < 0)
+				break;
+			return shardSend( fd, SHARD_OK, 0, m, dfs, sizeof(int) * m);
+		}
+
+		case SHARD_RANK: {
+			// 본문: 전체 df count개 + 질의
+			size_t offset = sizeof(int) * msg->count;
+			tSCORED *results;
+			int n;
+
+			if (msg->count < 0 || msg->arg <= 0 || offset > (size_t)msg->size)
+				break;
+			results = rankDocumentsStats( index, body + offset, msg->arg, (int *)body, msg->count, arena, &n);
+			return shardSend( fd, SHARD_OK, 0, n, results, sizeof(tSCORED) * n);
+		}
+	}
+
+	return shardSend( fd, SHARD_ERROR, 0, 0, NULL, 0);
+}
+
+// 샤드 작업 프로세스의 채널 하나
+typedef struct {
+	tINDEX	*index;
+	int		fd;
+} tSHARDCHANNEL;
+
+// 채널 스레드: 조정기가 채널을 닫을 때까지 요청을 처리한다.
+static void *_shardChannel( void *arg) {
+	tSHARDCHANNEL *ch = (tSHARDCHANNEL *)arg;
+	tARENA arena;
+	tSHARDMSG msg;
+	void *body;
+
+	arenaInit( &arena);
+	while (shardRecv( ch->fd, &msg, &arena, &body) && _shardRequest( ch->index, ch->fd, &msg, (char *)body, &arena))
+		arenaReset( &arena);
+	arenaDestroy( &arena);
+
+	return NULL;
+}
+
+// 샤드 작업 프로세스 (shard.h의 tSHARDFN, ctx는 tSHARDOPT)
+// 샤드 디렉토리의 색인을 매핑하고 채널마다 스레드 하나가 조정기가 보낸 요청(불린 검색, df, 순위 검색)을 끝날 때까지 처리한다.
+// 색인과 결과 캐시는 채널 스레드들이 함께 쓴다. (질의 서버의 작업 스레드들과 같다.)
+int shardServe( void *ctx, int *fds, int num_fds, int shard) {
+	tSHARDOPT *opt = (tSHARDOPT *)ctx;
+	tINDEX index;
+	tCACHE cache;
+	tARENA arena;
+	tSHARDMSG msg;
+	void *body;
+	tSHARDCHANNEL *channels = (tSHARDCHANNEL *)malloc(sizeof(tSHARDCHANNEL) * num_fds);
+	pthread_t *tids = (pthread_t *)malloc(sizeof(pthread_t) * num_fds);
+	int started = 0;
+
+	if (channels == NULL || tids == NULL || !load_segments( &index, opt->rank_k > 0)) {
+		fprintf( stderr, "Shard %d: %s\n", shard, (channels == NULL || tids == NULL) ? "out of memory" : "cannot load index");
+		shardSend( fds[0], SHARD_ERROR, 0, 0, NULL, 0);
+		free(channels);
+		free(tids);
+		return 1;
+	}
+	if (opt->cache_mb > 0 && cacheInit( &cache, (size_t)opt->cache_mb << 20))
+		index.cache = &cache;
+
+	arenaInit( &arena);
+
+	// 샤드의 문서 수와 문서 길이의 합을 첫 채널로 보내고 전체 색인의 값을 받아 순위 검색의 idf와 평균 문서 길이에 쓴다.
+	if (shardSend( fds[0], SHARD_HELLO, 0, index.num_docs, &index.total_doclen, sizeof(long)) &&
+		shardRecv( fds[0], &msg, &arena, &body) && msg.type == SHARD_STATS && msg.size == sizeof(long)) {
+		index.num_docs = msg.count;
+		index.total_doclen = *(long *)body;
+		avg_doclen = (index.num_docs > 0 && index.total_doclen > 0) ? (double)index.total_doclen / index.num_docs : 1;
+
+		// 첫 채널은 이 스레드가 맡는다. 스레드를 만들지 못한 채널은 닫는다. (조정기는 그 채널로 보낸 질의에 응답을 받지 못한다.)
+		for (int c = 0; c < num_fds; c++) {
+			channels[c].index = &index;
+			channels[c].fd = fds[c];
+			if (c == 0)
+				continue;
+			if (pthread_create( &tids[started], NULL, _shardChannel, &channels[c]) == 0)
+				started++;
+			else {
+				fprintf( stderr, "Shard %d: cannot start channel %d\n", shard, c);
+				close(fds[c]);
+				fds[c] = -1;
+			}
+		}
+		_shardChannel( &channels[0]);
+
+		for (int i = 0; i < started; i++)
+			pthread_join( tids[i], NULL);
+	}
+
+	for (int c = 0; c < num_fds; c++)
+		if (fds[c] >= 0)
+			close(fds[c]);
+	free(channels);
+	free(tids);
+	unload_segments( &index);
+	arenaDestroy( &arena);
+	if (index.cache != NULL)
+		cacheDestroy( index.cache);
+
+	return 0;
+}
+
+// 샤드 목록의 샤드마다 작업 프로세스를 num_channels개의 채널로 띄우고 전체 문서 수와 문서 길이의 합을 작업 프로세스들에 알린다.
+// 실패시 0을 반환
+int coordOpen( tCOORD *coord, tSHARDOPT *opt, int num_channels) {
+	tARENA arena;
+	tSHARDMSG msg;
+	void *body;
+	long total = 0;
+	int num_docs = 0;
+	int ret = 1;
+
+	if (!shardMapRead( &coord->map, SHARD_MANIFEST))
+		return 0;
+
+	coord->num_channels = num_channels;
+	coord->fds = (int *)malloc(sizeof(int) * coord->map.num_shards * num_channels);
+	coord->pids = (pid_t *)malloc(sizeof(pid_t) * coord->map.num_shards);
+	coord->idle = (int *)malloc(sizeof(int) * num_channels);
+	if (coord->fds == NULL || coord->pids == NULL || coord->idle == NULL ||
+		!shardSpawn( &coord->map, num_channels, shardServe, opt, coord->fds, coord->pids)) {
+		free(coord->fds);
+		free(coord->pids);
+		free(coord->idle);
+		shardMapFree( &coord->map);
+		return 0;
+	}
+	for (int c = 0; c < num_channels; c++)
+		coord->idle[c] = c;
+	coord->num_idle = num_channels;
+	pthread_mutex_init(&coord->lock, NULL);
+	pthread_cond_init(&coord->ready, NULL);
+
+	// 작업 프로세스는 첫 채널로 시작을 알린다.
+	arenaInit( &arena);
+	for (int s = 0; s < coord->map.num_shards && ret; s++) {
+		if (!shardRecv( coord->fds[s * num_channels], &msg, &arena, &body) || msg.type != SHARD_HELLO || msg.size != sizeof(long)) {
+			fprintf( stderr, "Shard %d failed to start\n", s);
+			ret = 0;
+		}
+		else {
+			num_docs += msg.count;
+			total += *(long *)body;
+		}
+	}
+	for (int s = 0; s < coord->map.num_shards && ret; s++)
+		ret = shardSend( coord->fds[s * num_channels], SHARD_STATS, 0, num_docs, &total, sizeof(long));
+	arenaDestroy( &arena);
+
+	if (!ret)
+		coordClose( coord);
+
+	return ret;
+}
+
+// 쉬는 채널 하나를 빌린다. (모두 쓰이고 있으면 기다린다.)
+static int _coordAcquire( tCOORD *coord) {
+	int c;
+
+	pthread_mutex_lock(&coord->lock);
+	while (coord->num_idle == 0)
+		pthread_cond_wait(&coord->ready, &coord->lock);
+	c = coord->idle[--coord->num_idle];
+	pthread_mutex_unlock(&coord->lock);
+
+	return c;
+}
+
+// 빌린 채널을 돌려준다.
+static void _coordRelease( tCOORD *coord, int c) {
+	pthread_mutex_lock(&coord->lock);
+	coord->idle[coord->num_idle++] = c;
+	pthread_cond_signal(&coord->ready);
+	pthread_mutex_unlock(&coord->lock);
+}
+
+// 채널 c로 모든 샤드에 같은 요청을 보낸다.
+// 보내지 못한 샤드가 있으면 0을 반환 (그 샤드의 응답은 받을 때 실패한다.)
+static int _coordScatter( tCOORD *coord, int c, int type, int arg, int count, const void *body, int size) {
+	int ret = 1;
+
+	for (int s = 0; s < coord->map.num_shards; s++)
+		if (!shardSend( coord->fds[s * coord->num_channels + c], type, arg, count, body, size))
+			ret = 0;
+
+	return ret;
+}
+
+// 채널 c로 모든 샤드의 응답(원소 크기 elem인 배열)을 받는다.
+// 실패한 응답이 있으면 0을 반환 (다음 요청과 어긋나지 않도록 나머지 응답도 모두 받는다.)
+static int _coordGather( tCOORD *coord, int c, size_t elem, tARENA *arena, tSHARDMSG *msgs, void **bodies) {
+	int ret = 1;
+
+	for (int s = 0; s < coord->map.num_shards; s++) {
+		if (!shardRecv( coord->fds[s * coord->num_channels + c], &msgs[s], arena, &bodies[s])) {
+			fprintf( stderr, "Shard %d is not responding\n", s);
+			msgs[s].count = 0;
+			ret = 0;
+		}
+		else if (msgs[s].type != SHARD_OK || msgs[s].count < 0 || (size_t)msgs[s].size != elem * msgs[s].count)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+// 샤드들이 찾은 문서번호 배열을 전체 문서번호로 바꿔 합친다.
+// 찾은 문서 수를 반환 (실패시 0)
+static int _coordMergeDocuments( tCOORD *coord, tSHARDMSG *msgs, void **bodies, tARENA *arena, int **docs) {
+	const int **lists = (const int **)arenaAlloc(arena, sizeof(int *) * coord->map.num_shards);
+	int *counts = (int *)arenaAlloc(arena, sizeof(int) * coord->map.num_shards);
+	int num = 0;
+
+	if (lists == NULL || counts == NULL)
+		return 0;
+
+	// 샤드 안의 문서번호 순서는 전체 문서번호 순서와 같으므로 바꾼 배열도 정렬되어 있다.
+	for (int s = 0; s < coord->map.num_shards; s++) {
+		int *list = (int *)bodies[s];
+
+		for (int i = 0; i < msgs[s].count; i++)
+			list[i] = shardGlobalDoc( &coord->map, s, list[i]);
+		lists[s] = list;
+		counts[s] = msgs[s].count;
+	}
+
+	*docs = unionDocumentsK( arena, lists, counts, coord->map.num_shards, &num);
+	return (*docs != NULL) ? num : 0;
+}
+
+// 샤드마다의 상위 k개를 전체 문서번호로 바꿔 모은 뒤 순위 순으로 정렬한다.
+// 전체 상위 k개에 드는 문서는 그 문서를 맡은 샤드의 상위 k개에도 들어 있다.
+// 찾은 문서 수를 반환 (k개까지, 실패시 0)
+static int _coordMergeRanked( tCOORD *coord, tSHARDMSG *msgs, void **bodies, int k, tARENA *arena, tSCORED **results) {
+	long total = 0;
+	int n = 0;
+
+	for (int s = 0; s < coord->map.num_shards; s++)
+		total += msgs[s].count;
+
+	*results = (tSCORED *)arenaAlloc(arena, sizeof(tSCORED) * (total + 1));
+	if (*results == NULL)
+		return 0;
+
+	for (int s = 0; s < coord->map.num_shards; s++) {
+		tSCORED *list = (tSCORED *)bodies[s];
+
+		for (int i = 0; i < msgs[s].count; i++) {
+			(*results)[n].doc = shardGlobalDoc( &coord->map, s, list[i].doc);
+			(*results)[n++].score = list[i].score;
+		}
+	}
+
+	qsort( *results, n, sizeof(tSCORED), _compareScored);
+	return (n < k) ? n : k;
+}
+
+// 질의 하나를 모든 샤드에 보내고 결과를 전체 문서번호로 합쳐 fp에 한 줄로 출력한다. (answerQuery와 같은 출력)
+// 순위 검색은 샤드들의 df를 먼저 모아 더한 뒤 모든 샤드가 같은 idf로 점수를 매긴 상위 rank_k개씩을 합친다.
+void coordAnswer( tCOORD *coord, int rank_k, char *query, tARENA *arena, FILE *fp) {
+	tSHARDMSG *msgs = (tSHARDMSG *)arenaAlloc(arena, sizeof(tSHARDMSG) * coord->map.num_shards);
+	void **bodies = (void **)arenaAlloc(arena, sizeof(void *) * coord->map.num_shards);
+	int len = strlen(query);
+	int num = 0;
+	int ok;
+	int c;
+
+	if (msgs == NULL || bodies == NULL) {
+		fprintf(fp, "not found!\n");
+		return;
+	}
+
+	// 문법 오류는 샤드들에 보내지 않고 한 번만 알린다.
+	if (queryParse( arena, query) == NULL) {
+		if (query[strspn(query, " \t\r\n")] != 0)
+			fprintf( stderr, "Query syntax error\n");
+		fprintf(fp, "not found!\n");
+		return;
+	}
+
+	// 채널을 빌리는 동안만 잠그므로 작업 스레드들의 질의는 서로 다른 채널로 동시에 오간다.
+	c = _coordAcquire( coord);
+
+	if (rank_k > 0) {
+		char *body = NULL;
+		int m = -1;
+
+		// 1단계: 점수를 매길 텀들의 샤드별 df (같은 질의이므로 텀 수와 순서는 샤드마다 같다.)
+		ok = _coordScatter( coord, c, SHARD_DF, 0, 0, query, len);
+		ok = _coordGather( coord, c, sizeof(int), arena, msgs, bodies) && ok;
+		if (ok) {
+			m = msgs[0].count;
+			body = (char *)arenaAlloc(arena, sizeof(int) * m + len);
+		}
+
+		for (int s = 1; s < coord->map.num_shards && body != NULL; s++)
+			if (msgs[s].count != m)
+				body = NULL;
+
+		// 2단계: 전체 df와 질의를 보내 샤드마다 상위 k개를 받는다.
+		if (body != NULL) {
+			int *dfs = (int *)body;
+
+			for (int t = 0; t < m; t++) {
+				dfs[t] = 0;
+				for (int s = 0; s < coord->map.num_shards; s++)
+					dfs[t] += ((int *)bodies[s])[t];
+			}
+			memcpy(body + sizeof(int) * m, query, len);
+
+			ok = _coordScatter( coord, c, SHARD_RANK, rank_k, m, body, sizeof(int) * m + len);
+			ok = _coordGather( coord, c, sizeof(tSCORED), arena, msgs, bodies) && ok;
+			if (ok) {
+				tSCORED *results;
+
+				num = _coordMergeRanked( coord, msgs, bodies, rank_k, arena, &results);
+				if (num > 0)
+					showRanked( fp, results, num);
+			}
+		}
+	}
+	else {
+		ok = _coordScatter( coord, c, SHARD_SEARCH, 0, 0, query, len);
+		ok = _coordGather( coord, c, sizeof(int), arena, msgs, bodies) && ok;
+		if (ok) {
+			int *docs;
+
+			num = _coordMergeDocuments( coord, msgs, bodies, arena, &docs);
+			if (num > 0)
+				showDocuments( fp, docsetFromArray( arena, docs, num, docs[num - 1]));
+		}
+	}
+
+	_coordRelease( coord, c);
+
+	if (num == 0)
+		fprintf(fp, "not found!\n");
+}
+
+// 작업 프로세스들을 끝내고 조정기를 닫는다.
+void coordClose( tCOORD *coord) {
+	shardStop( coord->fds, coord->pids, coord->map.num_shards, coord->num_channels);
+	pthread_mutex_destroy(&coord->lock);
+	pthread_cond_destroy(&coord->ready);
+	free(coord->fds);
+	free(coord->pids);
+	free(coord->idle);
+	shardMapFree( &coord->map);
+}
+
+static double _elapsed( struct timespec *t0) {
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e3 + (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static int _compareLong( const void *n1, const void *n2) {
+	long a = *(const long *)n1;
+	long b = *(const long *)n2;
+
+	return (a > b) - (a < b);
+}
+
+// 텀의 포스팅 리스트 전체를 복호화한다. (벤치마크용)
+static int *_decodeTerm( tHEADER *header, int *posting, int Hidx) {
+	int codec = idxFileHeader( posting)->codec;
+	int *docs = (int *)malloc(sizeof(int) * header[Hidx].df + 1);
+	unsigned char *list = (codec == CODEC_RAW) ? (unsigned char *)(posting + header[Hidx].index)
+											: (unsigned char *)posting + header[Hidx].index;
+
+	postingDecode( codec, list, header[Hidx].df, docs, NULL);
+	return docs;
+}
+
+// df 차이가 큰 텀 쌍의 교집합 속도를 방식별로 측정하여 출력한다.
+// (선형 병합, 지수 탐색, 스킵 테이블)
+void benchIntersect( tHEADER *header, int *posting) {
+	int num_terms = idxFileHeader( header)->count;
+	long *order;
+	int num_rare, num_common;
+	long found[3] = {0, 0, 0};
+	double ms[3] = {0, 0, 0};
+	int pairs = 0;
+	tARENA arena;
+
+	if (num_terms < 2)
+		return;
+
+	arenaInit( &arena);
+
+	// df 순으로 정렬하여 가장 드문 텀들과 가장 흔한 텀들을 짝짓는다. (상위 32비트: df, 하위: 텀 번호)
+	order = (long *)malloc(sizeof(long) * num_terms);
+	for (int i = 0; i < num_terms; i++)
+		order[i] = ((long)header[i].df << 32) | i;
+	qsort( order, num_terms, sizeof(long), _compareLong);
+
+	num_rare = (num_terms / 2 < 200) ? num_terms / 2 : 200;
+	num_common = (num_terms / 2 < 10) ? num_terms / 2 : 10;
+
+	for (int r = 0; r < num_rare; r++) {
+		int rare = (int)(order[r] & 0xffffffff);
+		int *rare_docs = _decodeTerm( header, posting, rare);
+
+		for (int c = num_terms - num_common; c < num_terms; c++) {
+			int common = (int)(order[c] & 0xffffffff);
+			int *docs, *result;
+			int n;
+			struct timespec t0;
+
+			// 선형 병합: 흔한 텀의 리스트를 모두 복호화한 뒤 병합
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			docs = _decodeTerm( header, posting, common);
+			result = (int *)malloc(sizeof(int) * header[rare].df + 1);
+			n = intersectScalar( rare_docs, header[rare].df, docs, header[common].df, result);
+			ms[0] += _elapsed( &t0);
+			found[0] += n;
+			free(docs);
+			free(result);
+
+			// 지수 탐색: 흔한 텀의 리스트를 모두 복호화한 뒤 드문 텀 기준으로 탐색
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			docs = _decodeTerm( header, posting, common);
+			result = intersectDocuments( &arena, rare_docs, header[rare].df, docs, header[common].df, &n);
+			ms[1] += _elapsed( &t0);
+			found[1] += n;
+			free(docs);
+			arenaReset( &arena);
+
+			// 스킵 테이블: 흔한 텀은 필요한 블록만 복호화
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			result = intersectPosting( &arena, rare_docs, header[rare].df, header, posting, common, &n);
+			ms[2] += _elapsed( &t0);
+			found[2] += n;
+			arenaReset( &arena);
+
+			pairs++;
+		}
+		free(rare_docs);
+	}
+
+	printf( "%d term pairs (rare df <= %ld, common df >= %ld), codec %u\n", pairs,
+			order[num_rare - 1] >> 32, order[num_terms - num_common] >> 32,
+			idxFileHeader( posting)->codec);
+	printf( "linear merge  : %9.3f ms (%ld docs)\n", ms[0], found[0]);
+	printf( "galloping     : %9.3f ms (%ld docs) x%.1f\n", ms[1], found[1], ms[0] / ms[1]);
+	printf( "skip pointers : %9.3f ms (%ld docs) x%.1f\n", ms[2], found[2], ms[0] / ms[2]);
+
+	arenaDestroy( &arena);
+	free(order);
+}
+
+// df가 큰 텀 쌍의 교집합/합집합 속도를 커널(스칼라, SSE, AVX2)별로 측정하여 출력한다.
+// 같은 텀 쌍을 밀도에 맞는 DocSet 표현(비트맵 등)으로 연산한 결과도 함께 출력한다.
+void benchSetops( tHEADER *header, int *posting) {
+	int num_terms = idxFileHeader( header)->count;
+	int saved = setopsLevel;
+	int best = setopsInit( -1);
+	long *order;
+	int num_common;
+	int **docs;
+	int *result;
+	int maxdf;
+	static const char *names[] = { "scalar", "sse4.2", "avx2" };
+	long found[3][2];
+	double ms[3][2] = {{0, 0}};
+	tDOCSET **sets;
+	tARENA set_arena, arena;
+	long set_found[2] = {0, 0};
+	double set_ms[2] = {0, 0};
+	size_t set_bytes = 0;
+	size_t array_bytes = 0;
+
+	if (num_terms < 2)
+		return;
+
+	order = (long *)malloc(sizeof(long) * num_terms);
+	for (int i = 0; i < num_terms; i++)
+		order[i] = ((long)header[i].df << 32) | i;
+	qsort( order, num_terms, sizeof(long), _compareLong);
+
+	num_common = (num_terms < 30) ? num_terms : 30;
+	docs = (int **)malloc(sizeof(int *) * num_common);
+	for (int c = 0; c < num_common; c++)
+		docs[c] = _decodeTerm( header, posting, (int)(order[num_terms - 1 - c] & 0xffffffff));
+	maxdf = (int)(order[num_terms - 1] >> 32);
+	result = (int *)malloc(sizeof(int) * (2 * maxdf + SETOPS_SLACK));
+
+	for (int level = 0; level <= best; level++) {
+		struct timespec t0;
+
+		setopsInit( level);
+		found[level][0] = found[level][1] = 0;
+		ms[level][0] = ms[level][1] = 0;
+
+		for (int x = 0; x < num_common; x++) {
+			for (int y = 0; y < num_common; y++) {
+				int nx = (int)(order[num_terms - 1 - x] >> 32);
+				int ny = (int)(order[num_terms - 1 - y] >> 32);
+
+				clock_gettime(CLOCK_MONOTONIC, &t0);
+				found[level][0] += setIntersect( docs[x], nx, docs[y], ny, result);
+				ms[level][0] += _elapsed( &t0);
+
+				clock_gettime(CLOCK_MONOTONIC, &t0);
+				found[level][1] += setUnion( docs[x], nx, docs[y], ny, result);
+				ms[level][1] += _elapsed( &t0);
+			}
+		}
+	}
+
+	printf( "\n%d x %d common term pairs (df >= %ld)\n", num_common, num_common,
+			order[num_terms - num_common] >> 32);
+	for (int level = 0; level <= best; level++) {
+		printf( "%-7s intersect: %9.3f ms (%ld docs) x%.1f   union: %9.3f ms (%ld docs) x%.1f\n",
+				names[level], ms[level][0], found[level][0], ms[0][0] / ms[level][0],
+				ms[level][1], found[level][1], ms[0][1] / ms[level][1]);
+	}
+
+	setopsInit( saved);
+
+	// DocSet: 텀마다 밀도에 맞는 표현으로 한 번 바꾸어 두고 연산
+	arenaInit( &set_arena);
+	arenaInit( &arena);
+	sets = (tDOCSET **)malloc(sizeof(tDOCSET *) * num_common);
+	for (int c = 0; c < num_common; c++)
+		sets[c] = docsetOptimize( &set_arena, docsetFromArray( &set_arena, docs[c],
+								(int)(order[num_terms - 1 - c] >> 32), idxFileHeader( posting)->num_docs));
+
+	for (int x = 0; x < num_common; x++) {
+		for (int y = 0; y < num_common; y++) {
+			struct timespec t0;
+			tDOCSET *set;
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			set = docsetAnd( &arena, sets[x], sets[y]);
+			set_ms[0] += _elapsed( &t0);
+			set_found[0] += set->count;
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			set = docsetOr( &arena, sets[x], sets[y]);
+			set_ms[1] += _elapsed( &t0);
+			set_found[1] += set->count;
+			set_bytes += docsetBytes( set);
+			array_bytes += sizeof(int) * set->count;
+
+			arenaReset( &arena);
+		}
+	}
+
+	printf( "%-7s intersect: %9.3f ms (%ld docs) x%.1f   union: %9.3f ms (%ld docs) x%.1f\n",
+			"docset", set_ms[0], set_found[0], ms[0][0] / set_ms[0],
+			set_ms[1], set_found[1], ms[0][1] / set_ms[1]);
+	printf( "docset union results: %zu bytes (%zu bytes as int arrays)\n", set_bytes, array_bytes);
+
+	free(sets);
+	arenaDestroy( &arena);
+	arenaDestroy( &set_arena);
+	for (int c = 0; c < num_common; c++)
+		free(docs[c]);
+	free(docs);
+	free(result);
+	free(order);
+}
+
+// 흔한 텀들의 OR 질의로 상위 k개 순위 검색 속도를 측정하여 출력한다.
+// (결과 집합 전체에 점수를 매기는 방식, WAND)
+void benchRank( tHEADER *header, int *posting, int *doclen) {
+	int num_terms = idxFileHeader( header)->count;
+	int num_docs = idxFileHeader( doclen)->count;
+	long *order;
+	int num_common;
+	int num_queries = 200;
+	int k = 10;
+	long scored[2] = {0, 0};
+	double ms[2] = {0, 0};
+	int mismatches = 0;
+	tARENA arena;
+
+	if (num_terms < 2)
+		return;
+
+	order = (long *)malloc(sizeof(long) * num_terms);
+	for (int i = 0; i < num_terms; i++)
+		order[i] = ((long)header[i].df << 32) | i;
+	qsort( order, num_terms, sizeof(long), _compareLong);
+
+	num_common = (num_terms < 200) ? num_terms : 200;
+	arenaInit( &arena);
+	srand(1);
+
+	for (int q = 0; q < num_queries; q++) {
+		int terms[2][4];
+		int n[2];
+		tTOPK topk[2];
+		tSCORED *results[2];
+		int numresults[2];
+		tCURSOR *cursors;
+		tDOCSET *docs = NULL;
+		struct timespec t0;
+
+		// 흔한 텀 2~4개의 OR
+		n[0] = n[1] = 2 + rand() % 3;
+		for (int i = 0; i < n[0]; i++)
+			terms[0][i] = terms[1][i] = (int)(order[num_terms - 1 - rand() % num_common] & 0xffffffff);
+
+		for (int m = 0; m < 2; m++) {
+			topk[m].items = (tSCORED *)arenaAlloc(&arena, sizeof(tSCORED) * k);
+			topk[m].num = 0;
+			topk[m].k = k;
+		}
+
+		// 결과 집합 전체: 합집합을 만든 뒤 모든 문서에 점수를 매긴다.
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		cursors = _termCursors( header, posting, terms[0], &n[0], num_docs, &arena);
+		for (int i = 0; i < n[0]; i++) {
+			tDOCSET *term = _termDocuments( header, posting, terms[0][i], &arena);
+
+			docs = (docs == NULL) ? term : docsetOr( &arena, docs, term);
+		}
+		scored[0] += _rankSet( docs, cursors, n[0], doclen, 0, &topk[0]);
+		results[0] = _topkResults( &topk[0], &numresults[0]);
+		ms[0] += _elapsed( &t0);
+
+		// WAND
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		cursors = _termCursors( header, posting, terms[1], &n[1], num_docs, &arena);
+		scored[1] += _rankWand( cursors, n[1], doclen, 0, NULL, &topk[1], &arena);
+		results[1] = _topkResults( &topk[1], &numresults[1]);
+		ms[1] += _elapsed( &t0);
+
+		if (numresults[0] != numresults[1])
+			mismatches++;
+		else {
+			for (int i = 0; i < numresults[0]; i++) {
+				if (results[0][i].doc != results[1][i].doc || results[0][i].score != results[1][i].score) {
+					mismatches++;
+					break;
+				}
+			}
+		}
+
+		arenaReset( &arena);
+	}
+
+	printf( "\n%d OR queries of 2-4 common terms (df >= %ld), top %d\n", num_queries,
+			order[num_terms - num_common] >> 32, k);
+	printf( "score all : %9.3f ms (%ld docs scored)\n", ms[0], scored[0]);
+	printf( "WAND      : %9.3f ms (%ld docs scored) x%.1f, %d mismatches\n",
+			ms[1], scored[1], ms[0] / ms[1], mismatches);
+
+	arenaDestroy( &arena);
+	free(order);
 }
@@ -0,0 +1,189 @@
+// 세그먼트 색인 (LSM)
+// 문서를 추가할 때마다 전체를 다시 색인하지 않고, 새 문서만 작은 세그먼트로 색인하여 덧붙인다. (index -a)
+// 세그먼트는 한 번 기록하면 바뀌지 않는 색인 파일들(dic.txt, header.idx, posting.idx, position.idx, doclen.idx)을
+// 담은 디렉토리(seg_000001/)이며, 세그먼트 목록(segments.txt)에 문서번호 범위와 함께 기록한다.
+// 세그먼트는 전체 문서번호 docbase+1 ~ docbase+num_docs를 맡고, 색인 파일에는 세그먼트 안의 문서번호(1부터)로 기록한다.
+// 삭제한 문서는 세그먼트의 삭제 비트맵(del.idx, tombstone)에 표시하고 병합할 때 포스팅에서 지운다.
+// 병합한 세그먼트도 삭제 비트맵을 이어받으므로 한 번 쓴 문서번호는 바뀌거나 다시 쓰이지 않는다.
+// 세그먼트 목록은 임시 파일에 쓴 뒤 rename으로 바꾸므로 검색기는 항상 완전한 목록을 읽는다.
+//
+// 세그먼트 목록 형식 (텍스트)
+//   세대(generation) 다음_세그먼트_번호 전체_문서_수 세그먼트_수
+//   세그먼트_번호 docbase 문서_수 삭제된_문서_수 포스팅에서_지운_문서_수	(문서번호 순으로 세그먼트 수만큼)
+//
+// del.idx 본문: 세그먼트 안의 문서번호 0 ~ num_docs 비트맵 (uint64_t, 문서번호 d는 words[d >> 6]의 (d & 63)번째 비트)
+
+#define SEG_MANIFEST	"segments.txt"
+#define SEG_LOCK		"segments.lock"	// 색인 작성기는 한 번에 하나만 (flock)
+#define SEG_DIR			"seg_%06d"
+#define SEG_DELETED		"del.idx"
+#define SEG_PATH		64
+
+// 세그먼트 정보
+typedef struct {
+	int		id;				// 세그먼트 번호 (디렉토리 이름)
+	int		docbase;		// 세그먼트 앞에 있는 문서 수
+	int		num_docs;		// 세그먼트가 맡은 문서 수
+	int		num_deleted;	// 삭제 비트맵에 표시된 문서 수
+	int		num_purged;		// 그 중 병합하면서 포스팅에서 지운 문서 수
+} tSEGINFO;
+
+// 세그먼트 목록
+typedef struct {
+	unsigned int	generation;	// 목록이 바뀔 때마다 1씩 증가
+	int			next_id;		// 다음에 만들 세그먼트 번호
+	int			num_docs;		// 전체 문서 수 (새 세그먼트의 docbase)
+	tSEGINFO	*segs;			// 문서번호 순
+	int			num_segs;
+	int			cap_segs;
+} tMANIFEST;
+
+////////////////////////////////////////////////////////////////////////////////
+/* makes path of a segment file (ex) "seg_000001/header.idx")
+	id < 0 means a single index (file in the current directory)
+	return	buf
+*/
+char *segmentPath( char *buf, int id, char *file) {
+	if (id < 0)
+		snprintf(buf, SEG_PATH, "%s", file);
+	else
+		snprintf(buf, SEG_PATH, SEG_DIR "/%s", id, file);
+	return buf;
+}
+
+/* returns number of words of deletion bitmap of a segment (doc ids 0 ~ num_docs)
+*/
+int segmentDeletedWords( int num_docs) {
+	return (num_docs >> 6) + 1;
+}
+
+/* initializes empty segment list
+*/
+void manifestInit( tMANIFEST *m) {
+	m->generation = 0;
+	m->next_id = 1;
+	m->num_docs = 0;
+	m->segs = NULL;
+	m->num_segs = 0;
+	m->cap_segs = 0;
+}
+
+/* appends a segment entry at the end of the list
+	return	entry pointer (valid until next manifestAdd)
+			NULL if overflow
+*/
+tSEGINFO *manifestAdd( tMANIFEST *m) {
+	if (m->num_segs == m->cap_segs) {
+		int cap = (m->cap_segs == 0) ? 16 : m->cap_segs * 2;
+		tSEGINFO *segs = (tSEGINFO *)realloc(m->segs, sizeof(tSEGINFO) * cap);
+
+		if (segs == NULL)
+			return NULL;
+		m->segs = segs;
+		m->cap_segs = cap;
+	}
+
+	memset(&m->segs[m->num_segs], 0, sizeof(tSEGINFO));
+	return &m->segs[m->num_segs++];
+}
+
+/* reads segment list file
+	return	1 success
+			0 failure (open error or invalid file)
+*/
+int manifestRead( tMANIFEST *m, char *filename) {
+	FILE *fp = fopen(filename, "rt");
+	int num_segs;
+
+	manifestInit( m);
+
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return 0;
+	}
+
+	if (fscanf(fp, "%u %d %d %d", &m->generation, &m->next_id, &m->num_docs, &num_segs) != 4)
+		num_segs = -1;
+
+	for (int i = 0; i < num_segs; i++) {
+		tSEGINFO *seg = manifestAdd( m);
+
+		if (seg == NULL || fscanf(fp, "%d %d %d %d %d", &seg->id, &seg->docbase, &seg->num_docs,
+								&seg->num_deleted, &seg->num_purged) != 5) {
+			num_segs = -1;
+			break;
+		}
+	}
+	fclose(fp);
+
+	if (num_segs < 0) {
+		fprintf( stderr, "Invalid segment list:%s\n", filename);
+		free(m->segs);
+		manifestInit( m);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* writes segment list file (written to a temporary file and renamed, so readers never see a partial list)
+	return	1 success
+			0 failure
+*/
+int manifestWrite( tMANIFEST *m, char *filename) {
+	char tmp[SEG_PATH];
+	FILE *fp;
+	int error;
+
+	snprintf(tmp, SEG_PATH, "%s.tmp", filename);
+	fp = fopen(tmp, "wt");
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", tmp);
+		return 0;
+	}
+
+	fprintf(fp, "%u %d %d %d\n", m->generation, m->next_id, m->num_docs, m->num_segs);
+	for (int i = 0; i < m->num_segs; i++) {
+		tSEGINFO *seg = &m->segs[i];
+
+		fprintf(fp, "%d %d %d %d %d\n", seg->id, seg->docbase, seg->num_docs, seg->num_deleted, seg->num_purged);
+	}
+
+	error = ferror(fp);
+	if (fclose(fp) != 0 || error || rename(tmp, filename) != 0) {
+		fprintf( stderr, "File write error:%s\n", filename);
+		unlink(tmp);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* finds the segment containing (global) doc id
+	return	index of the segment in the list
+			-1 not found
+*/
+int manifestFind( tMANIFEST *m, int docid) {
+	int lo = 0;
+	int hi = m->num_segs;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (m->segs[mid].docbase + m->segs[mid].num_docs < docid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < m->num_segs && docid > m->segs[lo].docbase)
+		return lo;
+	return -1;
+}
+
+/* frees segment list
+*/
+void manifestFree( tMANIFEST *m) {
+	free(m->segs);
+	manifestInit( m);
+}
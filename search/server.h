@@ -0,0 +1,705 @@
+// 질의 서버 (epoll 이벤트 루프 + 작업 스레드 풀)
+// 클라이언트는 Unix 도메인 소켓 또는 TCP로 접속하여 한 줄에 질의 하나를 보내고 질의마다 한 줄의 결과를 받는다.
+// 이벤트 루프(serverRun을 부른 스레드)는 접속과 입출력만 처리하고 질의는 작업 스레드들이 나누어 처리한다.
+// 색인은 읽기 전용으로 모든 작업 스레드가 함께 쓰고, 질의 처리에 쓰는 arena(arena.h)는 작업 스레드마다 하나씩 둔다.
+// 한 연결의 질의는 하나씩 차례로 처리하므로 응답 순서는 질의 순서와 같다. (여러 연결은 동시에 처리)
+// 질의가 들어온 때부터 응답이 준비된 때까지의 지연 시간을 히스토그램으로 모아
+// SERVER_STATS_SEC마다, 그리고 끝날 때 처리량(QPS)과 지연 시간 분위수(p50, p99)를 stderr에 출력한다.
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#define SERVER_MAX_EVENTS	64
+#define SERVER_STATS_SEC	10		// 통계 출력 주기 (초)
+#define SERVER_PENDING		16		// 한 연결에서 읽어 둘 최대 바이트 수 (질의 최대 길이의 배수, 넘으면 읽기를 멈춘다.)
+#define SERVER_HIST_SUB		16		// 지연 시간 히스토그램: 2의 거듭제곱 구간을 나누는 칸 수 (오차 1/16 이내)
+#define SERVER_HIST_SIZE	(64 * SERVER_HIST_SUB)
+
+// 질의 처리 함수: query(줄바꿈 문자 없음)를 처리하여 한 줄의 결과를 out에 출력한다.
+// 작업 스레드들이 동시에 부르며 arena는 그 작업 스레드 전용이다. (부른 뒤 arenaReset)
+typedef void (*tSERVERFN)( void *ctx, char *query, tARENA *arena, FILE *out);
+
+// 통계 출력 함수: 서버가 처리량과 지연 시간을 출력할 때 함께 불러 질의 처리 쪽의 통계(예) 캐시 적중률)를 출력한다.
+typedef void (*tSERVERREPORTFN)( void *ctx);
+
+// 클라이언트 연결
+typedef struct serverConn {
+	int					fd;
+	char				*in;		// 받은 데이터 (아직 처리하지 않은 질의들)
+	int					in_len;
+	int					in_cap;
+	char				*out;		// 보낼 응답
+	size_t				out_len;
+	size_t				out_off;	// 보낸 바이트 수
+	size_t				out_cap;
+	unsigned int		events;		// epoll에 등록한 이벤트
+	int					registered;	// epoll에 등록되어 있는지 (기다릴 이벤트가 없으면 뺀다.)
+	int					busy;		// 작업 스레드가 이 연결의 질의를 처리하고 있는지
+	int					eof;		// 클라이언트가 보내기를 마쳤는지 (남은 질의의 응답은 보낸다.)
+	int					dead;		// 입출력 오류 (응답을 보내지 않고 닫는다.)
+	int					closed;		// 닫은 연결 (같은 epoll_wait 결과에 남은 이벤트는 무시하고, 다 처리한 뒤 해제한다.)
+	struct serverConn	*prev;
+	struct serverConn	*next;
+} tSERVERCONN;
+
+// 작업 스레드가 처리할 질의
+typedef struct serverJob {
+	tSERVERCONN			*conn;
+	char				*query;
+	char				*result;	// 처리 결과 (open_memstream)
+	size_t				result_len;
+	struct timespec		t0;			// 질의가 들어온 시각
+	struct serverJob	*next;
+} tSERVERJOB;
+
+// 지연 시간 히스토그램 (나노초, 값 v는 v의 최상위 비트 아래 4비트로 칸을 정한다.)
+typedef struct {
+	long	counts[SERVER_HIST_SIZE];
+	long	total;
+	long	max;
+} tLATENCY;
+
+typedef struct {
+	char			*address;
+	int				listen_fd;
+	int				epoll_fd;
+	int				event_fd;	// 작업 스레드가 응답이 준비되었음을 이벤트 루프에 알린다.
+	int				max_query;	// 질의 최대 길이 (넘으면 연결을 닫는다.)
+	tSERVERFN		fn;
+	void			*ctx;
+	tSERVERREPORTFN	report;		// 통계를 출력할 때 함께 부른다. (NULL: 없음, serverOpen 뒤에 설정)
+	pthread_t		*tids;
+	int				num_workers;
+	pthread_mutex_t	lock;		// 아래 작업 큐들을 보호
+	pthread_cond_t	cond;
+	tSERVERJOB		*todo;		// 처리할 질의 (먼저 들어온 것부터)
+	tSERVERJOB		*todo_tail;
+	tSERVERJOB		*done;		// 처리한 질의 (이벤트 루프가 가져간다.)
+	int				stop;
+	tSERVERCONN		*conns;		// 열린 연결들
+	tSERVERCONN		*closed;	// 닫았지만 아직 해제하지 않은 연결들 (_serverReap)
+	tLATENCY		interval;	// 마지막 통계 출력 이후
+	tLATENCY		total;		// 서버를 시작한 이후
+	struct timespec	started;
+	struct timespec	reported;
+} tSERVER;
+
+static volatile sig_atomic_t serverStopped = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+void serverClose( tSERVER *server);
+
+static void _serverSignal( int sig) {
+	(void)sig;
+	serverStopped = 1;
+}
+
+static double _serverSeconds( struct timespec *t0, struct timespec *t1) {
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static int _latencyBucket( long ns) {
+	int shift;
+
+	if (ns < SERVER_HIST_SUB)
+		return (ns < 0) ? 0 : (int)ns;
+
+	// 최상위 비트 아래 4비트 (SERVER_HIST_SUB == 16)
+	shift = 63 - __builtin_clzl(ns) - 4;
+	return (shift + 1) * SERVER_HIST_SUB + (int)((ns >> shift) & (SERVER_HIST_SUB - 1));
+}
+
+// 칸의 가운데 값 (나노초)
+static double _latencyValue( int b) {
+	int shift = b / SERVER_HIST_SUB - 1;
+
+	if (shift < 0)
+		return b;
+	return (double)((long)(SERVER_HIST_SUB + b % SERVER_HIST_SUB) << shift) + (1L << shift) / 2.0;
+}
+
+static void _latencyAdd( tLATENCY *lat, long ns) {
+	lat->counts[_latencyBucket( ns)]++;
+	lat->total++;
+	if (ns > lat->max)
+		lat->max = ns;
+}
+
+// 분위수 p (0 ~ 1)의 지연 시간 (밀리초)
+static double _latencyPercentile( tLATENCY *lat, double p) {
+	long target = (long)(p * lat->total);
+	long sum = 0;
+
+	if (target < p * lat->total)
+		target++;
+	if (target < 1)
+		target = 1;
+
+	for (int b = 0; b < SERVER_HIST_SIZE; b++) {
+		sum += lat->counts[b];
+		if (sum >= target)
+			return _latencyValue( b) / 1e6;
+	}
+	return lat->max / 1e6;
+}
+
+static void _latencyReport( tLATENCY *lat, double seconds, char *label) {
+	fprintf( stderr, "[%s] %ld queries in %.1f s: %.1f QPS, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			label, lat->total, seconds, (seconds > 0) ? lat->total / seconds : 0,
+			_latencyPercentile( lat, 0.5), _latencyPercentile( lat, 0.99), lat->max / 1e6);
+}
+
+// 주소에 맞는 소켓을 만들어 듣기 시작한다.
+// '/'가 있으면 Unix 도메인 소켓 경로, 그 외에는 [HOST:]PORT (HOST를 생략하면 127.0.0.1)
+// 소켓 번호를 반환 (실패시 -1)
+static int _serverListen( char *address) {
+	int fd;
+
+	if (strchr(address, '/') != NULL) {
+		struct sockaddr_un sa;
+
+		if (strlen(address) >= sizeof(sa.sun_path)) {
+			fprintf( stderr, "Socket path too long:%s\n", address);
+			return -1;
+		}
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		strcpy(sa.sun_path, address);
+		unlink(address);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, SOMAXCONN) < 0) {
+			fprintf( stderr, "Socket error:%s (%s)\n", address, strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+	}
+	else {
+		struct sockaddr_in sa;
+		char host[INET_ADDRSTRLEN] = "127.0.0.1";
+		char *colon = strrchr(address, ':');
+		int port = atoi( colon ? colon + 1 : address);
+		int on = 1;
+
+		if (colon != NULL && colon > address) {
+			if (colon - address >= INET_ADDRSTRLEN) {
+				fprintf( stderr, "Invalid address:%s\n", address);
+				return -1;
+			}
+			memcpy(host, address, colon - address);
+			host[colon - address] = 0;
+		}
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		sa.sin_port = htons(port);
+		if (port <= 0 || port > 65535 || inet_pton(AF_INET, host, &sa.sin_addr) != 1) {
+			fprintf( stderr, "Invalid address:%s\n", address);
+			return -1;
+		}
+
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, SOMAXCONN) < 0) {
+			fprintf( stderr, "Socket error:%s (%s)\n", address, strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+// 작업 스레드: 작업 큐에서 질의를 꺼내 처리하고 결과를 처리한 질의 목록에 넣는다.
+static void *_serverWorker( void *arg) {
+	tSERVER *server = (tSERVER *)arg;
+	tARENA arena;
+
+	arenaInit( &arena);
+
+	while (1) {
+		tSERVERJOB *job;
+		FILE *fp;
+		uint64_t one = 1;
+
+		pthread_mutex_lock(&server->lock);
+		while (!server->stop && server->todo == NULL)
+			pthread_cond_wait(&server->cond, &server->lock);
+		job = server->todo;
+		if (job != NULL) {
+			server->todo = job->next;
+			if (server->todo == NULL)
+				server->todo_tail = NULL;
+		}
+		pthread_mutex_unlock(&server->lock);
+
+		if (job == NULL)
+			break;
+
+		fp = open_memstream(&job->result, &job->result_len);
+		if (fp != NULL) {
+			server->fn( server->ctx, job->query, &arena, fp);
+			fclose(fp);
+		}
+		arenaReset( &arena);
+
+		pthread_mutex_lock(&server->lock);
+		job->next = server->done;
+		server->done = job;
+		pthread_mutex_unlock(&server->lock);
+
+		if (write(server->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			fprintf( stderr, "eventfd write error:%s\n", strerror(errno));
+	}
+
+	arenaDestroy( &arena);
+	return NULL;
+}
+
+// 연결을 닫고 닫은 연결 목록으로 옮긴다.
+// 같은 epoll_wait 결과에 이 연결의 이벤트가 남아 있을 수 있으므로 해제는 _serverReap에서 한다.
+static void _serverClose( tSERVER *server, tSERVERCONN *c) {
+	if (c->registered)
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->registered = 0;
+	c->closed = 1;
+
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		server->conns = c->next;
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+
+	c->prev = NULL;
+	c->next = server->closed;
+	server->closed = c;
+}
+
+// 닫은 연결들을 해제한다.
+static void _serverReap( tSERVER *server) {
+	while (server->closed != NULL) {
+		tSERVERCONN *c = server->closed;
+
+		server->closed = c->next;
+		free(c->in);
+		free(c->out);
+		free(c);
+	}
+}
+
+static void _serverAccept( tSERVER *server) {
+	while (1) {
+		struct epoll_event ev;
+		tSERVERCONN *c;
+		int on = 1;
+		int fd = accept(server->listen_fd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				fprintf( stderr, "accept error:%s\n", strerror(errno));
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		// TCP이면 짧은 응답을 모으지 않고 바로 보낸다. (Unix 도메인 소켓이면 실패, 무시)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		c = (tSERVERCONN *)calloc(1, sizeof(tSERVERCONN));
+		if (c == NULL) {
+			close(fd);
+			return;
+		}
+		c->fd = fd;
+		c->events = EPOLLIN;
+		c->registered = 1;
+
+		ev.events = c->events;
+		ev.data.ptr = c;
+		if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close(fd);
+			free(c);
+			continue;
+		}
+
+		c->next = server->conns;
+		if (server->conns != NULL)
+			server->conns->prev = c;
+		server->conns = c;
+	}
+}
+
+// 받을 수 있는 데이터를 모두 읽는다.
+static void _serverRead( tSERVER *server, tSERVERCONN *c) {
+	while (!c->eof && !c->dead && c->in_len < server->max_query * SERVER_PENDING) {
+		ssize_t n;
+
+		if (c->in_len == c->in_cap) {
+			int cap = (c->in_cap == 0) ? 4096 : c->in_cap * 2;
+			char *in = (char *)realloc(c->in, cap);
+
+			if (in == NULL) {
+				c->dead = 1;
+				return;
+			}
+			c->in = in;
+			c->in_cap = cap;
+		}
+
+		n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+		if (n > 0)
+			c->in_len += n;
+		else if (n == 0)
+			c->eof = 1;
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+		else if (errno != EINTR)
+			c->dead = 1;
+	}
+}
+
+// 보낼 응답을 보낼 수 있는 만큼 보낸다.
+static void _serverWrite( tSERVERCONN *c) {
+	while (c->out_off < c->out_len && !c->dead) {
+		ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+
+		if (n > 0)
+			c->out_off += n;
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else
+			c->dead = 1;
+	}
+	c->out_off = c->out_len = 0;
+}
+
+static void _serverAppend( tSERVERCONN *c, const char *data, size_t len) {
+	if (c->out_len + len > c->out_cap) {
+		size_t cap = (c->out_cap == 0) ? 4096 : c->out_cap;
+		char *out;
+
+		while (cap < c->out_len + len)
+			cap *= 2;
+		out = (char *)realloc(c->out, cap);
+		if (out == NULL) {
+			c->dead = 1;
+			return;
+		}
+		c->out = out;
+		c->out_cap = cap;
+	}
+	memcpy(c->out + c->out_len, data, len);
+	c->out_len += len;
+}
+
+// 연결이 쉬고 있으면 받은 데이터에서 다음 질의(한 줄)를 꺼내 작업 큐에 넣는다.
+// 클라이언트가 보내기를 마쳤으면 줄바꿈 문자가 없는 마지막 줄도 질의로 처리한다.
+static void _serverDispatch( tSERVER *server, tSERVERCONN *c) {
+	tSERVERJOB *job;
+	char *nl;
+	int len;
+
+	if (c->busy || c->dead || c->in_len == 0)
+		return;
+
+	nl = (char *)memchr(c->in, '\n', c->in_len);
+	if (nl == NULL) {
+		if (c->in_len > server->max_query) {
+			fprintf( stderr, "Query too long (%d bytes), closing connection\n", c->in_len);
+			c->dead = 1;
+		}
+		if (!c->eof || c->dead)
+			return;
+	}
+	len = (nl != NULL) ? nl - c->in : c->in_len;
+
+	job = (tSERVERJOB *)calloc(1, sizeof(tSERVERJOB));
+	if (job == NULL || (job->query = (char *)malloc(len + 1)) == NULL) {
+		free(job);
+		c->dead = 1;
+		return;
+	}
+	memcpy(job->query, c->in, len);
+	job->query[len] = 0;
+	job->conn = c;
+	clock_gettime(CLOCK_MONOTONIC, &job->t0);
+
+	if (nl != NULL)
+		len++;
+	c->in_len -= len;
+	memmove(c->in, c->in + len, c->in_len);
+	c->busy = 1;
+
+	pthread_mutex_lock(&server->lock);
+	if (server->todo_tail != NULL)
+		server->todo_tail->next = job;
+	else
+		server->todo = job;
+	server->todo_tail = job;
+	pthread_cond_signal(&server->cond);
+	pthread_mutex_unlock(&server->lock);
+}
+
+// 연결 상태에 맞게 epoll 이벤트를 바꾸거나, 더 할 일이 없으면 연결을 닫는다.
+// 기다릴 이벤트가 없으면 (질의 처리 중에 클라이언트가 연결을 끊은 경우 등) EPOLLHUP이 계속 오지 않도록 epoll에서 뺀다.
+static void _serverUpdate( tSERVER *server, tSERVERCONN *c) {
+	struct epoll_event ev;
+	unsigned int events = 0;
+
+	if (c->busy)
+		;	// 처리 중인 질의가 끝날 때까지 닫지 않는다.
+	else if (c->dead || (c->eof && c->in_len == 0 && c->out_len == 0)) {
+		_serverClose( server, c);
+		return;
+	}
+
+	if (!c->eof && !c->dead && c->in_len < server->max_query * SERVER_PENDING)
+		events |= EPOLLIN;
+	if (c->out_len > 0 && !c->dead)
+		events |= EPOLLOUT;
+
+	ev.events = events;
+	ev.data.ptr = c;
+	if (events == 0) {
+		if (c->registered)
+			epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+		c->registered = 0;
+	}
+	else if (!c->registered) {
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+		c->registered = 1;
+	}
+	else if (events != c->events)
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->events = events;
+}
+
+// 작업 스레드들이 처리한 질의의 결과를 연결에 넘기고 지연 시간을 기록한다.
+static void _serverCollect( tSERVER *server) {
+	tSERVERJOB *job;
+	struct timespec now;
+	uint64_t value;
+
+	if (read(server->event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		fprintf( stderr, "eventfd read error:%s\n", strerror(errno));
+
+	pthread_mutex_lock(&server->lock);
+	job = server->done;
+	server->done = NULL;
+	pthread_mutex_unlock(&server->lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	while (job != NULL) {
+		tSERVERJOB *next = job->next;
+		tSERVERCONN *c = job->conn;
+		long ns = (now.tv_sec - job->t0.tv_sec) * 1000000000L + (now.tv_nsec - job->t0.tv_nsec);
+
+		_latencyAdd( &server->interval, ns);
+		_latencyAdd( &server->total, ns);
+
+		c->busy = 0;
+		if (!c->dead) {
+			if (job->result != NULL)
+				_serverAppend( c, job->result, job->result_len);
+			else
+				_serverAppend( c, "\n", 1);
+			_serverWrite( c);
+		}
+
+		free(job->query);
+		free(job->result);
+		free(job);
+
+		_serverDispatch( server, c);
+		_serverUpdate( server, c);
+		job = next;
+	}
+}
+
+/* opens query server listening on address and starts worker threads
+	address		Unix domain socket path (contains '/') or [HOST:]PORT (loopback if HOST omitted)
+	num_workers	number of worker threads calling fn concurrently
+	max_query	maximum length of a query line
+	fn, ctx		query handler and its argument (shared by all workers, must be read-only or thread-safe)
+	return	1 success
+			0 failure (nothing to close)
+*/
+int serverOpen( tSERVER *server, char *address, int num_workers, int max_query, tSERVERFN fn, void *ctx) {
+	struct epoll_event ev;
+
+	memset(server, 0, sizeof(tSERVER));
+	server->address = address;
+	server->max_query = max_query;
+	server->fn = fn;
+	server->ctx = ctx;
+	server->epoll_fd = -1;
+	server->event_fd = -1;
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->cond, NULL);
+
+	server->listen_fd = _serverListen( address);
+	server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	server->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (server->epoll_fd < 0 || server->event_fd < 0)
+		fprintf( stderr, "epoll/eventfd error:%s\n", strerror(errno));
+	if (server->listen_fd < 0 || server->epoll_fd < 0 || server->event_fd < 0) {
+		serverClose( server);
+		return 0;
+	}
+
+	// 듣기 소켓과 eventfd는 tSERVER 안의 필드 주소로 구별한다.
+	ev.events = EPOLLIN;
+	ev.data.ptr = &server->listen_fd;
+	epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &ev);
+	ev.data.ptr = &server->event_fd;
+	epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->event_fd, &ev);
+
+	server->tids = (pthread_t *)malloc(sizeof(pthread_t) * num_workers);
+	for (int i = 0; server->tids != NULL && i < num_workers; i++) {
+		if (pthread_create( &server->tids[i], NULL, _serverWorker, server) != 0)
+			break;
+		server->num_workers++;
+	}
+
+	if (server->num_workers == 0) {
+		fprintf( stderr, "Cannot start worker threads\n");
+		serverClose( server);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* runs event loop until SIGINT or SIGTERM
+	prints throughput and latency percentiles every SERVER_STATS_SEC seconds and at exit (stderr)
+	return	1 normal shutdown
+			0 epoll error
+*/
+int serverRun( tSERVER *server) {
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	struct sigaction sa;
+	struct timespec now;
+	int ret = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _serverSignal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &server->started);
+	server->reported = server->started;
+
+	fprintf( stderr, "Listening on %s (%d workers)\n", server->address, server->num_workers);
+
+	while (!serverStopped) {
+		int n = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, 1000);
+
+		if (n < 0 && errno != EINTR) {
+			fprintf( stderr, "epoll error:%s\n", strerror(errno));
+			ret = 0;
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			void *p = events[i].data.ptr;
+
+			if (p == &server->listen_fd)
+				_serverAccept( server);
+			else if (p == &server->event_fd)
+				_serverCollect( server);
+			else {
+				tSERVERCONN *c = (tSERVERCONN *)p;
+
+				if (c->closed)
+					continue;
+				if (events[i].events & EPOLLERR)
+					c->dead = 1;
+				if (events[i].events & (EPOLLIN | EPOLLHUP))
+					_serverRead( server, c);
+				if (events[i].events & EPOLLOUT)
+					_serverWrite( c);
+
+				_serverDispatch( server, c);
+				_serverUpdate( server, c);
+			}
+		}
+		_serverReap( server);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (_serverSeconds( &server->reported, &now) >= SERVER_STATS_SEC) {
+			if (server->interval.total > 0) {
+				_latencyReport( &server->interval, _serverSeconds( &server->reported, &now), "interval");
+				if (server->report != NULL)
+					server->report( server->ctx);
+			}
+			memset(&server->interval, 0, sizeof(tLATENCY));
+			server->reported = now;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	_latencyReport( &server->total, _serverSeconds( &server->started, &now), "total");
+	if (server->report != NULL)
+		server->report( server->ctx);
+
+	return ret;
+}
+
+/* stops worker threads, closes all connections and the listening socket
+	(removes the socket file of a Unix domain socket)
+*/
+void serverClose( tSERVER *server) {
+	pthread_mutex_lock(&server->lock);
+	server->stop = 1;
+	pthread_cond_broadcast(&server->cond);
+	pthread_mutex_unlock(&server->lock);
+
+	for (int i = 0; i < server->num_workers; i++)
+		pthread_join( server->tids[i], NULL);
+	free(server->tids);
+
+	// 작업 스레드가 모두 끝났으므로 남은 작업은 처리한 질의 목록에만 있다.
+	while (server->done != NULL) {
+		tSERVERJOB *job = server->done;
+
+		server->done = job->next;
+		free(job->query);
+		free(job->result);
+		free(job);
+	}
+	while (server->conns != NULL)
+		_serverClose( server, server->conns);
+	_serverReap( server);
+
+	if (server->listen_fd >= 0) {
+		close(server->listen_fd);
+		if (strchr(server->address, '/') != NULL)
+			unlink(server->address);
+	}
+	if (server->epoll_fd >= 0)
+		close(server->epoll_fd);
+	if (server->event_fd >= 0)
+		close(server->event_fd);
+
+	pthread_mutex_destroy(&server->lock);
+	pthread_cond_destroy(&server->cond);
+}
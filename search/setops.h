@@ -0,0 +1,362 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SETOPS_X86	1
+#else
+#define SETOPS_X86	0
+#endif
+
+// 정렬된 int 집합 연산 커널 (교집합, 합집합)
+// SIMD 커널은 결과 배열 끝을 넘어 최대 SETOPS_SLACK개까지 쓸 수 있으므로
+// 결과 배열은 (최대 결과 수 + SETOPS_SLACK)개 크기로 할당해야 한다.
+#define SETOPS_SLACK	8
+
+#define SETOPS_SCALAR	0
+#define SETOPS_SSE		1	// SSE4.2 (4 x int32)
+#define SETOPS_AVX2		2	// AVX2 (8 x int32)
+
+#define GALLOP_RATIO	32	// 두 집합의 크기 차이가 이보다 크면 지수 탐색(galloping)으로 교집합
+
+////////////////////////////////////////////////////////////////////////////////
+/* finds first position in sorted a[lo..n-1] whose value is >= target (exponential search)
+	return	position
+			n if not found
+*/
+int gallopSearch( const int *a, int lo, int n, int target) {
+	int step = 1;
+	int hi;
+
+	if (lo >= n || a[lo] >= target)
+		return lo;
+
+	// a[lo] < target 인 동안 간격을 두 배씩 늘린다.
+	while (lo + step < n && a[lo + step] < target) {
+		lo += step;
+		step <<= 1;
+	}
+	hi = (lo + step < n) ? lo + step : n;
+
+	// a[lo] < target <= a[hi] 구간에서 이진 탐색
+	lo++;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (a[mid] < target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* intersection of a small sorted set and a large one
+	(each element of small is searched in large by gallopSearch, so the cost is proportional to numsmall)
+	return	number of elements written to out
+*/
+int intersectGallop( const int *small, int numsmall, const int *large, int numlarge, int *out) {
+	int j = 0;
+	int k = 0;
+
+	for (int i = 0; i < numsmall && j < numlarge; i++) {
+		j = gallopSearch( large, j, numlarge, small[i]);
+		if (j < numlarge && large[j] == small[i])
+			out[k++] = small[i];
+	}
+	return k;
+}
+
+/* intersection of sorted sets a and b (scalar merge)
+	return	number of elements written to out
+*/
+int intersectScalar( const int *a, int na, const int *b, int nb, int *out) {
+	int i = 0;
+	int j = 0;
+	int k = 0;
+
+	while ((i < na) && (j < nb)) {
+		if (a[i] < b[j])
+			i++;
+		else if (a[i] > b[j])
+			j++;
+		else {
+			out[k++] = a[i];
+			i++;	j++;
+		}
+	}
+	return k;
+}
+
+/* union of sorted sets a and b (scalar merge)
+	return	number of elements written to out
+*/
+int unionScalar( const int *a, int na, const int *b, int nb, int *out) {
+	int i = 0;
+	int j = 0;
+	int k = 0;
+
+	while ((i < na) && (j < nb)) {
+		if (a[i] < b[j])
+			out[k++] = a[i++];
+		else if (a[i] > b[j])
+			out[k++] = b[j++];
+		else {
+			out[k++] = a[i];
+			i++;	j++;
+		}
+	}
+	while (i < na)
+		out[k++] = a[i++];
+	while (j < nb)
+		out[k++] = b[j++];
+
+	return k;
+}
+
+#if SETOPS_X86
+static unsigned char sseCompact[16][16];	// 4비트 마스크별: 선택된 레인을 앞으로 모으는 pshufb 마스크
+static int avx2Compact[256][8];				// 8비트 마스크별: 선택된 레인을 앞으로 모으는 permute 인덱스
+
+static void _setopsTables( void) {
+	for (int m = 0; m < 16; m++) {
+		int k = 0;
+
+		memset(sseCompact[m], 0x80, 16);
+		for (int lane = 0; lane < 4; lane++) {
+			if (m & (1 << lane)) {
+				for (int b = 0; b < 4; b++)
+					sseCompact[m][4 * k + b] = 4 * lane + b;
+				k++;
+			}
+		}
+	}
+	for (int m = 0; m < 256; m++) {
+		int k = 0;
+
+		for (int lane = 0; lane < 8; lane++)
+			if (m & (1 << lane))
+				avx2Compact[m][k++] = lane;
+		while (k < 8)
+			avx2Compact[m][k++] = 0;
+	}
+}
+
+// 4x4 블록끼리 모든 쌍을 비교(b를 회전시키며 비교)하여 일치하는 a의 원소를 모은다.
+__attribute__((target("sse4.2,popcnt")))
+int intersectSse( const int *a, int na, const int *b, int nb, int *out) {
+	int i = 0;
+	int j = 0;
+	int k = 0;
+
+	while (i + 4 <= na && j + 4 <= nb) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+		__m128i cmp = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi32(va, vb),
+						 _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+			_mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4E)),
+						 _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(cmp));
+		int amax = a[i + 3];
+		int bmax = b[j + 3];
+
+		_mm_storeu_si128((__m128i *)(out + k),
+						 _mm_shuffle_epi8(va, _mm_loadu_si128((const __m128i *)sseCompact[mask])));
+		k += _mm_popcnt_u32(mask);
+
+		if (amax <= bmax)
+			i += 4;
+		if (bmax <= amax)
+			j += 4;
+	}
+
+	return k + intersectScalar( a + i, na - i, b + j, nb - j, out + k);
+}
+
+// 8x8 블록끼리 모든 쌍을 비교하여 일치하는 a의 원소를 모은다.
+__attribute__((target("avx2,popcnt")))
+int intersectAvx2( const int *a, int na, const int *b, int nb, int *out) {
+	const __m256i rot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+	int i = 0;
+	int j = 0;
+	int k = 0;
+
+	while (i + 8 <= na && j + 8 <= nb) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+		__m256i cmp = _mm256_cmpeq_epi32(va, vb);
+		int mask;
+		int amax = a[i + 7];
+		int bmax = b[j + 7];
+
+		for (int r = 1; r < 8; r++) {
+			vb = _mm256_permutevar8x32_epi32(vb, rot);
+			cmp = _mm256_or_si256(cmp, _mm256_cmpeq_epi32(va, vb));
+		}
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(cmp));
+
+		_mm256_storeu_si256((__m256i *)(out + k),
+			_mm256_permutevar8x32_epi32(va, _mm256_loadu_si256((const __m256i *)avx2Compact[mask])));
+		k += _mm_popcnt_u32(mask);
+
+		if (amax <= bmax)
+			i += 8;
+		if (bmax <= amax)
+			j += 8;
+	}
+
+	return k + intersectScalar( a + i, na - i, b + j, nb - j, out + k);
+}
+
+// 정렬된 두 벡터를 min/max 네트워크로 병합한다. (작은 4개 -> vmin, 큰 4개 -> vmax)
+__attribute__((target("sse4.2")))
+static inline void _sseMerge( __m128i a, __m128i b, __m128i *vmin, __m128i *vmax) {
+	__m128i tmp = _mm_min_epi32(a, b);
+
+	*vmax = _mm_max_epi32(a, b);
+	tmp = _mm_alignr_epi8(tmp, tmp, 4);
+	*vmin = _mm_min_epi32(tmp, *vmax);
+	*vmax = _mm_max_epi32(tmp, *vmax);
+	tmp = _mm_alignr_epi8(*vmin, *vmin, 4);
+	*vmin = _mm_min_epi32(tmp, *vmax);
+	*vmax = _mm_max_epi32(tmp, *vmax);
+	tmp = _mm_alignr_epi8(*vmin, *vmin, 4);
+	*vmin = _mm_min_epi32(tmp, *vmax);
+	*vmax = _mm_max_epi32(tmp, *vmax);
+	*vmin = _mm_alignr_epi8(*vmin, *vmin, 4);
+}
+
+// 직전에 기록한 벡터(last)의 마지막 값과 중복되는 값을 빼고 v를 기록한다.
+__attribute__((target("sse4.2,popcnt")))
+static inline int _sseStoreUnique( __m128i last, __m128i v, int *out) {
+	__m128i prev = _mm_alignr_epi8(v, last, 12);	// [last3, v0, v1, v2]
+	int dup = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(prev, v)));
+	int keep = ~dup & 15;
+
+	_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i *)sseCompact[keep])));
+	return _mm_popcnt_u32(keep);
+}
+
+// 남은 세 정렬 배열을 병합한다. (out[k-1]과 같은 값은 건너뜀)
+static int _unionTail( const int *a, int na, const int *b, int nb, const int *c, int nc, int *out, int k) {
+	int i = 0, j = 0, l = 0;
+
+	while (i < na || j < nb || l < nc) {
+		int v = 0;
+		int first = 1;
+
+		if (i < na) { v = a[i]; first = 0; }
+		if (j < nb && (first || b[j] < v)) { v = b[j]; first = 0; }
+		if (l < nc && (first || c[l] < v)) v = c[l];
+
+		if (i < na && a[i] == v) i++;
+		if (j < nb && b[j] == v) j++;
+		if (l < nc && c[l] == v) l++;
+
+		if (k == 0 || out[k - 1] != v)
+			out[k++] = v;
+	}
+	return k;
+}
+
+// 4개씩 읽어 벡터 병합 네트워크로 합치고 중복을 제거하며 기록한다.
+__attribute__((target("sse4.2,popcnt")))
+int unionSse( const int *a, int na, const int *b, int nb, int *out) {
+	__m128i vmin, vmax, v, last;
+	int lenA = na & ~3;
+	int lenB = nb & ~3;
+	int i = 4;
+	int j = 4;
+	int k = 0;
+	int buf[4];
+
+	if (na < 4 || nb < 4)
+		return unionScalar( a, na, b, nb, out);
+
+	_sseMerge( _mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b), &vmin, &vmax);
+	last = _mm_set1_epi32(_mm_cvtsi128_si32(vmin) - 1);
+	k += _sseStoreUnique( last, vmin, out + k);
+	last = vmin;
+
+	while (1) {
+		// 아직 읽지 않은 원소 중 가장 작은 원소가 있는 쪽에서 4개를 읽는다.
+		// 그쪽에 4개가 남아 있지 않으면 나머지는 스칼라로 병합
+		if (j >= nb || (i < na && a[i] <= b[j])) {
+			if (i >= lenA)
+				break;
+			v = _mm_loadu_si128((const __m128i *)(a + i));
+			i += 4;
+		}
+		else {
+			if (j >= lenB)
+				break;
+			v = _mm_loadu_si128((const __m128i *)(b + j));
+			j += 4;
+		}
+		_sseMerge( v, vmax, &vmin, &vmax);
+		k += _sseStoreUnique( last, vmin, out + k);
+		last = vmin;
+	}
+
+	// vmax와 4개 미만으로 남은 원소들은 스칼라로 병합
+	_mm_storeu_si128((__m128i *)buf, vmax);
+	return _unionTail( buf, 4, a + i, na - i, b + j, nb - j, out, k);
+}
+#endif
+
+// 현재 사용 중인 커널
+int setopsLevel = SETOPS_SCALAR;
+int (*setIntersect)( const int *a, int na, const int *b, int nb, int *out) = intersectScalar;
+int (*setUnion)( const int *a, int na, const int *b, int nb, int *out) = unionScalar;
+
+/* intersection of sorted sets a and b
+	uses intersectGallop when their sizes differ by more than GALLOP_RATIO, setIntersect otherwise
+	return	number of elements written to out
+*/
+int intersectAdaptive( const int *a, int na, const int *b, int nb, int *out) {
+	if ((long)na * GALLOP_RATIO < nb)
+		return intersectGallop( a, na, b, nb, out);
+	if ((long)nb * GALLOP_RATIO < na)
+		return intersectGallop( b, nb, a, na, out);
+	return setIntersect( a, na, b, nb, out);
+}
+
+/* selects set operation kernels
+	level	SETOPS_SCALAR, SETOPS_SSE, SETOPS_AVX2 (capped by what the CPU supports)
+			-1 best kernel for the CPU
+	return	selected level
+*/
+int setopsInit( int level) {
+	int best = SETOPS_SCALAR;
+
+#if SETOPS_X86
+	static int tables = 0;
+
+	if (!tables) {
+		_setopsTables();
+		tables = 1;
+	}
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+		best = SETOPS_SSE;
+	if (best == SETOPS_SSE && __builtin_cpu_supports("avx2"))
+		best = SETOPS_AVX2;
+#endif
+
+	if (level < 0 || level > best)
+		level = best;
+
+	setopsLevel = level;
+	setIntersect = intersectScalar;
+	setUnion = unionScalar;
+
+#if SETOPS_X86
+	if (level >= SETOPS_SSE) {
+		setIntersect = intersectSse;
+		setUnion = unionSse;
+	}
+	if (level >= SETOPS_AVX2)
+		setIntersect = intersectAvx2;
+#endif
+
+	return level;
+}
@@ -0,0 +1,348 @@
+// 샤드 색인 (index -n N)
+// 문서를 문서번호 구간(range) 또는 문서번호의 나머지(hash)로 N개의 샤드로 나누어 샤드마다 따로 색인한다.
+// 샤드는 색인 파일들(dic.txt, dic.idx, header.idx, posting.idx, position.idx, doclen.idx)을 담은 디렉토리(shard_000/)이며
+// 색인 파일에는 샤드 안의 문서번호(1부터)로 기록하고, 샤드 목록(shards.txt)에 전체 문서번호와의 관계를 기록한다.
+//   range: 샤드 s가 전체 문서번호 docbase+1 ~ docbase+num_docs를 맡는다. (전체 = docbase + 샤드 안)
+//   hash: 전체 문서번호 d를 샤드 (d - 1) % N이 맡는다. (전체 = (샤드 안 - 1) * N + s + 1)
+// 검색기(search)는 샤드 목록이 있으면 조정기(coordinator)가 되어 샤드마다 작업 프로세스를 띄우고
+// 질의를 모든 작업 프로세스에 보낸 뒤(scatter) 돌아온 문서번호 목록 또는 상위 k개 목록을 합친다.(gather)
+// 조정기와 작업 프로세스는 socketpair(Unix 도메인 소켓)로 고정 길이 머리(tSHARDMSG)와 본문을 주고받는다.
+// 작업 프로세스마다 소켓(채널)을 여러 개 둘 수 있어 조정기는 채널마다 질의 하나씩을 동시에 보낸다.
+//
+// 샤드 목록 형식 (텍스트)
+//   샤드_수 range|hash 전체_문서_수
+//   샤드_번호 docbase 문서_수	(샤드 번호 순으로 샤드 수만큼, hash이면 docbase는 0)
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define SHARD_MANIFEST	"shards.txt"
+#define SHARD_DIR		"shard_%03d"
+#define SHARD_PATH		64
+#define SHARD_MAX		256		// 최대 샤드 수
+
+#define SHARD_RANGE		0		// 문서번호 구간으로 나눈다.
+#define SHARD_HASH		1		// 문서번호의 나머지로 나눈다.
+
+// 메시지 종류 (tSHARDMSG.type)
+#define SHARD_OK		0		// 응답: 성공 (count개의 결과가 본문에 있다.)
+#define SHARD_ERROR		-1		// 응답: 실패
+#define SHARD_HELLO		1		// 작업 프로세스 -> 조정기: 샤드의 문서 수(count)와 문서 길이의 합(본문, long)
+#define SHARD_STATS		2		// 조정기 -> 작업 프로세스: 전체 문서 수(count)와 문서 길이의 합(본문, long)
+#define SHARD_SEARCH	3		// 불린 검색 (본문: 질의) -> 샤드 안의 문서번호 배열
+#define SHARD_DF		4		// 순위 검색 1단계 (본문: 질의) -> 점수를 매길 텀들의 df 배열
+#define SHARD_RANK		5		// 순위 검색 2단계 (arg: k, 본문: 전체 df count개 + 질의) -> tSCORED 배열
+
+// 샤드 정보
+typedef struct {
+	int		docbase;	// range: 샤드 앞에 있는 문서 수
+	int		num_docs;	// 샤드가 맡은 문서 수
+} tSHARDINFO;
+
+// 샤드 목록
+typedef struct {
+	int			mode;		// SHARD_RANGE 또는 SHARD_HASH
+	int			num_docs;	// 전체 문서 수
+	tSHARDINFO	*shards;
+	int			num_shards;
+} tSHARDMAP;
+
+// 조정기와 작업 프로세스가 주고받는 메시지의 머리 (뒤에 size 바이트의 본문)
+typedef struct {
+	int		type;	// SHARD_*
+	int		arg;	// SHARD_RANK: k
+	int		count;	// 본문의 원소 수
+	int		size;	// 본문의 바이트 수
+} tSHARDMSG;
+
+// 작업 프로세스 함수: 샤드 디렉토리에서 조정기와 연결된 소켓 num_fds개(채널마다 하나)로 받은 요청을 처리하고 종료 코드를 반환한다.
+typedef int (*tSHARDFN)( void *ctx, int *fds, int num_fds, int shard);
+
+////////////////////////////////////////////////////////////////////////////////
+/* makes path of a shard file (ex) "shard_000/docs.tmp")
+	return	buf
+*/
+char *shardPath( char *buf, int shard, char *file) {
+	snprintf(buf, SHARD_PATH, SHARD_DIR "/%s", shard, file);
+	return buf;
+}
+
+/* makes shard list of num_docs documents split into num_shards shards
+	return	1 success
+			0 if overflow
+*/
+int shardMapInit( tSHARDMAP *map, int num_shards, int mode, int num_docs) {
+	map->mode = mode;
+	map->num_docs = num_docs;
+	map->num_shards = num_shards;
+	map->shards = (tSHARDINFO *)calloc(num_shards, sizeof(tSHARDINFO));
+	if (map->shards == NULL)
+		return 0;
+
+	for (int s = 0; s < num_shards; s++) {
+		if (mode == SHARD_RANGE) {
+			map->shards[s].docbase = (int)((long)num_docs * s / num_shards);
+			map->shards[s].num_docs = (int)((long)num_docs * (s + 1) / num_shards) - map->shards[s].docbase;
+		}
+		else
+			map->shards[s].num_docs = (num_docs > s) ? (num_docs - s - 1) / num_shards + 1 : 0;
+	}
+
+	return 1;
+}
+
+/* reads shard list file
+	return	1 success
+			0 failure (open error or invalid file)
+*/
+int shardMapRead( tSHARDMAP *map, char *filename) {
+	FILE *fp = fopen(filename, "rt");
+	char mode[16];
+	int num_shards;
+	int ret = 0;
+
+	map->shards = NULL;
+	map->num_shards = 0;
+
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return 0;
+	}
+
+	if (fscanf(fp, "%d %15s %d", &num_shards, mode, &map->num_docs) == 3 && num_shards > 0 && num_shards <= SHARD_MAX &&
+		(strcmp(mode, "range") == 0 || strcmp(mode, "hash") == 0) &&
+		shardMapInit( map, num_shards, (strcmp(mode, "range") == 0) ? SHARD_RANGE : SHARD_HASH, map->num_docs)) {
+		ret = 1;
+		for (int s = 0; s < num_shards && ret; s++) {
+			int id;
+
+			if (fscanf(fp, "%d %d %d", &id, &map->shards[s].docbase, &map->shards[s].num_docs) != 3 || id != s)
+				ret = 0;
+		}
+	}
+	fclose(fp);
+
+	if (!ret) {
+		fprintf( stderr, "Invalid shard list:%s\n", filename);
+		free(map->shards);
+		map->shards = NULL;
+		map->num_shards = 0;
+	}
+
+	return ret;
+}
+
+/* writes shard list file (written to a temporary file and renamed, so readers never see a partial list)
+	return	1 success
+			0 failure
+*/
+int shardMapWrite( tSHARDMAP *map, char *filename) {
+	char tmp[SHARD_PATH];
+	FILE *fp;
+	int error;
+
+	snprintf(tmp, SHARD_PATH, "%s.tmp", filename);
+	fp = fopen(tmp, "wt");
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", tmp);
+		return 0;
+	}
+
+	fprintf(fp, "%d %s %d\n", map->num_shards, (map->mode == SHARD_RANGE) ? "range" : "hash", map->num_docs);
+	for (int s = 0; s < map->num_shards; s++)
+		fprintf(fp, "%d %d %d\n", s, map->shards[s].docbase, map->shards[s].num_docs);
+
+	error = ferror(fp);
+	if (fclose(fp) != 0 || error || rename(tmp, filename) != 0) {
+		fprintf( stderr, "File write error:%s\n", filename);
+		unlink(tmp);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* returns shard of (global) doc id
+*/
+int shardOf( tSHARDMAP *map, int docid) {
+	int lo = 0;
+	int hi = map->num_shards - 1;
+
+	if (map->mode == SHARD_HASH)
+		return (docid - 1) % map->num_shards;
+
+	// 문서를 맡은 마지막 샤드 (빈 샤드는 건너뛴다.)
+	while (lo < hi) {
+		int mid = lo + (hi - lo + 1) / 2;
+
+		if (map->shards[mid].docbase < docid)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+/* converts doc id in shard into global doc id
+*/
+int shardGlobalDoc( tSHARDMAP *map, int shard, int docid) {
+	if (map->mode == SHARD_HASH)
+		return (docid - 1) * map->num_shards + shard + 1;
+	return map->shards[shard].docbase + docid;
+}
+
+/* frees shard list
+*/
+void shardMapFree( tSHARDMAP *map) {
+	free(map->shards);
+	map->shards = NULL;
+	map->num_shards = 0;
+}
+
+// 소켓에 len 바이트를 모두 보낸다. (상대가 끝났으면 SIGPIPE 대신 실패)
+static int _shardWriteAll( int fd, const void *data, size_t len) {
+	const char *p = (const char *)data;
+
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		p += n;
+		len -= n;
+	}
+	return 1;
+}
+
+// 소켓에서 len 바이트를 모두 받는다. (상대가 끝났으면 실패)
+static int _shardReadAll( int fd, void *data, size_t len) {
+	char *p = (char *)data;
+
+	while (len > 0) {
+		ssize_t n = recv(fd, p, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		p += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/* sends a message (header and size bytes of body)
+	return	1 success
+			0 failure (the other side has gone)
+*/
+int shardSend( int fd, int type, int arg, int count, const void *body, int size) {
+	tSHARDMSG msg = { type, arg, count, size };
+
+	return _shardWriteAll( fd, &msg, sizeof(msg)) && _shardWriteAll( fd, body, size);
+}
+
+/* receives a message
+	body is allocated from arena and terminated by NUL (valid until arenaReset)
+	return	1 success
+			0 failure (end of connection or overflow)
+*/
+int shardRecv( int fd, tSHARDMSG *msg, tARENA *arena, void **body) {
+	if (!_shardReadAll( fd, msg, sizeof(tSHARDMSG)) || msg->size < 0)
+		return 0;
+
+	*body = arenaAlloc(arena, msg->size + 1);
+	if (*body == NULL || !_shardReadAll( fd, *body, msg->size))
+		return 0;
+	((char *)*body)[msg->size] = 0;
+
+	return 1;
+}
+
+/* closes connections (num_channels per worker) to num_shards workers and waits for them to exit
+	return	1 if all workers exited normally
+			0 otherwise
+*/
+int shardStop( int *fds, pid_t *pids, int num_shards, int num_channels) {
+	int ret = 1;
+
+	for (int i = 0; i < num_shards * num_channels; i++)
+		close(fds[i]);
+
+	for (int s = 0; s < num_shards; s++) {
+		int status;
+
+		if (waitpid(pids[s], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+/* forks a worker process per shard, connected by num_channels socketpairs
+	worker runs fn in its shard directory and exits with its return value
+	fds[s * num_channels + c] (channel c of shard s) and pids[s] are set for each shard
+	return	1 success
+			0 failure (workers already started are stopped)
+*/
+int shardSpawn( tSHARDMAP *map, int num_channels, tSHARDFN fn, void *ctx, int *fds, pid_t *pids) {
+	int *peers = (int *)malloc(sizeof(int) * num_channels); // 작업 프로세스 쪽 소켓
+
+	if (peers == NULL) {
+		fprintf( stderr, "Out of memory\n");
+		return 0;
+	}
+	fflush(NULL);
+
+	for (int s = 0; s < map->num_shards; s++) {
+		int *mine = fds + s * num_channels;
+		int c;
+
+		for (c = 0; c < num_channels; c++) {
+			int sv[2];
+
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+				fprintf( stderr, "socketpair error:%s\n", strerror(errno));
+				break;
+			}
+			mine[c] = sv[0];
+			peers[c] = sv[1];
+		}
+
+		if (c == num_channels && (pids[s] = fork()) < 0)
+			fprintf( stderr, "fork error:%s\n", strerror(errno));
+		if (c < num_channels || pids[s] < 0) {
+			for (int i = 0; i < c; i++) {
+				close(mine[i]);
+				close(peers[i]);
+			}
+			shardStop( fds, pids, s, num_channels);
+			free(peers);
+			return 0;
+		}
+
+		if (pids[s] == 0) {
+			char dir[SHARD_PATH];
+
+			// 이 샤드와 앞의 샤드들과 연결된 조정기 쪽 소켓은 닫는다. (조정기가 끝나면 작업 프로세스도 끝나도록)
+			for (int i = 0; i < (s + 1) * num_channels; i++)
+				close(fds[i]);
+
+			snprintf(dir, SHARD_PATH, SHARD_DIR, s);
+			if (chdir(dir) != 0) {
+				fprintf( stderr, "chdir error:%s\n", dir);
+				_exit(1);
+			}
+			_exit(fn( ctx, peers, num_channels, s));
+		}
+
+		for (c = 0; c < num_channels; c++)
+			close(peers[c]);
+	}
+
+	free(peers);
+	return 1;
+}
@@ -0,0 +1,120 @@
+// 색인기의 스트리밍 토크나이저
+// 입력을 고정 크기 버퍼로 읽으면서 토큰을 하나씩 돌려준다. 한 줄이 한 문서이며 줄 길이에 제한이 없고,
+// 입력 버퍼와 토큰 버퍼는 처음부터 끝까지 재사용하므로 토큰마다 할당하지 않는다.
+// 정규화: 영문 대문자는 소문자로 바꾸고, 영문자/숫자/UTF-8 멀티바이트 문자의 바이트가 아닌 것(공백, 구두점, 제어문자)은 구분자로 본다.
+// TOKEN_MAX 바이트보다 긴 토큰은 나머지를 버린다. (사전 파일을 줄 단위로 다시 읽으므로)
+
+#define TOKEN_BUFSIZE	65536	// 입력 버퍼 크기
+#define TOKEN_MAX		255		// 토큰의 최대 바이트 수
+
+// tokenizerNext의 반환값
+#define TOKEN_EOF		0		// 입력의 끝 (또는 end 위치에 이름)
+#define TOKEN_WORD		1		// token에 토큰이 있다.
+#define TOKEN_EOL		2		// 문서(줄)의 끝
+
+typedef struct {
+	FILE			*fp;
+	long			offset;		// 다음에 볼 바이트의 파일 위치
+	long			end;		// 줄이 이 위치 이후에 시작하면 멈춘다. (-1: 파일 끝까지)
+	unsigned char	*buf;
+	int				len;		// buf에 읽은 바이트 수
+	int				pos;		// buf에서 다음에 볼 바이트
+	int				bol;		// 줄의 처음인지 여부
+	int				length;		// token의 바이트 수
+	char			token[TOKEN_MAX + 1];
+} tTOKENIZER;
+
+////////////////////////////////////////////////////////////////////////////////
+// 토큰에 들어가는 바이트이면 정규화한 값을, 구분자이면 0을 반환
+static inline unsigned char _tokenChar( unsigned char ch) {
+	if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch >= 0x80)
+		return ch;
+	if (ch >= 'A' && ch <= 'Z')
+		return ch + ('a' - 'A');
+	return 0;
+}
+
+/* starts tokenizing fp from its current position
+	stops before the first line starting at or after end (end < 0: until end of file)
+	return	1 success
+			0 out of memory
+*/
+int tokenizerInit( tTOKENIZER *tk, FILE *fp, long end) {
+	tk->fp = fp;
+	tk->offset = ftell(fp);
+	tk->end = end;
+	tk->buf = (unsigned char *)malloc(TOKEN_BUFSIZE);
+	tk->len = 0;
+	tk->pos = 0;
+	tk->bol = 1;
+	tk->length = 0;
+	tk->token[0] = 0;
+
+	return tk->buf != NULL;
+}
+
+/* reads next token (normalized, in tk->token and tk->length)
+	return	TOKEN_WORD token
+			TOKEN_EOL end of document (line)
+			TOKEN_EOF end of input
+*/
+int tokenizerNext( tTOKENIZER *tk) {
+	tk->length = 0;
+
+	for (;;) {
+		unsigned char ch;
+
+		if (tk->bol && tk->end >= 0 && tk->offset >= tk->end)
+			return TOKEN_EOF;
+
+		if (tk->pos == tk->len) {
+			tk->len = fread(tk->buf, 1, TOKEN_BUFSIZE, tk->fp);
+			tk->pos = 0;
+
+			// 입력의 끝: 남은 토큰, 마지막 줄의 끝('\n'이 없어도) 순으로 알린다.
+			if (tk->len == 0) {
+				if (tk->length > 0)
+					break;
+				if (!tk->bol) {
+					tk->bol = 1;
+					return TOKEN_EOL;
+				}
+				return TOKEN_EOF;
+			}
+		}
+
+		ch = tk->buf[tk->pos];
+
+		if (ch == '\n') {
+			// 줄 끝 앞의 토큰을 먼저 돌려주고 줄 끝은 다음에 알린다.
+			if (tk->length > 0)
+				break;
+			tk->pos++;
+			tk->offset++;
+			tk->bol = 1;
+			return TOKEN_EOL;
+		}
+
+		tk->pos++;
+		tk->offset++;
+		tk->bol = 0;
+
+		ch = _tokenChar( ch);
+		if (ch != 0) {
+			if (tk->length < TOKEN_MAX)
+				tk->token[tk->length++] = ch;
+		}
+		else if (tk->length > 0)
+			break;
+	}
+
+	tk->token[tk->length] = 0;
+	return TOKEN_WORD;
+}
+
+/* frees buffer of tokenizer (fp is not closed)
+*/
+void tokenizerDestroy( tTOKENIZER *tk) {
+	free(tk->buf);
+	tk->buf = NULL;
+}
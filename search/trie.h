@@ -1,49 +1,326 @@
+// 트라이 (영문 소문자와 EOW('$')로 된 키 -> 사전 번호)
+// 노드는 자식 수에 따라 크기가 다른 형태를 쓴다. (adaptive radix tree)
+//   TRIE_NODE0	자식 없음
+//   TRIE_NODE4	자식 4개까지: 문자 번호 순으로 정렬된 키 배열과 자식 배열
+//   TRIE_NODE16	자식 16개까지: 〃
+//   TRIE_NODE27	모든 문자: 문자 번호로 바로 찾는 자식 배열 (루트는 항상 이 형태)
+// 자식이 하나뿐이고 엔트리가 없는 노드들의 사슬은 아래 노드 하나로 합치고 그 문자들을 노드의 압축된 경로(prefix)로 둔다. (path compression)
+// 노드에 자식이 더 필요하면 한 단계 큰 형태로 다시 만들고 부모의 자식 번호를 고친다.
+//
+// 노드와 압축된 경로는 트라이마다 가진 노드 풀에 둔다.
+// 풀은 고정 크기 덩어리(TRIE_CHUNK_SIZE)들이고 할당은 현재 위치를 옮기기만 한다. (bump allocator)
+// 노드는 포인터 대신 풀 안의 4바이트 단위 위치(tTRIEREF, 32비트)로 가리킨다. (0: 없음)
+// 더 큰 형태로 바뀐 노드는 형태별 빈 노드 목록에 돌려 같은 형태의 노드를 만들 때 다시 쓴다. (slab)
+// trieReset은 덩어리들을 그대로 둔 채 위치만 되돌리므로 다시 만들 때 힙 할당이 일어나지 않고,
+// trieDestroy는 노드를 하나씩 따라가지 않고 덩어리들만 해제한다.
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #define MAX_DEGREE	27 // 'a' ~ 'z' and EOW
 #define EOW			'$' // end of word
+#define TRIE_MAX_KEY	65535	// 키의 최대 길이 (압축된 경로의 길이는 unsigned short)
+#define TRIE_MAX_WORD	255		// 단어 파일에서 읽는 단어의 최대 길이 (색인기의 TOKEN_MAX와 같다.)
+#define TRIE_WORD_FMT	"%255s"	// TRIE_MAX_WORD 바이트까지 읽는 fscanf 형식
+
+#define TRIE_UNIT		4						// 노드 풀의 할당 단위 (바이트)
+#define TRIE_CHUNK_BITS	16
+#define TRIE_CHUNK_SIZE	(TRIE_UNIT << TRIE_CHUNK_BITS)	// 덩어리 하나의 바이트 수 (256KB)
+#define TRIE_CHUNK_MASK	((1u << TRIE_CHUNK_BITS) - 1)
 
 // used in the following functions: trieInsert, trieSearch, triePrefixList
 #define getIndex(x)		(((x) == EOW) ? MAX_DEGREE-1 : ((x) - 'a'))
+#define getChar(i)		(((i) == MAX_DEGREE-1) ? EOW : 'a' + (i))
+#define isTrieChar(x)	(((x) >= 'a' && (x) <= 'z') || (x) == EOW)
+
+// 노드 형태 (TRIENODE.type)
+#define TRIE_NODE0		0
+#define TRIE_NODE4		1
+#define TRIE_NODE16		2
+#define TRIE_NODE27		3
+
+typedef uint32_t tTRIEREF;	// 노드 풀 안의 위치 (TRIE_UNIT 단위, 0: 없음)
+
+// 모든 노드 형태의 공통 머리
+typedef struct {
+	unsigned char	type;			// TRIE_NODE*
+	unsigned char	num_children;
+	unsigned short	prefix_len;		// 압축된 경로의 길이 (부모에서 내려온 문자 다음부터)
+	int 			index;			// 0, 1, 2, ... (-1: 이 노드에서 끝나는 엔트리 없음)
+	tTRIEREF		prefix;			// 압축된 경로가 있는 위치
+} TRIENODE;
+
+typedef struct {
+	TRIENODE		node;
+	unsigned char	keys[4];		// 문자 번호 (getIndex)
+	tTRIEREF		children[4];
+} TRIENODE4;
+
+typedef struct {
+	TRIENODE		node;
+	unsigned char	keys[16];
+	tTRIEREF		children[16];
+} TRIENODE16;
+
+typedef struct {
+	TRIENODE		node;
+	tTRIEREF		children[MAX_DEGREE];	// 문자 번호로 찾는다. (없으면 0)
+} TRIENODE27;
 
 // TRIE type definition
-typedef struct trieNode {
-	int 			index; // 0, 1, 2, ...
-	struct trieNode	*subtrees[MAX_DEGREE];
+typedef struct {
+	char		**chunks;		// 노드 풀의 덩어리들 (trieReset 후에도 남겨 다시 쓴다.)
+	int			num_chunks;
+	tTRIEREF	used;			// 다음에 할당할 위치
+	tTRIEREF	free[4];		// 형태별 빈 노드 목록 (노드의 처음 4바이트에 다음 빈 노드)
+	tTRIEREF	root;			// TRIE_NODE27
 } TRIE;
 
+static const size_t _trieNodeSize[] = { sizeof(TRIENODE), sizeof(TRIENODE4), sizeof(TRIENODE16), sizeof(TRIENODE27) };
+static const int _trieCapacity[] = { 0, 4, 16, MAX_DEGREE };
+
 ////////////////////////////////////////////////////////////////////////////////
-// Prototype declarations
+// 노드 풀 안의 위치를 주소로 바꾼다.
+static inline void *_trieAt( TRIE *trie, tTRIEREF ref) {
+	return trie->chunks[ref >> TRIE_CHUNK_BITS] + (size_t)(ref & TRIE_CHUNK_MASK) * TRIE_UNIT;
+}
 
-/* Allocates dynamic memory for a trie node and returns its address to caller
-	return	node pointer
-			NULL if overflow
-*/
-TRIE *trieCreateNode(void) {
-    TRIE *trie = (TRIE *)malloc(sizeof(TRIE));
+#define _trieNode(trie, ref)	((TRIENODE *)_trieAt( (trie), (ref)))
 
-    if (trie == NULL)
-        return NULL;
-    
-    trie->index = -1;
+// 노드 풀에서 size 바이트를 할당한다. (덩어리 경계에 걸치지 않는다.)
+// 실패시 0을 반환
+static tTRIEREF _trieAlloc( TRIE *trie, size_t size) {
+	tTRIEREF units = (size + TRIE_UNIT - 1) / TRIE_UNIT;
+	tTRIEREF ref = trie->used;
+	int chunk;
 
-	for (int i = 0; i < MAX_DEGREE; i++)
-		trie->subtrees[i] = NULL;
+	// 현재 덩어리에 남은 자리가 모자라면 다음 덩어리의 처음부터
+	if ((ref & TRIE_CHUNK_MASK) + units > TRIE_CHUNK_MASK + 1)
+		ref = (ref | TRIE_CHUNK_MASK) + 1;
+	if (ref == 0 || ref + units < ref)
+		return 0;
 
-	return trie;
+	chunk = ref >> TRIE_CHUNK_BITS;
+	if (chunk == trie->num_chunks) {
+		char **p = (char **)realloc(trie->chunks, sizeof(char *) * (chunk + 1));
+
+		if (p == NULL)
+			return 0;
+		trie->chunks = p;
+		trie->chunks[chunk] = (char *)malloc(TRIE_CHUNK_SIZE);
+		if (trie->chunks[chunk] == NULL)
+			return 0;
+		trie->num_chunks++;
+	}
+
+	trie->used = ref + units;
+	return ref;
+}
+
+// 노드의 압축된 경로
+static inline char *_triePrefix( TRIE *trie, TRIENODE *node) {
+	return (node->prefix_len > 0) ? (char *)_trieAt( trie, node->prefix) : NULL;
+}
+
+// 노드의 키 배열 (TRIE_NODE4, TRIE_NODE16)
+static inline unsigned char *_trieKeys( TRIENODE *node) {
+	return (node->type == TRIE_NODE4) ? ((TRIENODE4 *)node)->keys : ((TRIENODE16 *)node)->keys;
+}
+
+// 노드의 자식 배열 (TRIE_NODE4, TRIE_NODE16, TRIE_NODE27)
+static inline tTRIEREF *_trieChildren( TRIENODE *node) {
+	switch (node->type) {
+		case TRIE_NODE4: return ((TRIENODE4 *)node)->children;
+		case TRIE_NODE16: return ((TRIENODE16 *)node)->children;
+		case TRIE_NODE27: return ((TRIENODE27 *)node)->children;
+	}
+	return NULL;
+}
+
+// 압축된 경로로 쓸 len 바이트를 노드 풀에 복사한다.
+// 실패시 0을 반환 (len이 0이면 0을 반환하지만 실패가 아님)
+static tTRIEREF _trieNewPrefix( TRIE *trie, const char *prefix, int len) {
+	tTRIEREF ref;
+
+	if (len == 0)
+		return 0;
+
+	ref = _trieAlloc( trie, len);
+	if (ref != 0)
+		memcpy(_trieAt( trie, ref), prefix, len);
+	return ref;
+}
+
+// type 형태의 노드를 만든다. (자식 없음, 압축된 경로 없음)
+// 빈 노드 목록에 같은 형태의 노드가 있으면 그것을 쓴다.
+// 실패시 0을 반환
+static tTRIEREF _trieNewNode( TRIE *trie, int type, int index) {
+	tTRIEREF ref = trie->free[type];
+	TRIENODE *node;
+
+	if (ref != 0)
+		trie->free[type] = *(tTRIEREF *)_trieAt( trie, ref);
+	else if ((ref = _trieAlloc( trie, _trieNodeSize[type])) == 0)
+		return 0;
+
+	node = _trieNode(trie, ref);
+	memset(node, 0, _trieNodeSize[type]);
+	node->type = type;
+	node->index = index;
+
+	return ref;
+}
+
+// 더 이상 쓰지 않는 노드를 형태별 빈 노드 목록에 돌려준다.
+static void _trieFreeNode( TRIE *trie, tTRIEREF ref) {
+	TRIENODE *node = _trieNode(trie, ref);
+	int type = node->type;
+
+	*(tTRIEREF *)node = trie->free[type];
+	trie->free[type] = ref;
+}
+
+// 문자 번호 c인 자식을 가리키는 자식 배열의 칸을 찾는다.
+// 없으면 NULL을 반환
+static tTRIEREF *_trieFindChild( TRIENODE *node, int c) {
+	tTRIEREF *children = _trieChildren( node);
+
+	switch (node->type) {
+		case TRIE_NODE4:
+		case TRIE_NODE16: {
+			unsigned char *keys = _trieKeys( node);
+
+			for (int i = 0; i < node->num_children; i++)
+				if (keys[i] == c)
+					return &children[i];
+			return NULL;
+		}
+		case TRIE_NODE27:
+			return (children[c] != 0) ? &children[c] : NULL;
+	}
+	return NULL;
+}
+
+// 노드의 자식들을 문자 번호 순으로 keys, children에 담는다. (각 MAX_DEGREE개 크기)
+// 자식 수를 반환
+static int _trieListChildren( TRIENODE *node, unsigned char *keys, tTRIEREF *children) {
+	tTRIEREF *p = _trieChildren( node);
+	int n = 0;
+
+	if (node->type == TRIE_NODE27) {
+		for (int i = 0; i < MAX_DEGREE; i++)
+			if (p[i] != 0) {
+				keys[n] = i;
+				children[n++] = p[i];
+			}
+	}
+	else if (node->num_children > 0) {
+		memcpy(keys, _trieKeys( node), node->num_children);
+		memcpy(children, p, sizeof(tTRIEREF) * node->num_children);
+		n = node->num_children;
+	}
+	return n;
+}
+
+// *ref 노드에 문자 번호 c인 자식을 단다. (노드가 가득 찼으면 한 단계 큰 형태로 바꿔 *ref를 고친다.)
+// 실패시 0을 반환
+static int _trieAddChild( TRIE *trie, tTRIEREF *ref, int c, tTRIEREF child) {
+	TRIENODE *node = _trieNode(trie, *ref);
+	tTRIEREF *children;
+
+	if (node->num_children == _trieCapacity[node->type]) {
+		unsigned char keys[MAX_DEGREE];
+		tTRIEREF old[MAX_DEGREE];
+		int n = _trieListChildren( node, keys, old);
+		tTRIEREF grown = _trieNewNode( trie, node->type + 1, node->index);
+		TRIENODE *g;
+
+		if (grown == 0)
+			return 0;
+
+		g = _trieNode(trie, grown);
+		g->prefix = node->prefix;
+		g->prefix_len = node->prefix_len;
+		children = _trieChildren( g);
+		if (g->type == TRIE_NODE27) {
+			for (int i = 0; i < n; i++)
+				children[keys[i]] = old[i];
+		}
+		else {
+			memcpy(_trieKeys( g), keys, n);
+			memcpy(children, old, sizeof(tTRIEREF) * n);
+		}
+		g->num_children = n;
+
+		_trieFreeNode( trie, *ref);
+		*ref = grown;
+		node = g;
+	}
+
+	children = _trieChildren( node);
+	if (node->type == TRIE_NODE27)
+		children[c] = child;
+	else {
+		unsigned char *keys = _trieKeys( node);
+		int i = node->num_children;
+
+		// 문자 번호 순서를 지킨다. (trieList의 출력 순서)
+		for (; i > 0 && keys[i - 1] > c; i--) {
+			keys[i] = keys[i - 1];
+			children[i] = children[i - 1];
+		}
+		keys[i] = c;
+		children[i] = child;
+	}
+	node->num_children++;
+
+	return 1;
+}
+
+/* Empties trie (the node pool is kept, so rebuilding does not allocate again)
+	return	1 success
+			0 if overflow (first use)
+*/
+int trieReset( TRIE *trie) {
+	trie->used = 1; // 0은 없음을 뜻하므로 쓰지 않는다.
+	memset(trie->free, 0, sizeof(trie->free));
+	trie->root = _trieNewNode( trie, TRIE_NODE27, -1);
+
+	return trie->root != 0;
 }
 
 /* Deletes all data in trie and recycles memory
 */
-void trieDestroy( TRIE *root) {
-	if (root == NULL)
+void trieDestroy( TRIE *trie) {
+	if (trie == NULL)
 		return;
 
-	for (int i = 0; i < MAX_DEGREE; i++) {
-		if (*(root->subtrees + i))
-			trieDestroy(*(root->subtrees + i));
+	for (int i = 0; i < trie->num_chunks; i++)
+		free(trie->chunks[i]);
+	free(trie->chunks);
+	free(trie);
+}
+
+/* Allocates dynamic memory for an empty trie and returns its address to caller
+	return	trie pointer
+			NULL if overflow
+*/
+TRIE *trieCreateNode(void) {
+	TRIE *trie = (TRIE *)calloc(1, sizeof(TRIE));
+
+	if (trie == NULL)
+		return NULL;
+
+	if (!trieReset( trie)) {
+		trieDestroy( trie);
+		return NULL;
 	}
-	
-	free(root);
+
+	return trie;
 }
 
 /* Inserts new entry into the trie
@@ -51,24 +328,85 @@ void trieDestroy( TRIE *root) {
 			0 failure
 */
 // 주의! 엔트리를 중복 삽입하지 않도록 체크해야 함
-// 대소문자를 소문자로 통일하여 삽입
-// 영문자 외 문자를 포함하는 문자열은 삽입하지 않음
-int trieInsert( TRIE *root, char *str, int dic_index) {
+// 영문 소문자와 EOW 외 문자를 포함하는 문자열은 삽입하지 않음
+int trieInsert( TRIE *trie, char *str, int dic_index) {
+	tTRIEREF *ref = &trie->root; // 루트는 TRIE_NODE27이므로 바뀌지 않는다.
+	TRIENODE *pos = _trieNode(trie, trie->root);
+	int len;
+	int i = 0;
+
 	if (!str)
 		return 0;
 
-	TRIE *pos = root;
-	
-	for (int i = 0 ; i < strlen(str); i++) {
-		if (getIndex(str[i]) < 0 || getIndex(str[i]) > 26)
+	for (len = 0; str[len]; len++) {
+		if (!isTrieChar(str[len]))
 			return 0;
 	}
+	if (len > TRIE_MAX_KEY)
+		return 0;
+
+	while (i < len) {
+		tTRIEREF *slot = _trieFindChild( pos, getIndex(str[i]));
+		const char *rest = str + i + 1;
+		TRIENODE *child;
+		char *prefix;
+		int p = 0;
+
+		// 새 잎 노드가 남은 문자열 전체를 압축된 경로로 갖는다.
+		if (slot == NULL) {
+			tTRIEREF leaf = _trieNewNode( trie, TRIE_NODE0, dic_index);
+			tTRIEREF leaf_prefix = _trieNewPrefix( trie, rest, len - i - 1);
+
+			if (leaf == 0 || (leaf_prefix == 0 && len - i - 1 > 0))
+				return 0;
+			_trieNode(trie, leaf)->prefix = leaf_prefix;
+			_trieNode(trie, leaf)->prefix_len = len - i - 1;
 
-	for (int i = 0; i < strlen(str); i++) {
-		if (pos->subtrees[getIndex(str[i])] == NULL)
-			pos->subtrees[getIndex(str[i])] = trieCreateNode();
+			return _trieAddChild( trie, ref, getIndex(str[i]), leaf);
+		}
+
+		child = _trieNode(trie, *slot);
+		prefix = _triePrefix( trie, child);
+		while (p < child->prefix_len && prefix[p] == rest[p])
+			p++;
+
+		// 압축된 경로의 중간에서 갈라지면 같은 부분을 새 노드로 나누어 그 아래에 둘을 단다.
+		// 새 노드는 원래 경로의 앞부분을 그대로 가리키고 원래 노드에는 뒷부분을 복사해 준다.
+		if (p < child->prefix_len) {
+			tTRIEREF mid = _trieNewNode( trie, TRIE_NODE4, -1);
+			tTRIEREF tail = _trieNewPrefix( trie, prefix + p + 1, child->prefix_len - p - 1);
+			tTRIEREF leaf = 0;
+			tTRIEREF leaf_prefix = 0;
+			int c = getIndex(prefix[p]);
+
+			if (mid == 0 || (tail == 0 && child->prefix_len - p - 1 > 0))
+				return 0;
+			if (rest[p] != 0) {
+				leaf = _trieNewNode( trie, TRIE_NODE0, dic_index);
+				leaf_prefix = _trieNewPrefix( trie, rest + p + 1, len - i - p - 2);
+				if (leaf == 0 || (leaf_prefix == 0 && len - i - p - 2 > 0))
+					return 0;
+				_trieNode(trie, leaf)->prefix = leaf_prefix;
+				_trieNode(trie, leaf)->prefix_len = len - i - p - 2;
+			}
 
-		pos = pos->subtrees[getIndex(str[i])];
+			_trieNode(trie, mid)->prefix = child->prefix;
+			_trieNode(trie, mid)->prefix_len = p;
+			child->prefix = tail;
+			child->prefix_len -= p + 1;
+			_trieAddChild( trie, &mid, c, *slot);
+			if (leaf != 0)
+				_trieAddChild( trie, &mid, getIndex(rest[p]), leaf);
+			else
+				_trieNode(trie, mid)->index = dic_index;
+			*slot = mid;
+
+			return 1;
+		}
+
+		ref = slot;
+		pos = child;
+		i += 1 + p;
 	}
 
 	if (pos->index == -1) {
@@ -84,60 +422,390 @@ int trieInsert( TRIE *root, char *str, int dic_index) {
 	return	index in dictionary (trie) if key found
 			-1 key not found
 */
-int trieSearch( TRIE *root, char *str) {
-	TRIE *pos = root;
-	int len = strlen(str);
+int trieSearch( TRIE *trie, char *str) {
+	TRIENODE *pos = _trieNode(trie, trie->root);
 
-	for (int i = 0 ; i < len; i++) {
-		if (getIndex(str[i]) < 0 || getIndex(str[i]) > 26)
+	while (*str) {
+		tTRIEREF *slot = isTrieChar(*str) ? _trieFindChild( pos, getIndex(*str)) : NULL;
+
+		if (slot == NULL)
 			return -1;
-	}
 
-	for (int i = 0; i < len; i++) {
-		if (pos->subtrees[getIndex(str[i])] == NULL)
+		pos = _trieNode(trie, *slot);
+		str++;
+
+		// 압축된 경로에는 NUL이 없으므로 str이 더 짧으면 여기서 다르다.
+		if (pos->prefix_len > 0 && strncmp(_triePrefix( trie, pos), str, pos->prefix_len) != 0)
 			return -1;
+		str += pos->prefix_len;
+	}
+
+	return pos->index;
+}
 
-		pos = pos->subtrees[getIndex(str[i])];
+// str로 시작하는 엔트리들을 모두 담고 있는 가장 위의 노드를 찾는다.
+// path가 NULL이 아니면 그 노드까지의 키(노드의 압축된 경로는 빼고)를 담고 길이를 *pathlen에 넣는다.
+// 없으면 NULL을 반환
+static TRIENODE *_trieDescend( TRIE *trie, const char *str, char *path, int *pathlen) {
+	TRIENODE *pos = _trieNode(trie, trie->root);
+	int n = 0;
+
+	while (*str) {
+		tTRIEREF *slot = isTrieChar(*str) ? _trieFindChild( pos, getIndex(*str)) : NULL;
+		char *prefix;
+		int i;
+
+		if (slot == NULL)
+			return NULL;
+		if (path)
+			path[n] = *str;
+		n++;
+		str++;
+
+		pos = _trieNode(trie, *slot);
+		prefix = _triePrefix( trie, pos);
+
+		// str이 압축된 경로의 중간에서 끝나도 이 노드 아래의 엔트리는 모두 str로 시작한다.
+		for (i = 0; i < pos->prefix_len && *str; i++, str++)
+			if (*str != prefix[i])
+				return NULL;
+		if (*str == 0)
+			break;
+
+		if (path && pos->prefix_len > 0)
+			memcpy(path + n, prefix, pos->prefix_len);
+		n += pos->prefix_len;
 	}
 
-	if (pos->index != -1)
-		return pos->index;
-	
-	return -1;
+	if (pathlen)
+		*pathlen = n;
+	return pos;
 }
 
-/* prints all entries in trie using preorder traversal
-*/
-void trieList( TRIE *root) {
-	if (root->index != -1)
-		printf("%d\n", root->index);
-	for (int i = 0; i < MAX_DEGREE; i++) {
-		if (*(root->subtrees + i) != NULL)
-			trieList(*(root->subtrees + i));
+// 노드 아래의 엔트리들을 전위 순회로 출력한다. (key에 len 바이트의 노드까지의 키)
+static void _trieList( TRIE *trie, TRIENODE *node, char *key, int len) {
+	unsigned char keys[MAX_DEGREE];
+	tTRIEREF children[MAX_DEGREE];
+	int n;
+
+	if (node->prefix_len > 0)
+		memcpy(key + len, _triePrefix( trie, node), node->prefix_len);
+	len += node->prefix_len;
+
+	if (node->index != -1)
+		printf("%.*s\n", len, key);
+
+	n = _trieListChildren( node, keys, children);
+	for (int i = 0; i < n; i++) {
+		key[len] = getChar(keys[i]);
+		_trieList( trie, _trieNode(trie, children[i]), key, len + 1);
 	}
 }
 
+/* prints all entries (keys) in trie using preorder traversal
+*/
+void trieList( TRIE *trie) {
+	char *key = (char *)malloc(TRIE_MAX_KEY + 1);
+
+	if (key == NULL)
+		return;
+
+	_trieList( trie, _trieNode(trie, trie->root), key, 0);
+	free(key);
+}
+
 /* prints all entries starting with str (as prefix) in trie
    ex) "abb" -> "abbas", "abbasid", "abbess", ...
-	using trieList function
 */
-void triePrefixList( TRIE *root, char *str) {
-	TRIE *pos = root;
-	int len = strlen(str);
+void triePrefixList( TRIE *trie, char *str) {
+	char *key = (char *)malloc(TRIE_MAX_KEY + 1);
+	TRIENODE *pos;
+	int len;
 
-	for (int i = 0 ; i < strlen(str); i++) {
-		if (getIndex(str[i]) < 0 || getIndex(str[i]) > 26)
-			return;
+	if (key == NULL)
+		return;
+
+	pos = _trieDescend( trie, str, key, &len);
+	if (pos != NULL)
+		_trieList( trie, pos, key, len);
+	free(key);
+}
+
+// 노드 아래의 모든 엔트리의 사전 번호를 indices 뒤에 덧붙인다. (전위 순회, 배열은 필요하면 늘린다.)
+// 실패시 0을 반환
+static int _trieCollect( TRIE *trie, TRIENODE *node, int **indices, int *count, int *cap) {
+	unsigned char keys[MAX_DEGREE];
+	tTRIEREF children[MAX_DEGREE];
+	int n;
+
+	if (node->index != -1) {
+		if (*count == *cap) {
+			int newcap = (*cap == 0) ? 64 : *cap * 2;
+			int *p = (int *)realloc(*indices, sizeof(int) * newcap);
+
+			if (p == NULL)
+				return 0;
+			*indices = p;
+			*cap = newcap;
+		}
+		(*indices)[(*count)++] = node->index;
+	}
+
+	n = _trieListChildren( node, keys, children);
+	for (int i = 0; i < n; i++) {
+		if (!_trieCollect( trie, _trieNode(trie, children[i]), indices, count, cap))
+			return 0;
+	}
+	return 1;
+}
+
+/* collects indices of all entries starting with str (as prefix) in trie
+	like triePrefixList, but appends them to *indices (grown by realloc, *count used of *cap)
+	return	1 success
+			0 if overflow
+*/
+int triePrefixCollect( TRIE *trie, char *str, int **indices, int *count, int *cap) {
+	TRIENODE *pos = _trieDescend( trie, str, NULL, NULL);
+
+	if (pos == NULL)
+		return 1;
+
+	return _trieCollect( trie, pos, indices, count, cap);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 정렬된 키들로 트라이를 한 번에 만들기 (bulk loading)
+// 키들이 트라이 순서(문자 번호 순, 키가 그 키로 시작하는 키들보다 먼저)로 오면
+// 직전 키와의 공통 접두어 길이만 보고 직전 키의 경로에서 갈라지는 곳 아래의 노드들을 닫는다.
+// 루트에서 잎까지 다시 내려가지 않고, 노드는 닫을 때 자식 수에 맞는 가장 작은 형태로 한 번만 만든다.
+// 열린 노드들은 모두 직전 키의 경로 위에 있으므로 압축된 경로는 직전 키(path)의 구간으로 가지고 있다가 닫을 때 복사한다.
+// 순서가 어긋난 키가 오면 그때까지 만든 노드들을 모두 닫고 나머지 키들은 trieInsert로 넣는다.
+
+// 아직 닫지 않은 노드 (직전 키의 경로 위)
+typedef struct {
+	int				start;		// 압축된 경로의 시작 (path 안의 위치, 부모에서 내려온 문자 다음)
+	int				end;		// 압축된 경로의 끝 (자식들로 갈라지는 위치)
+	int				index;
+	int				num_children;
+	unsigned char	keys[MAX_DEGREE];
+	tTRIEREF		children[MAX_DEGREE];
+} tTRIEOPEN;
+
+typedef struct {
+	TRIE		*trie;
+	char		*path;		// 직전 키
+	int			len;		// 직전 키의 길이 (-1: 아직 키가 없음)
+	tTRIEOPEN	*open;		// 열린 노드들 (open[0]은 루트)
+	int			num_open;
+	int			cap;
+	int			sorted;		// 0이면 순서가 어긋나 trieInsert로 넣는 중
+	int			failed;		// 메모리 부족
+} tTRIEBULK;
+
+// 맨 위의 열린 노드를 닫아 노드 풀에 만들고 그 아래 열린 노드(부모)의 자식으로 단다.
+// 실패시 0을 반환
+static int _trieBulkClose( tTRIEBULK *bulk) {
+	tTRIEOPEN *top = &bulk->open[bulk->num_open - 1];
+	tTRIEOPEN *parent = top - 1;
+	int n = top->num_children;
+	int type = (n == 0) ? TRIE_NODE0 : (n <= 4) ? TRIE_NODE4 : (n <= 16) ? TRIE_NODE16 : TRIE_NODE27;
+	tTRIEREF ref = _trieNewNode( bulk->trie, type, top->index);
+	TRIENODE *node;
+	tTRIEREF *children;
+
+	bulk->num_open--;
+	if (ref == 0)
+		return 0;
+
+	node = _trieNode(bulk->trie, ref);
+	node->prefix_len = top->end - top->start;
+	if (node->prefix_len > 0 && (node->prefix = _trieNewPrefix( bulk->trie, bulk->path + top->start, node->prefix_len)) == 0)
+		return 0;
+
+	node->num_children = n;
+	children = _trieChildren( node);
+	if (type == TRIE_NODE27) {
+		for (int i = 0; i < n; i++)
+			children[top->keys[i]] = top->children[i];
+	}
+	else if (n > 0) {
+		memcpy(_trieKeys( node), top->keys, n);
+		memcpy(children, top->children, sizeof(tTRIEREF) * n);
+	}
+
+	parent->keys[parent->num_children] = getIndex(bulk->path[top->start - 1]);
+	parent->children[parent->num_children++] = ref;
+
+	return 1;
+}
+
+// 열린 노드를 하나 더 둘 자리를 만든다.
+// 실패시 0을 반환
+static int _trieBulkReserve( tTRIEBULK *bulk) {
+	if (bulk->num_open == bulk->cap) {
+		int cap = bulk->cap * 2;
+		tTRIEOPEN *p = (tTRIEOPEN *)realloc(bulk->open, sizeof(tTRIEOPEN) * cap);
+
+		if (p == NULL)
+			return 0;
+		bulk->open = p;
+		bulk->cap = cap;
+	}
+	return 1;
+}
+
+// 열린 노드를 모두 닫고 루트 노드에 자식들을 단다.
+// 실패시 0을 반환
+static int _trieBulkFinish( tTRIEBULK *bulk) {
+	TRIENODE27 *root = (TRIENODE27 *)_trieNode(bulk->trie, bulk->trie->root);
+
+	while (bulk->num_open > 1)
+		if (!_trieBulkClose( bulk))
+			return 0;
+
+	if (bulk->num_open == 1) {
+		root->node.index = bulk->open[0].index;
+		root->node.num_children = bulk->open[0].num_children;
+		for (int i = 0; i < bulk->open[0].num_children; i++)
+			root->children[bulk->open[0].keys[i]] = bulk->open[0].children[i];
+		bulk->num_open = 0;
+	}
+	return 1;
+}
+
+/* starts loading keys in trie order into trie (trie is emptied first)
+	return	1 success
+			0 if overflow
+*/
+int trieBulkInit( tTRIEBULK *bulk, TRIE *trie) {
+	bulk->trie = trie;
+	bulk->len = -1;
+	bulk->num_open = 1;
+	bulk->cap = 64;
+	bulk->sorted = 1;
+	bulk->failed = 0;
+	bulk->path = (char *)malloc(TRIE_MAX_KEY + 1);
+	bulk->open = (tTRIEOPEN *)malloc(sizeof(tTRIEOPEN) * bulk->cap);
+
+	if (bulk->path == NULL || bulk->open == NULL || !trieReset( trie)) {
+		free(bulk->path);
+		free(bulk->open);
+		bulk->path = NULL;
+		bulk->open = NULL;
+		return 0;
 	}
 
+	bulk->open[0].start = bulk->open[0].end = 0;
+	bulk->open[0].index = -1;
+	bulk->open[0].num_children = 0;
+
+	return 1;
+}
+
+/* adds key of len bytes (not necessarily NUL-terminated) with dictionary index
+	keys should come in trie order ('a' < ... < 'z' < EOW, and a key comes before keys extending it);
+	ex) strcmp order for keys of lowercase letters only
+	once a key is out of order, the rest are inserted by trieInsert
+	return	1 success
+			0 failure (invalid character, too long, duplicate or overflow)
+*/
+int trieBulkAdd( tTRIEBULK *bulk, const char *key, int len, int index) {
+	tTRIEOPEN *top;
+	int l = 0;
+
+	if (bulk->failed || len > TRIE_MAX_KEY)
+		return 0;
+
 	for (int i = 0; i < len; i++) {
-		if (pos->subtrees[getIndex(str[i])] == NULL)
-			return;
+		if (!isTrieChar(key[i]))
+			return 0;
+	}
+
+	if (!bulk->sorted) {
+		memcpy(bulk->path, key, len);
+		bulk->path[len] = 0;
+		return trieInsert( bulk->trie, bulk->path, index);
+	}
+
+	// 직전 키와의 공통 접두어
+	if (bulk->len >= 0) {
+		while (l < len && l < bulk->len && key[l] == bulk->path[l])
+			l++;
+
+		if (l == len || (l < bulk->len && getIndex(key[l]) < getIndex(bulk->path[l]))) {
+			if (l == len && len == bulk->len)
+				return 0; // 중복
+
+			// 순서가 어긋났다: 지금까지 만든 트라이에 하나씩 넣는다.
+			if (!_trieBulkFinish( bulk)) {
+				bulk->failed = 1;
+				return 0;
+			}
+			bulk->sorted = 0;
+			return trieBulkAdd( bulk, key, len, index);
+		}
+	}
+
+	// 직전 키가 l에서 갈라진 뒤의 노드들은 더 이상 자식이 생기지 않는다.
+	while (bulk->open[bulk->num_open - 1].start > l)
+		if (!_trieBulkClose( bulk)) {
+			bulk->failed = 1;
+			return 0;
+		}
+
+	if (!_trieBulkReserve( bulk)) {
+		bulk->failed = 1;
+		return 0;
+	}
+	top = &bulk->open[bulk->num_open - 1];
+
+	// 압축된 경로의 중간에서 갈라지면 같은 부분을 새 열린 노드로 나누고 뒷부분은 닫아서 그 자식으로 단다.
+	if (top->end > l) {
+		top[1].start = l + 1;
+		top[1].end = top->end;
+		top[1].index = top->index;
+		top[1].num_children = top->num_children;
+		memcpy(top[1].keys, top->keys, top->num_children);
+		memcpy(top[1].children, top->children, sizeof(tTRIEREF) * top->num_children);
+		top->end = l;
+		top->index = -1;
+		top->num_children = 0;
+		bulk->num_open++;
+		if (!_trieBulkClose( bulk)) {
+			bulk->failed = 1;
+			return 0;
+		}
+	}
 
-		pos = pos->subtrees[getIndex(str[i])];
+	if (l == len) // 첫 키가 빈 문자열
+		top->index = index;
+	else {
+		top[1].start = l + 1;
+		top[1].end = len;
+		top[1].index = index;
+		top[1].num_children = 0;
+		bulk->num_open++;
 	}
 
-	trieList(pos);
+	memcpy(bulk->path + l, key + l, len - l);
+	bulk->len = len;
+
+	return 1;
+}
+
+/* finishes loading (trie is ready to use, and more keys can be inserted by trieInsert)
+	return	1 success
+			0 if overflow while loading
+*/
+int trieBulkEnd( tTRIEBULK *bulk) {
+	int ok = !bulk->failed && _trieBulkFinish( bulk);
+
+	free(bulk->path);
+	free(bulk->open);
+	bulk->path = NULL;
+	bulk->open = NULL;
+
+	return ok;
 }
 
 /* makes permuterms for given str
@@ -179,6 +847,371 @@ void clear_permuterms( char *permuterms[], int size) {
 		free(permuterms[i]);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// permuterm 트라이를 여러 스레드로 만들기
+// 단어 w마다 w$w를 한 버퍼에 이어 붙여 두면 회전 i는 그 안의 i번째부터 len(w)+1 바이트이므로
+// 회전을 문자열로 만들지 않고 구간(tTRIEVIEW)으로 가리킨다. (회전마다 힙 할당이 없다.)
+// 회전들을 첫 문자(루트의 자식)로 나누어 스레드마다 맡은 첫 문자들의 서브트라이를 자기 노드 풀에 만든다.
+//   첫 문자는 회전 수가 많은 것부터 회전을 가장 적게 맡은 스레드에 준다.
+//   스레드는 맡은 회전들을 트라이 순서로 정렬하여 bulk loading으로 넣는다.
+// 첫 스레드는 결과 트라이에 바로 만들고, 나머지 스레드의 덩어리들은 결과 트라이의 덩어리 뒤에 이어 붙인 뒤
+// 서브트라이 안의 위치들을 옮긴 만큼 고치고 결과 트라이 루트의 자식으로 단다.
+
+#define TRIE_MAX_THREADS	MAX_DEGREE	// 첫 문자 수보다 많은 스레드는 쓰지 않는다.
+#define TRIE_SORT_SMALL		16			// 회전이 이보다 적으면 삽입 정렬
+#define TRIE_SORT_DEPTH		256			// 공통 접두어가 이보다 길면 qsort
+
+// 회전 하나 (w$w 안의 구간)
+typedef struct {
+	const char	*key;
+	int			len;	// 단어 길이 + 1
+	int			index;
+} tTRIEVIEW;
+
+// permuterm 트라이를 만드는 스레드 하나
+typedef struct {
+	TRIE			*trie;		// 서브트라이를 만들 트라이
+	const char		*buf;		// 단어마다 w$w
+	const size_t	*offsets;	// 단어 j의 w$w는 buf[offsets[j]] ~ buf[offsets[j + 1] - 1]
+	const int		*indices;
+	int				num_words;
+	const long		*counts;	// 첫 문자별 회전 수
+	unsigned char	mine[MAX_DEGREE];	// 맡은 첫 문자 번호이면 1
+	long			num_views;	// 맡은 회전 수
+	int				ok;
+} tTRIEPERMUTE;
+
+// 앞의 depth 바이트가 같은 두 회전을 트라이 순서로 비교한다. (같으면 사전 번호 순)
+static int _trieCompareView( const tTRIEVIEW *a, const tTRIEVIEW *b, int depth) {
+	int len = (a->len < b->len) ? a->len : b->len;
+
+	for (int i = depth; i < len; i++)
+		if (a->key[i] != b->key[i])
+			return getIndex(a->key[i]) - getIndex(b->key[i]);
+
+	if (a->len != b->len)
+		return a->len - b->len;
+	return (a->index > b->index) - (a->index < b->index);
+}
+
+static int _trieCompareViewQ( const void *v1, const void *v2) {
+	return _trieCompareView( (const tTRIEVIEW *)v1, (const tTRIEVIEW *)v2, 0);
+}
+
+// 앞의 depth 바이트가 같은 회전 n개를 트라이 순서로 정렬한다.
+// depth번째 문자(키가 끝났으면 0, 아니면 문자 번호 + 1)로 제자리에서 나누고 나눈 칸마다 다음 문자로 정렬한다. (MSD radix sort)
+// 회전마다 그 문자를 한 번만 읽어 buckets에 두고 나누는 동안에는 buckets만 본다. (buckets는 n바이트 이상)
+// 적으면 삽입 정렬, 공통 접두어가 아주 길면 (재귀가 깊어지지 않도록) qsort
+static void _trieSortViews( tTRIEVIEW *views, unsigned char *buckets, long n, int depth) {
+	long counts[MAX_DEGREE + 1] = { 0 };
+	long starts[MAX_DEGREE + 1];
+	long ends[MAX_DEGREE + 1];
+	long pos = 0;
+
+	if (n < TRIE_SORT_SMALL) {
+		for (long i = 1; i < n; i++) {
+			tTRIEVIEW v = views[i];
+			long j = i;
+
+			for (; j > 0 && _trieCompareView( &views[j - 1], &v, depth) > 0; j--)
+				views[j] = views[j - 1];
+			views[j] = v;
+		}
+		return;
+	}
+	if (depth >= TRIE_SORT_DEPTH) {
+		qsort( views, n, sizeof(tTRIEVIEW), _trieCompareViewQ);
+		return;
+	}
+
+	for (long i = 0; i < n; i++) {
+		buckets[i] = (depth == views[i].len) ? 0 : getIndex(views[i].key[depth]) + 1;
+		counts[buckets[i]]++;
+	}
+	for (int b = 0; b <= MAX_DEGREE; b++) {
+		starts[b] = pos;
+		pos += counts[b];
+		ends[b] = pos;
+	}
+
+	// 칸마다 제자리가 아닌 회전을 들어갈 칸의 다음 자리와 맞바꾼다.
+	for (int b = 0; b <= MAX_DEGREE; b++) {
+		while (starts[b] < ends[b]) {
+			tTRIEVIEW v = views[starts[b]];
+			unsigned char vb = buckets[starts[b]];
+
+			while (vb != b) {
+				long k = starts[vb]++;
+				tTRIEVIEW tv = views[k];
+				unsigned char tb = buckets[k];
+
+				views[k] = v;
+				buckets[k] = vb;
+				v = tv;
+				vb = tb;
+			}
+			views[starts[b]] = v;
+			buckets[starts[b]++] = vb;
+		}
+	}
+
+	for (int b = 0; b <= MAX_DEGREE; b++) {
+		long start = (b == 0) ? 0 : ends[b - 1];
+
+		if (ends[b] - start < 2)
+			continue;
+		if (b == 0) // 키가 같은 회전들 (중복 단어): 사전 번호 순
+			qsort( views, ends[0], sizeof(tTRIEVIEW), _trieCompareViewQ);
+		else
+			_trieSortViews( views + start, buckets + start, ends[b] - start, depth + 1);
+	}
+}
+
+// 맡은 첫 문자로 시작하는 회전들을 첫 문자별로 모아 정렬한 뒤 서브트라이를 만든다.
+static void *_triePermuteWorker( void *arg) {
+	tTRIEPERMUTE *job = (tTRIEPERMUTE *)arg;
+	tTRIEVIEW *views = (tTRIEVIEW *)malloc(sizeof(tTRIEVIEW) * (job->num_views + 1));
+	unsigned char *buckets = (unsigned char *)malloc(job->num_views + 1);
+	long starts[MAX_DEGREE];
+	long pos = 0;
+	tTRIEBULK bulk;
+
+	job->ok = 0;
+	if (views == NULL || buckets == NULL) {
+		free(views);
+		free(buckets);
+		return NULL;
+	}
+
+	// 첫 문자 번호 순으로 칸을 나누어 둔다.
+	for (int c = 0; c < MAX_DEGREE; c++) {
+		starts[c] = pos;
+		if (job->mine[c])
+			pos += job->counts[c];
+	}
+
+	for (int j = 0; j < job->num_words; j++) {
+		const char *w = job->buf + job->offsets[j];
+		int len = (int)((job->offsets[j + 1] - job->offsets[j] + 1) / 2);
+
+		for (int i = 0; i < len; i++) {
+			int c = getIndex(w[i]);
+
+			if (job->mine[c]) {
+				tTRIEVIEW *v = &views[starts[c]++];
+
+				v->key = w + i;
+				v->len = len;
+				v->index = job->indices[j];
+			}
+		}
+	}
+
+	// 칸 안의 회전들은 첫 문자가 같으므로 다음 문자부터 정렬한다.
+	for (int c = 0; c < MAX_DEGREE; c++) {
+		if (job->mine[c])
+			_trieSortViews( views + starts[c] - job->counts[c], buckets + starts[c] - job->counts[c], job->counts[c], 1);
+	}
+
+	if (trieBulkInit( &bulk, job->trie)) {
+		for (long i = 0; i < pos; i++)
+			trieBulkAdd( &bulk, views[i].key, views[i].len, views[i].index);
+		job->ok = trieBulkEnd( &bulk);
+	}
+
+	free(views);
+	free(buckets);
+	return NULL;
+}
+
+// 덩어리를 옮긴 서브트라이 안의 위치들(압축된 경로, 자식)을 delta만큼 고친다.
+static void _trieRelocate( TRIE *trie, tTRIEREF ref, tTRIEREF delta) {
+	TRIENODE *node = _trieNode(trie, ref);
+	tTRIEREF *children = _trieChildren( node);
+	int n = (node->type == TRIE_NODE27) ? MAX_DEGREE : node->num_children;
+
+	if (node->prefix_len > 0)
+		node->prefix += delta;
+
+	for (int i = 0; i < n; i++) {
+		if (children[i] != 0) {
+			children[i] += delta;
+			_trieRelocate( trie, children[i], delta);
+		}
+	}
+}
+
+// sub의 덩어리들을 trie의 덩어리 뒤로 옮기고 sub 루트의 자식들을 trie 루트의 자식으로 단다.
+// trie에서 쓰지 않는 덩어리(trieReset 전에 쓰던 것)는 먼저 해제한다.
+// 성공하면 sub는 해제된다. 실패시 0을 반환
+static int _trieAdopt( TRIE *trie, TRIE *sub) {
+	TRIENODE27 *subroot = (TRIENODE27 *)_trieNode(sub, sub->root);
+	TRIENODE27 *root;
+	int used = (int)((trie->used - 1) >> TRIE_CHUNK_BITS) + 1;
+	tTRIEREF delta;
+	char **p;
+
+	while (trie->num_chunks > used)
+		free(trie->chunks[--trie->num_chunks]);
+
+	if ((long)trie->num_chunks + sub->num_chunks > (1L << (32 - TRIE_CHUNK_BITS)))
+		return 0;
+	p = (char **)realloc(trie->chunks, sizeof(char *) * (trie->num_chunks + sub->num_chunks));
+	if (p == NULL)
+		return 0;
+	trie->chunks = p;
+
+	delta = (tTRIEREF)trie->num_chunks << TRIE_CHUNK_BITS;
+	memcpy(trie->chunks + trie->num_chunks, sub->chunks, sizeof(char *) * sub->num_chunks);
+	trie->num_chunks += sub->num_chunks;
+	trie->used = (tTRIEREF)trie->num_chunks << TRIE_CHUNK_BITS; // 다음 할당은 새 덩어리에서
+
+	root = (TRIENODE27 *)_trieNode(trie, trie->root);
+	for (int c = 0; c < MAX_DEGREE; c++) {
+		if (subroot->children[c] != 0) {
+			root->children[c] = subroot->children[c] + delta;
+			root->node.num_children++;
+			_trieRelocate( trie, root->children[c], delta);
+		}
+	}
+
+	free(sub->chunks);
+	free(sub);
+	return 1;
+}
+
+/* makes permuterm trie of words using num_threads threads (trie is emptied first)
+	all rotations of word$ are mapped to indices[i] (ex) "abc" -> "abc$", "bc$a", "c$ab", "$abc")
+	words with characters other than lowercase letters are skipped
+	num_threads <= 0: number of online processors
+	return	1 success
+			0 if overflow
+*/
+int triePermuteBuild( TRIE *trie, const char **words, const int *indices, int num_words, int num_threads) {
+	tTRIEPERMUTE jobs[TRIE_MAX_THREADS];
+	pthread_t tids[TRIE_MAX_THREADS];
+	long counts[MAX_DEGREE] = { 0 };
+	int order[MAX_DEGREE];		// 회전이 있는 첫 문자 번호들 (회전 수가 많은 것부터)
+	int num_first = 0;
+	size_t *offsets = (size_t *)malloc(sizeof(size_t) * (num_words + 1));
+	int *kept = (int *)malloc(sizeof(int) * (num_words + 1));	// 넣을 단어들 (words 안의 번호, 나중에 사전 번호)
+	char *buf = NULL;
+	int num_kept = 0;
+	int ok = 1;
+
+	if (offsets == NULL || kept == NULL || !trieReset( trie)) {
+		free(offsets);
+		free(kept);
+		return 0;
+	}
+
+	// 넣을 단어들의 w$w 위치
+	offsets[0] = 0;
+	for (int i = 0; i < num_words; i++) {
+		int len;
+
+		for (len = 0; words[i][len] >= 'a' && words[i][len] <= 'z'; len++)
+			;
+		if (words[i][len] != 0 || len >= TRIE_MAX_KEY)
+			continue;
+
+		kept[num_kept] = i;
+		offsets[num_kept + 1] = offsets[num_kept] + 2 * len + 1;
+		num_kept++;
+	}
+
+	buf = (char *)malloc(offsets[num_kept] + 1);
+	if (buf == NULL) {
+		free(offsets);
+		free(kept);
+		return 0;
+	}
+
+	// w$w를 만들고 첫 문자별 회전 수를 센다. (w$의 각 문자로 시작하는 회전이 하나씩)
+	for (int j = 0; j < num_kept; j++) {
+		size_t len = (offsets[j + 1] - offsets[j] - 1) / 2;
+		char *w = buf + offsets[j];
+
+		memcpy(w, words[kept[j]], len);
+		w[len] = EOW;
+		memcpy(w + len + 1, words[kept[j]], len);
+		for (size_t k = 0; k <= len; k++)
+			counts[getIndex(w[k])]++;
+		kept[j] = indices[kept[j]]; // 이제부터 사전 번호
+	}
+
+	// 회전 수가 많은 첫 문자부터
+	for (int c = 0; c < MAX_DEGREE; c++) {
+		int k = num_first;
+
+		if (counts[c] == 0)
+			continue;
+		while (k > 0 && counts[order[k - 1]] < counts[c]) {
+			order[k] = order[k - 1];
+			k--;
+		}
+		order[k] = c;
+		num_first++;
+	}
+
+	if (num_threads <= 0)
+		num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > num_first)
+		num_threads = num_first;
+	if (num_threads < 1)
+		num_threads = 1;
+
+	for (int t = 0; t < num_threads; t++) {
+		memset(&jobs[t], 0, sizeof(tTRIEPERMUTE));
+		jobs[t].trie = (t == 0) ? trie : trieCreateNode();
+		jobs[t].buf = buf;
+		jobs[t].offsets = offsets;
+		jobs[t].indices = kept;
+		jobs[t].counts = counts;
+		jobs[t].num_words = num_kept;
+		if (jobs[t].trie == NULL)
+			ok = 0;
+	}
+
+	for (int k = 0; k < num_first; k++) {
+		int t = 0;
+
+		for (int s = 1; s < num_threads; s++)
+			if (jobs[s].num_views < jobs[t].num_views)
+				t = s;
+		jobs[t].mine[order[k]] = 1;
+		jobs[t].num_views += counts[order[k]];
+	}
+
+	// 첫 스레드의 몫과 스레드를 만들지 못한 몫은 이 스레드에서
+	if (ok) {
+		int started[TRIE_MAX_THREADS] = { 0 };
+
+		for (int t = 1; t < num_threads; t++)
+			started[t] = pthread_create( &tids[t], NULL, _triePermuteWorker, &jobs[t]) == 0;
+		_triePermuteWorker( &jobs[0]);
+		for (int t = 1; t < num_threads; t++) {
+			if (started[t])
+				pthread_join( tids[t], NULL);
+			else
+				_triePermuteWorker( &jobs[t]);
+		}
+	}
+
+	for (int t = 1; t < num_threads; t++) {
+		if (ok && jobs[t].ok && jobs[0].ok && _trieAdopt( trie, jobs[t].trie))
+			continue;
+		ok = 0;
+		trieDestroy( jobs[t].trie);
+	}
+
+	free(buf);
+	free(offsets);
+	free(kept);
+
+	return ok && jobs[0].ok;
+}
+
 /* wildcard search
 	ex) "ab*", "*ab", "a*b", "*ab*"
 	using triePrefixList function
@@ -218,83 +1251,508 @@ void trieSearchWildcard( TRIE *root, char *str) {
 	}
 }
 
-/* makes a trie for given dictionary file
-	return	trie head node pointer
-			NULL failure
-*/ 
-TRIE *dic2trie( char *dicfile) {
-	TRIE *trie;
-	char str[100];
-	FILE *fp;
-	int num_p;
-	int dic_index = -1;
-	
-	fp = fopen(dicfile, "rt");
-	if (fp == NULL)
-	{
-		fprintf( stderr, "File open error: %s\n", dicfile);
-		return NULL;
+////////////////////////////////////////////////////////////////////////////////
+// 이중 배열 트라이 (double-array trie, DAT)
+// 다 만든 뒤 바뀌지 않는 트라이(사전, permuterm)를 두 정수 배열로 바꾸어 적은 메모리로 찾는다.
+//   상태 s에서 문자 코드 c로 가는 상태는 t = base[s] + c이고 check[t] == s일 때만 있다. (루트는 상태 1)
+//   문자 코드: 키의 끝 0, 'a' ~ 'z' 1 ~ 26, EOW 27
+//   아래에 엔트리가 하나뿐인 상태(잎)는 base에 -(tail 안의 위치)를 두고
+//   tail에 남은 문자열, NUL, 사전 번호(4바이트)를 둔다.
+// 트라이의 압축된 경로는 내부 노드이면 문자마다 상태 하나로 펼치고 잎 노드이면 tail에 둔다.
+// 찾기(datSearch)와 엔트리 순서(datPrefixCollect)는 트라이(trieSearch, triePrefixCollect)와 같다.
+// datWrite로 파일에 기록하고 datOpen으로 mmap하여 바로 쓸 수 있다. (datOpen은 배열들이 서로 맞는지 확인한다.)
+//
+// 파일 형식: tDATHEADER, base[num_states], check[num_states], tail[tail_size]
+
+#define DAT_MAGIC		0x52544144 // "DATR"
+#define DAT_VERSION		1
+#define DAT_ROOT		1
+#define DAT_CODES		(MAX_DEGREE + 1)	// 키의 끝과 문자들
+#define DAT_SCAN		256		// datBuild가 자식 상태들의 자리를 찾으며 보는 빈 칸의 최대 수
+
+#define getDatCode(x)	(getIndex(x) + 1)
+
+typedef struct {
+	int32_t		*base;		// 내부 상태: 자식 상태의 시작, 잎 상태: -(tail 안의 위치)
+	int32_t		*check;		// 부모 상태 (0: 빈 칸)
+	char		*tail;		// 잎 상태의 남은 문자열
+	uint32_t	num_states;	// base, check의 원소 수
+	uint32_t	tail_size;	// tail의 바이트 수
+	void		*map;		// datOpen으로 mmap한 파일 (NULL: datBuild로 만든 배열)
+	size_t		map_size;
+} tDAT;
+
+typedef struct {
+	uint32_t	magic;		// DAT_MAGIC
+	uint32_t	version;	// DAT_VERSION
+	uint32_t	num_states;
+	uint32_t	tail_size;
+} tDATHEADER;
+
+// datBuild가 쓰는 만드는 중의 배열들
+// 빈 칸들은 위치 순으로 이중 연결 리스트로 이어 두고 자식 상태들이 들어갈 자리를 빈 칸에서만 찾는다.
+typedef struct {
+	tDAT		*dat;
+	uint32_t	cap;		// base, check의 할당된 원소 수
+	uint32_t	tail_cap;
+	int32_t		*next;		// 빈 칸의 다음 빈 칸 (마지막은 cap)
+	int32_t		*prev;		// 빈 칸의 이전 빈 칸 (처음은 -1)
+	int32_t		head;		// 처음 빈 칸 (없으면 cap)
+	int32_t		last;		// 마지막 빈 칸 (없으면 -1)
+} tDATBUILD;
+
+////////////////////////////////////////////////////////////////////////////////
+// base, check를 n개 이상으로 늘린다. (늘어난 칸은 빈 칸 목록 뒤에 붙는다.)
+// 실패시 0을 반환
+static int _datReserve( tDATBUILD *b, uint64_t n) {
+	tDAT *dat = b->dat;
+	uint64_t cap = b->cap;
+	int32_t *p;
+
+	if (n <= cap)
+		return 1;
+	if (n > INT32_MAX)
+		return 0;
+
+	while (cap < n)
+		cap = (cap < 1024) ? 1024 : cap * 2;
+	if (cap > INT32_MAX)
+		cap = INT32_MAX;
+
+	if ((p = (int32_t *)realloc(dat->base, sizeof(int32_t) * cap)) == NULL)
+		return 0;
+	dat->base = p;
+	if ((p = (int32_t *)realloc(dat->check, sizeof(int32_t) * cap)) == NULL)
+		return 0;
+	dat->check = p;
+	if ((p = (int32_t *)realloc(b->next, sizeof(int32_t) * cap)) == NULL)
+		return 0;
+	b->next = p;
+	if ((p = (int32_t *)realloc(b->prev, sizeof(int32_t) * cap)) == NULL)
+		return 0;
+	b->prev = p;
+
+	memset(dat->base + b->cap, 0, sizeof(int32_t) * (cap - b->cap));
+	memset(dat->check + b->cap, 0, sizeof(int32_t) * (cap - b->cap));
+	for (uint32_t i = b->cap; i < cap; i++) {
+		b->next[i] = i + 1;
+		b->prev[i] = i - 1;
 	}
-	
-	trie = trieCreateNode(); // original trie
-	
-	printf( "Inserting to trie...\t");
-	while (fscanf( fp, "%s", str) == 1) // words file
-	{	
-		dic_index++;
-		trieInsert( trie, str, dic_index);
+	b->prev[b->cap] = b->last;
+	if (b->last < 0)
+		b->head = b->cap;
+	else
+		b->next[b->last] = b->cap;
+	b->last = cap - 1;
+	b->cap = cap;
+
+	return 1;
+}
+
+// 칸 t를 부모 상태 s의 자식으로 차지한다. (빈 칸 목록에서 뺀다.)
+static void _datUse( tDATBUILD *b, int32_t t, int32_t s) {
+	int32_t prev = b->prev[t];
+	int32_t next = b->next[t];
+
+	if (prev < 0)
+		b->head = next;
+	else
+		b->next[prev] = next;
+	if ((uint32_t)next < b->cap)
+		b->prev[next] = prev;
+	else
+		b->last = prev;
+
+	b->dat->check[t] = s;
+	if ((uint32_t)t >= b->dat->num_states)
+		b->dat->num_states = t + 1;
+}
+
+// 상태 s의 자식 문자 코드들(codes, 오름차순 n개)이 모두 빈 칸에 들어가는 base를 찾아 자식 상태들을 차지한다.
+// 앞쪽 빈 칸들을 DAT_SCAN개까지 보아도 맞는 자리가 없으면 쓰인 칸들 뒤에 둔다.
+// 실패시 0을 반환
+static int _datPlace( tDATBUILD *b, int32_t s, const int *codes, int n) {
+	int64_t base = 0;
+	int32_t pos = b->head;
+
+	for (int scanned = 0; ; pos = b->next[pos], scanned++) {
+		int i;
+
+		if ((uint32_t)pos >= b->cap || scanned == DAT_SCAN) {
+			base = b->dat->num_states;
+			break;
+		}
+
+		base = (int64_t)pos - codes[0];
+		if (base < 1)
+			continue;
+		for (i = 1; i < n && base + codes[i] < b->cap; i++)
+			if (b->dat->check[base + codes[i]] != 0)
+				break;
+		if (i == n)
+			break;
 	}
-	
-	printf( "[done]\n"); // Inserting to trie
-	fclose( fp);
 
-	return trie;
+	if (!_datReserve( b, (uint64_t)base + DAT_CODES))
+		return 0;
+
+	b->dat->base[s] = (int32_t)base;
+	for (int i = 0; i < n; i++)
+		_datUse( b, base + codes[i], s);
+
+	return 1;
 }
 
+// 상태 s를 남은 문자열이 len 바이트의 str이고 사전 번호가 index인 잎으로 만든다.
+// 실패시 0을 반환
+static int _datLeaf( tDATBUILD *b, int32_t s, const char *str, int len, int index) {
+	tDAT *dat = b->dat;
+	uint64_t need = (uint64_t)dat->tail_size + len + 1 + sizeof(int32_t);
 
-/* makes a permuterm trie for given dictionary file
-	return	trie head node pointer
-			NULL failure
-*/ 
-TRIE *dic2permute_trie( char *dicfile) {
-	TRIE *trie;
-	TRIE *permute_trie;
-	int ret;
-	char str[100];
-	FILE *fp;
-	char *permuterms[100];
-	int num_p;
-	int dic_index = -1;
-	
-	fp = fopen(dicfile, "rt");
-	if (fp == NULL)
-	{
-		fprintf( stderr, "File open error: %s\n", dicfile);
-		return NULL;
+	if (need > INT32_MAX)
+		return 0;
+	if (need > b->tail_cap) {
+		uint64_t cap = (b->tail_cap < 4096) ? 4096 : b->tail_cap;
+		char *p;
+
+		while (cap < need)
+			cap *= 2;
+		if (cap > INT32_MAX)
+			cap = INT32_MAX;
+		if ((p = (char *)realloc(dat->tail, cap)) == NULL)
+			return 0;
+		dat->tail = p;
+		b->tail_cap = cap;
 	}
-	
-	trie = trieCreateNode(); // original trie
-	permute_trie = trieCreateNode(); // trie for permuterm index
-	
-	printf( "Inserting to trie...\t");
-	while (fscanf( fp, "%s", str) == 1) // words file
-	{	
-		dic_index++;
-		ret = trieInsert( trie, str, dic_index);
-		
-		if (ret)
-		{
-			num_p = make_permuterms( str, permuterms);
-			
-			for (int i = 0; i < num_p; i++)
-				trieInsert( permute_trie, permuterms[i], dic_index);
-			
-			clear_permuterms( permuterms, num_p);
+
+	dat->base[s] = -(int32_t)dat->tail_size;
+	if (len > 0)
+		memcpy(dat->tail + dat->tail_size, str, len);
+	dat->tail[dat->tail_size + len] = 0;
+	memcpy(dat->tail + dat->tail_size + len + 1, &index, sizeof(int32_t));
+	dat->tail_size = need;
+
+	return 1;
+}
+
+// 트라이 노드(부모에서 내려온 문자까지 상태 s)와 그 아래를 이중 배열에 옮긴다.
+// 실패시 0을 반환
+static int _datBuild( tDATBUILD *b, TRIE *trie, TRIENODE *node, int32_t s) {
+	unsigned char keys[MAX_DEGREE];
+	tTRIEREF children[MAX_DEGREE];
+	int codes[DAT_CODES];
+	char *prefix = _triePrefix( trie, node);
+	int32_t base;
+	int n, k = 0;
+
+	n = _trieListChildren( node, keys, children);
+	if (n == 0 && s != DAT_ROOT)
+		return _datLeaf( b, s, prefix, node->prefix_len, node->index);
+
+	// 내부 노드의 압축된 경로는 문자마다 상태 하나로 펼친다.
+	for (int i = 0; i < node->prefix_len; i++) {
+		codes[0] = getDatCode(prefix[i]);
+		if (!_datPlace( b, s, codes, 1))
+			return 0;
+		s = b->dat->base[s] + codes[0];
+	}
+
+	if (node->index != -1)
+		codes[k++] = 0;
+	for (int i = 0; i < n; i++)
+		codes[k++] = keys[i] + 1;
+	if (k == 0) {
+		b->dat->base[s] = 1; // 빈 트라이의 루트
+		return 1;
+	}
+
+	if (!_datPlace( b, s, codes, k))
+		return 0;
+	base = b->dat->base[s];
+
+	if (node->index != -1 && !_datLeaf( b, base, "", 0, node->index))
+		return 0;
+	for (int i = 0; i < n; i++) {
+		if (!_datBuild( b, trie, _trieNode(trie, children[i]), base + keys[i] + 1))
+			return 0;
+	}
+	return 1;
+}
+
+/* frees double-array trie (unmaps it if opened by datOpen)
+*/
+void datFree( tDAT *dat) {
+	if (dat->map != NULL)
+		munmap(dat->map, dat->map_size);
+	else {
+		free(dat->base);
+		free(dat->check);
+		free(dat->tail);
+	}
+	memset(dat, 0, sizeof(tDAT));
+}
+
+/* builds double-array trie of all entries in trie (trie is not changed)
+	return	1 success
+			0 if overflow
+*/
+int datBuild( tDAT *dat, TRIE *trie) {
+	tDATBUILD b = { dat, 0, 0, NULL, NULL, 0, -1 };
+	int ok;
+
+	memset(dat, 0, sizeof(tDAT));
+	dat->tail_size = 1; // 잎의 base가 음수가 되도록 0은 쓰지 않는다.
+
+	if (!_datReserve( &b, DAT_ROOT + DAT_CODES) ||
+		(dat->tail = (char *)malloc(4096)) == NULL) {
+		free(b.next);
+		free(b.prev);
+		datFree( dat);
+		return 0;
+	}
+	b.tail_cap = 4096;
+	dat->tail[0] = 0;
+
+	// 칸 0(없음)과 루트는 부모가 없다.
+	_datUse( &b, 0, -1);
+	_datUse( &b, DAT_ROOT, -1);
+
+	ok = _datBuild( &b, trie, _trieNode(trie, trie->root), DAT_ROOT);
+	free(b.next);
+	free(b.prev);
+	if (!ok) {
+		datFree( dat);
+		return 0;
+	}
+
+	// 남는 칸을 돌려준다. (찾을 때 t < num_states를 확인한다.)
+	dat->base = (int32_t *)realloc(dat->base, sizeof(int32_t) * dat->num_states);
+	dat->check = (int32_t *)realloc(dat->check, sizeof(int32_t) * dat->num_states);
+	dat->tail = (char *)realloc(dat->tail, dat->tail_size);
+
+	return 1;
+}
+
+// 잎 상태의 사전 번호
+static inline int _datLeafIndex( const char *tail) {
+	int32_t index;
+
+	memcpy(&index, tail + strlen(tail) + 1, sizeof(int32_t));
+	return index;
+}
+
+/* Retrieve double-array trie for the requested key (like trieSearch)
+	return	index in dictionary if key found
+			-1 key not found
+*/
+int datSearch( tDAT *dat, char *str) {
+	int32_t s = DAT_ROOT;
+
+	for (;; str++) {
+		uint32_t t;
+
+		if (dat->base[s] < 0) {
+			const char *tail = dat->tail - dat->base[s];
+
+			return (strcmp(tail, str) == 0) ? _datLeafIndex( tail) : -1;
+		}
+
+		if (*str != 0 && !isTrieChar(*str))
+			return -1;
+
+		t = dat->base[s] + ((*str != 0) ? getDatCode(*str) : 0);
+		if (t >= dat->num_states || dat->check[t] != s)
+			return -1;
+		s = t;
+
+		// 키의 끝으로 간 상태는 잎이다.
+		if (*str == 0)
+			return (dat->base[s] < 0) ? _datLeafIndex( dat->tail - dat->base[s]) : -1;
+	}
+}
+
+// str로 시작하는 엔트리들을 모두 담고 있는 가장 위의 상태를 찾는다.
+// 잎에 이르면 남은 str이 tail의 앞부분인지만 본다.
+// 없으면 0을 반환
+static int32_t _datDescend( tDAT *dat, const char *str) {
+	int32_t s = DAT_ROOT;
+
+	for (; *str; str++) {
+		uint32_t t;
+
+		if (dat->base[s] < 0) {
+			const char *tail = dat->tail - dat->base[s];
+
+			if (strncmp(tail, str, strlen(str)) != 0)
+				return 0;
+			break;
 		}
+
+		if (!isTrieChar(*str))
+			return 0;
+		t = dat->base[s] + getDatCode(*str);
+		if (t >= dat->num_states || dat->check[t] != s)
+			return 0;
+		s = t;
+	}
+
+	return s;
+}
+
+// 상태 s 아래의 모든 엔트리의 사전 번호를 indices 뒤에 덧붙인다. (전위 순회, 배열은 필요하면 늘린다.)
+// 실패시 0을 반환
+static int _datCollect( tDAT *dat, int32_t s, int **indices, int *count, int *cap) {
+	if (dat->base[s] < 0) {
+		if (*count == *cap) {
+			int newcap = (*cap == 0) ? 64 : *cap * 2;
+			int *p = (int *)realloc(*indices, sizeof(int) * newcap);
+
+			if (p == NULL)
+				return 0;
+			*indices = p;
+			*cap = newcap;
+		}
+		(*indices)[(*count)++] = _datLeafIndex( dat->tail - dat->base[s]);
+		return 1;
+	}
+
+	for (int c = 0; c < DAT_CODES; c++) {
+		uint32_t t = dat->base[s] + c;
+
+		if (t >= dat->num_states)
+			break;
+		if (dat->check[t] == s && !_datCollect( dat, t, indices, count, cap))
+			return 0;
+	}
+	return 1;
+}
+
+/* collects indices of all entries starting with str (as prefix) in double-array trie (like triePrefixCollect)
+	return	1 success
+			0 if overflow
+*/
+int datPrefixCollect( tDAT *dat, char *str, int **indices, int *count, int *cap) {
+	int32_t s = _datDescend( dat, str);
+
+	if (s == 0)
+		return 1;
+
+	return _datCollect( dat, s, indices, count, cap);
+}
+
+/* writes double-array trie into file (read back by datOpen)
+	written to a temporary file (filename.tmp) and renamed, so a process mapping the old file keeps reading it
+	return	1 success
+			0 failure
+*/
+int datWrite( tDAT *dat, char *filename) {
+	tDATHEADER dh = { DAT_MAGIC, DAT_VERSION, dat->num_states, dat->tail_size };
+	char *tmp = (char *)malloc(strlen(filename) + 5);
+	FILE *fp;
+	int ok;
+
+	if (tmp == NULL)
+		return 0;
+	strcpy(tmp, filename);
+	strcat(tmp, ".tmp");
+
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		fprintf( stderr, "File open error:%s\n", tmp);
+		free(tmp);
+		return 0;
+	}
+
+	ok = fwrite(&dh, sizeof(dh), 1, fp) == 1 &&
+		fwrite(dat->base, sizeof(int32_t), dat->num_states, fp) == dat->num_states &&
+		fwrite(dat->check, sizeof(int32_t), dat->num_states, fp) == dat->num_states &&
+		fwrite(dat->tail, 1, dat->tail_size, fp) == dat->tail_size &&
+		fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	ok = (fclose(fp) == 0) && ok;
+	ok = ok && rename(tmp, filename) == 0;
+
+	if (!ok) {
+		fprintf( stderr, "File write error:%s\n", filename);
+		unlink(tmp);
+	}
+	free(tmp);
+	return ok;
+}
+
+// 파일에서 읽은 배열들로 찾을 때 범위 밖을 읽지 않는지 확인한다.
+//   잎의 tail 위치는 tail 안이고 그 뒤에 NUL과 사전 번호(4바이트)가 tail 안에 있어야 한다.
+//   루트는 부모가 없어야 한다. (check만 따라 내려가므로 루트로 돌아오는 고리가 없다.)
+// 잘못되었으면 0을 반환
+static int _datValidate( tDAT *dat) {
+	if (dat->check[DAT_ROOT] >= 0 || dat->base[DAT_ROOT] < 0)
+		return 0;
+
+	for (uint32_t s = 0; s < dat->num_states; s++) {
+		int64_t pos = -(int64_t)dat->base[s];
+		const char *end;
+
+		if (pos <= 0)
+			continue;
+		if (pos >= dat->tail_size)
+			return 0;
+		end = (const char *)memchr(dat->tail + pos, 0, dat->tail_size - pos);
+		if (end == NULL || (uint64_t)(end - dat->tail) + 1 + sizeof(int32_t) > dat->tail_size)
+			return 0;
+	}
+	return 1;
+}
+
+/* maps double-array trie file written by datWrite into memory (read only)
+	return	1 success
+			0 failure (open error, wrong magic/version, truncated or corrupt file)
+*/
+int datOpen( tDAT *dat, char *filename) {
+	struct stat st;
+	tDATHEADER *dh;
+	int fd;
+
+	memset(dat, 0, sizeof(tDAT));
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf( stderr, "File open error:%s\n", filename);
+		return 0;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(tDATHEADER)) {
+		fprintf( stderr, "Invalid trie file:%s\n", filename);
+		close(fd);
+		return 0;
+	}
+
+	dh = (tDATHEADER *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (dh == MAP_FAILED) {
+		fprintf( stderr, "mmap error:%s\n", filename);
+		return 0;
+	}
+
+	if (dh->magic != DAT_MAGIC || dh->version != DAT_VERSION || dh->num_states <= DAT_ROOT || dh->tail_size == 0 ||
+		(off_t)(sizeof(tDATHEADER) + (uint64_t)dh->num_states * 2 * sizeof(int32_t) + dh->tail_size) != st.st_size) {
+		fprintf( stderr, "Invalid trie file:%s\n", filename);
+		munmap(dh, st.st_size);
+		return 0;
+	}
+
+	dat->map = dh;
+	dat->map_size = st.st_size;
+	dat->num_states = dh->num_states;
+	dat->tail_size = dh->tail_size;
+	dat->base = (int32_t *)(dh + 1);
+	dat->check = dat->base + dh->num_states;
+	dat->tail = (char *)(dat->check + dh->num_states);
+
+	if (!_datValidate( dat)) {
+		fprintf( stderr, "Invalid trie file:%s\n", filename);
+		datFree( dat);
+		return 0;
 	}
-	
-	printf( "[done]\n"); // Inserting to trie
-	fclose( fp);
 
-	return permute_trie;
+	return 1;
 }
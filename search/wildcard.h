@@ -0,0 +1,417 @@
+// 와일드카드 텀 확장
+// 질의의 와일드카드 텀(예) "ab*", "*ab", "a*b", "*ab*")을 세그먼트 사전(dict.h)에서 패턴에 맞는 텀들로 펼친다.
+//   접두어 패턴(ab*): 정렬된 사전에서 이진 탐색으로 텀 구간을 찾는다. (dictPrefix)
+//   그 외: permuterm 트라이(trie.h)에서 '*'가 끝에 오도록 회전한 패턴을 접두어로 찾는다.
+//     a*b -> "b$a", *ab -> "ab$", *ab* -> "ab" (텀 "xaby"의 회전 "aby$x"가 "ab"로 시작)
+//   '*'가 여러 개인 패턴(예) "a*b*c")은 회전한 패턴으로 후보를 찾은 뒤 패턴 전체와 맞춰 본다.
+// permuterm 트라이는 색인기가 사전과 함께 이중 배열 트라이(tDAT) 파일(dic.pmt, wildcardWrite)로 기록해 두고
+// 세그먼트마다 처음 쓸 때 매핑한다. 파일이 없으면 (예전 색인) 그때 사전으로 만든다.
+// 질의 서버의 작업 스레드들이 함께 쓰므로 매핑하거나 만들 때만 mutex로 보호한다.
+// 트라이에 넣을 수 없는 텀(영문 소문자 외의 문자를 포함하거나 너무 긴 텀)은 따로 모아
+// 텀$ 의 모든 회전을 바이트 순으로 정렬한 배열을 만들어 두고 같은 회전한 패턴으로 이진 탐색한다.
+
+#include <pthread.h>
+
+#define WILDCARD_MAX_TERM	256		// permuterm 트라이에 넣는 텀의 최대 길이
+#define WILDCARD_FILE		"dic.pmt"	// 색인기가 기록하는 permuterm 이중 배열 트라이 파일
+#define WILDCARD_TOO_MANY	-1		// wildcardExpand: 패턴에 맞는 텀이 max개보다 많다.
+#define WILDCARD_NOMEM		-2		// wildcardExpand: 메모리 부족
+
+// 트라이에 넣지 않은 텀의 회전 하나 (텀$ 을 k 바이트 돌린 문자열)
+typedef struct {
+	const char	*term;
+	int			len;
+	int			k;
+	int			index;	// 사전 번호
+} tWILDCARDROT;
+
+typedef struct {
+	pthread_mutex_t	lock;		// permuterm 트라이를 매핑하거나 만들 때
+	int				built;		// permuterm 트라이를 준비했는지 여부 (-1: 실패)
+	char			*datfile;	// permuterm 트라이 파일 (NULL: 파일 없이 만든다.)
+	tDAT			permuterm;	// 텀$ 의 모든 회전 -> 사전 번호
+	int				*others;	// 트라이에 넣지 않은 텀들의 사전 번호
+	int				num_others;
+	tWILDCARDROT	*rotations;	// others의 텀$ 의 모든 회전 (바이트 순)
+	size_t			num_rotations;
+} tWILDCARD;
+
+////////////////////////////////////////////////////////////////////////////////
+// 텀이 패턴에 맞는지 ('*'는 0개 이상의 아무 바이트)
+static int _wildcardMatch( const char *pattern, const char *term) {
+	const char *star = NULL;	// 마지막으로 지난 '*'
+	const char *resume = NULL;	// 그 '*'가 대신할 텀의 다음 위치
+
+	while (*term) {
+		if (*pattern == '*') {
+			star = pattern++;
+			resume = term;
+		}
+		else if (*pattern == *term) {
+			pattern++;
+			term++;
+		}
+		else if (star != NULL) {
+			// 마지막 '*'가 한 바이트 더 대신한다.
+			pattern = star + 1;
+			term = ++resume;
+		}
+		else
+			return 0;
+	}
+
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == 0;
+}
+
+// 텀이 permuterm 트라이에 넣을 수 있는 텀(영문 소문자, WILDCARD_MAX_TERM 바이트 미만)인지
+static int _wildcardTrieTerm( const char *term) {
+	int len;
+
+	for (len = 0; term[len]; len++)
+		if (term[len] < 'a' || term[len] > 'z')
+			return 0;
+	return len > 0 && len < WILDCARD_MAX_TERM;
+}
+
+// 사전의 텀들을 permuterm 트라이에 넣을 텀(words, indices: 텀 수만큼의 자리)과 넣지 않을 텀(wc->others)으로 나눈다.
+// words가 NULL이면 넣지 않을 텀만 모은다.
+// 넣을 텀 수를 반환 (실패시 -1)
+static int _wildcardSplit( tWILDCARD *wc, tDICT *dict, const char **words, int *indices) {
+	int num_words = 0;
+	int cap = 0;
+
+	for (unsigned int i = 0; i < dict->num_terms; i++) {
+		const char *term = dictTerm( dict, i);
+
+		if (_wildcardTrieTerm( term)) {
+			if (words != NULL) {
+				words[num_words] = term;
+				indices[num_words] = i;
+			}
+			num_words++;
+			continue;
+		}
+
+		if (wc->num_others == cap) {
+			int *p;
+
+			cap = (cap == 0) ? 64 : cap * 2;
+			p = (int *)realloc(wc->others, sizeof(int) * cap);
+			if (p == NULL)
+				return -1;
+			wc->others = p;
+		}
+		wc->others[wc->num_others++] = i;
+	}
+
+	return num_words;
+}
+
+// 회전의 i번째 바이트 (0 <= i <= len)
+static inline unsigned char _wildcardRotChar( const tWILDCARDROT *r, int i) {
+	int j = r->k + i;
+
+	if (j > r->len)
+		j -= r->len + 1;
+	return (j == r->len) ? '$' : (unsigned char)r->term[j];
+}
+
+static int _wildcardCompareRot( const void *n1, const void *n2) {
+	const tWILDCARDROT *a = (const tWILDCARDROT *)n1;
+	const tWILDCARDROT *b = (const tWILDCARDROT *)n2;
+
+	for (int i = 0; i <= a->len && i <= b->len; i++) {
+		int d = _wildcardRotChar( a, i) - _wildcardRotChar( b, i);
+
+		if (d != 0)
+			return d;
+	}
+	return (a->len > b->len) - (a->len < b->len);
+}
+
+// 회전을 key와 앞부분만 비교한다. (key로 시작하면 0)
+static int _wildcardComparePrefix( const tWILDCARDROT *r, const char *key) {
+	for (int i = 0; key[i]; i++) {
+		int d;
+
+		if (i > r->len)
+			return -1;
+		if ((d = _wildcardRotChar( r, i) - (unsigned char)key[i]) != 0)
+			return d;
+	}
+	return 0;
+}
+
+// 트라이에 넣지 않은 텀들(wc->others)의 모든 회전을 정렬한 배열을 만든다.
+// 실패시 0을 반환
+static int _wildcardRotate( tWILDCARD *wc, tDICT *dict) {
+	size_t n = 0;
+
+	for (int i = 0; i < wc->num_others; i++)
+		n += strlen(dictTerm( dict, wc->others[i])) + 1;
+
+	wc->rotations = (tWILDCARDROT *)malloc(sizeof(tWILDCARDROT) * (n + 1));
+	if (wc->rotations == NULL)
+		return 0;
+
+	for (int i = 0; i < wc->num_others; i++) {
+		const char *term = dictTerm( dict, wc->others[i]);
+		int len = strlen(term);
+
+		for (int k = 0; k <= len; k++) {
+			tWILDCARDROT *r = &wc->rotations[wc->num_rotations++];
+
+			r->term = term;
+			r->len = len;
+			r->k = k;
+			r->index = wc->others[i];
+		}
+	}
+	qsort( wc->rotations, wc->num_rotations, sizeof(tWILDCARDROT), _wildcardCompareRot);
+
+	return 1;
+}
+
+// key로 시작하는 회전들의 사전 번호를 indices 뒤에 덧붙인다. (datPrefixCollect와 같이 배열은 필요하면 늘린다.)
+// 실패시 0을 반환
+static int _wildcardRotCollect( tWILDCARD *wc, const char *key, int **indices, int *count, int *cap) {
+	size_t lo = 0;
+	size_t hi = wc->num_rotations;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (_wildcardComparePrefix( &wc->rotations[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < wc->num_rotations && _wildcardComparePrefix( &wc->rotations[lo], key) == 0; lo++) {
+		if (*count == *cap) {
+			int newcap = (*cap == 0) ? 64 : *cap * 2;
+			int *p = (int *)realloc(*indices, sizeof(int) * newcap);
+
+			if (p == NULL)
+				return 0;
+			*indices = p;
+			*cap = newcap;
+		}
+		(*indices)[(*count)++] = wc->rotations[lo].index;
+	}
+	return 1;
+}
+
+// 사전의 모든 텀으로 permuterm 트라이를 만든다. (triePermuteBuild: 회전들을 첫 문자별로 나누어 여러 스레드로)
+// 다 만든 트라이는 이중 배열 트라이로 바꾸고 해제한다.
+// 실패시 0을 반환
+static int _wildcardBuild( tWILDCARD *wc, tDICT *dict) {
+	const char **words = (const char **)malloc(sizeof(char *) * (dict->num_terms + 1));
+	int *indices = (int *)malloc(sizeof(int) * (dict->num_terms + 1));
+	TRIE *trie = trieCreateNode();
+	int num_words = -1;
+	int ok;
+
+	if (words != NULL && indices != NULL && trie != NULL)
+		num_words = _wildcardSplit( wc, dict, words, indices);
+
+	ok = num_words >= 0 && triePermuteBuild( trie, words, indices, num_words, 0) && datBuild( &wc->permuterm, trie);
+
+	free(words);
+	free(indices);
+	trieDestroy( trie);
+	return ok;
+}
+
+// permuterm 트라이를 준비한다. 색인기가 기록한 파일이 있으면 매핑하고 없으면 만든다.
+// 실패시 0을 반환
+static int _wildcardLoad( tWILDCARD *wc, tDICT *dict) {
+	if (wc->datfile != NULL && access(wc->datfile, R_OK) == 0 && datOpen( &wc->permuterm, wc->datfile)) {
+		if (_wildcardSplit( wc, dict, NULL, NULL) >= 0 && _wildcardRotate( wc, dict))
+			return 1;
+		datFree( &wc->permuterm);
+		return 0;
+	}
+
+	if (!_wildcardBuild( wc, dict))
+		return 0;
+	if (_wildcardRotate( wc, dict))
+		return 1;
+	datFree( &wc->permuterm);
+	return 0;
+}
+
+static int _wildcardCompareInt( const void *n1, const void *n2) {
+	int a = *(const int *)n1;
+	int b = *(const int *)n2;
+
+	return (a > b) - (a < b);
+}
+
+/* initializes wildcard expander of a segment
+	permuterm trie is mapped from datfile written by wildcardWrite on first use
+	(built from the dictionary if datfile is NULL or does not exist)
+*/
+void wildcardInit( tWILDCARD *wc, const char *datfile) {
+	pthread_mutex_init(&wc->lock, NULL);
+	wc->built = 0;
+	wc->datfile = (datfile != NULL) ? strdup(datfile) : NULL;
+	memset(&wc->permuterm, 0, sizeof(tDAT));
+	wc->others = NULL;
+	wc->num_others = 0;
+	wc->rotations = NULL;
+	wc->num_rotations = 0;
+}
+
+/* expands wildcard pattern into dictionary indices of matching terms
+	ex) "ab*", "*ab", "a*b", "*ab*", "a*b*c"
+	indices are sorted and stored in *terms (allocated from arena)
+	return	number of matching terms (0 ~ max)
+			WILDCARD_TOO_MANY more than max terms match
+			WILDCARD_NOMEM if overflow
+*/
+int wildcardExpand( tWILDCARD *wc, tDICT *dict, const char *pattern, int max, tARENA *arena, int **terms) {
+	const char *first = strchr(pattern, '*');
+	const char *last = strrchr(pattern, '*');
+	size_t len = strlen(pattern);
+	int *found = NULL;
+	int count = 0;
+	int cap = 0;
+	int n = 0;
+	char *key;
+
+	*terms = NULL;
+
+	// 접두어 패턴: 정렬된 사전의 구간
+	if (pattern[0] != '*' && last == pattern + len - 1) {
+		int start;
+		int num;
+
+		key = (char *)arenaAlloc(arena, first - pattern + 1);
+		if (key == NULL)
+			return WILDCARD_NOMEM;
+		memcpy(key, pattern, first - pattern);
+		key[first - pattern] = 0;
+
+		num = dictPrefix( dict, key, &start);
+		if (first == last && num > max)
+			return WILDCARD_TOO_MANY;
+
+		*terms = (int *)arenaAlloc(arena, sizeof(int) * ((num < max) ? num : max) + 1);
+		if (*terms == NULL)
+			return WILDCARD_NOMEM;
+
+		for (int i = start; i < start + num; i++) {
+			if (first != last && !_wildcardMatch( pattern, dictTerm( dict, i)))
+				continue;
+			if (n == max)
+				return WILDCARD_TOO_MANY;
+			(*terms)[n++] = i;
+		}
+		return n;
+	}
+
+	pthread_mutex_lock(&wc->lock);
+	if (!wc->built)
+		wc->built = _wildcardLoad( wc, dict) ? 1 : -1;
+	pthread_mutex_unlock(&wc->lock);
+	if (wc->built < 0)
+		return WILDCARD_NOMEM;
+
+	// '*'가 끝에 오도록 회전한 패턴 (뒤 조각 + '$' + 앞 조각)
+	// 양 끝이 '*'이면 가운데 가장 긴 조각으로 시작하는 회전
+	key = (char *)arenaAlloc(arena, len + 2);
+	if (key == NULL)
+		return WILDCARD_NOMEM;
+
+	if (pattern[0] == '*' && last == pattern + len - 1) {
+		const char *p = pattern;
+		size_t best = 0;
+
+		key[0] = 0;
+		while (p < last) {
+			const char *q = strchr(p + 1, '*');
+
+			if ((size_t)(q - p - 1) > best) {
+				best = q - p - 1;
+				memcpy(key, p + 1, best);
+				key[best] = 0;
+			}
+			p = q;
+		}
+	}
+	else {
+		strcpy(key, last + 1);
+		strcat(key, "$");
+		strncat(key, pattern, first - pattern);
+	}
+
+	if (!datPrefixCollect( &wc->permuterm, key, &found, &count, &cap) ||
+		!_wildcardRotCollect( wc, key, &found, &count, &cap)) {
+		free(found);
+		return WILDCARD_NOMEM;
+	}
+
+	// 한 텀의 여러 회전이 찾아질 수 있으므로 (예) *a*의 "banana") 정렬하여 중복을 없앤다.
+	if (count > 1)
+		qsort( found, count, sizeof(int), _wildcardCompareInt);
+
+	*terms = (int *)arenaAlloc(arena, sizeof(int) * (max + 1));
+	if (*terms == NULL) {
+		free(found);
+		return WILDCARD_NOMEM;
+	}
+
+	// 후보들을 사전 번호 순으로 패턴과 맞춰 본다.
+	for (int i = 0; i < count; i++) {
+		int idx = found[i];
+
+		if ((i > 0 && found[i - 1] == idx) || !_wildcardMatch( pattern, dictTerm( dict, idx)))
+			continue;
+		if (n == max) {
+			free(found);
+			return WILDCARD_TOO_MANY;
+		}
+		(*terms)[n++] = idx;
+	}
+
+	free(found);
+	return n;
+}
+
+/* frees permuterm trie of wildcard expander
+*/
+void wildcardDestroy( tWILDCARD *wc) {
+	if (wc->built > 0)
+		datFree( &wc->permuterm);
+	free(wc->others);
+	free(wc->rotations);
+	free(wc->datfile);
+	pthread_mutex_destroy(&wc->lock);
+	wc->built = 0;
+	wc->datfile = NULL;
+	wc->others = NULL;
+	wc->num_others = 0;
+	wc->rotations = NULL;
+	wc->num_rotations = 0;
+}
+
+/* builds permuterm trie of dictionary and writes it into file (mapped by wildcardExpand)
+	return	1 success
+			0 failure (file is removed)
+*/
+int wildcardWrite( tDICT *dict, char *filename) {
+	tWILDCARD wc;
+	int ok;
+
+	wildcardInit( &wc, NULL);
+	wc.built = _wildcardBuild( &wc, dict) ? 1 : -1;
+	ok = wc.built > 0 && datWrite( &wc.permuterm, filename);
+	if (!ok)
+		unlink(filename);
+
+	wildcardDestroy( &wc);
+	return ok;
+}
@@ -3,81 +3,24 @@
 #include <string.h>
 #include <ctype.h> // isupper, tolower
 
-#define MAX_DEGREE	27 // 'a' ~ 'z' and EOW
-#define EOW			'$' // end of word
-
-// used in the following functions: trieInsert, trieSearch, triePrefixList
-#define getIndex(x)		(((x) == EOW) ? MAX_DEGREE-1 : ((x) - 'a'))
-
-// TRIE type definition
-typedef struct trieNode {
-	char 			*entry;
-	struct trieNode	*subtrees[MAX_DEGREE];
-} TRIE;
-
-////////////////////////////////////////////////////////////////////////////////
-// Prototype declarations
-
-/* Allocates dynamic memory for a trie node and returns its address to caller
-	return	node pointer
-			NULL if overflow
-*/
-TRIE *trieCreateNode(void);
-
-/* Deletes all data in trie and recycles memory
-*/
-void trieDestroy( TRIE *root);
-
-/* Inserts new entry into the trie
-	return	1 success
-			0 failure
-*/
-// 주의! 엔트리를 중복 삽입하지 않도록 체크해야 함
-// 대소문자를 소문자로 통일하여 삽입
-// 영문자 외 문자를 포함하는 문자열은 삽입하지 않음
-int trieInsert( TRIE *root, char *str);
-
-/* Retrieve trie for the requested key
-	return	1 key found
-			0 key not found
-*/
-int trieSearch( TRIE *root, char *str);
-
-/* prints all entries in trie using preorder traversal
-*/
-void trieList( TRIE *root);
-
-/* prints all entries starting with str (as prefix) in trie
-   ex) "abb" -> "abbas", "abbasid", "abbess", ...
-	using trieList function
-*/
-void triePrefixList( TRIE *root, char *str);
-
-/* makes permuterms for given str
-	ex) "abc" -> "abc$", "bc$a", "c$ab", "$abc"
-	return	number of permuterms
-*/
-int make_permuterms( char *str, char *permuterms[]);
-
-/* recycles memory for permuterms
-*/
-void clear_permuterms( char *permuterms[], int size);
-
-/* wildcard search
-	ex) "ab*", "*ab", "a*b", "*ab*"
-	using triePrefixList function
-*/
-void trieSearchWildcard( TRIE *root, char *str);
+// TRIE type and functions (trieCreateNode, trieDestroy, trieBulkInit, trieBulkAdd, trieBulkEnd, trieSearch,
+// triePermuteBuild, trieSearchWildcard, datBuild, datSearch, datFree)
+#include "search/trie.h"
 
 int main(int argc, char **argv)
 {
 	TRIE *trie;
 	TRIE *permute_trie;
+	tDAT dat; // 같은 단어들의 이중 배열 트라이
+	tTRIEBULK bulk;
 	int ret;
-	char str[100];
+	char str[TRIE_MAX_WORD + 2]; // 와일드카드 질의는 끝에 '$'를 붙인다.
 	FILE *fp;
-	char *permuterms[100];
-	int num_p;
+	const char **words = NULL; // permuterm 트라이에 넣을 단어들
+	int *indices = NULL;
+	int num_words = 0;
+	int cap = 0;
+	int dic_index = -1;
 	
 	if (argc != 2)
 	{
@@ -94,28 +37,65 @@ int main(int argc, char **argv)
 	
 	trie = trieCreateNode(); // original trie
 	permute_trie = trieCreateNode(); // trie for permuterm index
+	if (trie == NULL || permute_trie == NULL || !trieBulkInit( &bulk, trie))
+	{
+		fprintf( stderr, "Out of memory\n");
+		return 1;
+	}
 	
+	// 정렬된 단어 파일이면 한 번에 만들고, 순서가 어긋나면 그 뒤로는 하나씩 넣는다.
 	printf( "Inserting to trie...\t");
-	while (fscanf( fp, "%s", str) == 1) // words file
+	while (fscanf( fp, TRIE_WORD_FMT, str) == 1) // words file
 	{	
-		ret = trieInsert( trie, str);
+		// 대소문자를 소문자로 통일하여 삽입
+		for (int i = 0; str[i]; i++)
+			str[i] = tolower(str[i]);
+
+		dic_index++;
+		ret = trieBulkAdd( &bulk, str, strlen(str), dic_index);
 		
 		if (ret)
 		{
-			num_p = make_permuterms( str, permuterms);
-			
-			for (int i = 0; i < num_p; i++)
-				trieInsert( permute_trie, permuterms[i]);
-			
-			clear_permuterms( permuterms, num_p);
+			if (num_words == cap)
+			{
+				cap = (cap == 0) ? 1024 : cap * 2;
+				words = (const char **)realloc( words, sizeof(char *) * cap);
+				indices = (int *)realloc( indices, sizeof(int) * cap);
+				if (words == NULL || indices == NULL)
+				{
+					fprintf( stderr, "Out of memory\n");
+					return 1;
+				}
+			}
+			words[num_words] = strdup( str);
+			indices[num_words++] = dic_index;
 		}
 	}
-	
-	printf( "[done]\n"); // Inserting to trie
 	fclose( fp);
+
+	// 단어마다 회전을 만들어 넣는 대신 회전들을 첫 문자별로 나누어 여러 스레드로 만든다.
+	if (!trieBulkEnd( &bulk) || !triePermuteBuild( permute_trie, words, indices, num_words, 0) ||
+		!datBuild( &dat, trie))
+	{
+		fprintf( stderr, "Out of memory\n");
+		return 1;
+	}
+	printf( "[done]\n"); // Inserting to trie
+
+	// 이중 배열 트라이가 모든 단어에 대해 트라이와 같은 사전 번호를 내는지 확인
+	for (int i = 0; i < num_words; i++)
+	{
+		if (datSearch( &dat, (char *)words[i]) != trieSearch( trie, (char *)words[i]))
+			fprintf( stderr, "Double-array trie mismatch: %s\n", words[i]);
+	}
+
+	for (int i = 0; i < num_words; i++)
+		free( (char *)words[i]);
+	free( words);
+	free( indices);
 	
 	printf( "\nQuery: ");
-	while (fscanf( stdin, "%s", str) == 1)
+	while (fscanf( stdin, TRIE_WORD_FMT, str) == 1)
 	{
 		if (strchr( str, '*')) // wildcard search term
 		{
@@ -124,189 +104,16 @@ int main(int argc, char **argv)
 		else // search term
 		{
 			ret = trieSearch( trie, str);
-			printf( "[%s]%s found!\n", str, ret ? "": " not");
+			printf( "[%s]%s found!\n", str, (ret != -1) ? "": " not");
+			if (datSearch( &dat, str) != ret)
+				fprintf( stderr, "Double-array trie mismatch: %s\n", str);
 		}
 		printf( "\nQuery: ");
 	}
 
 	trieDestroy( trie);
 	trieDestroy( permute_trie);
+	datFree( &dat);
 	
 	return 0;
 }
-
-TRIE *trieCreateNode(void) {
-    TRIE *trie = (TRIE *)malloc(sizeof(TRIE));
-
-    if (trie == NULL)
-        return NULL;
-    
-    trie->entry = NULL;
-
-	for (int i = 0; i < MAX_DEGREE; i++)
-		trie->subtrees[i] = NULL;
-
-	return trie;
-}
-
-void trieDestroy( TRIE *root) {
-	if (root == NULL)
-		return;
-
-	for (int i = 0; i < MAX_DEGREE; i++) {
-		if (*(root->subtrees + i))
-			trieDestroy(*(root->subtrees + i));
-	}
-	
-	if (root->entry != NULL)
-		free(root->entry);
-
-	free(root);
-}
-
-int trieInsert( TRIE *root, char *str) {
-	if (!str)
-		return 0;
-
-	TRIE *pos = root;
-	
-	for (int i = 0 ; i < strlen(str); i++) {
-		str[i] = tolower(str[i]);
-
-		if (getIndex(str[i]) < 0 || getIndex(str[i]) > 26)
-			return 0;
-	}
-
-	for (int i = 0; i < strlen(str); i++) {
-		if (pos->subtrees[getIndex(str[i])] == NULL)
-			pos->subtrees[getIndex(str[i])] = trieCreateNode();
-
-		pos = pos->subtrees[getIndex(str[i])];
-	}
-
-	if(pos->entry == NULL) {
-		pos->entry = strdup(str);
-
-		return 1;
-	}
-
-	return 0;
-}
-
-int trieSearch( TRIE *root, char *str) {
-	TRIE *pos = root;
-	int len = strlen(str);
-
-	for (int i = 0 ; i < strlen(str); i++) {
-		if (getIndex(str[i]) < 0 || getIndex(str[i]) > 26)
-			return 0;
-	}
-
-	for (int i = 0; i < len; i++) {
-		if (pos->subtrees[getIndex(str[i])] == NULL)
-			return 0;
-
-		pos = pos->subtrees[getIndex(str[i])];
-	}
-
-	if (pos->entry)
-		return 1;
-	
-	return 0;
-}
-
-void trieList( TRIE *root) {
-	if (root->entry != NULL)
-		printf("%s\n", root->entry);
-	for (int i = 0; i < MAX_DEGREE; i++) {
-		if (*(root->subtrees + i) != NULL)
-			trieList(*(root->subtrees + i));
-	}
-}
-
-void triePrefixList( TRIE *root, char *str) {
-	TRIE *pos = root;
-	int len = strlen(str);
-
-	for (int i = 0 ; i < strlen(str); i++) {
-		if (getIndex(str[i]) < 0 || getIndex(str[i]) > 26)
-			return;
-	}
-
-	for (int i = 0; i < len; i++) {
-		if (pos->subtrees[getIndex(str[i])] == NULL)
-			return;
-
-		pos = pos->subtrees[getIndex(str[i])];
-	}
-
-	trieList(pos);
-}
-
-int make_permuterms( char *str, char *permuterms[]) {
-	int len = strlen(str);
-	char ch[2] = {0, 0};
-	char *pmt;
-	char *tstr;
-	
-	str[len++] = '$';
-	str[len] = '\0';
-
-	permuterms[0] = strdup(str);
-
-	pmt = strdup(str);
-	tstr = strdup(str);
-
-	for (int i = 1; i < len; i++) {
-		strncpy(ch, tstr, 1);
-		strcpy(pmt, tstr + 1);
-		strcat(pmt, ch);
-		permuterms[i] = strdup(pmt);
-		strcpy(tstr, pmt);
-	}
-
-	free(pmt);
-	free(tstr);
-
-	return len;
-}
-
-void clear_permuterms( char *permuterms[], int size) {
-	for (int i = 0; i < size; i++)
-		free(permuterms[i]);
-}
-
-void trieSearchWildcard( TRIE *root, char *str) {
-	int len = strlen(str);
-	char ch[2] = {0, 0};
-	char *pmt;
-	char *tstr;
-
-	if (str[0] == '*' && str[len - 1] == '*') {
-		for (int i = 1; i <= len; i++) {
-			str[i - 1] = str[i];
-		}
-		len--;
-	}
-
-	str[len++] = '$';
-	str[len] = '\0';
-	pmt = strdup(str);
-	tstr = strdup(str);
-
-	while(1) {
-		if (pmt[len - 1] == '*') {
-			pmt[len - 1] = '\0';
-
-			triePrefixList( root, pmt);
-			free(pmt);
-			free(tstr);
-
-			return;
-		}
-		strncpy(ch, tstr, 1);
-		strcpy(pmt, tstr + 1);
-		strcat(pmt, ch);
-		strcpy(tstr, pmt);
-	}
-}
\ No newline at end of file